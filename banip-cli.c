@@ -1,8 +1,11 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "common.h"
-#include "queue.h"
+#include "client.h"
 
 void _verr(bool fatal, int errcode, const char *fmt, ...)
 {
@@ -25,34 +28,124 @@ void _verr(bool fatal, int errcode, const char *fmt, ...)
     }
 }
 
+/**
+ * Send the messages of a file (- for stdin), one per line: empty lines
+ * and comments (#) are skipped, as are invalid messages (with a warning)
+ **/
+static bool send_file(client_t *client, const char *filename, unsigned long *count, unsigned long *skipped, char **error)
+{
+    FILE *fp;
+    bool sent;
+    char *line;
+    size_t size;
+    ssize_t length;
+    record_t record;
+    unsigned long number;
+
+    if (0 == strcmp(filename, "-")) {
+        fp = stdin;
+    } else if (NULL == (fp = fopen(filename, "r"))) {
+        set_system_error(error, "fopen(\"%s\", \"r\") failed", filename);
+        return false;
+    }
+    sent = true;
+    line = NULL;
+    size = 0;
+    number = 0;
+    while (sent && -1 != (length = getline(&line, &size, fp))) {
+        ++number;
+        while (length > 0 && ('\n' == line[length - 1] || '\r' == line[length - 1])) {
+            line[--length] = '\0';
+        }
+        if (0 == length || '#' == line[0]) {
+            continue;
+        }
+        if (!record_parse(&record, line, error)) {
+            fprintf(stderr, "%s:%lu: %s, skipped\n", filename, number, *error);
+            error_free(error);
+            ++*skipped;
+        } else if ((sent = client_send_record(client, &record, error))) {
+            ++*count;
+        }
+    }
+    if (sent && ferror(fp)) {
+        set_system_error(error, "reading '%s' failed", filename);
+        sent = false;
+    }
+    free(line);
+    if (stdin != fp) {
+        fclose(fp);
+    }
+
+    return sent;
+}
+
 int main(int argc, char **argv)
 {
-    int status;
-    void *queue;
+    int c, i, bFlag, status;
+    bool opened, sent;
     char *error;
+    client_t client;
+    const char *filename;
+    struct timespec start, end;
+    unsigned long count, skipped;
 
+    bFlag = 0;
     error = NULL;
-    queue = NULL;
+    opened = false;
+    filename = NULL;
+    count = skipped = 0;
     status = EXIT_FAILURE;
     do {
-
-        if (argc != 3) {
-            fprintf(stderr, "expected arguments are: 1) queue path/name ; 2) message to send\n");
-            break;
+        while (-1 != (c = getopt(argc, argv, "bf:"))) {
+            switch (c) {
+                case 'b':
+                    bFlag = 1;
+                    break;
+                case 'f':
+                    filename = optarg;
+                    bFlag = 1;
+                    break;
+                default:
+                    argc = 0;
+                    break;
+            }
         }
-        if (NULL == (queue = queue_init(&error))) {
+        argc -= optind;
+        argv += optind;
+        if (argc < (NULL == filename ? 2 : 1)) {
+            fprintf(stderr, "expected arguments are: [-b] [-f file] 1) queue path/name ; 2) message(s) to send (with -b: packed as binary records, with -f: read from file, one per line, - for stdin, as binary records)\n");
             break;
         }
-        if (!queue_open(queue, argv[1], QUEUE_FL_SENDER, &error)) {
+        if (!(opened = client_open(&client, argv[0], bFlag ? CLIENT_FL_BINARY : 0, &error))) {
             break;
         }
-        if (queue_send(queue, argv[2], -1, &error)) {
+        /* send everything asked for, packed in as few messages as possible */
+        client.window = 0;
+        client.delay = (unsigned long) -1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 1, sent = true; sent && i < argc; i++) {
+            if ((sent = client_send(&client, argv[i], &error))) {
+                ++count;
+            }
+        }
+        if (sent && NULL != filename) {
+            sent = send_file(&client, filename, &count, &skipped, &error);
+        }
+        if (sent && (sent = client_flush(&client, &error))) {
             printf("OK\n");
+            if (NULL != filename) {
+                double elapsed;
+
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+                printf("%lu address(es) sent in %lu message(s), %lu line(s) skipped, %.3f s (%.0f addresses/s)\n", count, client.sent, skipped, elapsed, elapsed > 0 ? count / elapsed : 0.0);
+            }
+            status = EXIT_SUCCESS;
         }
-        status = EXIT_SUCCESS;
     } while (false);
-    if (NULL != queue) {
-        queue_close(&queue, &error);
+    if (opened) {
+        client_close(&client, NULL == error ? &error : NULL);
     }
     if (NULL != error) {
         fprintf(stderr, "%s\n", error);
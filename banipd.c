@@ -1,4 +1,5 @@
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -12,15 +13,26 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "err.h"
 #include "engine.h"
 #include "queue.h"
 #include "parse.h"
+#include "cache.h"
+#include "trie.h"
+#include "whitelist.h"
+#include "wheel.h"
+#include "journal.h"
+#include "policy.h"
+#include "sketch.h"
+#include "event.h"
+#include "ring.h"
 #include "capsicum.h"
 
-static char optstr[] = "b:e:g:l:p:q:s:t:dhv";
+static char optstr[] = "b:e:g:j:l:n:p:P:q:R:s:t:T:w:W:dhv";
 
 static struct option long_options[] =
 {
@@ -28,19 +40,26 @@ static struct option long_options[] =
     {"daemonize",        no_argument,       NULL, 'd'},
     {"engine",           required_argument, NULL, 'e'},
     {"group",            required_argument, NULL, 'g'},
+    {"journal",          required_argument, NULL, 'j'},
     {"log",              required_argument, NULL, 'l'},
+    {"batch",            required_argument, NULL, 'n'},
     {"pid",              required_argument, NULL, 'p'},
+    {"policy",           required_argument, NULL, 'P'},
     {"queue",            required_argument, NULL, 'q'},
+    {"report",           required_argument, NULL, 'R'},
     {"qsize",            required_argument, NULL, 's'},
     {"table",            required_argument, NULL, 't'},
+    {"ttl",              required_argument, NULL, 'T'},
     {"verbose",          no_argument,       NULL, 'v'},
+    {"batch-time",       required_argument, NULL, 'w'},
+    {"whitelist",        required_argument, NULL, 'W'},
     {NULL,               no_argument,       NULL, 0}
 };
 
 static void usage(void) {
     fprintf(
         stderr,
-        "usage: %s [-%s] [ -q queue_name ] [ -t table_name ]\n",
+        "usage: %s [-%s] -q queue_name -t table_name [ -q queue_name -t table_name ... ]\n",
         __progname,
         NULL == strrchr(optstr, ':') ? optstr : strrchr(optstr, ':') + 1
     );
@@ -77,32 +96,163 @@ void _verr(bool fatal, int errcode, const char *fmt, ...)
         fputs(strerror(errcode), err_file);
     }
     fprintf(err_file, "\n");
+    fflush(err_file);
     if (fatal) {
         exit(BANIPD_EXIT_FAILURE);
     }
 }
 
-static void *ctxt = NULL;
-static void *queue = NULL;
+/**
+ * A queue and the table the addresses it receives are banned into: its
+ * own settings and the state of these bans
+ **/
+typedef struct {
+    const char *queuename;
+    const char *tablename;
+    const engine_t *engine;
+    unsigned long msgsize; /* 0 for the default of the queue */
+    unsigned long qsize; /* same */
+    unsigned long default_ttl;
+    const char *policyspec;
+    const char *journalfilename;
+    unsigned long report_threshold;
+    unsigned long report_window; /* ms */
+    unsigned long report_width;
+    void *queue;
+    void *ctxt;
+    cache_t cache;
+    wheel_t expirations;
+    journal_t journal;
+    policy_t policy;
+    sketch_t reports;
+    unsigned long merged;
+    unsigned long expired;
+    unsigned long reported;
+    unsigned long unbanned;
+    unsigned long oversized; /* messages too long for max_message_size dropped by the queue, already reported */
+    bool deferred; /* the engine left some work for later */
+    /* a queue which is not a file descriptor (System V) is waited on by a relay thread */
+    char *relayed; /* the first message received by the relay, NULL without a relay */
+    int relayed_length;
+    int relay[2][2]; /* relay to receiver: a message is in relayed, receiver to relay: it was taken */
+    pthread_t relay_thread;
+    bool relaying;
+} binding_t;
+
+static binding_t *bindings = NULL;
+static size_t bindings_count = 0;
+static binding_t defaults; /* settings given before the first -q */
 static char *buffer = NULL;
-static const engine_t *engine = NULL;
+static addr_t *batch = NULL;
+static bool *results = NULL;
+static unsigned long *ttls = NULL;
+static unsigned long batch_size;
+static unsigned long batch_time;
 static const char *pidfilename = NULL;
 static const char *logfilename = NULL;
+static trie_t pending[2];
+static whitelist_t whitelist;
+static const char *whitelistfilename = NULL;
+static unsigned long whitelisted = 0;
+static volatile sig_atomic_t shutdown_requested = 0; /* the signal asking for it */
+static volatile sig_atomic_t stats_requested = 0;
+static volatile sig_atomic_t reload_requested = 0;
+static bool ticking = false;
+static volatile sig_atomic_t tick_requested = 0;
+static event_loop_t loop;
+static bool use_events;
+static void **ready = NULL;
+static unsigned long max_message_size;
+/* between the receiver thread and the applier (the main thread) */
+static ring_t ring;
+static ring_entry_t *entries = NULL;
+static pthread_t receiver;
+static bool receiving = false;
+static unsigned long applied = 0;
+static unsigned long applied_batches = 0;
+static uint64_t ring_time = 0; /* total time spent in the ring, in microseconds */
+static uint64_t ring_time_max = 0;
+
+static void binding_free(binding_t *b)
+{
+    if (NULL != b->relayed) {
+        int i;
+
+        if (b->relaying) {
+            b->relaying = false;
+            pthread_cancel(b->relay_thread);
+            pthread_join(b->relay_thread, NULL);
+        }
+        for (i = 0; i < 2; i++) {
+            close(b->relay[i][0]);
+            close(b->relay[i][1]);
+        }
+        free(b->relayed);
+        b->relayed = NULL;
+    }
+    journal_close(&b->journal);
+    policy_free(&b->policy);
+    sketch_free(&b->reports);
+    wheel_free(&b->expirations);
+    cache_free(&b->cache);
+    if (NULL != b->ctxt) {
+        if (NULL != b->engine->close) {
+            b->engine->close(b->ctxt);
+        }
+        free(b->ctxt);
+        b->ctxt = NULL;
+    }
+    queue_close(&b->queue, NULL);
+}
+
+static void stop_receiving(void)
+{
+    if (receiving) {
+        receiving = false;
+        pthread_cancel(receiver);
+        pthread_join(receiver, NULL);
+    }
+}
 
 static void cleanup(void)
 {
+    size_t i;
+
+    /* stop the receiver before freeing what it uses */
+    stop_receiving();
     if (NULL != buffer) {
         free(buffer);
         buffer = NULL;
     }
-    if (NULL != ctxt) {
-        if (NULL != engine->close) {
-            engine->close(ctxt);
-        }
-        free(ctxt);
-        ctxt = NULL;
+    if (NULL != batch) {
+        free(batch);
+        batch = NULL;
+    }
+    if (NULL != results) {
+        free(results);
+        results = NULL;
+    }
+    if (NULL != ttls) {
+        free(ttls);
+        ttls = NULL;
+    }
+    if (NULL != entries) {
+        free(entries);
+        entries = NULL;
     }
-    queue_close(&queue, NULL);
+    free(ready);
+    ready = NULL;
+    ring_free(&ring);
+    for (i = 0; i < bindings_count; i++) {
+        binding_free(&bindings[i]);
+    }
+    free(bindings);
+    bindings = NULL;
+    bindings_count = 0;
+    event_close(&loop);
+    whitelist_free(&whitelist);
+    trie_free(&pending[0]);
+    trie_free(&pending[1]);
     if (NULL != pidfilename) {
         if (0 != unlink(pidfilename)) {
             warnc("unlink failed");
@@ -114,12 +264,28 @@ static void cleanup(void)
     }
 }
 
+/**
+ * Get the main loop out of ring_wait to handle a request right away,
+ * even if the signal came in just before it went to sleep
+ **/
+static void wake_up(void)
+{
+    if (NULL != ring.entries) {
+        ring_interrupt(&ring);
+    }
+}
+
 static void on_signal(int signo)
 {
     switch (signo) {
         case SIGINT:
         case SIGTERM:
-            cleanup();
+            /* the main loop stops, unless it was already asked to (then exit right now) */
+            if (0 == shutdown_requested) {
+                shutdown_requested = signo;
+                wake_up();
+                return;
+            }
             break;
         case SIGUSR1:
             if (NULL != err_file && NULL != logfilename && fileno(err_file) > 2) {
@@ -129,6 +295,21 @@ static void on_signal(int signo)
                 }
             }
             return;
+        case SIGUSR2:
+            /* dumped by the main loop, not from here */
+            stats_requested = 1;
+            wake_up();
+            return;
+        case SIGHUP:
+            /* same for the reload of the whitelist */
+            reload_requested = 1;
+            wake_up();
+            return;
+        case SIGALRM:
+            /* and for the bans which have come to an end */
+            tick_requested = 1;
+            wake_up();
+            return;
         default:
             /* NOP */
             break;
@@ -137,53 +318,1172 @@ static void on_signal(int signo)
     kill(getpid(), signo);
 }
 
+/* default values for -n/--batch and -w/--batch-time */
+#define DEFAULT_BATCH_SIZE 64
+#define DEFAULT_BATCH_TIME 10 /* ms */
+
+/* default number of counters per row of the sketch of -R/--report */
+#define DEFAULT_REPORT_WIDTH 32768
+
+/* addresses which can be waiting between the receiver and the applier */
+#define RING_CAPACITY 16384
+
+/* messages taken from a queue at once (one recvmmsg for a unix socket) */
+#define RECEIVE_SLOTS 32
+
+static void timespec_add_ms(struct timespec *ts, unsigned long ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ++ts->tv_sec;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static bool timespec_elapsed(const struct timespec *deadline)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+static void dump_stats(void)
+{
+    size_t i;
+
+    for (i = 0; i < bindings_count; i++) {
+        binding_t *b;
+        unsigned long dropped;
+        const char *name, *separator;
+
+        b = &bindings[i];
+        /* with a single queue, lines are not prefixed by its name */
+        name = bindings_count > 1 ? b->queuename : "";
+        separator = bindings_count > 1 ? ": " : "";
+        warn(
+            "%s%scache: %lu hit(s), %lu miss(es), %zu address(es), %zu network(s), %lu merged",
+            name, separator, b->cache.hits, b->cache.misses, b->cache.count, b->cache.networks[0].count + b->cache.networks[1].count, b->merged
+        );
+        warn("%s%sexpiry: %zu ban(s) pending, %lu expired, %lu unbanned", name, separator, b->expirations.count, b->expired, b->unbanned);
+        if (NULL != b->journalfilename) {
+            warn("%s%sjournal: %zu record(s) since the snapshot of %zu ban(s)", name, separator, b->journal.records + b->journal.pending, b->journal.snapshot_count);
+        }
+        if (0 != b->report_threshold) {
+            warn("%s%sreports: %lu received, %lu ban(s), %zu bytes of counters", name, separator, b->reports.reports, b->reported, sketch_size(&b->reports));
+        }
+        if (policy_enabled(&b->policy)) {
+            warn("%s%spolicy: %lu ban(s) escalated, %lu prefix(es) widened, %zu counter(s), %lu evicted", name, separator, b->policy.escalated, b->policy.widened, b->policy.count, b->policy.evicted);
+        }
+        /* only a shared memory queue knows what its senders had to drop */
+        if (QUEUE_ERR_OK == queue_get_attribute(b->queue, QUEUE_ATTR_DROPPED, &dropped)) {
+            warn("%s%squeue: %lu message(s) dropped by the senders (queue full)", name, separator, dropped);
+        }
+    }
+    warn("whitelist: %zu network(s), %lu address(es) not banned", whitelist_count(&whitelist), whitelisted);
+    warn(
+        "ring: %zu address(es) queued (%zu at most), %lu applied in %lu batch(es), %lu us in the ring on average (%lu at most), %lu wait(s) for room",
+        ring_depth(&ring), ring.max_depth, applied, applied_batches, 0 == applied ? 0 : (unsigned long) (ring_time / applied), (unsigned long) ring_time_max, ring.full
+    );
+}
+
+/**
+ * Make what was appended to the journal durable, with a single fsync
+ **/
+static void journal_flush(binding_t *b)
+{
+    char *error;
+
+    error = NULL;
+    if (NULL != b->journalfilename && !journal_sync(&b->journal, &error)) {
+        _verr(false, 0, "%s", error); // TODO: transition
+        error_free(&error);
+    }
+}
+
+static void journal_record(binding_t *b, int type, const addr_t *addr, uint64_t expiry)
+{
+    char *error;
+
+    error = NULL;
+    if (NULL != b->journalfilename && !journal_append(&b->journal, type, addr, expiry, &error)) {
+        _verr(false, 0, "%s", error); // TODO: transition
+        error_free(&error);
+    }
+}
+
+/**
+ * Current time, in microseconds, for the time spent in the ring
+ **/
+static uint64_t now_microseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Current time, in milliseconds, for the window of the reports
+ **/
+static uint64_t now_milliseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Current time, in seconds, for the expiration of the bans
+ **/
+static uint64_t now_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+/**
+ * Get a SIGALRM every second while some bans are waiting for their end
+ **/
+static void set_ticking(void)
+{
+    bool on;
+    size_t i;
+    struct itimerval it;
+
+    for (i = 0, on = false; !on && i < bindings_count; i++) {
+        on = 0 != bindings[i].expirations.count;
+    }
+    if (on != ticking) {
+        bzero(&it, sizeof(it));
+        if (on) {
+            it.it_interval.tv_sec = it.it_value.tv_sec = 1;
+        }
+        if (0 != setitimer(ITIMER_REAL, &it, NULL)) {
+            warnc("setitimer failed");
+        } else {
+            ticking = on;
+        }
+    }
+}
+
+/**
+ * Remove the count first addresses of batch from the firewall (and the cache)
+ **/
+static void unban_batch(binding_t *b, size_t count)
+{
+    size_t i;
+    char *error;
+
+    error = NULL;
+    if (!b->engine->unhandle(b->ctxt, b->tablename, batch, count, results, &error)) {
+        if (NULL != error) {
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+        }
+        for (i = 0; i < count; i++) {
+            if (!results[i]) {
+                char buffer[INET6_ADDRSTRLEN];
+
+                _verr(false, 0, "failed to unban %s", addr_ntop(&batch[i], buffer, sizeof(buffer)));
+            }
+        }
+    }
+    for (i = 0; i < count; i++) {
+        cache_remove(&b->cache, &batch[i]);
+        journal_record(b, JOURNAL_UNBAN, &batch[i], 0);
+    }
+}
+
+/**
+ * Unban the count first addresses of batch on demand (binary records)
+ **/
+static void unban_flush(binding_t *b, size_t count)
+{
+    if (NULL == b->engine->unhandle) {
+        warn("%s can't unban, %zu address(es) left banned", b->engine->name, count);
+        return;
+    }
+    unban_batch(b, count);
+    b->unbanned += count;
+    journal_flush(b);
+}
+
+static void expire_flush(binding_t *b, size_t count)
+{
+    unban_batch(b, count);
+    b->expired += count;
+}
+
+typedef struct {
+    binding_t *b;
+    size_t count;
+} expire_t;
+
+static void expire_collect(const addr_t *addr, void *arg)
+{
+    expire_t *e;
+
+    e = (expire_t *) arg;
+    /* already unbanned on demand (a binary record) */
+    if (!cache_has(&e->b->cache, addr)) {
+        return;
+    }
+    batch[e->count++] = *addr;
+    if (e->count == batch_size) {
+        expire_flush(e->b, e->count);
+        e->count = 0;
+    }
+}
+
+/**
+ * Unban, by batches, the addresses whose ban is over
+ **/
+static void expire_bans(void)
+{
+    size_t i;
+    uint64_t now;
+
+    now = now_seconds();
+    for (i = 0; i < bindings_count; i++) {
+        expire_t e;
+
+        e.b = &bindings[i];
+        e.count = 0;
+        wheel_advance(&e.b->expirations, now, expire_collect, &e);
+        if (0 != e.count) {
+            expire_flush(e.b, e.count);
+        }
+        journal_flush(e.b);
+    }
+    set_ticking();
+}
+
+/**
+ * Load the whitelist again into a new one and only replace the current
+ * one if it succeeded
+ **/
+static void reload_whitelist(void)
+{
+    char *error;
+    whitelist_t fresh;
+
+    error = NULL;
+    if (whitelist_load(&fresh, whitelistfilename, &error)) {
+        whitelist_free(&whitelist);
+        whitelist = fresh;
+        warn("whitelist reloaded: %zu network(s)", whitelist_count(&whitelist));
+    } else {
+        _verr(false, 0, "reloading whitelist failed, keeping the previous one: %s", error); // TODO: transition
+        error_free(&error);
+    }
+}
+
+/**
+ * Handle what signals asked for
+ *
+ * @return true if there was something to do
+ **/
+static bool handle_requests(void)
+{
+    bool requested;
+
+    requested = false;
+    if (stats_requested) {
+        stats_requested = 0;
+        requested = true;
+        dump_stats();
+    }
+    if (reload_requested) {
+        reload_requested = 0;
+        requested = true;
+        reload_whitelist();
+    }
+    if (tick_requested) {
+        tick_requested = 0;
+        requested = true;
+        expire_bans();
+    }
+
+    return requested;
+}
+
+typedef struct {
+    int fa;
+    size_t count;
+} merge_t;
+
+static void merge_collect(const uint8_t *key, uint8_t length, void *arg)
+{
+    merge_t *m;
+
+    m = (merge_t *) arg;
+    addr_from_prefix(&batch[m->count++], m->fa, key, length);
+}
+
+/**
+ * Rewrite the batch without its redundancies: duplicates and addresses
+ * covered by an other one are dropped, 2 sibling networks are replaced
+ * by their parent (eg: 1.2.3.4 and 1.2.3.5 become 1.2.3.4/31). A batch
+ * which mixes different durations of ban is left as is. Only the batch is
+ * considered: a network may still overlap one banned earlier.
+ *
+ * @return the new number of addresses
+ **/
+static size_t merge_batch(binding_t *b, size_t count)
+{
+    size_t i;
+    merge_t m;
+    char *error;
+
+    error = NULL;
+    for (i = 1; i < count; i++) {
+        if (ttls[i] != ttls[0]) {
+            return count;
+        }
+    }
+    trie_reset(&pending[0]);
+    trie_reset(&pending[1]);
+    for (i = 0; i < count; i++) {
+        trie_t *trie;
+        uint8_t length;
+        uint8_t key[TRIE_KEY_SIZE];
+
+        length = batch[i].netmask;
+        memcpy(key, &batch[i].sa, ADDR_SIZE(&batch[i]));
+        trie = &pending[AF_INET == batch[i].fa ? 0 : 1];
+        if (!trie_insert(trie, key, length, &error) || !trie_aggregate(trie, key, &length, &error)) {
+            /* not fatal, the batch is just kept as is */
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+            return count;
+        }
+    }
+    m.count = 0;
+    m.fa = AF_INET;
+    trie_foreach(&pending[0], merge_collect, &m);
+    m.fa = AF_INET6;
+    trie_foreach(&pending[1], merge_collect, &m);
+    b->merged += count - m.count;
+    for (i = 1; i < m.count; i++) {
+        ttls[i] = ttls[0];
+    }
+
+    return m.count;
+}
+
+/**
+ * Hand the addresses collected by the drain loop to the engine
+ **/
+static void handle_batch(binding_t *b, size_t count)
+{
+    size_t i;
+    char *error;
+    uint64_t now;
+    time_t wall;
+
+    error = NULL;
+    count = merge_batch(b, count);
+    for (i = 0; i < count; i++) {
+        if (!cache_add(&b->cache, &batch[i], &error)) {
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+        }
+    }
+    b->deferred |= 0 != count && NULL != b->engine->deferred;
+    if (0 != count && !engine_handle_batch(b->engine, b->ctxt, b->tablename, batch, count, results, &error)) {
+        if (NULL != error) {
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+        }
+        for (i = 0; i < count; i++) {
+            if (!results[i]) {
+                char buffer[INET6_ADDRSTRLEN];
+
+                _verr(false, 0, "failed to ban %s", addr_ntop(&batch[i], buffer, sizeof(buffer)));
+                /* give it a chance to be banned next time */
+                cache_remove(&b->cache, &batch[i]);
+            }
+        }
+    }
+    wall = time(NULL);
+    for (i = 0; i < count; i++) {
+        if (results[i]) {
+            journal_record(b, JOURNAL_BAN, &batch[i], 0 == ttls[i] ? 0 : wall + ttls[i]);
+        }
+    }
+    journal_flush(b);
+    if (NULL == b->engine->unhandle) {
+        return;
+    }
+    now = now_seconds();
+    for (i = 0; i < count; i++) {
+        if (results[i] && 0 != ttls[i]) {
+            if (WHEEL_NIL == wheel_add(&b->expirations, &batch[i], now + ttls[i], &error)) {
+                _verr(false, 0, "%s", error); // TODO: transition
+                error_free(&error);
+            }
+        }
+    }
+    set_ticking();
+}
+
+/**
+ * A text message is an address or a network, optionally followed by the
+ * duration of its ban, in seconds (eg: "192.0.2.1 3600"). Prefixed by
+ * "report ", the address is only banned once it has been reported too
+ * many times (see -R/--report).
+ **/
+static bool parse_message(const binding_t *b, char *message, ring_entry_t *entry, char **error)
+{
+    char *p;
+    unsigned long ttl;
+
+    ttl = b->default_ttl;
+    entry->action = RECORD_BAN;
+    entry->reason = 0;
+    entry->source = 0;
+    if (0 == strncmp(message, "report ", STR_LEN("report "))) {
+        if (0 == b->report_threshold) {
+            set_generic_error(error, "report received but reports are disabled (see -R/--report)");
+            return false;
+        }
+        entry->action = RECORD_REPORT;
+        message += STR_LEN("report ");
+    }
+    if (NULL != (p = strchr(message, ' '))) {
+        *p++ = '\0';
+        if (!parse_ulong(p, &ttl, error)) {
+            return false;
+        }
+    }
+    entry->ttl = ttl > UINT32_MAX ? UINT32_MAX : ttl;
+
+    return parse_addr(message, &entry->addr, error);
+}
+
+/**
+ * A binary record (see record.h): only checked and copied, no parsing
+ **/
+static bool parse_record(const binding_t *b, const char *data, ring_entry_t *entry, char **error)
+{
+    size_t i;
+    uint8_t *bytes;
+    record_t record;
+
+    if (!record_unpack(data, &record, error)) {
+        return false;
+    }
+    if (RECORD_REPORT == record.action && 0 == b->report_threshold) {
+        set_generic_error(error, "report received but reports are disabled (see -R/--report)");
+        return false;
+    }
+    addr_from_prefix(&entry->addr, 4 == record.family ? AF_INET : AF_INET6, record.addr, record.prefix);
+    /* as parse_addr, clear the bits beyond the prefix */
+    bytes = (uint8_t *) &entry->addr.sa;
+    for (i = record.prefix; i < ADDR_SIZE(&entry->addr) * 8; i++) {
+        bytes[i / 8] &= ~(0x80 >> (i % 8));
+    }
+    if (RECORD_TTL_DEFAULT == record.ttl) {
+        entry->ttl = b->default_ttl > UINT32_MAX ? UINT32_MAX : b->default_ttl;
+    } else {
+        entry->ttl = record.ttl;
+    }
+    entry->action = record.action;
+    entry->reason = record.reason;
+    entry->source = record.source;
+
+    return true;
+}
+
+/**
+ * Count a report of addr
+ *
+ * @return true if addr has now been reported enough times to be banned
+ **/
+static bool report_reached(binding_t *b, const addr_t *addr, uint64_t now)
+{
+    if (sketch_add(&b->reports, addr, now) < b->report_threshold) {
+        return false;
+    }
+    ++b->reported;
+
+    return true;
+}
+
+/**
+ * Parse the value of -R/--report: <reports>/<seconds>[/<counters per row>]
+ **/
+static bool parse_report_option(binding_t *b, const char *value, char **error)
+{
+    size_t i;
+    bool ok;
+    char *copy, *p, *token;
+    unsigned long *settings[] = { &b->report_threshold, &b->report_window, &b->report_width };
+
+    if (NULL == (copy = strdup(value))) {
+        set_malloc_error(error, strlen(value) + 1);
+        return false;
+    }
+    ok = true;
+    for (i = 0, p = copy; ok && NULL != (token = strsep(&p, "/")); i++) {
+        ok = i < ARRAY_SIZE(settings) && parse_ulong(token, settings[i], error);
+    }
+    if (ok && i < 2) {
+        ok = false;
+    }
+    if (!ok && NULL != error && NULL == *error) {
+        set_generic_error(error, "<reports>/<seconds>[/<counters per row>] expected, got '%s'", value);
+    }
+    b->report_window *= 1000;
+    free(copy);
+
+    return ok;
+}
+
+/**
+ * Apply the policy to the address about to be banned: replace it by its
+ * prefix if too many of its neighbours were recently banned (unless the
+ * prefix includes whitelisted addresses) and lengthen the ban of a repeat
+ * offender
+ **/
+static void apply_policy(binding_t *b, addr_t *addr, unsigned long *ttl, uint64_t now, int verbose)
+{
+    addr_t prefix;
+
+    if (policy_widen(&b->policy, addr, &prefix, now)) {
+        if (whitelist_match(&whitelist, &prefix)) {
+            ++whitelisted;
+        } else {
+            if (verbose) {
+                char buffer[INET6_ADDRSTRLEN];
+
+                warn("%s/%u is banned instead of a part of it", addr_ntop(&prefix, buffer, sizeof(buffer)), prefix.netmask);
+            }
+            *addr = prefix;
+        }
+    }
+    *ttl = policy_ttl(&b->policy, addr, *ttl, now);
+}
+
+typedef struct {
+    addr_t *addrs;
+    uint64_t *expiries;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} restore_t;
+
+static void restore_collect(const addr_t *addr, uint64_t expiry, void *arg)
+{
+    restore_t *r;
+
+    r = (restore_t *) arg;
+    if (r->failed) {
+        return;
+    }
+    if (r->count == r->capacity) {
+        size_t capacity;
+        addr_t *addrs;
+        uint64_t *expiries;
+
+        capacity = 0 == r->capacity ? 1024 : r->capacity * 2;
+        if (NULL == (addrs = realloc(r->addrs, capacity * sizeof(*addrs)))) {
+            r->failed = true;
+            return;
+        }
+        r->addrs = addrs;
+        if (NULL == (expiries = realloc(r->expiries, capacity * sizeof(*expiries)))) {
+            r->failed = true;
+            return;
+        }
+        r->expiries = expiries;
+        r->capacity = capacity;
+    }
+    r->addrs[r->count] = *addr;
+    r->expiries[r->count++] = expiry;
+}
+
+/**
+ * Rebuild the cache and the expirations from the journal, then reconcile
+ * the firewall with them: the bans still running are handed again, all
+ * at once, to the engine (in case the table was lost: reboot, flushed
+ * set, ...) and those which came to an end while banipd was not running
+ * are removed from it.
+ **/
+static bool restore_bans(binding_t *b, char **error)
+{
+    bool ok;
+    time_t wall;
+    restore_t r;
+    uint64_t now;
+    bool *results;
+    size_t i, live;
+    char *engine_error;
+
+    ok = false;
+    results = NULL;
+    engine_error = NULL;
+    bzero(&r, sizeof(r));
+    do {
+        if (!journal_open(&b->journal, b->journalfilename, restore_collect, &r, error)) {
+            break;
+        }
+        if (r.failed) {
+            set_generic_error(error, "out of memory while restoring the bans of '%s'", b->journalfilename);
+            break;
+        }
+        if (NULL == (results = calloc(r.count + 1, sizeof(*results)))) {
+            set_calloc_error(error, r.count + 1, sizeof(*results));
+            break;
+        }
+        wall = time(NULL);
+        now = now_seconds();
+        /* put the bans which are over at the end */
+        for (i = 0, live = r.count; i < live; ) {
+            if (NULL == b->engine->unhandle || 0 == r.expiries[i] || r.expiries[i] > (uint64_t) wall) {
+                ++i;
+            } else {
+                addr_t addr;
+                uint64_t expiry;
+
+                --live;
+                addr = r.addrs[i];
+                r.addrs[i] = r.addrs[live];
+                r.addrs[live] = addr;
+                expiry = r.expiries[i];
+                r.expiries[i] = r.expiries[live];
+                r.expiries[live] = expiry;
+            }
+        }
+        for (i = 0; i < live; i++) {
+            if (!cache_add(&b->cache, &r.addrs[i], &engine_error)) {
+                _verr(false, 0, "%s", engine_error); // TODO: transition
+                error_free(&engine_error);
+            }
+            if (NULL != b->engine->unhandle && 0 != r.expiries[i]) {
+                if (WHEEL_NIL == wheel_add(&b->expirations, &r.addrs[i], now + (r.expiries[i] - wall), &engine_error)) {
+                    _verr(false, 0, "%s", engine_error); // TODO: transition
+                    error_free(&engine_error);
+                }
+            }
+        }
+        b->deferred |= 0 != live && NULL != b->engine->deferred;
+        if (0 != live && !engine_handle_batch(b->engine, b->ctxt, b->tablename, r.addrs, live, results, &engine_error)) {
+            size_t failed;
+
+            if (NULL != engine_error) {
+                _verr(false, 0, "%s", engine_error); // TODO: transition
+                error_free(&engine_error);
+            }
+            for (i = failed = 0; i < live; i++) {
+                if (!results[i]) {
+                    ++failed;
+                    cache_remove(&b->cache, &r.addrs[i]);
+                }
+            }
+            _verr(false, 0, "failed to restore %zu ban(s)", failed);
+        }
+        if (live != r.count) {
+            if (!b->engine->unhandle(b->ctxt, b->tablename, r.addrs + live, r.count - live, results, &engine_error) && NULL != engine_error) {
+                _verr(false, 0, "%s", engine_error); // TODO: transition
+                error_free(&engine_error);
+            }
+            for (i = live; i < r.count; i++) {
+                journal_record(b, JOURNAL_UNBAN, &r.addrs[i], 0);
+            }
+            b->expired += r.count - live;
+        }
+        journal_flush(b);
+        set_ticking();
+        warn("%s: %zu ban(s) restored from the journal, %zu ended while stopped", b->queuename, live, r.count - live);
+        ok = true;
+    } while (false);
+    free(results);
+    free(r.addrs);
+    free(r.expiries);
+
+    return ok;
+}
+
+/* the settings of the last -q given, the defaults of all queues before the first one */
+#define SETTINGS() \
+    (0 == bindings_count ? &defaults : &bindings[bindings_count - 1])
+
+/**
+ * Add a queue (-q): it starts with the settings given before the first
+ * -q, the options which follow only apply to it
+ **/
+static binding_t *binding_add(const char *queuename, char **error)
+{
+    binding_t *b;
+
+    if (NULL == (b = realloc(bindings, (bindings_count + 1) * sizeof(*bindings)))) {
+        set_malloc_error(error, (bindings_count + 1) * sizeof(*bindings));
+        return NULL;
+    }
+    bindings = b;
+    b = &bindings[bindings_count];
+    *b = defaults;
+    b->queuename = queuename;
+    b->queue = b->ctxt = NULL;
+    b->merged = b->expired = b->reported = b->unbanned = b->oversized = 0;
+    b->deferred = false;
+    b->relayed = NULL;
+    b->relaying = false;
+    bzero(&b->reports, sizeof(b->reports));
+    if (!cache_init(&b->cache, error)) {
+        return NULL;
+    }
+    wheel_init(&b->expirations, now_seconds());
+    journal_init(&b->journal);
+    policy_init(&b->policy, NULL, NULL);
+    ++bindings_count;
+
+    return b;
+}
+
+/**
+ * Create the queue of b
+ *
+ * @param max_message_size raised to the maximum size of its messages
+ **/
+static bool binding_open(binding_t *b, unsigned long *max_message_size, char **error)
+{
+    unsigned long size;
+
+    if (NULL == (b->queue = queue_init(error))) {
+        return false;
+    }
+    if (0 != b->msgsize) {
+        queue_set_attribute(b->queue, QUEUE_ATTR_MAX_MESSAGE_SIZE, b->msgsize); // TODO: check returned value
+    }
+    if (0 != b->qsize) {
+        queue_set_attribute(b->queue, QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE, b->qsize); // TODO: check returned value
+    }
+    if (!queue_open(b->queue, b->queuename, QUEUE_FL_OWNER, error)) {
+        return false;
+    }
+    if (QUEUE_ERR_OK != queue_get_attribute(b->queue, QUEUE_ATTR_MAX_MESSAGE_SIZE, &size)) {
+        set_generic_error(error, "queue_get_attribute failed");
+        return false;
+    }
+    if (size > *max_message_size) {
+        *max_message_size = size;
+    }
+
+    return true;
+}
+
+/**
+ * Push entry to the ring, waiting for the applier while it is full
+ **/
+static void push(ring_entry_t *entry)
+{
+    char *error;
+
+    error = NULL;
+    entry->enqueued = now_microseconds();
+    while (!ring_push(&ring, entry)) {
+        ring_commit(&ring);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        if (!ring_wait(&ring, RING_PRODUCER, &error)) {
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+        }
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    }
+}
+
+/**
+ * Receiver side: collect the messages of the queue of b, the first one
+ * being already in buffer if first (its length) is not -1, and keep
+ * receiving, without waiting and RECEIVE_SLOTS at a time (see
+ * queue_receive_many), the ones already queued until the queue is empty,
+ * batch_size addresses were received (a binary message carries several)
+ * or the time budget is spent (to be fair to the other queues). Their
+ * addresses are pushed to the ring as they come and handed to the applier
+ * at once, at the end (or when the ring is full).
+ **/
+static void drain(binding_t *b, int first)
+{
+    char *error;
+    int i, n, lengths[RECEIVE_SLOTS];
+    size_t count, pushed;
+    unsigned long oversized;
+    struct timespec deadline;
+
+    error = NULL;
+    count = 0;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespec_add_ms(&deadline, batch_time);
+    i = n = 0;
+    if (-1 != first) {
+        lengths[n++] = first;
+    }
+    while (1) {
+        char *message;
+        ring_entry_t entry;
+
+        if (i == n) {
+            /* take what is already queued, by chunks, without waiting (at least an address per message) */
+            n = RECEIVE_SLOTS;
+            if (batch_size - count < (size_t) n) {
+                n = batch_size - count;
+            }
+            if (-1 == (n = queue_receive_many(b->queue, buffer, max_message_size, lengths, n, false, &error))) {
+                _verr(false, 0, "%s", error); // TODO: transition
+                error_free(&error);
+            }
+            if (n <= 0) {
+                /* empty (maybe already drained by the previous round) */
+                break;
+            }
+            i = 0;
+        }
+        message = buffer + i * max_message_size;
+        entry.binding = b - bindings;
+        pushed = 0;
+        if (RECORD_IS_BINARY(message, lengths[i])) {
+            int j;
+
+            if (0 != lengths[i] % RECORD_SIZE) {
+                set_generic_error(&error, "binary message of %d bytes, not a multiple of %d", lengths[i], RECORD_SIZE);
+            }
+            for (j = 0; NULL == error && j < lengths[i]; j += RECORD_SIZE) {
+                if (parse_record(b, message + j, &entry, &error)) {
+                    push(&entry);
+                    ++pushed;
+                } else {
+                    /* only this one is skipped, not the records which follow */
+                    _verr(false, 0, "record %d of %d: %s", j / RECORD_SIZE + 1, lengths[i] / RECORD_SIZE, error); // TODO: transition
+                    error_free(&error);
+                }
+            }
+        } else if (parse_message(b, message, &entry, &error)) {
+            push(&entry);
+            ++pushed;
+        }
+        if (NULL != error) {
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+        }
+        ++i;
+        /* a message without any valid address still counts, not to drain invalid ones for ever */
+        count += 0 == pushed ? 1 : pushed;
+        /* the messages received are out of the queue: all of them are pushed */
+        if (i == n && (count >= batch_size || timespec_elapsed(&deadline))) {
+            break;
+        }
+    }
+    ring_commit(&ring);
+    /* the queue drops (System V and unix sockets) what doesn't fit in a buffer */
+    if (QUEUE_ERR_OK == queue_get_attribute(b->queue, QUEUE_ATTR_OVERSIZED, &oversized) && oversized != b->oversized) {
+        warn("%s: %lu message(s) too long, dropped", b->queuename, oversized - b->oversized);
+        b->oversized = oversized;
+    }
+}
+
+/**
+ * Set up the relay of b: its pipes (the read end of the first one is
+ * what the receiver waits on) and a buffer for the message it receives
+ **/
+static bool relay_init(binding_t *b, char **error)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (0 != pipe(b->relay[i])) {
+            set_system_error(error, "pipe failed");
+            break;
+        }
+    }
+    if (i < 2 || NULL == (b->relayed = malloc(max_message_size))) {
+        if (2 == i) {
+            set_malloc_error(error, max_message_size);
+        }
+        while (--i >= 0) {
+            close(b->relay[i][0]);
+            close(b->relay[i][1]);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * The relay thread of a queue which can't be waited on with the others:
+ * block until a message comes in, wake the receiver up and wait for it
+ * to have drained the queue (this message included) before waiting again.
+ * The queue is then only used by one thread at a time.
+ **/
+static void *relay(void *arg)
+{
+    char c, *error;
+    binding_t *b;
+
+    b = (binding_t *) arg;
+    c = 0;
+    error = NULL;
+    while (1) {
+        if (-1 == (b->relayed_length = queue_receive(b->queue, b->relayed, max_message_size, &error))) {
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+            break;
+        }
+        if (1 != write(b->relay[0][1], &c, 1) || 1 != read(b->relay[1][0], &c, 1)) {
+            warnc("relay of %s failed", b->queuename);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * The receiver thread: wait for messages and push them to the ring. It
+ * can only be cancelled (see cleanup) while waiting.
+ **/
+static void *receive(void *UNUSED(arg))
+{
+    char *error;
+
+    error = NULL;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    while (1) {
+        int i, n, first;
+
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        if (use_events) {
+            first = -1;
+            n = event_wait(&loop, ready, bindings_count, &error);
+        } else {
+            ready[0] = &bindings[0];
+            n = -1 == (first = queue_receive(bindings[0].queue, buffer, max_message_size, &error)) ? -1 : 1;
+        }
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (-1 == n) {
+            _verr(false, 0, "%s", error); // TODO: transition
+            error_free(&error);
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            char c;
+            binding_t *b;
+
+            b = (binding_t *) ready[i];
+            if (NULL == b->relayed) {
+                drain(b, first);
+            } else if (1 == read(b->relay[0][0], &c, 1)) {
+                /* NUL terminated, as any received message */
+                memcpy(buffer, b->relayed, b->relayed_length + 1);
+                drain(b, b->relayed_length);
+                if (1 != write(b->relay[1][1], &c, 1)) {
+                    warnc("relay of %s failed", b->queuename);
+                }
+            }
+        }
+    }
+    /* not reached */
+
+    return NULL;
+}
+
+/**
+ * Applier side: take what has accumulated in the ring, by batches of up
+ * to batch_size addresses, and hand each batch to the engine(s), one call
+ * per queue. Filtering (whitelist, cache, reports, policy) is done here as
+ * it is the only thread to access their state.
+ **/
+static void apply(int verbose)
+{
+    size_t n;
+
+    while (0 != (n = ring_pop(&ring, entries, batch_size))) {
+        size_t i, j;
+        uint64_t now, now_us;
+
+        now = now_seconds();
+        now_us = now_microseconds();
+        applied += n;
+        ++applied_batches;
+        for (j = 0; j < n; j++) {
+            uint64_t elapsed;
+
+            elapsed = now_us - entries[j].enqueued;
+            ring_time += elapsed;
+            if (elapsed > ring_time_max) {
+                ring_time_max = elapsed;
+            }
+        }
+        for (i = 0; i < bindings_count; i++) {
+            size_t count;
+            binding_t *b;
+            bool unbanning;
+            addr_t network;
+
+            b = &bindings[i];
+            /* in arrival order: a run of bans is handed to the engine before the unbans which follow, and the reverse */
+            for (j = count = 0, unbanning = false; j < n; j++) {
+                if (i != entries[j].binding) {
+                    continue;
+                }
+                if (RECORD_UNBAN == entries[j].action) {
+                    if (!unbanning && 0 != count) {
+                        handle_batch(b, count);
+                        count = 0;
+                    }
+                    unbanning = true;
+                    /* only what was banned as such, not an address of a banned network */
+                    if (cache_has(&b->cache, &entries[j].addr)) {
+                        /* also skips a repeat of the same run (unban_batch removes it anyway) */
+                        if (NULL != b->engine->unhandle) {
+                            cache_remove(&b->cache, &entries[j].addr);
+                        }
+                        batch[count++] = entries[j].addr;
+                    } else if (cache_covering(&b->cache, &entries[j].addr, &network)) {
+                        char addr[INET6_ADDRSTRLEN], net[INET6_ADDRSTRLEN];
+
+                        /* a network can't be partly unbanned, it may also have been merged from neighbours (see merge_batch) */
+                        warn("%s/%u not unbanned: banned as part of %s/%u, unban this network instead", addr_ntop(&entries[j].addr, addr, sizeof(addr)), entries[j].addr.netmask, addr_ntop(&network, net, sizeof(net)), network.netmask);
+                    }
+                    continue;
+                }
+                if (unbanning && 0 != count) {
+                    unban_flush(b, count);
+                    count = 0;
+                }
+                unbanning = false;
+                batch[count] = entries[j].addr;
+                ttls[count] = entries[j].ttl;
+                if (whitelist_match(&whitelist, &batch[count])) {
+                    ++whitelisted;
+                    if (verbose) {
+                        char addr[INET6_ADDRSTRLEN];
+
+                        warn("%s/%u is whitelisted, not banned", addr_ntop(&batch[count], addr, sizeof(addr)), batch[count].netmask);
+                    }
+                /* skip what is already banned, redundancies of the batch are handled by merge_batch */
+                } else if (!cache_lookup(&b->cache, &batch[count])) {
+                    /* a report is counted, not banned, until it reaches the threshold */
+                    if (RECORD_REPORT != entries[j].action || report_reached(b, &batch[count], now_milliseconds())) {
+                        if (verbose && (0 != entries[j].reason || 0 != entries[j].source)) {
+                            char addr[INET6_ADDRSTRLEN];
+
+                            warn("%s/%u is banned for reason %u, from source %u", addr_ntop(&batch[count], addr, sizeof(addr)), batch[count].netmask, entries[j].reason, entries[j].source);
+                        }
+                        apply_policy(b, &batch[count], &ttls[count], now, verbose);
+                        ++count;
+                    }
+                }
+            }
+            if (0 != count) {
+                if (unbanning) {
+                    unban_flush(b, count);
+                } else {
+                    handle_batch(b, count);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Let the engines catch up with the work they left for later, by slices
+ * of batch_size items not to delay the bans to come
+ *
+ * @return true if some work is still left
+ **/
+static bool run_deferred(void)
+{
+    size_t i;
+    bool left;
+    char *error;
+
+    error = NULL;
+    for (i = 0, left = false; i < bindings_count; i++) {
+        binding_t *b;
+
+        b = &bindings[i];
+        if (b->deferred) {
+            b->deferred = b->engine->deferred(b->ctxt, batch_size, &error);
+            if (NULL != error) {
+                _verr(false, 0, "%s", error); // TODO: transition
+                error_free(&error);
+            }
+            left |= b->deferred;
+        }
+    }
+
+    return left;
+}
+
 int main(int argc, char **argv)
 {
     gid_t gid;
-    addr_t addr;
+    size_t i;
     char *error;
     struct sigaction sa;
     int c, dFlag, vFlag;
-    unsigned long max_message_size;
-    const char *queuename, *tablename;
+    sigset_t alarm_set, all_set, saved_set;
+    bool drop_privileges, deferred;
 
-    ctxt = NULL;
     error = NULL;
     gid = (gid_t) -1;
     vFlag = dFlag = 0;
-    tablename = queuename = NULL;
-    if (NULL == (queue = queue_init(&error))) {
-        errx("queue_init failed"); // TODO: better
-    }
+    loop.fd = -1;
+    batch_size = DEFAULT_BATCH_SIZE;
+    batch_time = DEFAULT_BATCH_TIME;
+    trie_init(&pending[0]);
+    trie_init(&pending[1]);
     atexit(cleanup);
     sa.sa_handler = &on_signal;
+    /**
+     * the handlers only set a flag and wake the main loop up through the
+     * ring (see wake_up): the system calls they interrupt (the ones of the
+     * engines included) are restarted instead of failing with EINTR
+     **/
+    sa.sa_flags = SA_RESTART;
     sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
-    sa.sa_flags = SA_RESTART;
+    /* statistics are dumped and the whitelist reloaded by the main loop, right away */
+    sigaction(SIGUSR2, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    /**
+     * ticks of the expiration of the bans are only let in while waiting for a
+     * message, not to interrupt (with EINTR) what the engines are doing
+     **/
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+    sigaction(SIGALRM, &sa, NULL);
     sigaction(SIGUSR1, &sa, NULL);
-    if (NULL == (engine = get_default_engine())) {
+    if (NULL == (defaults.engine = get_default_engine())) {
         errx("no engine available for your system");
     }
     while (-1 != (c = getopt_long(argc, argv, optstr, long_options, NULL))) {
         switch (c) {
             case 'b':
-            {
-                unsigned long val;
-
-                if (parse_ulong(optarg, &val, &error)) {
-                    queue_set_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_SIZE, val); // TODO: check returned value
-                } else {
+                if (!parse_ulong(optarg, &SETTINGS()->msgsize, &error)) {
                     errx("invalid value for option -b/--msgsize: %s", error);
                 }
                 break;
-            }
             case 'd':
                 dFlag = 1;
                 break;
             case 'e':
             {
-                if (NULL == (engine = get_engine_by_name(optarg))) {
+                if (NULL == (SETTINGS()->engine = get_engine_by_name(optarg))) {
                     errx("unknown engine '%s'", optarg);
                 }
                 break;
@@ -198,6 +1498,9 @@ int main(int argc, char **argv)
                 gid = grp->gr_gid;
                 break;
             }
+            case 'j':
+                SETTINGS()->journalfilename = optarg;
+                break;
             case 'l':
             {
                 logfilename = optarg;
@@ -207,29 +1510,51 @@ int main(int argc, char **argv)
                 }
                 break;
             }
+            case 'n':
+                if (!parse_ulong(optarg, &batch_size, &error)) {
+                    errx("invalid value for option -n/--batch: %s", error);
+                }
+                break;
             case 'p':
                 pidfilename = optarg;
                 break;
+            case 'P':
+                SETTINGS()->policyspec = optarg;
+                break;
             case 'q':
-                queuename = optarg;
+                if (NULL == binding_add(optarg, &error)) {
+                    errx("%s", error);
+                }
+                break;
+            case 'R':
+                if (!parse_report_option(SETTINGS(), optarg, &error)) {
+                    errx("invalid value for option -R/--report: %s", error);
+                }
                 break;
             case 's':
-            {
-                unsigned long val;
-
-                if (parse_ulong(optarg, &val, &error)) {
-                    queue_set_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE, val); // TODO: check returned value
-                } else {
+                if (!parse_ulong(optarg, &SETTINGS()->qsize, &error)) {
                     errx("invalid value for option -s/--qsize: %s", error);
                 }
                 break;
-            }
             case 't':
-                tablename = optarg;
+                SETTINGS()->tablename = optarg;
+                break;
+            case 'T':
+                if (!parse_ulong(optarg, &SETTINGS()->default_ttl, &error)) {
+                    errx("invalid value for option -T/--ttl: %s", error);
+                }
                 break;
             case 'v':
                 vFlag++;
                 break;
+            case 'w':
+                if (!parse_ulong(optarg, &batch_time, &error)) {
+                    errx("invalid value for option -w/--batch-time: %s", error);
+                }
+                break;
+            case 'W':
+                whitelistfilename = optarg;
+                break;
             case 'h':
             default:
                 usage();
@@ -238,11 +1563,40 @@ int main(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
-    if (0 != argc || NULL == queuename || NULL == tablename) {
+    if (0 != argc || 0 == bindings_count) {
         usage();
     }
+    for (i = 0; i < bindings_count; i++) {
+        size_t j;
+
+        if (NULL == bindings[i].tablename) {
+            usage();
+        }
+        for (j = 0; j < i; j++) {
+            if (NULL != bindings[i].journalfilename && NULL != bindings[j].journalfilename && 0 == strcmp(bindings[i].journalfilename, bindings[j].journalfilename)) {
+                errx("queues %s and %s can't share the journal %s, give a -j/--journal to each of them", bindings[j].queuename, bindings[i].queuename, bindings[i].journalfilename);
+            }
+        }
+    }
 
     do {
+        if (!whitelist_load(&whitelist, whitelistfilename, &error)) {
+            break;
+        }
+        for (i = 0; i < bindings_count; i++) {
+            binding_t *b;
+
+            b = &bindings[i];
+            if (!policy_init(&b->policy, b->policyspec, &error)) {
+                break;
+            }
+            if (0 != b->report_threshold && !sketch_init(&b->reports, 0 == b->report_width ? DEFAULT_REPORT_WIDTH : b->report_width, b->report_window, now_milliseconds(), &error)) {
+                break;
+            }
+        }
+        if (NULL != error) {
+            break;
+        }
         if (dFlag) {
             if (0 != daemon(0, !vFlag)) {
                 set_system_error(&error, "daemon failed");
@@ -281,21 +1635,60 @@ int main(int argc, char **argv)
                 break;
             }
         }
-        if (!queue_open(queue, queuename, QUEUE_FL_OWNER, &error)) {
+        max_message_size = 0;
+        for (i = 0; i < bindings_count && binding_open(&bindings[i], &max_message_size, &error); i++)
+            ;
+        if (i < bindings_count) {
+            break;
+        }
+        /* RECEIVE_SLOTS slots, each with room for a NUL after the longest message */
+        if (NULL == (buffer = calloc(RECEIVE_SLOTS, ++max_message_size))) {
+            set_calloc_error(&error, RECEIVE_SLOTS, max_message_size);
             break;
         }
-        if (QUEUE_ERR_OK != queue_get_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_SIZE, &max_message_size)) {
-            set_generic_error(&error, "queue_get_attribute failed");
+        if (NULL == (batch = calloc(batch_size, sizeof(*batch)))) {
+            set_calloc_error(&error, batch_size, sizeof(*batch));
             break;
         }
-        if (NULL == (buffer = calloc(++max_message_size, sizeof(*buffer)))) {
-            set_malloc_error(&error, max_message_size * sizeof(*buffer));
+        if (NULL == (results = calloc(batch_size, sizeof(*results)))) {
+            set_calloc_error(&error, batch_size, sizeof(*results));
             break;
         }
-        if (NULL != engine->open && NULL == (ctxt = engine->open(tablename, &error))) {
+        if (NULL == (ttls = calloc(batch_size, sizeof(*ttls)))) {
+            set_calloc_error(&error, batch_size, sizeof(*ttls));
             break;
         }
-        if (0 == getuid() && engine->drop_privileges) {
+        if (NULL == (ready = calloc(bindings_count, sizeof(*ready)))) {
+            set_calloc_error(&error, bindings_count, sizeof(*ready));
+            break;
+        }
+        if (NULL == (entries = calloc(batch_size, sizeof(*entries)))) {
+            set_calloc_error(&error, batch_size, sizeof(*entries));
+            break;
+        }
+        if (!ring_init(&ring, RING_CAPACITY, &error)) {
+            break;
+        }
+        drop_privileges = true;
+        for (i = 0; i < bindings_count; i++) {
+            binding_t *b;
+
+            b = &bindings[i];
+            if (NULL != b->engine->open && NULL == (b->ctxt = b->engine->open(b->tablename, &error))) {
+                break;
+            }
+            if (0 != b->default_ttl && NULL == b->engine->unhandle) {
+                warn("engine %s can't remove addresses, bans will be permanent", b->engine->name);
+            }
+            if (NULL != b->journalfilename && !restore_bans(b, &error)) {
+                break;
+            }
+            drop_privileges &= b->engine->drop_privileges;
+        }
+        if (i < bindings_count) {
+            break;
+        }
+        if (0 == getuid() && drop_privileges) {
             struct passwd *pwd;
 
             if (NULL == (pwd = getpwnam("nobody")) && NULL == (pwd = getpwnam("daemon"))) {
@@ -310,18 +1703,85 @@ int main(int argc, char **argv)
         if (!CAP_ENTER(&error)) {
             break;
         }
-        while (1) {
-            ssize_t read;
+        /**
+         * Wait on all the queues at once, the ones which are not file
+         * descriptors (System V) through a relay thread, unless there is
+         * only one of them to wait on
+         **/
+        use_events = bindings_count > 1 || -1 != queue_get_fd(bindings[0].queue);
+        if (use_events) {
+            if (!event_init(&loop, &error)) {
+                break;
+            }
+            for (i = 0; i < bindings_count; i++) {
+                int fd;
 
-            if (
-                   -1 == (read = queue_receive(queue, buffer, max_message_size, &error))
-                || !parse_addr(buffer, &addr, &error)
-                || !engine->handle(ctxt, tablename, addr, &error)
-            ) {
+                if (-1 == (fd = queue_get_fd(bindings[i].queue))) {
+                    if (!relay_init(&bindings[i], &error)) {
+                        break;
+                    }
+                    fd = bindings[i].relay[0][0];
+                }
+                if (!event_add(&loop, fd, &bindings[i], &error)) {
+                    break;
+                }
+            }
+            if (i < bindings_count) {
+                break;
+            }
+        }
+        /**
+         * Receive in a thread of its own, which doesn't take any signal,
+         * so that queues are still drained while the engines are busy
+         **/
+        sigfillset(&all_set);
+        pthread_sigmask(SIG_BLOCK, &all_set, &saved_set);
+        c = pthread_create(&receiver, NULL, receive, NULL);
+        if (0 == c) {
+            receiving = true;
+            for (i = 0; i < bindings_count; i++) {
+                if (NULL != bindings[i].relayed) {
+                    if (0 != (c = pthread_create(&bindings[i].relay_thread, NULL, relay, &bindings[i]))) {
+                        break;
+                    }
+                    bindings[i].relaying = true;
+                }
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &saved_set, NULL);
+        if (0 != c) {
+            errno = c;
+            set_system_error(&error, "pthread_create failed");
+            break;
+        }
+        deferred = false;
+        while (0 == shutdown_requested) {
+            pthread_sigmask(SIG_UNBLOCK, &alarm_set, NULL);
+            /* with work left by the engines, only look for new bans (which go first) */
+            if (!deferred && !ring_wait(&ring, RING_CONSUMER, &error)) {
                 _verr(false, 0, "%s", error); // TODO: transition
                 error_free(&error);
             }
+            pthread_sigmask(SIG_BLOCK, &alarm_set, NULL);
+            apply(vFlag);
+            deferred = run_deferred();
+            handle_requests();
         }
+        /**
+         * Graceful shutdown, out of the signal handler: stop receiving,
+         * hand what is left in the ring to the engines, free everything
+         * then die by the signal which asked for it
+         **/
+        c = shutdown_requested;
+        stop_receiving();
+        apply(vFlag);
+        while (run_deferred())
+            ;
+        sigprocmask(SIG_BLOCK, &all_set, NULL);
+        cleanup();
+        signal(c, SIG_DFL);
+        kill(getpid(), c);
+        sigprocmask(SIG_UNBLOCK, &all_set, NULL);
         /* not reached */
     } while (false);
     if (NULL != error) {
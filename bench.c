@@ -0,0 +1,1404 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "err.h"
+#include "common.h"
+#include "trie.h"
+#include "parse.h"
+#include "wheel.h"
+#include "journal.h"
+#include "cache.h"
+#include "sketch.h"
+#include "ring.h"
+#include "queue.h"
+#include "client.h"
+
+/**
+ * Micro-benchmarks (and sanity checks) of the hot paths of banipd
+ *
+ * usage: bench <subcommand> [arguments]
+ **/
+
+void _verr(bool fatal, int errcode, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (NULL != fmt) {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        if (errcode) {
+            fprintf(stderr, ": ");
+        }
+    }
+    if (errcode) {
+        fputs(strerror(errcode), stderr);
+    }
+    fprintf(stderr, "\n");
+    if (fatal) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* xorshift64*, reproducible from one run to another */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void rng_fill(uint8_t *buffer, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        buffer[i] = (uint8_t) (rng() >> 56);
+    }
+}
+
+static double elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/* ======================== trie ======================== */
+
+/* size of the working set of the second series of lookups */
+#define HOT_KEYS 4096
+
+/* number of lookups checked against a linear scan */
+#define CHECKED_LOOKUPS 200
+
+typedef struct {
+    uint8_t length;
+    uint8_t key[TRIE_KEY_SIZE];
+} prefix_t;
+
+static bool prefix_includes(const prefix_t *prefix, const uint8_t *key)
+{
+    uint8_t i;
+
+    for (i = 0; i < prefix->length; i++) {
+        if (((prefix->key[i / 8] ^ key[i / 8]) >> (7 - i % 8)) & 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Insert count random prefixes (of length min_length to bits) then look
+ * for random addresses. A sample of the lookups is checked against a
+ * linear scan of the prefixes.
+ **/
+static bool bench_trie_family(const char *name, size_t count, uint8_t bits, uint8_t min_length, size_t lookups)
+{
+    bool ok;
+    size_t i;
+    trie_t trie;
+    char *error;
+    prefix_t *prefixes;
+    uint8_t (*keys)[TRIE_KEY_SIZE];
+    struct timespec start;
+    volatile size_t found;
+    double ns;
+
+    ok = false;
+    error = NULL;
+    keys = NULL;
+    prefixes = NULL;
+    do {
+        if (!trie_init_large(&trie, &error)) {
+            break;
+        }
+        if (NULL == (prefixes = calloc(count, sizeof(*prefixes)))) {
+            set_calloc_error(&error, count, sizeof(*prefixes));
+            break;
+        }
+        if (NULL == (keys = calloc(lookups, sizeof(*keys)))) {
+            set_calloc_error(&error, lookups, sizeof(*keys));
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            prefixes[i].length = min_length + rng() % (bits - min_length + 1);
+            rng_fill(prefixes[i].key, bits / 8);
+        }
+        for (i = 0; i < lookups; i++) {
+            rng_fill(keys[i], bits / 8);
+            /* make half of them fall into a known prefix */
+            if (i % 2) {
+                memcpy(keys[i], prefixes[rng() % count].key, bits / 16);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < count; i++) {
+            if (!trie_insert(&trie, prefixes[i].key, prefixes[i].length, &error)) {
+                break;
+            }
+        }
+        if (i < count) {
+            break;
+        }
+        ns = elapsed_ns(&start);
+        printf("trie/%s: %zu prefixes (%zu distinct) inserted in %.0f ms (%.1f ns/insert), %u nodes\n", name, count, trie.count, ns / 1e6, ns / count, trie.size - 1);
+        if (!trie_optimize(&trie, &error)) {
+            break;
+        }
+
+        found = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < lookups; i++) {
+            found += trie_covered(&trie, keys[i], bits);
+        }
+        ns = elapsed_ns(&start);
+        printf("trie/%s: %zu random lookups (%zu covered) in %.0f ms (%.1f ns/lookup)\n", name, lookups, (size_t) found, ns / 1e6, ns / lookups);
+
+        /* what banipd mostly sees: the same attackers again and again */
+        found = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < lookups; i++) {
+            found += trie_covered(&trie, keys[i % HOT_KEYS], bits);
+        }
+        ns = elapsed_ns(&start);
+        printf("trie/%s: %zu lookups among %d addresses (%zu covered) in %.0f ms (%.1f ns/lookup)\n", name, lookups, HOT_KEYS, (size_t) found, ns / 1e6, ns / lookups);
+
+        /* check a sample against a linear scan, longest prefix included */
+        for (i = 0; i < lookups && i < CHECKED_LOOKUPS; i++) {
+            size_t j;
+            bool expected;
+            uint8_t match, longest;
+
+            longest = 0;
+            expected = false;
+            for (j = 0; j < count; j++) {
+                if (prefix_includes(&prefixes[j], keys[i]) && (!expected || prefixes[j].length > longest)) {
+                    expected = true;
+                    longest = prefixes[j].length;
+                }
+            }
+            if (expected != trie_lookup(&trie, keys[i], bits, &match) || (expected && match != longest)) {
+                set_generic_error(&error, "trie/%s: wrong result for lookup #%zu", name, i);
+                break;
+            }
+        }
+        if (NULL != error) {
+            break;
+        }
+
+        /* removing everything must leave an empty trie */
+        for (i = 0; i < count; i++) {
+            trie_remove(&trie, prefixes[i].key, prefixes[i].length);
+        }
+        if (0 != trie.count || 0 != trie.root) {
+            set_generic_error(&error, "trie/%s: %zu prefixes left after removing all of them", name, trie.count);
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+    free(prefixes);
+    free(keys);
+    trie_free(&trie);
+
+    return ok;
+}
+
+/**
+ * Aggregation: the 2^n addresses of a random /(32-n) must end up as this
+ * single network, whatever the order of insertion
+ **/
+static bool bench_trie_aggregate(void)
+{
+    bool ok;
+    trie_t trie;
+    char *error;
+    uint32_t i, base;
+    uint8_t key[TRIE_KEY_SIZE], length;
+
+    ok = true;
+    error = NULL;
+    trie_init(&trie);
+    base = (uint32_t) rng() & 0xFFFFFF00;
+    for (i = 0; ok && i < 256; i++) {
+        uint32_t host;
+
+        /* visit the 256 addresses of the /24 in a scrambled order */
+        host = base | ((i * 167) & 0xFF);
+        key[0] = host >> 24;
+        key[1] = host >> 16;
+        key[2] = host >> 8;
+        key[3] = host;
+        length = 32;
+        ok = trie_insert(&trie, key, length, &error) && trie_aggregate(&trie, key, &length, &error);
+    }
+    if (ok && (1 != trie.count || !trie_find(&trie, key, 24))) {
+        set_generic_error(&error, "trie/aggregate: expected a single /24, got %zu prefixes", trie.count);
+        ok = false;
+    }
+    if (ok) {
+        printf("trie/aggregate: 256 addresses merged into a /24\n");
+    }
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+    trie_free(&trie);
+
+    return ok;
+}
+
+static int bench_trie(int argc, char **argv)
+{
+    char *error;
+    unsigned long count, lookups;
+
+    error = NULL;
+    count = 1000000;
+    if (argc > 0) {
+        char *endptr;
+
+        count = strtoul(argv[0], &endptr, 10);
+        if (0 == count || '\0' != *endptr) {
+            set_generic_error(&error, "positive number of prefixes expected, got: %s", argv[0]);
+            fprintf(stderr, "%s\n", error);
+            error_free(&error);
+            return EXIT_FAILURE;
+        }
+    }
+    lookups = 10 * count < HOT_KEYS ? HOT_KEYS : 10 * count;
+    if (!bench_trie_family("v4", count, 32, 16, lookups)) {
+        return EXIT_FAILURE;
+    }
+    if (!bench_trie_family("v6", count, 128, 32, lookups)) {
+        return EXIT_FAILURE;
+    }
+    if (!bench_trie_aggregate()) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* ======================== parse ======================== */
+
+/* number of distinct strings parsed by the throughput measure */
+#define PARSE_SAMPLES 1024
+
+static const char fuzz_alphabet[] = "0123456789abcdefABCDEFx:./ ";
+
+/**
+ * What parse_addr should do, built on inet_pton and strtoul
+ **/
+static bool reference_parse(const char *string, addr_t *addr)
+{
+    char buffer[64];
+    const char *slash;
+    unsigned int i, maxlen;
+    unsigned long prefix;
+    uint8_t *bytes;
+
+    if (NULL == (slash = strchr(string, '/'))) {
+        slash = string + strlen(string);
+    }
+    if ((size_t) (slash - string) >= sizeof(buffer)) {
+        return false;
+    }
+    memcpy(buffer, string, slash - string);
+    buffer[slash - string] = '\0';
+    memset(addr, 0, sizeof(*addr));
+    bytes = (uint8_t *) &addr->sa;
+    if (1 == inet_pton(AF_INET, buffer, bytes)) {
+        addr->fa = AF_INET;
+        maxlen = 32;
+        prefix = 32;
+    } else if (1 == inet_pton(AF_INET6, buffer, bytes)) {
+        addr->fa = AF_INET6;
+        maxlen = 128;
+        prefix = 64;
+    } else {
+        return false;
+    }
+    if ('/' == *slash) {
+        if ('\0' == slash[1] || strspn(slash + 1, "0123456789") != strlen(slash + 1)) {
+            return false;
+        }
+        prefix = strtoul(slash + 1, NULL, 10);
+        if (0 == prefix || prefix > maxlen) {
+            return false;
+        }
+    }
+    for (i = prefix; i < maxlen; i++) {
+        bytes[i / 8] &= ~(0x80 >> (i % 8));
+    }
+    addr->netmask = prefix;
+
+    return true;
+}
+
+/**
+ * Write a random, valid or almost valid, address into buffer
+ **/
+static void random_address(char *buffer, size_t size)
+{
+    size_t len;
+    uint8_t bytes[16];
+
+    rng_fill(bytes, sizeof(bytes));
+    switch (rng() % 4) {
+        case 0:
+        case 1:
+            snprintf(buffer, size, "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+            break;
+        case 2:
+            /* favor runs of zeros to get some "::" */
+            if (rng() % 2) {
+                memset(bytes + rng() % 8, 0, rng() % 8);
+            }
+            inet_ntop(AF_INET6, bytes, buffer, size);
+            break;
+        case 3:
+            snprintf(buffer, size, "%x:%x:%x:%x:%x:%x:%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7], bytes[8], bytes[9]);
+            break;
+    }
+    if (0 == rng() % 2) {
+        len = strlen(buffer);
+        snprintf(buffer + len, size - len, "/%u", (unsigned int) (rng() % 140));
+    }
+}
+
+/**
+ * Generate a test case: either a random string or a random address altered
+ * by a few insertions, deletions or substitutions of characters
+ **/
+static void fuzz_string(char *buffer, size_t size)
+{
+    size_t i, len, mutations;
+
+    if (0 == rng() % 8) {
+        len = rng() % (size - 1);
+        for (i = 0; i < len; i++) {
+            buffer[i] = fuzz_alphabet[rng() % STR_LEN(fuzz_alphabet)];
+        }
+        buffer[len] = '\0';
+        return;
+    }
+    random_address(buffer, size);
+    for (mutations = rng() % 4; mutations > 0; mutations--) {
+        size_t at;
+
+        len = strlen(buffer);
+        at = rng() % (len + 1);
+        switch (rng() % 3) {
+            case 0:
+                if (len + 1 < size) {
+                    memmove(buffer + at + 1, buffer + at, len - at + 1);
+                    buffer[at] = fuzz_alphabet[rng() % STR_LEN(fuzz_alphabet)];
+                }
+                break;
+            case 1:
+                if (at < len) {
+                    memmove(buffer + at, buffer + at + 1, len - at);
+                }
+                break;
+            case 2:
+                if (at < len) {
+                    buffer[at] = fuzz_alphabet[rng() % STR_LEN(fuzz_alphabet)];
+                }
+                break;
+        }
+    }
+}
+
+static bool bench_parse_fuzz(unsigned long count)
+{
+    char *error;
+    unsigned long i, valid;
+    char buffer[INET6_ADDRSTRLEN + 16];
+
+    valid = 0;
+    error = NULL;
+    for (i = 0; i < count; i++) {
+        bool ok, expected;
+        addr_t addr, reference;
+
+        fuzz_string(buffer, sizeof(buffer));
+        expected = reference_parse(buffer, &reference);
+        memset(&addr, 0, sizeof(addr));
+        ok = parse_addr(buffer, &addr, &error);
+        error_free(&error);
+        if (ok != expected) {
+            fprintf(stderr, "parse/fuzz: '%s' is %s by parse_addr but %s by inet_pton\n", buffer, ok ? "accepted" : "rejected", expected ? "accepted" : "rejected");
+            return false;
+        }
+        if (ok) {
+            ++valid;
+            if (addr.fa != reference.fa || addr.netmask != reference.netmask || 0 != memcmp(&addr.sa, &reference.sa, sizeof(addr.sa))) {
+                char got[INET6_ADDRSTRLEN], expected[INET6_ADDRSTRLEN];
+
+                fprintf(stderr, "parse/fuzz: '%s' parsed as %s/%u instead of %s/%u\n", buffer, addr_ntop(&addr, got, sizeof(got)), addr.netmask, addr_ntop(&reference, expected, sizeof(expected)), reference.netmask);
+                return false;
+            }
+        }
+    }
+    printf("parse/fuzz: %lu strings (%lu valid) parsed as inet_pton does\n", count, valid);
+
+    return true;
+}
+
+static bool bench_parse_throughput(unsigned long count)
+{
+    size_t i;
+    char *error;
+    unsigned long n, failures;
+    struct timespec start;
+    double ns;
+    addr_t addr;
+    static char samples[PARSE_SAMPLES][INET6_ADDRSTRLEN + 16];
+
+    error = NULL;
+    for (i = 0; i < PARSE_SAMPLES; i++) {
+        do {
+            random_address(samples[i], sizeof(samples[i]));
+        } while (!reference_parse(samples[i], &addr));
+    }
+    failures = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < count; n++) {
+        if (!parse_addr(samples[n % PARSE_SAMPLES], &addr, &error)) {
+            ++failures;
+            error_free(&error);
+        }
+    }
+    ns = elapsed_ns(&start);
+    if (0 != failures) {
+        fprintf(stderr, "parse/throughput: %lu valid address(es) rejected\n", failures);
+        return false;
+    }
+    printf("parse/throughput: %lu parses, %.1f ns/parse, %.1f M parses/s\n", count, ns / count, count / ns * 1e3);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < count; n++) {
+        reference_parse(samples[n % PARSE_SAMPLES], &addr);
+    }
+    ns = elapsed_ns(&start);
+    printf("parse/throughput: inet_pton + strtoul, %.1f ns/parse, %.1f M parses/s\n", ns / count, count / ns * 1e3);
+
+    return true;
+}
+
+static int bench_parse(int argc, char **argv)
+{
+    char *error;
+    unsigned long count;
+
+    error = NULL;
+    count = 1000000;
+    if (argc > 0) {
+        char *endptr;
+
+        count = strtoul(argv[0], &endptr, 10);
+        if (0 == count || '\0' != *endptr) {
+            set_generic_error(&error, "positive number of strings expected, got: %s", argv[0]);
+            fprintf(stderr, "%s\n", error);
+            error_free(&error);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!bench_parse_fuzz(count)) {
+        return EXIT_FAILURE;
+    }
+    if (!bench_parse_throughput(10 * count)) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* ======================== wheel ======================== */
+
+/* timers are scheduled up to 2^WHEEL_HORIZON_BITS seconds ahead */
+#define WHEEL_HORIZON_BITS 20
+
+typedef struct {
+    uint64_t now;
+    size_t fired;
+    size_t wrong;
+} wheel_check_t;
+
+/**
+ * The expected expiry of each timer is stored in its address
+ **/
+static void wheel_check(const addr_t *addr, void *arg)
+{
+    uint64_t expiry;
+    wheel_check_t *check;
+
+    check = (wheel_check_t *) arg;
+    memcpy(&expiry, &addr->sa, sizeof(expiry));
+    ++check->fired;
+    if (expiry != check->now) {
+        ++check->wrong;
+    }
+}
+
+/**
+ * Schedule count timers (a quarter in the next minute, a quarter in the
+ * next hour, the others in the next 12 days), cancel one out of 10, then
+ * advance one second at a time and check that each timer expires at its
+ * second
+ **/
+static int bench_wheel(int argc, char **argv)
+{
+    size_t i;
+    double ns;
+    wheel_t wheel;
+    char *error;
+    uint32_t *timers;
+    unsigned long count;
+    wheel_check_t check;
+    struct timespec start;
+
+    error = NULL;
+    count = 1000000;
+    if (argc > 0) {
+        char *endptr;
+
+        count = strtoul(argv[0], &endptr, 10);
+        if (0 == count || '\0' != *endptr) {
+            set_generic_error(&error, "positive number of timers expected, got: %s", argv[0]);
+            fprintf(stderr, "%s\n", error);
+            error_free(&error);
+            return EXIT_FAILURE;
+        }
+    }
+    if (NULL == (timers = malloc(count * sizeof(*timers)))) {
+        fprintf(stderr, "malloc failed\n");
+        return EXIT_FAILURE;
+    }
+    wheel_init(&wheel, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < count; i++) {
+        addr_t addr;
+        uint64_t expiry;
+        static const int bits[] = { 6, 12, WHEEL_HORIZON_BITS, WHEEL_HORIZON_BITS };
+
+        expiry = 1 + rng() % ((uint64_t) 1 << bits[i % ARRAY_SIZE(bits)]);
+        memset(&addr, 0, sizeof(addr));
+        addr.fa = AF_INET6;
+        addr.netmask = 128;
+        memcpy(&addr.sa, &expiry, sizeof(expiry));
+        if (WHEEL_NIL == (timers[i] = wheel_add(&wheel, &addr, expiry, &error))) {
+            fprintf(stderr, "%s\n", error);
+            error_free(&error);
+            free(timers);
+            wheel_free(&wheel);
+            return EXIT_FAILURE;
+        }
+    }
+    ns = elapsed_ns(&start);
+    printf("wheel: %lu timers added, %.1f ns/add\n", count, ns / count);
+    for (i = 0; i < count; i += 10) {
+        wheel_cancel(&wheel, timers[i]);
+    }
+    bzero(&check, sizeof(check));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (check.now = 1; check.now <= (uint64_t) 1 << WHEEL_HORIZON_BITS; check.now++) {
+        wheel_advance(&wheel, check.now, wheel_check, &check);
+    }
+    ns = elapsed_ns(&start);
+    printf("wheel: %lu ticks, %.1f ns/tick, %.1f ns/expiry\n", (unsigned long) 1 << WHEEL_HORIZON_BITS, ns / ((uint64_t) 1 << WHEEL_HORIZON_BITS), ns / count);
+    free(timers);
+    wheel_free(&wheel);
+    if (0 != check.wrong || check.fired != count - (count + 9) / 10) {
+        fprintf(stderr, "wheel: %zu timers expired (%zu at the wrong time), %lu expected\n", check.fired, check.wrong, count - (count + 9) / 10);
+        return EXIT_FAILURE;
+    }
+    printf("wheel: %zu timers expired on time\n", check.fired);
+
+    return EXIT_SUCCESS;
+}
+
+/* ======================== journal ======================== */
+
+typedef struct {
+    cache_t cache;
+    bool caching;
+    size_t count;
+    size_t failed;
+} journal_check_t;
+
+/**
+ * What banipd does for each ban of the snapshot: put it back in the cache
+ **/
+static void journal_check(const addr_t *addr, uint64_t UNUSED(expiry), void *arg)
+{
+    journal_check_t *check;
+
+    check = (journal_check_t *) arg;
+    ++check->count;
+    if (check->caching && !cache_add(&check->cache, addr, NULL)) {
+        ++check->failed;
+    }
+}
+
+/**
+ * Distinct addresses: IPv4 for even i, IPv6 for odd ones
+ **/
+static void journal_address(addr_t *addr, size_t i)
+{
+    uint8_t key[16];
+
+    bzero(key, sizeof(key));
+    if (0 == i % 2) {
+        uint32_t v4;
+
+        v4 = htonl(0x01000000 + i);
+        addr_from_prefix(addr, AF_INET, &v4, 32);
+    } else {
+        key[0] = 0x20;
+        key[1] = 0x01;
+        memcpy(key + 4, &i, sizeof(i));
+        addr_from_prefix(addr, AF_INET6, key, 64);
+    }
+}
+
+/**
+ * Open the journal and rebuild the cache from it, measuring how long it takes
+ **/
+static bool journal_reopen(const char *path, const char *what, bool caching, size_t expected)
+{
+    double ns;
+    char *error;
+    journal_t journal;
+    journal_check_t check;
+    struct timespec start;
+
+    error = NULL;
+    bzero(&check, sizeof(check));
+    check.caching = caching;
+    if (!cache_init(&check.cache, &error)) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!journal_open(&journal, path, journal_check, &check, &error)) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+        cache_free(&check.cache);
+        return false;
+    }
+    ns = elapsed_ns(&start);
+    journal_close(&journal);
+    cache_free(&check.cache);
+    printf("journal: %zu bans restored (%s) in %.1f ms, %.1f ns/ban\n", check.count, what, ns / 1e6, ns / (check.count ? check.count : 1));
+    if (expected != check.count || 0 != check.failed) {
+        fprintf(stderr, "journal: %zu bans restored (%zu not cached), %zu expected\n", check.count, check.failed, expected);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Journal count bans then the unban of one out of 10, then restore them:
+ * a first time from the journal (compacted into the snapshot), then from
+ * the snapshot alone (what a restart costs), without and with the cache
+ **/
+static int bench_journal(int argc, char **argv)
+{
+    bool ok;
+    size_t i;
+    double ns;
+    addr_t addr;
+    char *error;
+    journal_t journal;
+    unsigned long count;
+    struct timespec start;
+    char dir[] = "/tmp/bench.XXXXXX", path[sizeof(dir) + STR_SIZE("/journal.snapshot")];
+
+    ok = false;
+    error = NULL;
+    count = 1000000;
+    if (argc > 0) {
+        char *endptr;
+
+        count = strtoul(argv[0], &endptr, 10);
+        if (0 == count || '\0' != *endptr) {
+            set_generic_error(&error, "positive number of bans expected, got: %s", argv[0]);
+            fprintf(stderr, "%s\n", error);
+            error_free(&error);
+            return EXIT_FAILURE;
+        }
+    }
+    if (NULL == mkdtemp(dir)) {
+        fprintf(stderr, "mkdtemp failed\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(path, sizeof(path), "%s/journal", dir);
+    do {
+        if (!journal_open(&journal, path, NULL, NULL, &error)) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < count; i++) {
+            journal_address(&addr, i);
+            if (!journal_append(&journal, JOURNAL_BAN, &addr, 0 == i % 3 ? 0 : 1700000000 + i, &error)) {
+                break;
+            }
+        }
+        for (i = 0; NULL == error && i < count; i += 10) {
+            journal_address(&addr, i);
+            if (!journal_append(&journal, JOURNAL_UNBAN, &addr, 0, &error)) {
+                break;
+            }
+        }
+        /* written and synced, but not compacted */
+        journal_close(&journal);
+        if (NULL != error) {
+            break;
+        }
+        ns = elapsed_ns(&start);
+        printf("journal: %lu bans and %lu unbans written in %.1f ms\n", count, (count + 9) / 10, ns / 1e6);
+        ok = journal_reopen(path, "journal compacted", false, count - (count + 9) / 10)
+            && journal_reopen(path, "snapshot", false, count - (count + 9) / 10)
+            && journal_reopen(path, "snapshot, cache rebuilt", true, count - (count + 9) / 10);
+    } while (false);
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/journal.snapshot", dir);
+    unlink(path);
+    rmdir(dir);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* ======================== sketch ======================== */
+
+/* simulated traffic: reports per second, window and threshold */
+#define SKETCH_RATE 1000000
+#define SKETCH_WINDOW 1000 /* ms */
+#define SKETCH_THRESHOLD 50
+/* 1 report out of SKETCH_HEAVY_EVERY comes from one of SKETCH_HEAVY sources */
+#define SKETCH_HEAVY 100
+#define SKETCH_HEAVY_EVERY 100
+
+/**
+ * Feed the sketch with count reports, at SKETCH_RATE reports per second:
+ * most come from random sources out of 2^24 (a handful of reports each
+ * per window), the others from SKETCH_HEAVY sources, each one largely
+ * above the threshold. All heavy sources have to be caught, the light
+ * ones caught are false positives (due to collisions).
+ **/
+static int bench_sketch(int argc, char **argv)
+{
+    size_t i;
+    double ns;
+    char *error;
+    sketch_t sketch;
+    struct timespec start;
+    unsigned long count, width;
+    size_t caught, false_positives;
+    bool heavy_caught[SKETCH_HEAVY];
+
+    error = NULL;
+    count = 10000000;
+    width = 262144;
+    for (i = 0; i < (size_t) argc && i < 2; i++) {
+        char *endptr;
+        unsigned long val;
+
+        val = strtoul(argv[i], &endptr, 10);
+        if (0 == val || '\0' != *endptr) {
+            set_generic_error(&error, "positive number expected, got: %s", argv[i]);
+            fprintf(stderr, "%s\n", error);
+            error_free(&error);
+            return EXIT_FAILURE;
+        }
+        *(0 == i ? &count : &width) = val;
+    }
+    if (!sketch_init(&sketch, width, SKETCH_WINDOW, 0, &error)) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+        return EXIT_FAILURE;
+    }
+    caught = false_positives = 0;
+    bzero(heavy_caught, sizeof(heavy_caught));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < count; i++) {
+        addr_t addr;
+        uint32_t v4;
+        bool heavy;
+
+        if ((heavy = 0 == i % SKETCH_HEAVY_EVERY)) {
+            v4 = htonl(0x0A000000 + (i / SKETCH_HEAVY_EVERY) % SKETCH_HEAVY);
+        } else {
+            v4 = htonl(0x0B000000 + (rng() & 0xFFFFFF));
+        }
+        addr_from_prefix(&addr, AF_INET, &v4, 32);
+        if (sketch_add(&sketch, &addr, (uint64_t) i * 1000 / SKETCH_RATE) >= SKETCH_THRESHOLD) {
+            if (!heavy) {
+                ++false_positives;
+            } else if (!heavy_caught[ntohl(v4) & 0xFFFFFF]) {
+                heavy_caught[ntohl(v4) & 0xFFFFFF] = true;
+                ++caught;
+            }
+        }
+    }
+    ns = elapsed_ns(&start);
+    printf("sketch: %lu reports, %.1f ns/report (%.1f M reports/s), %zu bytes\n", count, ns / count, count / ns * 1e3, sketch_size(&sketch));
+    printf("sketch: %zu/%d heavy sources caught, %zu reports of light ones over the threshold\n", caught, SKETCH_HEAVY, false_positives);
+    sketch_free(&sketch);
+    if (count >= (unsigned long) SKETCH_HEAVY * SKETCH_HEAVY_EVERY * SKETCH_THRESHOLD && SKETCH_HEAVY != caught) {
+        fprintf(stderr, "sketch: a count-min sketch can't underestimate, all heavy sources should have been caught\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* ======================== ring ======================== */
+
+/* entries pushed before a commit, as the receiver does for a drained queue */
+#define RING_BURST 64
+/* entries popped at once, as the applier does (default -n/--batch) */
+#define RING_BATCH 64
+
+typedef struct {
+    ring_t ring;
+    unsigned long count;
+} ring_bench_t;
+
+static void *ring_produce(void *arg)
+{
+    char *error;
+    unsigned long i;
+    ring_bench_t *rb;
+    ring_entry_t entry;
+
+    rb = (ring_bench_t *) arg;
+    error = NULL;
+    bzero(&entry, sizeof(entry));
+    for (i = 0; i < rb->count; i++) {
+        /* the sequence number, to check that nothing is lost or reordered */
+        entry.binding = (uint32_t) i;
+        while (!ring_push(&rb->ring, &entry)) {
+            ring_commit(&rb->ring);
+            if (!ring_wait(&rb->ring, RING_PRODUCER, &error)) {
+                fprintf(stderr, "%s\n", error);
+                error_free(&error);
+            }
+        }
+        if (0 == (i + 1) % RING_BURST) {
+            ring_commit(&rb->ring);
+        }
+    }
+    ring_commit(&rb->ring);
+
+    return NULL;
+}
+
+/**
+ * Push count entries from a thread while popping them, by batches, from
+ * the main one: throughput of the ring and its wake ups
+ **/
+static int bench_ring(int argc, char **argv)
+{
+    int err;
+    bool ok;
+    double ns;
+    char *error;
+    ring_bench_t rb;
+    pthread_t producer;
+    struct timespec start;
+    unsigned long i, batches;
+    ring_entry_t entries[RING_BATCH];
+
+    ok = true;
+    error = NULL;
+    rb.count = 10000000;
+    if (argc > 0) {
+        char *endptr;
+
+        rb.count = strtoul(argv[0], &endptr, 10);
+        if (0 == rb.count || '\0' != *endptr) {
+            fprintf(stderr, "positive number expected, got: %s\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!ring_init(&rb.ring, 4096, &error)) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (0 != (err = pthread_create(&producer, NULL, ring_produce, &rb))) {
+        fprintf(stderr, "pthread_create failed: %s\n", strerror(err));
+        ring_free(&rb.ring);
+        return EXIT_FAILURE;
+    }
+    for (i = batches = 0; i < rb.count; ) {
+        size_t j, n;
+
+        if (0 == (n = ring_pop(&rb.ring, entries, ARRAY_SIZE(entries)))) {
+            if (!ring_wait(&rb.ring, RING_CONSUMER, &error)) {
+                fprintf(stderr, "%s\n", error);
+                error_free(&error);
+            }
+            continue;
+        }
+        for (j = 0; j < n; j++, i++) {
+            if ((uint32_t) i != entries[j].binding) {
+                ok = false;
+            }
+        }
+        ++batches;
+    }
+    pthread_join(producer, NULL);
+    ns = elapsed_ns(&start);
+    printf("ring: %lu entries, %.1f ns/entry (%.1f M entries/s), %.1f entries per batch, producer blocked %lu time(s)\n", rb.count, ns / rb.count, rb.count / ns * 1e3, (double) rb.count / batches, rb.ring.full);
+    ring_free(&rb.ring);
+    if (!ok) {
+        fprintf(stderr, "ring: entries lost or out of order\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* ======================== queue ======================== */
+
+typedef struct {
+    const char *name;
+    unsigned long count;
+    unsigned long retries; /* sends refused by a full queue */
+    bool ok;
+} queue_bench_t;
+
+static void *queue_produce(void *arg)
+{
+    void *queue;
+    char *error;
+    unsigned long i;
+    queue_bench_t *qb;
+    char message[STR_SIZE("255.255.255.255")];
+
+    qb = (queue_bench_t *) arg;
+    error = NULL;
+    qb->ok = false;
+    if (NULL == (queue = queue_init(&error)) || !queue_open(queue, qb->name, QUEUE_FL_SENDER, &error)) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+        queue_close(&queue, NULL);
+        return NULL;
+    }
+    for (i = 0; i < qb->count; i++) {
+        int length;
+
+        length = snprintf(message, sizeof(message), "10.%lu.%lu.%lu", (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+        /* a shared memory queue never blocks: retry when it is full */
+        while (!queue_send(queue, message, length, &error)) {
+            error_free(&error);
+            ++qb->retries;
+            sched_yield();
+        }
+    }
+    queue_close(&queue, NULL);
+    qb->ok = true;
+
+    return NULL;
+}
+
+/**
+ * Send count messages to a queue (default: shm:/banip-bench) from a
+ * thread while receiving them from the main one: cost of a message from
+ * a sender to banipd for a given kind of queue
+ **/
+static int bench_queue(int argc, char **argv)
+{
+    int err;
+    bool ok;
+    double ns;
+    void *queue;
+    char *error, *buffer;
+    queue_bench_t qb;
+    pthread_t producer;
+    struct timespec start;
+    unsigned long i, size, dropped;
+
+    ok = false;
+    error = NULL;
+    queue = NULL;
+    buffer = NULL;
+    qb.count = 1000000;
+    qb.retries = 0;
+    qb.name = "shm:/banip-bench";
+    do {
+        if (argc > 0) {
+            char *endptr;
+
+            qb.count = strtoul(argv[0], &endptr, 10);
+            if (0 == qb.count || '\0' != *endptr) {
+                set_generic_error(&error, "positive number of messages expected, got: %s", argv[0]);
+                break;
+            }
+        }
+        if (argc > 1) {
+            qb.name = argv[1];
+        }
+        if (NULL == (queue = queue_init(&error))) {
+            break;
+        }
+        queue_set_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE, 4096);
+        if (!queue_open(queue, qb.name, QUEUE_FL_OWNER, &error)) {
+            break;
+        }
+        if (QUEUE_ERR_OK != queue_get_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_SIZE, &size)) {
+            set_generic_error(&error, "queue_get_attribute failed");
+            break;
+        }
+        if (NULL == (buffer = malloc(++size))) {
+            set_malloc_error(&error, size);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (0 != (err = pthread_create(&producer, NULL, queue_produce, &qb))) {
+            set_generic_error(&error, "pthread_create failed: %s", strerror(err));
+            break;
+        }
+        for (i = 0; i < qb.count; i++) {
+            if (-1 == queue_receive(queue, buffer, size, &error)) {
+                break;
+            }
+        }
+        if (i < qb.count) {
+            /* the producer can't be stopped, let it be blocked in its queue */
+            break;
+        }
+        pthread_join(producer, NULL);
+        ns = elapsed_ns(&start);
+        printf("queue: %lu messages through %s, %.1f ns/message (%.1f M messages/s), %lu send(s) refused (full)\n", qb.count, qb.name, ns / qb.count, qb.count / ns * 1e3, qb.retries);
+        if (QUEUE_ERR_OK == queue_get_attribute(queue, QUEUE_ATTR_DROPPED, &dropped) && dropped != qb.retries) {
+            set_generic_error(&error, "%lu message(s) counted as dropped, %lu expected", dropped, qb.retries);
+            break;
+        }
+        ok = qb.ok;
+    } while (false);
+    free(buffer);
+    if (NULL != queue) {
+        queue_close(&queue, NULL);
+    }
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* ======================== timed receive ======================== */
+
+/* milliseconds queue_receive_timed waits for nothing, then for a message sent TIMED_BENCH_SEND ms later */
+#define TIMED_BENCH_TIMEOUT 50
+#define TIMED_BENCH_SEND 20
+#define TIMED_BENCH_LONG 2000
+
+static void *timed_produce(void *arg)
+{
+    void *queue;
+    char *error;
+    queue_bench_t *qb;
+
+    qb = (queue_bench_t *) arg;
+    error = NULL;
+    qb->ok = false;
+    usleep(TIMED_BENCH_SEND * 1000);
+    if (NULL == (queue = queue_init(&error)) || !queue_open(queue, qb->name, QUEUE_FL_SENDER, &error) || !queue_send(queue, "10.0.0.1", -1, &error)) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    } else {
+        qb->ok = true;
+    }
+    queue_close(&queue, NULL);
+
+    return NULL;
+}
+
+/**
+ * queue_receive_timed on a queue (default: shm:/banip-bench): on an empty
+ * one, it has to give up after TIMED_BENCH_TIMEOUT ms, then, waiting for
+ * TIMED_BENCH_LONG ms, to return as soon as a message is sent (from a
+ * thread, TIMED_BENCH_SEND ms later) rather than at the end of the timeout
+ **/
+static int bench_timed(int argc, char **argv)
+{
+    int err, read;
+    bool ok, started;
+    double ms;
+    void *queue;
+    char *error, *buffer;
+    queue_bench_t qb;
+    pthread_t producer;
+    unsigned long size;
+    struct timespec start;
+
+    ok = started = false;
+    error = NULL;
+    queue = NULL;
+    buffer = NULL;
+    qb.name = "shm:/banip-bench";
+    do {
+        if (argc > 0) {
+            qb.name = argv[0];
+        }
+        if (NULL == (queue = queue_init(&error))) {
+            break;
+        }
+        if (!queue_open(queue, qb.name, QUEUE_FL_OWNER, &error)) {
+            break;
+        }
+        if (QUEUE_ERR_OK != queue_get_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_SIZE, &size)) {
+            set_generic_error(&error, "queue_get_attribute failed");
+            break;
+        }
+        if (NULL == (buffer = malloc(++size))) {
+            set_malloc_error(&error, size);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (-1 == (read = queue_receive_timed(queue, buffer, size, TIMED_BENCH_TIMEOUT, &error))) {
+            break;
+        }
+        ms = elapsed_ns(&start) / 1e6;
+        printf("timed: nothing received from %s, gave up after %.1f ms (timeout: %d ms)\n", qb.name, ms, TIMED_BENCH_TIMEOUT);
+        if (0 != read || ms < TIMED_BENCH_TIMEOUT - 1 || ms > TIMED_BENCH_TIMEOUT + 500) {
+            set_generic_error(&error, "empty queue: %d returned after %.1f ms, 0 expected after %d ms", read, ms, TIMED_BENCH_TIMEOUT);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (0 != (err = pthread_create(&producer, NULL, timed_produce, &qb))) {
+            set_generic_error(&error, "pthread_create failed: %s", strerror(err));
+            break;
+        }
+        started = true;
+        if (-1 == (read = queue_receive_timed(queue, buffer, size, TIMED_BENCH_LONG, &error))) {
+            break;
+        }
+        ms = elapsed_ns(&start) / 1e6;
+        printf("timed: message sent after %d ms received from %s after %.1f ms (timeout: %d ms)\n", TIMED_BENCH_SEND, qb.name, ms, TIMED_BENCH_LONG);
+        if (STR_LEN("10.0.0.1") != read || 0 != strcmp(buffer, "10.0.0.1") || ms > TIMED_BENCH_LONG / 2) {
+            set_generic_error(&error, "message not received (%d) or too late (%.1f ms)", read, ms);
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (started) {
+        pthread_join(producer, NULL);
+        ok &= qb.ok;
+    }
+    free(buffer);
+    if (NULL != queue) {
+        queue_close(&queue, NULL);
+    }
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* ======================== client ======================== */
+
+/* distinct addresses among the hits of bench client */
+#define CLIENT_BENCH_ADDRESSES 100
+/* milliseconds a record is held by the client (client_set_delay) */
+#define CLIENT_BENCH_DELAY 20
+
+/**
+ * A flood of count hits from CLIENT_BENCH_ADDRESSES addresses through a
+ * client (binary records, non blocking) to a queue (default:
+ * shm:/banip-bench) nobody receives from: all but the first hit of each
+ * address have to be suppressed. Held for CLIENT_BENCH_DELAY ms, a record
+ * then has to be sent by the client itself, at the end of the delay, with
+ * no other hit to carry it. Then, without suppression, twice as
+ * many addresses as the queue holds: what doesn't fit has to be dropped,
+ * not to block.
+ **/
+static int bench_client(int argc, char **argv)
+{
+    double ns;
+    void *queue;
+    bool ok, opened;
+    client_t client;
+    const char *name;
+    struct timespec start;
+    unsigned long i, count, capacity, before, after;
+    char *error, message[STR_SIZE("255.255.255.255")];
+
+    ok = opened = false;
+    error = NULL;
+    queue = NULL;
+    count = 1000000;
+    name = "shm:/banip-bench";
+    do {
+        if (argc > 0) {
+            char *endptr;
+
+            count = strtoul(argv[0], &endptr, 10);
+            if (count < CLIENT_BENCH_ADDRESSES || '\0' != *endptr) {
+                set_generic_error(&error, "number of hits of at least %d expected, got: %s", CLIENT_BENCH_ADDRESSES, argv[0]);
+                break;
+            }
+        }
+        if (argc > 1) {
+            name = argv[1];
+        }
+        if (NULL == (queue = queue_init(&error))) {
+            break;
+        }
+        queue_set_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE, 256);
+        if (!queue_open(queue, name, QUEUE_FL_OWNER, &error)) {
+            break;
+        }
+        if (!(opened = client_open(&client, name, CLIENT_FL_BINARY | CLIENT_FL_NONBLOCK, &error))) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < count; i++) {
+            snprintf(message, sizeof(message), "10.0.0.%lu", i % CLIENT_BENCH_ADDRESSES);
+            if (!client_send(&client, message, &error)) {
+                break;
+            }
+        }
+        if (i < count) {
+            break;
+        }
+        ns = elapsed_ns(&start);
+        printf("client: %lu hits from %d addresses through %s, %.1f ns/hit, %lu message(s) sent, %lu suppressed, %lu dropped\n", count, CLIENT_BENCH_ADDRESSES, name, ns / count, client.sent, client.suppressed, client.overflowed);
+        /* an address dropped by a full queue is sent again on its next hit */
+        if (client.sent + client.suppressed + client.overflowed != count || (0 == client.overflowed && CLIENT_BENCH_ADDRESSES != client.sent)) {
+            set_generic_error(&error, "%lu message(s) sent, %lu suppressed and %lu dropped, %d sent (without drop) and %lu in all expected", client.sent, client.suppressed, client.overflowed, CLIENT_BENCH_ADDRESSES, count);
+            break;
+        }
+        /* held by the delay, a record is sent by the client itself once it is due */
+        if (!client_set_delay(&client, CLIENT_BENCH_DELAY, &error)) {
+            break;
+        }
+        before = client.sent + client.overflowed;
+        if (!client_send(&client, "10.2.0.1", &error)) {
+            break;
+        }
+        usleep(CLIENT_BENCH_DELAY * 1000 / 2);
+        pthread_mutex_lock(&client.lock);
+        after = client.sent + client.overflowed;
+        pthread_mutex_unlock(&client.lock);
+        if (after != before) {
+            set_generic_error(&error, "record sent before the end of the delay of %d ms", CLIENT_BENCH_DELAY);
+            break;
+        }
+        usleep(4 * CLIENT_BENCH_DELAY * 1000);
+        pthread_mutex_lock(&client.lock);
+        after = client.sent + client.overflowed;
+        pthread_mutex_unlock(&client.lock);
+        printf("client: record held for %d ms then sent by the client\n", CLIENT_BENCH_DELAY);
+        if (after != before + 1) {
+            set_generic_error(&error, "record held still not sent %d ms after the end of its delay", 4 * CLIENT_BENCH_DELAY);
+            break;
+        }
+        client_set_delay(&client, 0, NULL);
+        if (QUEUE_ERR_OK != queue_get_attribute(queue, QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE, &capacity)) {
+            /* unknown (unix socket, System V): no overflow to check */
+            ok = true;
+            break;
+        }
+        client.window = 0;
+        client.sent = client.suppressed = client.overflowed = 0;
+        for (i = 0; i < 2 * capacity; i++) {
+            snprintf(message, sizeof(message), "10.1.%lu.%lu", (i >> 8) & 0xFF, i & 0xFF);
+            if (!client_send(&client, message, &error)) {
+                break;
+            }
+        }
+        if (i < 2 * capacity) {
+            break;
+        }
+        printf("client: %lu addresses for a queue of %lu messages, %lu dropped\n", 2 * capacity, capacity, client.overflowed);
+        if (0 == client.overflowed || client.sent + client.overflowed != 2 * capacity) {
+            set_generic_error(&error, "%lu message(s) sent and %lu dropped, %lu in all expected", client.sent, client.overflowed, 2 * capacity);
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (opened) {
+        client_close(&client, NULL);
+    }
+    if (NULL != queue) {
+        queue_close(&queue, NULL);
+    }
+    if (NULL != error) {
+        fprintf(stderr, "%s\n", error);
+        error_free(&error);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(int, char **);
+    const char *usage;
+} subcommands[] = {
+    { "trie", bench_trie, "trie [number of prefixes]" },
+    { "parse", bench_parse, "parse [number of fuzzed strings]" },
+    { "wheel", bench_wheel, "wheel [number of timers]" },
+    { "journal", bench_journal, "journal [number of bans]" },
+    { "sketch", bench_sketch, "sketch [number of reports] [counters per row]" },
+    { "ring", bench_ring, "ring [number of entries]" },
+    { "queue", bench_queue, "queue [number of messages] [name of the queue]" },
+    { "timed", bench_timed, "timed [name of the queue]" },
+    { "client", bench_client, "client [number of hits] [name of the queue]" },
+};
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    if (argc > 1) {
+        for (i = 0; i < ARRAY_SIZE(subcommands); i++) {
+            if (0 == strcmp(argv[1], subcommands[i].name)) {
+                return subcommands[i].run(argc - 2, argv + 2);
+            }
+        }
+    }
+    fprintf(stderr, "usage:\n");
+    for (i = 0; i < ARRAY_SIZE(subcommands); i++) {
+        fprintf(stderr, "    %s %s\n", argv[0], subcommands[i].usage);
+    }
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "cache.h"
+
+#define CACHE_INITIAL_CAPACITY 1024 /* has to be a power of 2 */
+
+enum {
+    SLOT_EMPTY,
+    SLOT_USED,
+    SLOT_REMOVED,
+};
+
+struct cache_entry_t {
+    uint8_t state;
+    uint8_t fa;
+    uint8_t addr[16];
+};
+
+#define NETWORKS(cache, addr) \
+    (&(cache)->networks[AF_INET == (addr)->fa ? 0 : 1])
+
+static bool is_host(const addr_t *addr)
+{
+    return addr->netmask == ADDR_SIZE(addr) * 8;
+}
+
+/* FNV-1a */
+static size_t cache_hash(const addr_t *addr)
+{
+    size_t i;
+    uint32_t hash;
+    const uint8_t *p;
+
+    hash = 2166136261U ^ addr->fa;
+    for (i = 0, p = (const uint8_t *) &addr->sa; i < ADDR_SIZE(addr); i++) {
+        hash = (hash ^ p[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+/**
+ * Find the slot of addr or, if absent, the one where it would be inserted
+ **/
+static cache_entry_t *cache_find(const cache_t *cache, const addr_t *addr)
+{
+    size_t i;
+    cache_entry_t *removed;
+
+    removed = NULL;
+    for (i = cache_hash(addr) & (cache->capacity - 1); ; i = (i + 1) & (cache->capacity - 1)) {
+        cache_entry_t *entry;
+
+        entry = &cache->entries[i];
+        switch (entry->state) {
+            case SLOT_EMPTY:
+                return NULL == removed ? entry : removed;
+            case SLOT_REMOVED:
+                if (NULL == removed) {
+                    removed = entry;
+                }
+                break;
+            case SLOT_USED:
+                if (entry->fa == addr->fa && 0 == memcmp(entry->addr, &addr->sa, ADDR_SIZE(addr))) {
+                    return entry;
+                }
+                break;
+        }
+    }
+}
+
+static bool cache_resize(cache_t *cache, size_t capacity, char **error)
+{
+    size_t i, old_capacity;
+    cache_entry_t *old_entries;
+
+    old_capacity = cache->capacity;
+    old_entries = cache->entries;
+    if (NULL == (cache->entries = calloc(capacity, sizeof(*cache->entries)))) {
+        set_calloc_error(error, capacity, sizeof(*cache->entries));
+        cache->entries = old_entries;
+        return false;
+    }
+    cache->capacity = capacity;
+    cache->used = cache->count;
+    for (i = 0; i < old_capacity; i++) {
+        if (SLOT_USED == old_entries[i].state) {
+            addr_t addr;
+
+            addr.fa = old_entries[i].fa;
+            memcpy(&addr.sa, old_entries[i].addr, ADDR_SIZE(&addr));
+            *cache_find(cache, &addr) = old_entries[i];
+        }
+    }
+    free(old_entries);
+
+    return true;
+}
+
+static void cache_reset(cache_t *cache)
+{
+    cache->capacity = cache->used = cache->count = 0;
+    cache->entries = NULL;
+    cache->hits = cache->misses = 0;
+}
+
+bool cache_init(cache_t *cache, char **error)
+{
+    cache_reset(cache);
+    trie_init(&cache->networks[1]);
+
+    return trie_init_large(&cache->networks[0], error) && trie_init_large(&cache->networks[1], error);
+}
+
+/**
+ * Is addr already banned, by itself or by a network which covers it?
+ * Unlike cache_lookup, leaves the hits/misses counters alone.
+ **/
+bool cache_contains(cache_t *cache, const addr_t *addr)
+{
+    bool found;
+
+    found = false;
+    if (is_host(addr) && 0 != cache->count) {
+        found = SLOT_USED == cache_find(cache, addr)->state;
+    }
+    if (!found) {
+        found = trie_covered(NETWORKS(cache, addr), &addr->sa, addr->netmask);
+    }
+
+    return found;
+}
+
+/**
+ * Is exactly addr (not a network covering it) in the cache?
+ **/
+bool cache_has(cache_t *cache, const addr_t *addr)
+{
+    if (!is_host(addr)) {
+        return trie_find(NETWORKS(cache, addr), &addr->sa, addr->netmask);
+    }
+
+    return 0 != cache->count && SLOT_USED == cache_find(cache, addr)->state;
+}
+
+/**
+ * Is addr included in a network of the cache (other than addr itself)?
+ *
+ * @param network if not NULL, set to the longest of these networks
+ **/
+bool cache_covering(cache_t *cache, const addr_t *addr, addr_t *network)
+{
+    size_t i;
+    uint8_t match;
+
+    if (!trie_lookup(NETWORKS(cache, addr), &addr->sa, addr->netmask, &match) || match == addr->netmask) {
+        return false;
+    }
+    if (NULL != network) {
+        addr_from_prefix(network, addr->fa, &addr->sa, match);
+        for (i = match; i < ADDR_SIZE(network) * 8; i++) {
+            ((uint8_t *) &network->sa)[i / 8] &= ~(0x80 >> (i % 8));
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Same as cache_contains but updates the hits/misses counters.
+ **/
+bool cache_lookup(cache_t *cache, const addr_t *addr)
+{
+    bool found;
+
+    if ((found = cache_contains(cache, addr))) {
+        ++cache->hits;
+    } else {
+        ++cache->misses;
+    }
+
+    return found;
+}
+
+bool cache_add(cache_t *cache, const addr_t *addr, char **error)
+{
+    cache_entry_t *entry;
+
+    if (!is_host(addr)) {
+        return trie_insert(NETWORKS(cache, addr), &addr->sa, addr->netmask, error);
+    }
+    /* keep the load factor under 3/4 */
+    if (4 * (cache->used + 1) > 3 * cache->capacity) {
+        size_t capacity;
+
+        /* don't grow if it's only filled by removed slots */
+        capacity = 0 == cache->capacity ? CACHE_INITIAL_CAPACITY : 4 * (cache->count + 1) > 3 * cache->capacity / 2 ? cache->capacity * 2 : cache->capacity;
+        if (!cache_resize(cache, capacity, error)) {
+            return false;
+        }
+    }
+    entry = cache_find(cache, addr);
+    if (SLOT_USED != entry->state) {
+        if (SLOT_EMPTY == entry->state) {
+            ++cache->used;
+        }
+        entry->state = SLOT_USED;
+        entry->fa = addr->fa;
+        memcpy(entry->addr, &addr->sa, ADDR_SIZE(addr));
+        ++cache->count;
+    }
+
+    return true;
+}
+
+void cache_remove(cache_t *cache, const addr_t *addr)
+{
+    cache_entry_t *entry;
+
+    if (!is_host(addr)) {
+        trie_remove(NETWORKS(cache, addr), &addr->sa, addr->netmask);
+    } else if (0 != cache->count && SLOT_USED == (entry = cache_find(cache, addr))->state) {
+        entry->state = SLOT_REMOVED;
+        --cache->count;
+    }
+}
+
+void cache_free(cache_t *cache)
+{
+    free(cache->entries);
+    trie_free(&cache->networks[0]);
+    trie_free(&cache->networks[1]);
+    cache_reset(cache);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parse.h"
+#include "trie.h"
+
+typedef struct cache_entry_t cache_entry_t;
+
+/**
+ * The addresses already banned (or being banned): single addresses (/32
+ * and /128) go in an open addressing hash table, networks in a trie per
+ * family to also find the addresses they cover.
+ **/
+typedef struct {
+    size_t capacity; /* number of slots, a power of 2 */
+    size_t used;     /* non empty slots (including removed ones) */
+    size_t count;    /* number of addresses */
+    cache_entry_t *entries;
+    trie_t networks[2];
+    unsigned long hits, misses;
+} cache_t;
+
+bool cache_init(cache_t *, char **);
+bool cache_contains(cache_t *, const addr_t *);
+bool cache_has(cache_t *, const addr_t *);
+bool cache_covering(cache_t *, const addr_t *, addr_t *);
+bool cache_lookup(cache_t *, const addr_t *);
+bool cache_add(cache_t *, const addr_t *, char **);
+void cache_remove(cache_t *, const addr_t *);
+void cache_free(cache_t *);
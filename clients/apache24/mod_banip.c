@@ -12,7 +12,7 @@
 #include "util_script.h"
 
 #include "common.h"
-#include "queue.h"
+#include "client.h"
 
 #define BANIP_PREFIX "BanIP"
 #define BANIP_HEADER "X-BanIP"
@@ -40,6 +40,8 @@ struct _pattern_compiler {
 typedef struct {
     char *queue;
     int enabled;
+    unsigned long window;
+    unsigned long delay;
     apr_array_header_t *rules;
 } banip_server_conf;
 
@@ -48,7 +50,8 @@ typedef struct {
     apr_array_header_t *rules;
 } banip_perdir_conf;
 
-static void *queue = NULL;
+static client_t client;
+static int client_opened = 0;
 
 /* ======================== ? ========================  */
 
@@ -168,6 +171,8 @@ static void *config_server_create(apr_pool_t *p, server_rec *s)
     ret = (banip_server_conf *) apr_pcalloc(p, sizeof(*ret));
     ret->enabled = 0;
     ret->queue = NULL;
+    ret->window = CLIENT_DEFAULT_WINDOW;
+    ret->delay = 0;
     ret->rules = apr_array_make(p, 2, sizeof(banip_rule));
 
     return (void *) ret;
@@ -208,22 +213,30 @@ static void *config_perdir_merge(apr_pool_t *p, void *basev, void *overridesv)
 
 /* ======================== ? ========================  */
 
-static int banip_queue_send_message(request_rec *r)
+/**
+ * Never blocks the worker: an address sent in the last BanIPWindow seconds
+ * is not sent again and, if the queue is full, the address is dropped
+ **/
+static void banip_queue_send_message(request_rec *r)
 {
+    char *error;
     banip_server_conf *sconf;
 
+    error = NULL;
     sconf = (banip_server_conf *) ap_get_module_config(r->server->module_config, &banip_module);
-    if (QUEUE_ERR_OK == queue_send(queue, r->useragent_ip, -1)) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, "Message '%s' sent on mqueue '%s'", r->useragent_ip, sconf->queue);
+    if (client_send(&client, r->useragent_ip, &error)) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, "Address '%s' sent on queue '%s'", r->useragent_ip, sconf->queue);
     } else {
-        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, "Failed sending message '%s' on '%s'", r->useragent_ip, sconf->queue);
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, "Failed sending address '%s' on '%s': %s", r->useragent_ip, sconf->queue, error);
+        error_free(&error);
     }
 }
 
 static apr_status_t banip_queue_close(void *UNUSED(data))
 {
-    if (NULL != queue) {
-        queue_close(&queue);
+    if (client_opened) {
+        client_opened = 0;
+        client_close(&client, NULL);
     }
 
     return OK;
@@ -231,8 +244,10 @@ static apr_status_t banip_queue_close(void *UNUSED(data))
 
 static int banip_post_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s)
 {
+    char *error;
     banip_server_conf *sconf;
 
+    error = NULL;
     // TODO: we haven't yet drop root privileges here?
     if (AP_SQ_MS_CREATE_PRE_CONFIG == ap_state_query(AP_SQ_MAIN_STATE)) {
         return OK;
@@ -243,21 +258,40 @@ static int banip_post_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp,
             ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, "A '" BANIP_PREFIX "Queue' directive is missing to set queue name");
             return HTTP_INTERNAL_SERVER_ERROR;
         }
-        if (NULL == (queue = queue_init())) {
-            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, "Failed to initialize a queue");
-            return HTTP_INTERNAL_SERVER_ERROR;
-        }
-        if (QUEUE_ERR_OK != queue_open(queue, sconf->queue, QUEUE_FL_SENDER)) {
-            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, "Failed to open queue '%s'", sconf->queue);
-            queue_close(&queue);
+        if (!client_open(&client, sconf->queue, CLIENT_FL_BINARY | CLIENT_FL_NONBLOCK, &error)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, "Failed to open queue '%s': %s", sconf->queue, error);
+            error_free(&error);
             return HTTP_INTERNAL_SERVER_ERROR;
         }
+        client_opened = 1;
+        client.window = sconf->window;
         apr_pool_cleanup_register(p, NULL, banip_queue_close, apr_pool_cleanup_null);
     }
 
     return OK;
 }
 
+/**
+ * The thread of the client which sends the addresses held (BanIPDelay)
+ * doesn't survive the fork: each child starts its own
+ **/
+static void banip_child_init(apr_pool_t *p, server_rec *s)
+{
+    char *error;
+    banip_server_conf *sconf;
+
+    error = NULL;
+    sconf = (banip_server_conf *) ap_get_module_config(s->module_config, &banip_module);
+    if (client_opened && 0 != sconf->delay) {
+        if (!client_set_delay(&client, sconf->delay, &error)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, "Failed to hold the addresses for '%s': %s", sconf->queue, error);
+            error_free(&error);
+        }
+        /* stop it (and send what is held) when the child exits */
+        apr_pool_cleanup_register(p, NULL, banip_queue_close, apr_pool_cleanup_null);
+    }
+}
+
 static int banip_fixup(request_rec *r)
 {
     int i;
@@ -332,6 +366,36 @@ static const char *cmd_banip_queue(cmd_parms *cmd, void *cfg, const char *arg)
     return NULL;
 }
 
+static const char *cmd_banip_unsigned(cmd_parms *cmd, unsigned long *value, const char *arg)
+{
+    char *endptr;
+
+    *value = strtoul(arg, &endptr, 10);
+    if (endptr == arg || '\0' != *endptr) {
+        return apr_pstrcat(cmd->pool, cmd->directive->directive, ": positive integer expected, got '", arg, "'", NULL);
+    }
+
+    return NULL;
+}
+
+static const char *cmd_banip_window(cmd_parms *cmd, void *cfg, const char *arg)
+{
+    banip_server_conf *sconf;
+
+    sconf = (banip_server_conf *) ap_get_module_config(cmd->server->module_config, &banip_module);
+
+    return cmd_banip_unsigned(cmd, &sconf->window, arg);
+}
+
+static const char *cmd_banip_delay(cmd_parms *cmd, void *cfg, const char *arg)
+{
+    banip_server_conf *sconf;
+
+    sconf = (banip_server_conf *) ap_get_module_config(cmd->server->module_config, &banip_module);
+
+    return cmd_banip_unsigned(cmd, &sconf->delay, arg);
+}
+
 static const char *cmd_banip_rule(cmd_parms *cmd, void *cfg, int argc, char *const argv[])
 {
     const char *ret;
@@ -403,6 +467,8 @@ static void banip_insert_output_filter(request_rec *r)
 static const command_rec command_table[] = {
     AP_INIT_FLAG(BANIP_PREFIX "Enable", cmd_banip_enable, NULL, OR_FILEINFO, "TODO"),
     AP_INIT_TAKE1(BANIP_PREFIX "Queue", cmd_banip_queue, NULL, RSRC_CONF, "TODO"),
+    AP_INIT_TAKE1(BANIP_PREFIX "Window", cmd_banip_window, NULL, RSRC_CONF, "seconds during which an address banned is not sent again"),
+    AP_INIT_TAKE1(BANIP_PREFIX "Delay", cmd_banip_delay, NULL, RSRC_CONF, "milliseconds for which addresses are held to be sent together"),
     AP_INIT_TAKE_ARGV(BANIP_PREFIX "Rule", cmd_banip_rule, NULL, OR_FILEINFO, "TODO"),
 #if 0
     AP_INIT_ITERATE(BANIP_PREFIX "Policy", cmd_banip_policy, NULL, RSRC_CONF, "TODO"),
@@ -424,6 +490,7 @@ static void register_hooks(apr_pool_t *p)
 
     ap_hook_fixups(banip_fixup, NULL, NULL, APR_HOOK_FIRST);
     ap_hook_post_config(banip_post_config, NULL, NULL, APR_HOOK_FIRST);
+    ap_hook_child_init(banip_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 #ifndef WITHOUT_OUTPUT_FILTER
     ap_register_output_filter(BANIP_FILTER, banip_output_filter, NULL, AP_FTYPE_CONTENT_SET);
     ap_hook_insert_filter(banip_insert_output_filter, NULL, NULL, APR_HOOK_FIRST);
@@ -1,7 +1,7 @@
 <?php
 /*
 Required extension: sysvmsg
-Note: banipd needs to be built with System V queue (not POSIX)
+Note: banipd has to serve a System V queue (-q sysv:/tmp/banip)
 
 Example:
 $banip = new BanIPClient('/tmp/banip');
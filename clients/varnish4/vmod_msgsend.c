@@ -15,7 +15,7 @@
 
 #include "vcc_if.h"
 
-#include "queue.h"
+#include "client.h"
 #include "error.h"
 
 #ifdef DEBUG
@@ -37,16 +37,21 @@ cd $HOME/libvmod-msgsend
 ./autogen.sh && ./configure VARNISHSRC=$HOME/Downloads/varnish-4.0.0/ && make ; sudo make install
 */
 
+/**
+ * The client (see client.h) is shared by the worker threads: they never
+ * wait for the queue, an address already sent in the last seconds (see
+ * .set_window) is not sent again and, if the queue is full, the address
+ * is dropped
+ **/
 struct vmod_msgsend_mqueue {
     unsigned magic;
     #define VMOD_MSGSEND_OBJ_MAGIC 0x9966feff
-    void *queue;
+    client_t client;
     const char *queue_name;
 };
 
 VCL_VOID vmod_mqueue__init(const struct vrt_ctx *ctx, struct vmod_msgsend_mqueue **qp, const char *vcl_name, VCL_STRING queue_name)
 {
-    void *queue;
     char *error;
     struct vmod_msgsend_mqueue *q;
 
@@ -54,24 +59,16 @@ VCL_VOID vmod_mqueue__init(const struct vrt_ctx *ctx, struct vmod_msgsend_mqueue
     CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
     AN(qp);
     AZ(*qp);
-    if (NULL == (queue = queue_init(&error))) {
-        if (NULL != ctx->vsl) {
-            VSLb(ctx->vsl, SLT_Error, "Can't init queue: %s", error);
-            error_free(&error);
-        }
-    }
-    if (!queue_open(queue, queue_name, QUEUE_FL_SENDER, &error)) {
+    ALLOC_OBJ(q, VMOD_MSGSEND_OBJ_MAGIC);
+    AN(q);
+    if (!client_open(&q->client, queue_name, CLIENT_FL_BINARY | CLIENT_FL_NONBLOCK, &error)) {
         if (NULL != ctx->vsl) {
             VSLb(ctx->vsl, SLT_Error, "Can't open queue '%s': %s", queue_name, error);
-            error_free(&error);
         }
-        queue_close(&queue, NULL);
+        error_free(&error);
     }
-    XXXAN(queue);
-    ALLOC_OBJ(q, VMOD_MSGSEND_OBJ_MAGIC);
-    AN(q);
+    XXXAN(q->client.queue);
     *qp = q;
-    q->queue = queue;
     q->queue_name = queue_name;
     AN(*qp);
 }
@@ -80,7 +77,7 @@ VCL_VOID vmod_mqueue__fini(struct vmod_msgsend_mqueue **qp)
 {
     AN(qp);
     CHECK_OBJ_NOTNULL(*qp, VMOD_MSGSEND_OBJ_MAGIC);
-    queue_close(&(*qp)->queue, NULL);
+    client_close(&(*qp)->client, NULL);
     FREE_OBJ(*qp);
     *qp = NULL;
 }
@@ -92,8 +89,37 @@ VCL_VOID vmod_mqueue_sendmsg(const struct vrt_ctx *ctx, struct vmod_msgsend_mque
     CHECK_OBJ_NOTNULL(q, VMOD_MSGSEND_OBJ_MAGIC);
 
     error = NULL;
-    if (!queue_send(q->queue, message, -1, &error)) {
+    if (!client_send(&q->client, message, &error)) {
         VSLb(ctx->vsl, SLT_Error, "Failed sending message '%s' on '%s': %s", message, q->queue_name, error);
         error_free(&error);
     }
 }
+
+VCL_VOID vmod_mqueue_set_window(const struct vrt_ctx *ctx, struct vmod_msgsend_mqueue *q, VCL_INT seconds)
+{
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+    CHECK_OBJ_NOTNULL(q, VMOD_MSGSEND_OBJ_MAGIC);
+
+    q->client.window = seconds < 0 ? 0 : seconds;
+}
+
+VCL_VOID vmod_mqueue_set_delay(const struct vrt_ctx *ctx, struct vmod_msgsend_mqueue *q, VCL_INT milliseconds)
+{
+    char *error;
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+    CHECK_OBJ_NOTNULL(q, VMOD_MSGSEND_OBJ_MAGIC);
+
+    error = NULL;
+    if (!client_set_delay(&q->client, milliseconds < 0 ? 0 : milliseconds, &error)) {
+        VSLb(ctx->vsl, SLT_Error, "Can't hold the addresses for '%s': %s", q->queue_name, error);
+        error_free(&error);
+    }
+}
+
+VCL_INT vmod_mqueue_overflowed(const struct vrt_ctx *ctx, struct vmod_msgsend_mqueue *q)
+{
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+    CHECK_OBJ_NOTNULL(q, VMOD_MSGSEND_OBJ_MAGIC);
+
+    return q->client.overflowed;
+}
@@ -1,7 +1,19 @@
+#ifdef __linux__
+# define _GNU_SOURCE /* pipe2 */
+#endif /* __linux__ */
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "err.h"
 #include "command.h"
 
 int run_command(char **error, const char *format, ...)
@@ -20,3 +32,364 @@ int run_command(char **error, const char *format, ...)
 
     return system(buffer);
 }
+
+/* ======================== coprocess ======================== */
+
+static unsigned long count_lines(const char *string)
+{
+    unsigned long count;
+
+    for (count = 0; NULL != (string = strchr(string, '\n')); string++) {
+        ++count;
+    }
+
+    return count;
+}
+
+/**
+ * Remember the label of the next line appended to the buffer
+ **/
+static void coprocess_label(coprocess_t *cp, const char *label)
+{
+    char *entry;
+
+    entry = cp->history[cp->total % COPROCESS_HISTORY_SIZE];
+    if (snprintf(entry, STR_SIZE(cp->history[0]), "%s", label) >= (int) STR_SIZE(cp->history[0])) {
+        /* not worth an error, it's only used for reporting */
+        entry[STR_LEN(cp->history[0])] = '\0';
+    }
+    ++cp->total;
+    ++cp->buflines;
+}
+
+void coprocess_init(coprocess_t *cp, const char *name, const char * const *argv, const char *prologue, const char *epilogue)
+{
+    cp->name = name;
+    cp->argv = argv;
+    cp->prologue = prologue;
+    cp->epilogue = epilogue;
+    cp->pid = -1;
+    cp->in = cp->out = -1;
+    cp->first = cp->total = 0;
+    cp->len = 0;
+    cp->buflines = 0;
+    cp->outlen = 0;
+}
+
+bool coprocess_start(coprocess_t *cp, char **error)
+{
+    bool ok;
+    int in[2], out[2];
+
+    ok = false;
+    in[0] = in[1] = out[0] = out[1] = -1;
+    do {
+        /* close-on-exec from the start: our ends never leak into an other child, even one forked by an other thread */
+        if (0 != pipe2(in, O_CLOEXEC) || 0 != pipe2(out, O_CLOEXEC)) {
+            set_system_error(error, "pipe2 failed");
+            break;
+        }
+        if (-1 == (cp->pid = fork())) {
+            set_system_error(error, "fork failed");
+            break;
+        }
+        if (0 == cp->pid) {
+            /* only async-signal-safe calls from here: we may have been forked from a multithreaded process */
+            /* dup2 clears FD_CLOEXEC of the copies, the originals are closed by exec */
+            if (-1 == dup2(in[0], STDIN_FILENO) || -1 == dup2(out[1], STDOUT_FILENO) || -1 == dup2(out[1], STDERR_FILENO)) {
+                _exit(127);
+            }
+            execvp(cp->argv[0], (char * const *) cp->argv);
+            /* to the parent, through the pipe, which logs it */
+            write(STDERR_FILENO, "exec ", STR_LEN("exec "));
+            write(STDERR_FILENO, cp->argv[0], strlen(cp->argv[0]));
+            write(STDERR_FILENO, " failed\n", STR_LEN(" failed\n"));
+            _exit(127);
+        }
+        close(in[0]);
+        close(out[1]);
+        in[0] = out[1] = -1;
+        cp->in = in[1];
+        cp->out = out[0];
+        if (-1 == fcntl(cp->out, F_SETFL, O_NONBLOCK)) {
+            set_system_error(error, "fcntl failed");
+            coprocess_stop(cp);
+            break;
+        }
+        /* what is pending in the buffer will be the first lines read by this child */
+        cp->first = cp->total - cp->buflines;
+        cp->outlen = 0;
+        ok = true;
+    } while (false);
+    if (!ok) {
+        if (-1 != in[0]) {
+            close(in[0]);
+        }
+        if (-1 != out[1]) {
+            close(out[1]);
+        }
+        if (-1 == cp->pid) {
+            if (-1 != in[1]) {
+                close(in[1]);
+            }
+            if (-1 != out[0]) {
+                close(out[0]);
+            }
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Add a line to the current chunk, it is not sent until coprocess_flush
+ *
+ * @param label what the line is about, to report an error on it (eg: the address)
+ * @param format printf-like format of the line, including the trailing '\n'
+ *
+ * @return false if the chunk is full
+ **/
+bool coprocess_append(coprocess_t *cp, const char *label, const char *format, ...)
+{
+    int l;
+    va_list ap;
+    size_t mark, reserved;
+    unsigned long marklines;
+
+    mark = cp->len;
+    marklines = cp->buflines;
+    reserved = NULL == cp->epilogue ? 0 : strlen(cp->epilogue);
+    if (0 == cp->len && NULL != cp->prologue) {
+        unsigned long i, lines;
+
+        cp->len = strlen(cp->prologue);
+        memcpy(cp->buf, cp->prologue, cp->len);
+        for (i = 0, lines = count_lines(cp->prologue); i < lines; i++) {
+            coprocess_label(cp, "");
+        }
+    }
+    va_start(ap, format);
+    l = vsnprintf(cp->buf + cp->len, STR_SIZE(cp->buf) - cp->len - reserved, format, ap);
+    va_end(ap);
+    if (l < 0 || (size_t) l >= STR_SIZE(cp->buf) - cp->len - reserved) {
+        cp->total -= cp->buflines - marklines;
+        cp->buflines = marklines;
+        cp->len = mark;
+        return false;
+    }
+    cp->len += l;
+    coprocess_label(cp, label);
+
+    return true;
+}
+
+/**
+ * Log a line of output of the child, with the label of the line of input
+ * it refers to, if any
+ **/
+static void coprocess_report(coprocess_t *cp, const char *line)
+{
+    const char *p;
+    unsigned long n, index;
+
+    if (NULL != (p = strstr(line, "line ")) && (n = strtoul(p + STR_LEN("line "), NULL, 10)) > 0) {
+        index = cp->first + n - 1;
+        if (index < cp->total && cp->total - index <= COPROCESS_HISTORY_SIZE && '\0' != *cp->history[index % COPROCESS_HISTORY_SIZE]) {
+            warn("%s: %s (%s)", cp->name, line, cp->history[index % COPROCESS_HISTORY_SIZE]);
+            return;
+        }
+    }
+    warn("%s: %s", cp->name, line);
+}
+
+/**
+ * Log what the child wrote, without blocking, and reap it if it died.
+ * It will be restarted by the next coprocess_flush.
+ **/
+void coprocess_poll(coprocess_t *cp)
+{
+    int status;
+    bool eof;
+    pid_t pid;
+
+    if (-1 == cp->pid) {
+        return;
+    }
+    eof = false;
+    while (1) {
+        char *start, *nl;
+        ssize_t r;
+
+        if (-1 == (r = read(cp->out, cp->outbuf + cp->outlen, STR_LEN(cp->outbuf) - cp->outlen))) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                warnc("%s: read failed", cp->name);
+            }
+            break;
+        }
+        if (0 == r) {
+            eof = true;
+        }
+        cp->outlen += r;
+        cp->outbuf[cp->outlen] = '\0';
+        for (start = cp->outbuf; NULL != (nl = strchr(start, '\n')); start = nl + 1) {
+            *nl = '\0';
+            coprocess_report(cp, start);
+        }
+        cp->outlen -= start - cp->outbuf;
+        memmove(cp->outbuf, start, cp->outlen);
+        /* line too long or incomplete last one */
+        if ((eof && 0 != cp->outlen) || STR_LEN(cp->outbuf) == cp->outlen) {
+            cp->outbuf[cp->outlen] = '\0';
+            coprocess_report(cp, cp->outbuf);
+            cp->outlen = 0;
+        }
+        if (eof) {
+            break;
+        }
+    }
+    /* the child closed its output: it is exiting, wait for it */
+    if (0 == (pid = waitpid(cp->pid, &status, eof ? 0 : WNOHANG))) {
+        return;
+    }
+    if (-1 == pid) {
+        warnc("%s: waitpid failed", cp->name);
+    } else if (WIFEXITED(status) && EXIT_SUCCESS != WEXITSTATUS(status)) {
+        warn("%s: exited with status %d", cp->name, WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        warn("%s: killed by signal %d", cp->name, WTERMSIG(status));
+    }
+    if (-1 != cp->in) {
+        close(cp->in);
+    }
+    close(cp->out);
+    cp->in = cp->out = -1;
+    cp->pid = -1;
+}
+
+/**
+ * Wait for the child to end, logging what it writes until then
+ **/
+static void coprocess_wait(coprocess_t *cp)
+{
+    int flags;
+
+    if (-1 != (flags = fcntl(cp->out, F_GETFL))) {
+        fcntl(cp->out, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    while (-1 != cp->pid) {
+        coprocess_poll(cp);
+    }
+}
+
+/**
+ * Write the whole buffer to the pipe fd: a dead child has to be reported
+ * by write (EPIPE), not kill us, but SIGPIPE is only blocked for the
+ * calling thread and the time of the write, then the one it raised (if
+ * any) is consumed before restoring the mask
+ **/
+static bool write_all(int fd, const char *buffer, size_t len)
+{
+    bool ok;
+    ssize_t w;
+    sigset_t pipeset, oldset;
+
+    ok = true;
+    sigemptyset(&pipeset);
+    sigaddset(&pipeset, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeset, &oldset);
+    while (len > 0) {
+        if (-1 == (w = write(fd, buffer, len))) {
+            if (EINTR == errno) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        buffer += w;
+        len -= w;
+    }
+    /* SIGPIPE was not already pending (or blocked) before: clear the one we caused */
+    if (!ok && EPIPE == errno && !sigismember(&oldset, SIGPIPE)) {
+        int err;
+        sigset_t pending;
+        struct timespec zero = { 0, 0 };
+
+        err = errno;
+        sigpending(&pending);
+        if (sigismember(&pending, SIGPIPE)) {
+            sigtimedwait(&pipeset, NULL, &zero);
+        }
+        errno = err;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+    return ok;
+}
+
+/**
+ * Send the current chunk to the child, (re)starting it if needed.
+ * If the child dies while we write, it is restarted and the chunk sent
+ * once more.
+ **/
+bool coprocess_flush(coprocess_t *cp, char **error)
+{
+    bool ok;
+    int attempt;
+
+    if (0 == cp->len) {
+        return true;
+    }
+    ok = false;
+    if (NULL != cp->epilogue) {
+        unsigned long i, lines;
+
+        /* room was kept by coprocess_append */
+        memcpy(cp->buf + cp->len, cp->epilogue, strlen(cp->epilogue));
+        cp->len += strlen(cp->epilogue);
+        for (i = 0, lines = count_lines(cp->epilogue); i < lines; i++) {
+            coprocess_label(cp, "");
+        }
+    }
+    for (attempt = 0; attempt < 2; attempt++) {
+        /* report errors of the previous chunks and notice if the child died meanwhile */
+        coprocess_poll(cp);
+        if (-1 == cp->pid && !coprocess_start(cp, error)) {
+            break;
+        }
+        if (write_all(cp->in, cp->buf, cp->len)) {
+            ok = true;
+            break;
+        }
+        if (EPIPE != errno) {
+            set_system_error(error, "writing to %s failed", cp->name);
+            break;
+        }
+        /* EPIPE: the child is gone, wait for it and try again with a new one */
+        close(cp->in);
+        cp->in = -1;
+        coprocess_wait(cp);
+    }
+    if (!ok && NULL != error && NULL == *error) {
+        set_generic_error(error, "%s died twice in a row, %lu line(s) dropped", cp->name, cp->buflines);
+    }
+    cp->len = 0;
+    cp->buflines = 0;
+
+    return ok;
+}
+
+void coprocess_stop(coprocess_t *cp)
+{
+    if (-1 == cp->pid) {
+        return;
+    }
+    /* on EOF the child ends by itself */
+    if (-1 != cp->in) {
+        close(cp->in);
+        cp->in = -1;
+    }
+    coprocess_wait(cp);
+}
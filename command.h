@@ -1,5 +1,42 @@
 #pragma once
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <netinet/in.h>
 
 int run_command(char **, const char *, ...);
+
+/* number of lines whose label is remembered to report errors */
+#define COPROCESS_HISTORY_SIZE 1024
+
+/* size of the buffer of a chunk */
+#define COPROCESS_BUFFER_SIZE 16384
+
+/**
+ * A long-lived child (like ipset restore) fed with lines on its standard input
+ **/
+typedef struct {
+    const char *name;
+    const char * const *argv;
+    const char *prologue; /* written before each chunk (may be NULL) */
+    const char *epilogue; /* written after each chunk (may be NULL) */
+    pid_t pid;
+    int in;  /* stdin of the child */
+    int out; /* stdout and stderr of the child, non-blocking */
+    unsigned long total; /* number of lines appended since the beginning */
+    unsigned long first; /* index (in total) of the first line read by the current child */
+    size_t len; /* used part of buf */
+    unsigned long buflines; /* number of lines in buf */
+    char buf[COPROCESS_BUFFER_SIZE];
+    size_t outlen; /* used part of outbuf */
+    char outbuf[1024];
+    char history[COPROCESS_HISTORY_SIZE][INET6_ADDRSTRLEN + 4]; /* label of the last lines */
+} coprocess_t;
+
+void coprocess_init(coprocess_t *, const char *, const char * const *, const char *, const char *);
+bool coprocess_start(coprocess_t *, char **);
+bool coprocess_append(coprocess_t *, const char *, const char *, ...);
+bool coprocess_flush(coprocess_t *, char **);
+void coprocess_poll(coprocess_t *);
+void coprocess_stop(coprocess_t *);
@@ -4,9 +4,25 @@
 #include "common.h"
 #include "engine.h"
 
-static bool dummy_handle(void *UNUSED(ctxt), const char *UNUSED(tablename), addr_t addr, char **UNUSED(error))
+static bool dummy_handle(void *UNUSED(ctxt), const char *tablename, const addr_t *addr, char **UNUSED(error))
 {
-    fprintf(stderr, "Received: '%s'\n", addr.humanrepr);
+    char buffer[INET6_ADDRSTRLEN];
+
+    fprintf(stderr, "Received: '%s' into %s\n", addr_ntop(addr, buffer, sizeof(buffer)), tablename);
+
+    return true;
+}
+
+static bool dummy_unhandle(void *UNUSED(ctxt), const char *tablename, const addr_t *addrs, size_t count, bool *results, char **UNUSED(error))
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        char buffer[INET6_ADDRSTRLEN];
+
+        fprintf(stderr, "Removed: '%s' from %s\n", addr_ntop(&addrs[i], buffer, sizeof(buffer)), tablename);
+        results[i] = true;
+    }
 
     return true;
 }
@@ -16,5 +32,8 @@ const engine_t dummy_engine = {
     "dummy",
     NULL,
     dummy_handle,
+    NULL,
+    dummy_unhandle,
+    NULL,
     NULL
 };
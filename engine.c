@@ -20,6 +20,8 @@ extern engine_t ipset_engine;
 
 #ifdef WITH_IPTABLES
 extern engine_t iptables_engine;
+extern engine_t iptables_restore_engine;
+extern engine_t ipset_restore_engine;
 #endif /* IPTABLES */
 
 extern engine_t dummy_engine;
@@ -39,6 +41,8 @@ static const engine_t *available_engines[] = {
 #endif /* IPSET */
 #ifdef WITH_IPTABLES
     &iptables_engine,
+    &iptables_restore_engine,
+    &ipset_restore_engine,
 #endif /* IPTABLES */
     &dummy_engine,
     NULL
@@ -62,3 +66,26 @@ const engine_t *get_engine_by_name(const char *name)
 
     return NULL;
 }
+
+/**
+ * Dispatch a batch of addresses to the engine, falling back on
+ * its handle callback for each address if it can't do better
+ **/
+bool engine_handle_batch(const engine_t *engine, void *ctxt, const char *tablename, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    bool ok;
+    size_t i;
+
+    if (NULL != engine->handle_batch) {
+        return engine->handle_batch(ctxt, tablename, addrs, count, results, error);
+    }
+    ok = true;
+    for (i = 0; i < count; i++) {
+        /* only keep the first error */
+        if (!(results[i] = engine->handle(ctxt, tablename, &addrs[i], ok ? error : NULL))) {
+            ok = false;
+        }
+    }
+
+    return ok;
+}
@@ -9,9 +9,40 @@ typedef struct {
     const char * const name;
     void *(*open)(const char *, char **);
 //     int (*getopt)(void *, int, const char *);
-    bool (*handle)(void *, const char *, addr_t, char **);
+    bool (*handle)(void *, const char *, const addr_t *, char **);
+    /**
+     * Optional: add several addresses at once (one kernel call when the firewall allows it)
+     *
+     * @param ctxt
+     * @param tablename
+     * @param addrs the addresses
+     * @param count number of addresses
+     * @param results set to true or false for each address, depending if it was added
+     * @param error set to the error of the first failing address
+     *
+     * @return false if at least one address failed
+     **/
+    bool (*handle_batch)(void *, const char *, const addr_t *, size_t, bool *, char **);
+    /**
+     * Optional: remove addresses previously added, when their ban expires
+     * (same parameters as handle_batch). Without it, bans are permanent.
+     **/
+    bool (*unhandle)(void *, const char *, const addr_t *, size_t, bool *, char **);
+    /**
+     * Optional: do a part of the work left by handle/handle_batch for later
+     * (eg: killing the states of the banned addresses), called when no
+     * address is waiting to be banned
+     *
+     * @param ctxt
+     * @param max maximum number of items to process
+     * @param error set if some of them failed
+     *
+     * @return true if some work is left
+     **/
+    bool (*deferred)(void *, size_t, char **);
     void (*close)(void *);
 } engine_t;
 
 const engine_t *get_default_engine(void);
 const engine_t *get_engine_by_name(const char *);
+bool engine_handle_batch(const engine_t *, void *, const char *, const addr_t *, size_t, bool *, char **);
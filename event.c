@@ -0,0 +1,160 @@
+#include <sys/param.h> /* BSD */
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "event.h"
+
+#if defined(__linux__)
+# define WITH_EPOLL
+# include <sys/epoll.h>
+#elif defined(BSD) || defined(__APPLE__)
+# define WITH_KQUEUE
+# include <sys/event.h>
+# include <sys/time.h>
+#else
+# include <poll.h>
+#endif
+
+/* a descriptor watched through poll(2) and what to return when it is readable */
+struct event_watch_t {
+    int fd;
+    void *data;
+};
+
+bool event_init(event_loop_t *loop, char **error)
+{
+    loop->count = 0;
+    loop->watches = NULL;
+#if defined(WITH_EPOLL)
+    if (-1 == (loop->fd = epoll_create1(EPOLL_CLOEXEC))) {
+        set_system_error(error, "epoll_create1 failed");
+        return false;
+    }
+#elif defined(WITH_KQUEUE)
+    if (-1 == (loop->fd = kqueue())) {
+        set_system_error(error, "kqueue failed");
+        return false;
+    }
+#else
+    (void) error;
+    loop->fd = -1;
+#endif
+
+    return true;
+}
+
+/**
+ * Watch fd: data is what event_wait gives back when fd becomes readable
+ **/
+bool event_add(event_loop_t *loop, int fd, void *data, char **error)
+{
+#if defined(WITH_EPOLL)
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = data;
+    if (0 != epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &ev)) {
+        set_system_error(error, "epoll_ctl(EPOLL_CTL_ADD) failed for %d", fd);
+        return false;
+    }
+#elif defined(WITH_KQUEUE)
+    struct kevent ev;
+
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, data);
+    if (0 != kevent(loop->fd, &ev, 1, NULL, 0, NULL)) {
+        set_system_error(error, "kevent(EV_ADD) failed for %d", fd);
+        return false;
+    }
+#else
+    struct event_watch_t *watches;
+
+    if (NULL == (watches = realloc(loop->watches, (loop->count + 1) * sizeof(*watches)))) {
+        set_malloc_error(error, (loop->count + 1) * sizeof(*watches));
+        return false;
+    }
+    loop->watches = watches;
+    watches[loop->count].fd = fd;
+    watches[loop->count].data = data;
+#endif
+    ++loop->count;
+
+    return true;
+}
+
+/**
+ * Block until at least one of the descriptors is readable (or a signal
+ * is caught)
+ *
+ * @param ready set to the data of the readable descriptors
+ * @param max size of ready
+ *
+ * @return the number of readable descriptors, 0 if interrupted by a
+ * signal, -1 on failure
+ **/
+int event_wait(event_loop_t *loop, void **ready, int max, char **error)
+{
+    int i, n;
+
+#if defined(WITH_EPOLL)
+    struct epoll_event evs[max];
+
+    if (-1 == (n = epoll_wait(loop->fd, evs, max, -1))) {
+        if (EINTR == errno) {
+            return 0;
+        }
+        set_system_error(error, "epoll_wait failed");
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        ready[i] = evs[i].data.ptr;
+    }
+#elif defined(WITH_KQUEUE)
+    struct kevent evs[max];
+
+    if (-1 == (n = kevent(loop->fd, NULL, 0, evs, max, NULL))) {
+        if (EINTR == errno) {
+            return 0;
+        }
+        set_system_error(error, "kevent failed");
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        ready[i] = evs[i].udata;
+    }
+#else
+    struct pollfd fds[loop->count];
+
+    for (i = 0; i < loop->count; i++) {
+        fds[i].fd = loop->watches[i].fd;
+        fds[i].events = POLLIN;
+    }
+    if (-1 == poll(fds, loop->count, -1)) {
+        if (EINTR == errno) {
+            return 0;
+        }
+        set_system_error(error, "poll failed");
+        return -1;
+    }
+    for (i = n = 0; i < loop->count && n < max; i++) {
+        if (0 != fds[i].revents) {
+            ready[n++] = loop->watches[i].data;
+        }
+    }
+#endif
+
+    return n;
+}
+
+void event_close(event_loop_t *loop)
+{
+    if (-1 != loop->fd) {
+        close(loop->fd);
+        loop->fd = -1;
+    }
+    free(loop->watches);
+    loop->watches = NULL;
+    loop->count = 0;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Wait for several file descriptors to be readable: epoll on Linux,
+ * kqueue on the BSD, poll(2) elsewhere
+ **/
+typedef struct {
+    int fd; /* epoll or kqueue descriptor, -1 with poll(2) */
+    int count;
+    struct event_watch_t *watches; /* with poll(2) only */
+} event_loop_t;
+
+bool event_init(event_loop_t *, char **);
+bool event_add(event_loop_t *, int, void *, char **);
+int event_wait(event_loop_t *, void **, int, char **);
+void event_close(event_loop_t *);
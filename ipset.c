@@ -1,43 +1,425 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdarg.h>
+#include <string.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
 
 #include "common.h"
+#include "err.h"
+#include "command.h"
 #include "engine.h"
+#include "netlink.h"
+
+/* lowest protocol version, understood by any kernel */
+#ifdef IPSET_PROTOCOL_MIN
+# define IPSET_USED_PROTOCOL IPSET_PROTOCOL_MIN
+#else
+# define IPSET_USED_PROTOCOL IPSET_PROTOCOL
+#endif /* IPSET_PROTOCOL_MIN */
+
+#define IPSET_TYPENAME "hash:net"
+
+enum {
+    IPSET_SET_V4,
+    IPSET_SET_V6,
+    _IPSET_SET_COUNT
+};
+
+typedef struct {
+    netlink_t nl;
+    char sets[_IPSET_SET_COUNT][IPSET_MAXNAMELEN];
+} ipset_data_t;
+
+typedef struct {
+    uint8_t revision; /* IPSET_CMD_TYPE: highest revision of the type */
+    uint32_t lineno;  /* IPSET_CMD_ADD: line of the faulty element (0 if unknown) */
+} ipset_reply_t;
+
+static const struct {
+    int code;
+    const char *message;
+} ipset_errors[] = {
+    { IPSET_ERR_PROTOCOL, "kernel error received: ipset protocol error" },
+    { IPSET_ERR_FIND_TYPE, "kernel error received: set type not supported" },
+    { IPSET_ERR_MAX_SETS, "kernel error received: maximal number of sets reached" },
+    { IPSET_ERR_EXIST_SETNAME2, "set with the same name already exists" },
+    { IPSET_ERR_TYPE_MISMATCH, "the sets are not of the same type" },
+    { IPSET_ERR_EXIST, "element already exists" },
+    { IPSET_ERR_INVALID_CIDR, "the value of the CIDR parameter of the IP address is invalid" },
+    { IPSET_ERR_INVALID_FAMILY, "protocol family not supported by the set" },
+    { IPSET_ERR_TIMEOUT, "timeout cannot be used: set was created without timeout support" },
+    { IPSET_ERR_IPADDR_IPV4, "an IPv4 address is expected" },
+    { IPSET_ERR_IPADDR_IPV6, "an IPv6 address is expected" },
+    { IPSET_ERR_HASH_FULL, "hash is full, cannot add more elements" },
+};
+
+static const char *ipset_strerror(int code)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(ipset_errors); i++) {
+        if (code == ipset_errors[i].code) {
+            return ipset_errors[i].message;
+        }
+    }
+
+    return strerror(code);
+}
+
+/**
+ * Start a message of the ipset subsystem with its mandatory attributes
+ **/
+static struct nlmsghdr *ipset_msg_start(ipset_data_t *data, uint8_t cmd, uint8_t family, uint32_t seq)
+{
+    uint8_t protocol;
+    struct nlmsghdr *nlh;
+
+    protocol = IPSET_USED_PROTOCOL;
+    if (NULL == (nlh = netlink_msg_start(&data->nl, NETLINK_MSG_TYPE(NFNL_SUBSYS_IPSET, cmd), NLM_F_ACK, family, 0, seq))) {
+        return NULL;
+    }
+    if (NULL == netlink_attr_put(&data->nl, IPSET_ATTR_PROTOCOL, &protocol, sizeof(protocol))) {
+        return NULL;
+    }
+
+    return nlh;
+}
+
+/**
+ * Send the buffer and wait for the acknowledgement of the request seq
+ *
+ * @return -1 if the exchange failed (error is set) else the error reported by the kernel (0 on success)
+ **/
+static int ipset_talk(ipset_data_t *data, uint32_t seq, ipset_reply_t *reply, char **error)
+{
+    if (!netlink_send(&data->nl, error)) {
+        return -1;
+    }
+    while (1) {
+        ssize_t read;
+        struct nlmsghdr *nlh;
+
+        if (-1 == (read = recv(data->nl.fd, data->nl.rbuf, sizeof(data->nl.rbuf), 0))) {
+            set_system_error(error, "recv failed");
+            return -1;
+        }
+        for (nlh = (struct nlmsghdr *) data->nl.rbuf; NLMSG_OK(nlh, read); nlh = NLMSG_NEXT(nlh, read)) {
+            int len;
+            struct nlattr *nla;
+            struct nlmsghdr *attrs;
+
+            if (seq != nlh->nlmsg_seq) {
+                continue;
+            }
+            if (NLMSG_ERROR == nlh->nlmsg_type) {
+                struct nlmsgerr *err;
+
+                err = NLMSG_DATA(nlh);
+                if (0 == err->error) {
+                    return 0;
+                }
+                /* look for the IPSET_ATTR_LINENO the kernel set into the copy of our request */
+                attrs = &err->msg;
+                len = (char *) nlh + nlh->nlmsg_len - (char *) attrs - NLMSG_SPACE(sizeof(struct nfgenmsg));
+                if (len > 0 && attrs->nlmsg_len >= NLMSG_SPACE(sizeof(struct nfgenmsg))) {
+                    NETLINK_ATTR_FOREACH(nla, (char *) attrs + NLMSG_SPACE(sizeof(struct nfgenmsg)), len) {
+                        if (IPSET_ATTR_LINENO == (nla->nla_type & NLA_TYPE_MASK) && nla->nla_len >= NLA_HDRLEN + sizeof(reply->lineno)) {
+                            memcpy(&reply->lineno, NETLINK_ATTR_DATA(nla), sizeof(reply->lineno));
+                        }
+                    }
+                }
+                return -err->error;
+            }
+            /* answer to IPSET_CMD_TYPE */
+            len = nlh->nlmsg_len - NLMSG_SPACE(sizeof(struct nfgenmsg));
+            NETLINK_ATTR_FOREACH(nla, (char *) NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof(struct nfgenmsg)), len) {
+                if (IPSET_ATTR_REVISION == (nla->nla_type & NLA_TYPE_MASK)) {
+                    memcpy(&reply->revision, NETLINK_ATTR_DATA(nla), sizeof(reply->revision));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Create (if it doesn't already exist) a hash:net set with timeout support
+ **/
+static bool ipset_create(ipset_data_t *data, const char *name, uint8_t family, uint8_t revision, char **error)
+{
+    int ret;
+    uint32_t seq, timeout;
+    struct nlattr *nest;
+    struct nlmsghdr *nlh;
+    ipset_reply_t reply;
+
+    netlink_reset(&data->nl);
+    seq = data->nl.seq++;
+    timeout = htonl(0); /* no default timeout but allow one per element */
+    bzero(&reply, sizeof(reply));
+    nlh = ipset_msg_start(data, IPSET_CMD_CREATE, family, seq);
+    netlink_attr_put_strz(&data->nl, IPSET_ATTR_SETNAME, name);
+    netlink_attr_put_strz(&data->nl, IPSET_ATTR_TYPENAME, IPSET_TYPENAME);
+    netlink_attr_put(&data->nl, IPSET_ATTR_REVISION, &revision, sizeof(revision));
+    netlink_attr_put(&data->nl, IPSET_ATTR_FAMILY, &family, sizeof(family));
+    nest = netlink_nest_start(&data->nl, IPSET_ATTR_DATA);
+    netlink_attr_put(&data->nl, IPSET_ATTR_TIMEOUT | NLA_F_NET_BYTEORDER, &timeout, sizeof(timeout));
+    netlink_nest_end(&data->nl, nest);
+    netlink_msg_end(&data->nl, nlh);
+    if (-1 == (ret = ipset_talk(data, seq, &reply, error))) {
+        return false;
+    }
+    /* without NLM_F_EXCL, the kernel accepts an identical existing set but an existing one can differ */
+    if (0 != ret && EEXIST != ret && IPSET_ERR_EXIST_SETNAME2 != ret) {
+        set_generic_error(error, "creating set %s failed: %s", name, ipset_strerror(ret));
+        return false;
+    }
+
+    return true;
+}
 
 static void *ipset_open(const char *tablename, char **error)
 {
     bool ok;
+    ipset_data_t *data;
 
     ok = false;
     do {
-        if (!(ok &= (EXIT_SUCCESS != run_command(error, "ipset -! create %s4 hash:net family inet", tablename)))) {
+        int ret;
+        uint32_t seq;
+        uint8_t family;
+        struct nlmsghdr *nlh;
+        ipset_reply_t reply;
+
+        if (NULL == (data = malloc(sizeof(*data)))) {
+            set_malloc_error(error, sizeof(*data));
+            break;
+        }
+        data->nl.fd = -1;
+        if (snprintf(data->sets[IPSET_SET_V4], STR_SIZE(data->sets[IPSET_SET_V4]), "%s4", tablename) >= (int) STR_SIZE(data->sets[IPSET_SET_V4])) {
+            set_generic_error(error, "set name '%s' is too long", tablename);
+            break;
+        }
+        snprintf(data->sets[IPSET_SET_V6], STR_SIZE(data->sets[IPSET_SET_V6]), "%s6", tablename);
+        if (!netlink_open(&data->nl, NETLINK_NETFILTER, error)) {
             break;
         }
-        if (!(ok &= (EXIT_SUCCESS != run_command(error, "ipset -! create %s6 hash:net family inet6", tablename)))) {
+        /* ask for the revisions of hash:net supported by the kernel */
+        netlink_reset(&data->nl);
+        seq = data->nl.seq++;
+        family = NFPROTO_IPV4;
+        bzero(&reply, sizeof(reply));
+        nlh = ipset_msg_start(data, IPSET_CMD_TYPE, family, seq);
+        netlink_attr_put_strz(&data->nl, IPSET_ATTR_TYPENAME, IPSET_TYPENAME);
+        netlink_attr_put(&data->nl, IPSET_ATTR_FAMILY, &family, sizeof(family));
+        netlink_msg_end(&data->nl, nlh);
+        if (-1 == (ret = ipset_talk(data, seq, &reply, error))) {
             break;
         }
-        if (!(ok &= (EXIT_SUCCESS != run_command(error, "iptables -I INPUT -m set --match-set %s4 src -j DROP", tablename)))) {
+        if (0 != ret) {
+            set_generic_error(error, "looking for " IPSET_TYPENAME " set type failed: %s", ipset_strerror(ret));
             break;
         }
-        if (!(ok &= (EXIT_SUCCESS != run_command(error, "iptables -I INPUT -m set --match-set %s4 src -j DROP", tablename)))) {
+        if (!ipset_create(data, data->sets[IPSET_SET_V4], NFPROTO_IPV4, reply.revision, error)) {
+            break;
+        }
+        if (!ipset_create(data, data->sets[IPSET_SET_V6], NFPROTO_IPV6, reply.revision, error)) {
+            break;
+        }
+        /* only once, at startup, so it's fine to rely on the binaries */
+        if (EXIT_SUCCESS != run_command(error, "iptables -C INPUT -m set --match-set %s src -j DROP 2>/dev/null || iptables -I INPUT -m set --match-set %s src -j DROP", data->sets[IPSET_SET_V4], data->sets[IPSET_SET_V4])) {
+            set_generic_error(error, "adding iptables rule for set %s failed", data->sets[IPSET_SET_V4]);
+            break;
+        }
+        if (EXIT_SUCCESS != run_command(error, "ip6tables -C INPUT -m set --match-set %s src -j DROP 2>/dev/null || ip6tables -I INPUT -m set --match-set %s src -j DROP", data->sets[IPSET_SET_V6], data->sets[IPSET_SET_V6])) {
+            set_generic_error(error, "adding ip6tables rule for set %s failed", data->sets[IPSET_SET_V6]);
             break;
         }
         ok = true;
     } while (false);
+    if (!ok && NULL != data) {
+        netlink_close(&data->nl);
+        free(data);
+        data = NULL;
+    }
 
-    return (void *) !ok;
+    return data;
 }
 
-static bool ipset_handle(void *UNUSED(ctxt), const char *tablename, addr_t addr, char **error)
+/**
+ * Append an element to the IPSET_ATTR_ADT container, without a timeout:
+ * the element lives until removed, banipd unbans it once its ban is over
+ * (expiry is not delegated to the kernel, as for the other engines)
+ *
+ * @return false if the buffer is full
+ **/
+static bool ipset_append(netlink_t *nl, const addr_t *addr, uint32_t lineno)
 {
-    return EXIT_SUCCESS == run_command(error, "ipset -! -A %s%c %s", tablename, addr.fa == AF_INET ? '4' : '6', addr.humanrepr);
+    size_t mark;
+    struct nlattr *elem, *ip;
+
+    mark = nl->len;
+    do {
+        if (NULL == (elem = netlink_nest_start(nl, IPSET_ATTR_DATA))) {
+            break;
+        }
+        if (NULL == (ip = netlink_nest_start(nl, IPSET_ATTR_IP))) {
+            break;
+        }
+        if (NULL == netlink_attr_put(nl, (AF_INET == addr->fa ? IPSET_ATTR_IPADDR_IPV4 : IPSET_ATTR_IPADDR_IPV6) | NLA_F_NET_BYTEORDER, &addr->sa, ADDR_SIZE(addr))) {
+            break;
+        }
+        netlink_nest_end(nl, ip);
+        if (NULL == netlink_attr_put(nl, IPSET_ATTR_CIDR, &addr->netmask, sizeof(addr->netmask))) {
+            break;
+        }
+        if (NULL == netlink_attr_put(nl, IPSET_ATTR_LINENO, &lineno, sizeof(lineno))) {
+            break;
+        }
+        netlink_nest_end(nl, elem);
+
+        return true;
+    } while (false);
+    nl->len = mark;
+
+    return false;
+}
+
+/**
+ * Add (or remove) the addresses of the given family with IPSET_CMD_ADD (or
+ * IPSET_CMD_DEL) messages, each one carrying as many elements as the buffer
+ * can hold. The kernel stops at the first faulty element and tells which one
+ * it was through its line number (lineno = index in addrs + 1): the following
+ * elements are sent again. Without NLM_F_EXCL, adding an element already
+ * there or removing one which isn't is not an error.
+ **/
+static bool ipset_family_batch(ipset_data_t *data, int cmd, int set, const addr_t *addrs, size_t count, bool *results, bool ok, char **error)
+{
+    size_t i;
+    uint8_t family;
+
+    i = 0;
+    family = IPSET_SET_V4 == set ? NFPROTO_IPV4 : NFPROTO_IPV6;
+    while (i < count) {
+        int ret;
+        uint32_t seq, lineno;
+        size_t from, to, j;
+        struct nlattr *adt;
+        struct nlmsghdr *nlh;
+        ipset_reply_t reply;
+
+        netlink_reset(&data->nl);
+        seq = data->nl.seq++;
+        lineno = 0;
+        nlh = ipset_msg_start(data, cmd, family, seq);
+        netlink_attr_put_strz(&data->nl, IPSET_ATTR_SETNAME, data->sets[set]);
+        /* placeholder for the kernel to report the faulty element */
+        netlink_attr_put(&data->nl, IPSET_ATTR_LINENO, &lineno, sizeof(lineno));
+        adt = netlink_nest_start(&data->nl, IPSET_ATTR_ADT);
+        for (from = to = i; to < count; to++) {
+            if (family != (AF_INET == addrs[to].fa ? NFPROTO_IPV4 : NFPROTO_IPV6)) {
+                continue;
+            }
+            if (!ipset_append(&data->nl, &addrs[to], to + 1)) {
+                break;
+            }
+        }
+        netlink_nest_end(&data->nl, adt);
+        netlink_msg_end(&data->nl, nlh);
+        i = to;
+        for (j = from; j < to && (family != (AF_INET == addrs[j].fa ? NFPROTO_IPV4 : NFPROTO_IPV6)); j++)
+            ;
+        if (j == to) {
+            /* no element of this family */
+            continue;
+        }
+        bzero(&reply, sizeof(reply));
+        ret = ipset_talk(data, seq, &reply, ok ? error : NULL);
+        if (0 != ret && -1 != ret && ok) {
+            if (0 != reply.lineno && reply.lineno - 1 < count) {
+                char buffer[INET6_ADDRSTRLEN];
+
+                set_generic_error(error, "%s %s %s set %s failed: %s", IPSET_CMD_ADD == cmd ? "adding" : "removing", addr_ntop(&addrs[reply.lineno - 1], buffer, sizeof(buffer)), IPSET_CMD_ADD == cmd ? "to" : "from", data->sets[set], ipset_strerror(ret));
+            } else {
+                set_generic_error(error, "%s elements %s set %s failed: %s", IPSET_CMD_ADD == cmd ? "adding" : "removing", IPSET_CMD_ADD == cmd ? "to" : "from", data->sets[set], ipset_strerror(ret));
+            }
+        }
+        for (j = from; j < to; j++) {
+            if (family != (AF_INET == addrs[j].fa ? NFPROTO_IPV4 : NFPROTO_IPV6)) {
+                continue;
+            }
+            if (0 == ret) {
+                results[j] = true;
+            } else if (-1 != ret && 0 != reply.lineno && reply.lineno - 1 >= from && reply.lineno - 1 < to) {
+                /* elements before the faulty one were added, resume after it */
+                if (j < reply.lineno - 1) {
+                    results[j] = true;
+                } else {
+                    results[j] = false;
+                    i = j + 1;
+                    break;
+                }
+            } else {
+                results[j] = false;
+            }
+        }
+        ok &= 0 == ret;
+    }
+
+    return ok;
+}
+
+static bool ipset_handle_batch(void *ctxt, const char *UNUSED(tablename), const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    bool ok;
+    ipset_data_t *data;
+
+    data = (ipset_data_t *) ctxt;
+    ok = ipset_family_batch(data, IPSET_CMD_ADD, IPSET_SET_V4, addrs, count, results, true, error);
+    ok = ipset_family_batch(data, IPSET_CMD_ADD, IPSET_SET_V6, addrs, count, results, ok, error);
+
+    return ok;
+}
+
+static bool ipset_unhandle(void *ctxt, const char *UNUSED(tablename), const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    bool ok;
+    ipset_data_t *data;
+
+    data = (ipset_data_t *) ctxt;
+    ok = ipset_family_batch(data, IPSET_CMD_DEL, IPSET_SET_V4, addrs, count, results, true, error);
+    ok = ipset_family_batch(data, IPSET_CMD_DEL, IPSET_SET_V6, addrs, count, results, ok, error);
+
+    return ok;
+}
+
+static bool ipset_handle(void *ctxt, const char *tablename, const addr_t *addr, char **error)
+{
+    bool result;
+
+    return ipset_handle_batch(ctxt, tablename, addr, 1, &result, error);
+}
+
+static void ipset_close(void *ctxt)
+{
+    ipset_data_t *data;
+
+    data = (ipset_data_t *) ctxt;
+    netlink_close(&data->nl);
 }
 
 const engine_t ipset_engine = {
-    false,
+    false, /* the kernel checks CAP_NET_ADMIN at each message, not when the socket is opened */
     "ipset",
     ipset_open,
     ipset_handle,
-    NULL
+    ipset_handle_batch,
+    ipset_unhandle,
+    NULL,
+    ipset_close
 };
@@ -5,9 +5,33 @@
 #include "command.h"
 #include "engine.h"
 
-static int iptables_handle(void *UNUSED(ctxt), const char *tablename, addr_t addr)
+/* the rules of an IPv6 address or network are managed by ip6tables */
+#define IPTABLES(addr) \
+    (AF_INET == (addr)->fa ? "iptables" : "ip6tables")
+
+static bool iptables_handle(void *UNUSED(ctxt), const char *tablename, const addr_t *addr, char **error)
+{
+    char buffer[INET6_ADDRSTRLEN];
+
+    return EXIT_SUCCESS == run_command(error, "%s -I %s 1 -s %s/%u -j DROP", IPTABLES(addr), tablename, addr_ntop(addr, buffer, sizeof(buffer)), addr->netmask);
+}
+
+static bool iptables_unhandle(void *UNUSED(ctxt), const char *tablename, const addr_t *addrs, size_t count, bool *results, char **error)
 {
-    return run_command("iptables -I %s 1 -s %s -j DROP", tablename, addr.humanrepr);
+    bool ok;
+    size_t i;
+
+    ok = true;
+    for (i = 0; i < count; i++) {
+        char buffer[INET6_ADDRSTRLEN];
+
+        /* only keep the first error */
+        if (!(results[i] = EXIT_SUCCESS == run_command(ok ? error : NULL, "%s -D %s -s %s/%u -j DROP", IPTABLES(&addrs[i]), tablename, addr_ntop(&addrs[i], buffer, sizeof(buffer)), addrs[i].netmask))) {
+            ok = false;
+        }
+    }
+
+    return ok;
 }
 
 const engine_t iptables_engine = {
@@ -15,5 +39,8 @@ const engine_t iptables_engine = {
     "iptables",
     NULL,
     iptables_handle,
+    NULL,
+    iptables_unhandle,
+    NULL,
     NULL
 };
@@ -0,0 +1,506 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "journal.h"
+
+#define SNAPSHOT_SUFFIX ".snapshot"
+#define SNAPSHOT_TMP_SUFFIX ".tmp"
+#define SNAPSHOT_MAGIC "BANIPSNP"
+#define SNAPSHOT_VERSION 1
+
+/* the journal is not compacted below this number of records */
+#define JOURNAL_COMPACT_MIN 65536
+
+/* the bytes compared to sort the records */
+#define JOURNAL_KEY_SIZE offsetof(journal_record_t, type)
+
+typedef struct {
+    char magic[STR_LEN(SNAPSHOT_MAGIC)];
+    uint32_t version;
+    uint32_t record_size; /* to refuse a snapshot from an other architecture */
+    uint64_t count;
+} snapshot_header_t;
+
+/* a record of the journal and its position in it, to keep the last event of an address */
+typedef struct {
+    journal_record_t record;
+    size_t seq;
+} journal_event_t;
+
+void journal_init(journal_t *journal)
+{
+    journal->fd = -1;
+    journal->path = journal->snapshot = NULL;
+    journal->records = journal->snapshot_count = journal->pending = 0;
+    journal->compact_at = JOURNAL_COMPACT_MIN;
+    journal->dirty = false;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+    int d;
+    const journal_event_t *ea, *eb;
+
+    ea = (const journal_event_t *) a;
+    eb = (const journal_event_t *) b;
+    if (0 == (d = memcmp(&ea->record, &eb->record, JOURNAL_KEY_SIZE))) {
+        d = (ea->seq > eb->seq) - (ea->seq < eb->seq);
+    }
+
+    return d;
+}
+
+static void record_to_addr(const journal_record_t *record, addr_t *addr)
+{
+    addr_from_prefix(addr, 4 == record->family ? AF_INET : AF_INET6, record->addr, record->netmask);
+}
+
+static bool record_valid(const journal_record_t *record)
+{
+    return (JOURNAL_BAN == record->type || JOURNAL_UNBAN == record->type)
+        && ((4 == record->family && record->netmask <= 32) || (6 == record->family && record->netmask <= 128));
+}
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+    ssize_t written;
+    const char *p;
+
+    for (p = (const char *) data; size > 0; p += written, size -= written) {
+        if (-1 == (written = write(fd, p, size))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Write the buffered records at the end of the journal (without syncing it)
+ **/
+static bool journal_write(journal_t *journal, char **error)
+{
+    bool ok;
+
+    ok = true;
+    if (0 != journal->pending) {
+        if (write_all(journal->fd, journal->buffer, journal->pending * sizeof(*journal->buffer))) {
+            journal->records += journal->pending;
+            journal->dirty = true;
+        } else {
+            ok = false;
+            set_system_error(error, "failed writing to journal '%s'", journal->path);
+            /* don't leave a partial record which would shift the following ones */
+            if (0 != ftruncate(journal->fd, journal->records * sizeof(*journal->buffer))) {
+                /* NOP: reported on the next compaction, if it is still there */
+            }
+        }
+        journal->pending = 0;
+    }
+
+    return ok;
+}
+
+/**
+ * Map the snapshot, if there is one (*count is 0 and *map NULL otherwise)
+ **/
+static bool snapshot_map(const char *path, void **map, size_t *map_size, const journal_record_t **records, size_t *count, char **error)
+{
+    int fd;
+    bool ok;
+    struct stat st;
+    const snapshot_header_t *header;
+
+    ok = false;
+    *map = NULL;
+    *count = 0;
+    *records = NULL;
+    if (-1 == (fd = open(path, O_RDONLY))) {
+        if (ENOENT == errno) {
+            return true;
+        }
+        set_system_error(error, "failed opening snapshot '%s'", path);
+        return false;
+    }
+    do {
+        if (0 != fstat(fd, &st)) {
+            set_system_error(error, "fstat on snapshot '%s' failed", path);
+            break;
+        }
+        if ((size_t) st.st_size < sizeof(*header)) {
+            set_generic_error(error, "snapshot '%s' is truncated", path);
+            break;
+        }
+        *map_size = st.st_size;
+        if (MAP_FAILED == (*map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+            *map = NULL;
+            set_system_error(error, "mmap on snapshot '%s' failed", path);
+            break;
+        }
+        header = (const snapshot_header_t *) *map;
+        if (0 != memcmp(header->magic, SNAPSHOT_MAGIC, STR_LEN(SNAPSHOT_MAGIC)) || SNAPSHOT_VERSION != header->version || sizeof(**records) != header->record_size) {
+            set_generic_error(error, "'%s' is not a snapshot of this version of banipd", path);
+            break;
+        }
+        if (sizeof(*header) + header->count * sizeof(**records) != *map_size) {
+            set_generic_error(error, "snapshot '%s' is truncated", path);
+            break;
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise(*map, *map_size, MADV_SEQUENTIAL);
+#endif /* MADV_SEQUENTIAL */
+        *records = (const journal_record_t *) (header + 1);
+        *count = header->count;
+        ok = true;
+    } while (false);
+    close(fd);
+    if (!ok && NULL != *map) {
+        munmap(*map, *map_size);
+        *map = NULL;
+    }
+
+    return ok;
+}
+
+/**
+ * Read the whole journal, sorted by address then order of arrival
+ **/
+static bool journal_read(journal_t *journal, journal_event_t **events, size_t *count, char **error)
+{
+    size_t i;
+    off_t offset;
+    struct stat st;
+
+    *count = 0;
+    *events = NULL;
+    if (0 != fstat(journal->fd, &st)) {
+        set_system_error(error, "fstat on journal '%s' failed", journal->path);
+        return false;
+    }
+    /* a partial record at the end (crash while writing it) is ignored */
+    journal->records = st.st_size / sizeof(journal_record_t);
+    if (0 == journal->records) {
+        return true;
+    }
+    if (NULL == (*events = malloc(journal->records * sizeof(**events)))) {
+        set_malloc_error(error, journal->records * sizeof(**events));
+        return false;
+    }
+    offset = 0;
+    for (i = 0; i < journal->records; ) {
+        size_t j, n;
+        ssize_t r;
+
+        n = journal->records - i;
+        if (n > ARRAY_SIZE(journal->buffer)) {
+            n = ARRAY_SIZE(journal->buffer);
+        }
+        if (-1 == (r = pread(journal->fd, journal->buffer, n * sizeof(*journal->buffer), offset))) {
+            set_system_error(error, "failed reading journal '%s'", journal->path);
+            free(*events);
+            *events = NULL;
+            return false;
+        }
+        if (0 == (n = r / sizeof(*journal->buffer))) {
+            break;
+        }
+        offset += n * sizeof(*journal->buffer);
+        for (j = 0; j < n; j++, i++) {
+            if (record_valid(&journal->buffer[j])) {
+                (*events)[*count].record = journal->buffer[j];
+                (*events)[*count].seq = i;
+                ++*count;
+            }
+        }
+    }
+    qsort(*events, *count, sizeof(**events), event_cmp);
+
+    return true;
+}
+
+static bool sync_directory(const char *path, char **error)
+{
+    int fd;
+    bool ok;
+    char *slash, *dirname;
+
+    if (NULL == (slash = strrchr(path, '/'))) {
+        dirname = NULL;
+    } else if (NULL == (dirname = strndup(path, slash == path ? 1 : (size_t) (slash - path)))) {
+        set_malloc_error(error, (size_t) (slash - path) + 1);
+        return false;
+    }
+    ok = false;
+    if (-1 == (fd = open(NULL == dirname ? "." : dirname, O_RDONLY))) {
+        set_system_error(error, "failed opening directory of '%s'", path);
+    } else {
+        if (0 != fsync(fd)) {
+            set_system_error(error, "fsync on directory of '%s' failed", path);
+        } else {
+            ok = true;
+        }
+        close(fd);
+    }
+    free(dirname);
+
+    return ok;
+}
+
+/**
+ * Fold the journal into a new snapshot: for each address, its last event
+ * replaces what the previous snapshot said about it and only the bans are
+ * kept. The new snapshot is written aside then renamed over the previous
+ * one before the journal is emptied: replaying the journal a second time
+ * (crash in between) on the new snapshot gives the same result.
+ *
+ * With an empty journal, the snapshot is only read.
+ *
+ * @param cb, if not NULL, called for each ban of the resulting snapshot,
+ * with the end of the ban
+ **/
+bool journal_compact(journal_t *journal, journal_callback_t cb, void *arg, char **error)
+{
+    bool ok;
+    void *map;
+    FILE *fp;
+    char *tmp;
+    size_t map_size;
+    journal_event_t *events;
+    snapshot_header_t header;
+    size_t i, k, snapshot_count, event_count;
+    const journal_record_t *snapshot;
+
+    ok = false;
+    fp = NULL;
+    tmp = NULL;
+    map = NULL;
+    events = NULL;
+    do {
+        addr_t addr;
+
+        if (!journal_write(journal, error)) {
+            break;
+        }
+        if (!snapshot_map(journal->snapshot, &map, &map_size, &snapshot, &snapshot_count, error)) {
+            break;
+        }
+        if (!journal_read(journal, &events, &event_count, error)) {
+            break;
+        }
+        if (0 == journal->records) {
+            /* nothing new, don't write the same snapshot again */
+            if (NULL != cb) {
+                for (i = 0; i < snapshot_count; i++) {
+                    record_to_addr(&snapshot[i], &addr);
+                    cb(&addr, snapshot[i].expiry, arg);
+                }
+            }
+            journal->snapshot_count = snapshot_count;
+            ok = true;
+            break;
+        }
+        if (NULL == (tmp = malloc(strlen(journal->snapshot) + STR_SIZE(SNAPSHOT_TMP_SUFFIX)))) {
+            set_malloc_error(error, strlen(journal->snapshot) + STR_SIZE(SNAPSHOT_TMP_SUFFIX));
+            break;
+        }
+        sprintf(tmp, "%s" SNAPSHOT_TMP_SUFFIX, journal->snapshot);
+        if (NULL == (fp = fopen(tmp, "w"))) {
+            set_system_error(error, "failed creating snapshot '%s'", tmp);
+            break;
+        }
+        bzero(&header, sizeof(header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, STR_LEN(SNAPSHOT_MAGIC));
+        header.version = SNAPSHOT_VERSION;
+        header.record_size = sizeof(journal_record_t);
+        header.count = 0;
+        if (1 != fwrite(&header, sizeof(header), 1, fp)) {
+            set_system_error(error, "failed writing snapshot '%s'", tmp);
+            break;
+        }
+        /* merge the 2 sorted sequences, the last event of an address wins */
+        for (i = k = 0; i < snapshot_count || k < event_count; ) {
+            int d;
+            size_t last;
+            const journal_record_t *record;
+
+            last = k;
+            if (k < event_count) {
+                while (last + 1 < event_count && 0 == memcmp(&events[last + 1].record, &events[k].record, JOURNAL_KEY_SIZE)) {
+                    ++last;
+                }
+            }
+            if (i >= snapshot_count) {
+                d = 1;
+            } else if (k >= event_count) {
+                d = -1;
+            } else {
+                d = memcmp(&snapshot[i], &events[k].record, JOURNAL_KEY_SIZE);
+            }
+            if (d < 0) {
+                record = &snapshot[i++];
+            } else {
+                record = &events[last].record;
+                k = last + 1;
+                if (0 == d) {
+                    ++i;
+                }
+                if (JOURNAL_BAN != record->type) {
+                    continue;
+                }
+            }
+            if (1 != fwrite(record, sizeof(*record), 1, fp)) {
+                break;
+            }
+            ++header.count;
+            if (NULL != cb) {
+                record_to_addr(record, &addr);
+                cb(&addr, record->expiry, arg);
+            }
+        }
+        if (ferror(fp)) {
+            set_system_error(error, "failed writing snapshot '%s'", tmp);
+            break;
+        }
+        if (0 != fseek(fp, 0, SEEK_SET) || 1 != fwrite(&header, sizeof(header), 1, fp) || 0 != fflush(fp)) {
+            set_system_error(error, "failed writing snapshot '%s'", tmp);
+            break;
+        }
+        if (0 != fsync(fileno(fp))) {
+            set_system_error(error, "fsync on snapshot '%s' failed", tmp);
+            break;
+        }
+        if (0 != rename(tmp, journal->snapshot)) {
+            set_system_error(error, "failed renaming '%s' to '%s'", tmp, journal->snapshot);
+            break;
+        }
+        if (!sync_directory(journal->snapshot, error)) {
+            break;
+        }
+        if (0 != ftruncate(journal->fd, 0) || 0 != fsync(journal->fd)) {
+            set_system_error(error, "failed truncating journal '%s'", journal->path);
+            break;
+        }
+        journal->records = 0;
+        journal->dirty = false;
+        journal->snapshot_count = header.count;
+        ok = true;
+    } while (false);
+    if (NULL != fp) {
+        fclose(fp);
+        if (!ok) {
+            unlink(tmp);
+        }
+    }
+    if (NULL != map) {
+        munmap(map, map_size);
+    }
+    free(events);
+    free(tmp);
+    journal->compact_at = journal->snapshot_count > JOURNAL_COMPACT_MIN ? journal->snapshot_count : JOURNAL_COMPACT_MIN;
+    if (!ok && journal->records * 2 > journal->compact_at) {
+        /* don't try again on every sync */
+        journal->compact_at = journal->records * 2;
+    }
+
+    return ok;
+}
+
+/**
+ * Open (or create) the journal at path and rebuild the state it records:
+ * the journal is compacted into the snapshot and cb called for each ban
+ * of it
+ **/
+bool journal_open(journal_t *journal, const char *path, journal_callback_t cb, void *arg, char **error)
+{
+    journal_init(journal);
+    do {
+        if (NULL == (journal->path = strdup(path))) {
+            set_malloc_error(error, strlen(path) + 1);
+            break;
+        }
+        if (NULL == (journal->snapshot = malloc(strlen(path) + STR_SIZE(SNAPSHOT_SUFFIX)))) {
+            set_malloc_error(error, strlen(path) + STR_SIZE(SNAPSHOT_SUFFIX));
+            break;
+        }
+        sprintf(journal->snapshot, "%s" SNAPSHOT_SUFFIX, path);
+        if (-1 == (journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600))) {
+            set_system_error(error, "failed opening journal '%s'", path);
+            break;
+        }
+        if (!journal_compact(journal, cb, arg, error)) {
+            break;
+        }
+
+        return true;
+    } while (false);
+    journal_close(journal);
+
+    return false;
+}
+
+/**
+ * Record a ban (or unban) of addr. Records are buffered: journal_sync
+ * makes them durable.
+ *
+ * @param type JOURNAL_BAN or JOURNAL_UNBAN
+ * @param expiry end of the ban, in seconds since the epoch, 0 for ever
+ **/
+bool journal_append(journal_t *journal, int type, const addr_t *addr, uint64_t expiry, char **error)
+{
+    journal_record_t *record;
+
+    record = &journal->buffer[journal->pending++];
+    bzero(record, sizeof(*record));
+    record->family = AF_INET == addr->fa ? 4 : 6;
+    record->netmask = addr->netmask;
+    memcpy(record->addr, &addr->sa, ADDR_SIZE(addr));
+    record->type = type;
+    record->expiry = expiry;
+
+    return journal->pending < ARRAY_SIZE(journal->buffer) || journal_write(journal, error);
+}
+
+/**
+ * Write and fsync (once for all) the records appended since the last call
+ * then compact the journal if it grew too much
+ **/
+bool journal_sync(journal_t *journal, char **error)
+{
+    if (!journal_write(journal, error)) {
+        return false;
+    }
+    if (journal->dirty) {
+        if (0 != fsync(journal->fd)) {
+            set_system_error(error, "fsync on journal '%s' failed", journal->path);
+            return false;
+        }
+        journal->dirty = false;
+    }
+    if (journal->records >= journal->compact_at) {
+        return journal_compact(journal, NULL, NULL, error);
+    }
+
+    return true;
+}
+
+void journal_close(journal_t *journal)
+{
+    if (-1 != journal->fd) {
+        /* no compaction here: it is done on the next start */
+        if (journal_write(journal, NULL) && journal->dirty) {
+            fsync(journal->fd);
+        }
+        close(journal->fd);
+    }
+    free(journal->path);
+    free(journal->snapshot);
+    journal_init(journal);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+
+/* records buffered in memory before being written to the journal */
+#define JOURNAL_BUFFER_SIZE 256
+
+enum {
+    JOURNAL_BAN = 1,
+    JOURNAL_UNBAN,
+};
+
+/**
+ * A ban or an unban, as written (in native byte order) to the journal and
+ * the snapshot. family, netmask and addr come first: they form the key
+ * records are sorted on.
+ **/
+typedef struct {
+    uint8_t family; /* 4 or 6, AF_INET* differ from a system to an other */
+    uint8_t netmask;
+    uint8_t addr[16];
+    uint8_t type; /* JOURNAL_BAN or JOURNAL_UNBAN */
+    uint8_t unused[5];
+    uint64_t expiry; /* end of the ban, in seconds since the epoch, 0 if permanent */
+} journal_record_t;
+
+/**
+ * Persistent state of banipd: an append-only journal of the bans and
+ * unbans (<path>) and a snapshot (<path>.snapshot) of what was banned when
+ * the journal was last compacted into it. The snapshot is a header followed
+ * by the records, sorted, of the bans only: it is read through mmap(2).
+ **/
+typedef struct {
+    int fd; /* journal */
+    char *path;
+    char *snapshot;
+    size_t records; /* in the journal */
+    size_t snapshot_count;
+    size_t compact_at; /* number of records of the journal which triggers a compaction */
+    size_t pending;
+    bool dirty; /* written since the last fsync */
+    journal_record_t buffer[JOURNAL_BUFFER_SIZE];
+} journal_t;
+
+typedef void (*journal_callback_t)(const addr_t *, uint64_t, void *);
+
+void journal_init(journal_t *);
+bool journal_open(journal_t *, const char *, journal_callback_t, void *, char **);
+bool journal_append(journal_t *, int, const addr_t *, uint64_t, char **);
+bool journal_sync(journal_t *, char **);
+bool journal_compact(journal_t *, journal_callback_t, void *, char **);
+void journal_close(journal_t *);
@@ -0,0 +1,176 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <linux/netfilter/nfnetlink.h>
+
+#include "common.h"
+#include "err.h"
+#include "netlink.h"
+
+/* reserve room to always be able to close a batch */
+#define NETLINK_BATCH_END_SIZE (NLMSG_ALIGN(NLMSG_HDRLEN + sizeof(struct nfgenmsg)))
+
+bool netlink_open(netlink_t *nl, int protocol, char **error)
+{
+    struct sockaddr_nl snl;
+
+    nl->len = 0;
+    nl->seq = time(NULL);
+    if (-1 == (nl->fd = socket(AF_NETLINK, SOCK_RAW, protocol))) {
+        set_system_error(error, "socket(AF_NETLINK, SOCK_RAW, %d) failed", protocol);
+        return false;
+    }
+    bzero(&snl, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    if (-1 == bind(nl->fd, (struct sockaddr *) &snl, sizeof(snl))) {
+        set_system_error(error, "bind failed");
+        return false;
+    }
+
+    return true;
+}
+
+void netlink_close(netlink_t *nl)
+{
+    if (-1 != nl->fd) {
+        if (0 != close(nl->fd)) {
+            warnc("closing netlink socket failed");
+        }
+        nl->fd = -1;
+    }
+}
+
+void netlink_reset(netlink_t *nl)
+{
+    nl->len = 0;
+}
+
+static void *netlink_reserve(netlink_t *nl, size_t len)
+{
+    void *p;
+
+    if (nl->len + NLMSG_ALIGN(len) > sizeof(nl->buf) - NETLINK_BATCH_END_SIZE) {
+        return NULL;
+    }
+    p = nl->buf + nl->len;
+    bzero(p, NLMSG_ALIGN(len));
+    nl->len += NLMSG_ALIGN(len);
+
+    return p;
+}
+
+/**
+ * Start a netfilter (nfgenmsg) message
+ *
+ * @return NULL if the buffer is full
+ **/
+struct nlmsghdr *netlink_msg_start(netlink_t *nl, uint16_t type, uint16_t flags, uint8_t family, uint16_t res_id, uint32_t seq)
+{
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfg;
+
+    if (NULL == (nlh = netlink_reserve(nl, NLMSG_HDRLEN + sizeof(*nfg)))) {
+        return NULL;
+    }
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nlh->nlmsg_seq = seq;
+    nfg = NLMSG_DATA(nlh);
+    nfg->nfgen_family = family;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(res_id);
+
+    return nlh;
+}
+
+void netlink_msg_end(netlink_t *nl, struct nlmsghdr *nlh)
+{
+    nlh->nlmsg_len = nl->buf + nl->len - (char *) nlh;
+}
+
+/**
+ * Append an attribute
+ *
+ * @return NULL if the buffer is full
+ **/
+struct nlattr *netlink_attr_put(netlink_t *nl, uint16_t type, const void *value, size_t value_len)
+{
+    struct nlattr *nla;
+
+    if (NULL == (nla = netlink_reserve(nl, NLA_HDRLEN + value_len))) {
+        return NULL;
+    }
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + value_len;
+    if (0 != value_len) {
+        memcpy(NETLINK_ATTR_DATA(nla), value, value_len);
+    }
+
+    return nla;
+}
+
+struct nlattr *netlink_attr_put_strz(netlink_t *nl, uint16_t type, const char *value)
+{
+    return netlink_attr_put(nl, type, value, strlen(value) + 1);
+}
+
+struct nlattr *netlink_nest_start(netlink_t *nl, uint16_t type)
+{
+    return netlink_attr_put(nl, NLA_F_NESTED | type, NULL, 0);
+}
+
+void netlink_nest_end(netlink_t *nl, struct nlattr *nla)
+{
+    nla->nla_len = nl->buf + nl->len - (char *) nla;
+}
+
+/**
+ * Reset the buffer and open a transaction for the given subsystem
+ **/
+bool netlink_batch_begin(netlink_t *nl, uint16_t subsys)
+{
+    struct nlmsghdr *nlh;
+
+    nl->len = 0;
+    if (NULL == (nlh = netlink_msg_start(nl, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC, subsys, nl->seq++))) {
+        return false;
+    }
+    netlink_msg_end(nl, nlh);
+
+    return true;
+}
+
+void netlink_batch_end(netlink_t *nl, uint16_t subsys)
+{
+    struct nlmsghdr *nlh;
+
+    /* room for it was reserved by netlink_reserve */
+    nlh = (struct nlmsghdr *) (nl->buf + nl->len);
+    nl->len += NETLINK_BATCH_END_SIZE;
+    bzero(nlh, NETLINK_BATCH_END_SIZE);
+    nlh->nlmsg_len = NLMSG_HDRLEN + sizeof(struct nfgenmsg);
+    nlh->nlmsg_type = NFNL_MSG_BATCH_END;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    nlh->nlmsg_seq = nl->seq++;
+    ((struct nfgenmsg *) NLMSG_DATA(nlh))->res_id = htons(subsys);
+}
+
+/**
+ * Send the whole buffer to the kernel
+ **/
+bool netlink_send(netlink_t *nl, char **error)
+{
+    struct sockaddr_nl snl;
+
+    bzero(&snl, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    if (-1 == sendto(nl->fd, nl->buf, nl->len, 0, (struct sockaddr *) &snl, sizeof(snl))) {
+        set_system_error(error, "sendto failed");
+        return false;
+    }
+
+    return true;
+}
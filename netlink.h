@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/netlink.h>
+
+/* size of the buffer used to build messages */
+#define NETLINK_BUFFER_SIZE 65536
+
+/* size of the buffer to receive replies and acknowledgements */
+#define NETLINK_RECV_BUFFER_SIZE 8192
+
+typedef struct {
+    int fd;
+    uint32_t seq;
+    size_t len; /* used part of buf */
+    char buf[NETLINK_BUFFER_SIZE];
+    char rbuf[NETLINK_RECV_BUFFER_SIZE];
+} netlink_t;
+
+#define NETLINK_MSG_TYPE(subsys, msg) \
+    (((subsys) << 8) | (msg))
+
+bool netlink_open(netlink_t *, int, char **);
+void netlink_close(netlink_t *);
+
+void netlink_reset(netlink_t *);
+struct nlmsghdr *netlink_msg_start(netlink_t *, uint16_t, uint16_t, uint8_t, uint16_t, uint32_t);
+void netlink_msg_end(netlink_t *, struct nlmsghdr *);
+struct nlattr *netlink_attr_put(netlink_t *, uint16_t, const void *, size_t);
+struct nlattr *netlink_attr_put_strz(netlink_t *, uint16_t, const char *);
+struct nlattr *netlink_nest_start(netlink_t *, uint16_t);
+void netlink_nest_end(netlink_t *, struct nlattr *);
+
+bool netlink_batch_begin(netlink_t *, uint16_t);
+void netlink_batch_end(netlink_t *, uint16_t);
+
+bool netlink_send(netlink_t *, char **);
+
+#define NETLINK_ATTR_DATA(nla) \
+    ((void *) ((char *) (nla) + NLA_HDRLEN))
+
+#define NETLINK_ATTR_FOREACH(nla, start, len) \
+    for (nla = (struct nlattr *) (start); (len) >= (int) NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= (len); (len) -= NLA_ALIGN(nla->nla_len), nla = (struct nlattr *) ((char *) nla + NLA_ALIGN(nla->nla_len)))
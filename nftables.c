@@ -1,154 +1,446 @@
-#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
 #include <linux/netfilter/nf_tables.h>
-#include <libmnl/libmnl.h>
-#include <libnftnl/set.h>
 
 #include "common.h"
 #include "err.h"
 #include "engine.h"
+#include "netlink.h"
 
 /*
-nft add table ip filter
-nft add chain ip filter input
-nft add set filter blacklist { type ipv4_addr\;}
-nft add rule ip filter input ip saddr @blacklist drop
+nft add table inet filter
+nft add chain inet filter input { type filter hook input priority 0\; }
+nft add set inet filter blacklist4 { type ipv4_addr\; flags interval\; }
+nft add set inet filter blacklist6 { type ipv6_addr\; flags interval\; }
+nft add rule inet filter input ip saddr @blacklist4 drop
+nft add rule inet filter input ip6 saddr @blacklist6 drop
 
 # add element(s) to blacklist
-nft add element filter blacklist { 192.168.3.4 }
+nft add element inet filter blacklist4 { 192.168.3.4 }
 
 # print blacklist elements
-nft list set filter blacklist
-
-nft export json
+nft list set inet filter blacklist4
 */
 
-/*
-#define MNL_SOCKET_BUFFER_SIZE (getpagesize() < 8192L ? getpagesize() : 8192L)
-*/
-#undef MNL_SOCKET_BUFFER_SIZE
-#define MNL_SOCKET_BUFFER_SIZE 8192L
+#define NFTABLES_DEFAULT_TABLE "filter"
+
+enum {
+    NFTABLES_SET_V4,
+    NFTABLES_SET_V6,
+    _NFTABLES_SET_COUNT
+};
 
 typedef struct {
-    uint32_t portid;
-    struct nft_set *s;
-    struct mnl_socket *nl;
-    struct nft_set_elem *e;
-    char buf[MNL_SOCKET_BUFFER_SIZE];
+    bool exists;
+    bool interval;
+    char name[NFT_SET_MAXNAMELEN];
+} nftables_set_t;
+
+typedef struct {
+    netlink_t nl;
+    char table[NFT_TABLE_MAXNAMELEN];
+    nftables_set_t sets[_NFTABLES_SET_COUNT];
 } nftables_data_t;
 
-static void *nftables_open(const char *UNUSED(tablename), char **error)
+/* ======================== set lookup ======================== */
+
+/**
+ * Ask the kernel about the set to know if it exists and accepts intervals
+ **/
+static bool nftables_get_set(nftables_data_t *data, nftables_set_t *set, uint32_t key_len, char **error)
+{
+    bool done;
+    uint32_t seq;
+    struct nlmsghdr *nlh;
+
+    netlink_reset(&data->nl);
+    seq = data->nl.seq++;
+    nlh = netlink_msg_start(&data->nl, NETLINK_MSG_TYPE(NFNL_SUBSYS_NFTABLES, NFT_MSG_GETSET), NLM_F_ACK, NFPROTO_INET, 0, seq);
+    netlink_attr_put_strz(&data->nl, NFTA_SET_TABLE, data->table);
+    netlink_attr_put_strz(&data->nl, NFTA_SET_NAME, set->name);
+    netlink_msg_end(&data->nl, nlh);
+    if (!netlink_send(&data->nl, error)) {
+        return false;
+    }
+    done = false;
+    while (!done) {
+        ssize_t read;
+
+        if (-1 == (read = recv(data->nl.fd, data->nl.rbuf, sizeof(data->nl.rbuf), 0))) {
+            set_system_error(error, "recv failed");
+            return false;
+        }
+        for (nlh = (struct nlmsghdr *) data->nl.rbuf; NLMSG_OK(nlh, read); nlh = NLMSG_NEXT(nlh, read)) {
+            if (seq != nlh->nlmsg_seq) {
+                continue;
+            }
+            if (NLMSG_ERROR == nlh->nlmsg_type) {
+                struct nlmsgerr *err;
+
+                err = NLMSG_DATA(nlh);
+                if (ENOENT == -err->error) {
+                    set->exists = false;
+                } else if (0 != err->error) {
+                    set_errno_error(error, -err->error, "looking for set %s failed", set->name);
+                    return false;
+                }
+                done = true;
+            } else if (NETLINK_MSG_TYPE(NFNL_SUBSYS_NFTABLES, NFT_MSG_NEWSET) == nlh->nlmsg_type) {
+                int len;
+                struct nlattr *nla;
+
+                set->exists = true;
+                len = nlh->nlmsg_len - NLMSG_SPACE(sizeof(struct nfgenmsg));
+                NETLINK_ATTR_FOREACH(nla, (char *) NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof(struct nfgenmsg)), len) {
+                    uint32_t value;
+
+                    if (nla->nla_len < NLA_HDRLEN + sizeof(value)) {
+                        continue;
+                    }
+                    memcpy(&value, NETLINK_ATTR_DATA(nla), sizeof(value));
+                    switch (nla->nla_type & NLA_TYPE_MASK) {
+                        case NFTA_SET_FLAGS:
+                            set->interval = HAS_FLAG(ntohl(value), NFT_SET_INTERVAL);
+                            break;
+                        case NFTA_SET_KEY_LEN:
+                            if (key_len != ntohl(value)) {
+                                set_generic_error(error, "set %s has %u bytes keys, %u expected", set->name, ntohl(value), key_len);
+                                return false;
+                            }
+                            break;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static void *nftables_open(const char *tablename, char **error)
 {
+    bool ok;
     nftables_data_t *data;
 
+    ok = false;
     do {
-        if (NULL == (data = malloc(sizeof(*data))) {
+        const char *p;
+
+        if (NULL == (data = malloc(sizeof(*data)))) {
             set_malloc_error(error, sizeof(*data));
             break;
         }
-        if (NULL == (data->nl = mnl_socket_open(NETLINK_GENERIC))) {
-            free(data);
-            data = NULL;
-            set_system_error("mnl_socket_open failed");
+        data->nl.fd = -1;
+        /* tablename is [<table>:]<set>, sets <set>4 and <set>6 of the inet family are used */
+        if (NULL == (p = strchr(tablename, ':'))) {
+            snprintf(data->table, STR_SIZE(data->table), "%s", NFTABLES_DEFAULT_TABLE);
+            p = tablename;
+        } else {
+            if ((size_t) (p - tablename) >= STR_SIZE(data->table)) {
+                set_generic_error(error, "table name of '%s' is too long", tablename);
+                break;
+            }
+            memcpy(data->table, tablename, p - tablename);
+            data->table[p - tablename] = '\0';
+            ++p;
+        }
+        if (snprintf(data->sets[NFTABLES_SET_V4].name, STR_SIZE(data->sets[NFTABLES_SET_V4].name), "%s4", p) >= (int) STR_SIZE(data->sets[NFTABLES_SET_V4].name)) {
+            set_generic_error(error, "set name '%s' is too long", p);
+            break;
+        }
+        snprintf(data->sets[NFTABLES_SET_V6].name, STR_SIZE(data->sets[NFTABLES_SET_V6].name), "%s6", p);
+        if (!netlink_open(&data->nl, NETLINK_NETFILTER, error)) {
+            break;
+        }
+        if (!nftables_get_set(data, &data->sets[NFTABLES_SET_V4], sizeof(struct in_addr), error)) {
+            break;
+        }
+        if (!nftables_get_set(data, &data->sets[NFTABLES_SET_V6], sizeof(struct in6_addr), error)) {
             break;
         }
-        if (mnl_socket_bind(data->nl, 0, MNL_SOCKET_AUTOPID) < 0) {
-            free(data);
-            data = NULL;
-            set_system_error("mnl_socket_bind failed");
+        if (!data->sets[NFTABLES_SET_V4].exists && !data->sets[NFTABLES_SET_V6].exists) {
+            set_generic_error(error, "neither set %s nor %s exist in table inet %s", data->sets[NFTABLES_SET_V4].name, data->sets[NFTABLES_SET_V6].name, data->table);
             break;
         }
-        data->portid = mnl_socket_get_portid(data->nl);
-        data->s = nft_set_alloc();
-#if 0
-        data->e = nft_set_elem_alloc();
-        nft_set_elem_add(data->s, data->e);
-#else
-        data->e = NULL;
-#endif
-        nft_set_attr_set(data->s, NFT_SET_ATTR_TABLE, "filter");
+        ok = true;
     } while (false);
+    if (!ok && NULL != data) {
+        netlink_close(&data->nl);
+        free(data);
+        data = NULL;
+    }
 
     return data;
 }
 
-static bool nftables_handle(void *ctxt, const char *tablename, addr_t addr, char **error)
+/* ======================== elements insertion ======================== */
+
+/**
+ * Compute the first address after the network (the exclusive end of the interval)
+ *
+ * @return false if it overflows (the interval goes up to the last address)
+ **/
+static bool nftables_interval_end(const addr_t *addr, uint8_t *end)
 {
-    int ret;
-    nftables_data_t *data;
-    struct nlmsghdr *nlh;
-    uint32_t seq, family;
+    int i;
+    uint8_t carry;
 
-    data = (nftables_data_t *) ctxt;
-    seq = time(NULL);
-    {
-#if 1
-        uint32_t xxx;
-        struct nft_set_elem *e;
-
-        xxx = 0x3;
-        e = nft_set_elem_alloc();
-#endif
-        family = addr.fa == AF_INET ? NFPROTO_IPV4 : NFPROTO_IPV6;
-        nft_set_attr_set(data->s, NFT_SET_ATTR_NAME, tablename); // TODO: le nom doit/peut être différent ip/ip6?
-#if 0
-        nft_set_elem_attr_set(data->e, NFT_SET_ELEM_ATTR_KEY, &addr.sa, addr.sa_size);
-#else
-        nft_set_elem_attr_set(e, NFT_SET_ELEM_ATTR_KEY, &xxx, sizeof(xxx));
-        nft_set_elem_add(data->s, e);
-#endif
+    if (0 == addr->netmask) {
+        return false;
+    }
+    memcpy(end, &addr->sa, ADDR_SIZE(addr));
+    i = (addr->netmask - 1) / 8;
+    carry = 1 << (7 - (addr->netmask - 1) % 8);
+    for (; i >= 0 && 0 != carry; i--) {
+        end[i] += carry;
+        carry = 0 == end[i];
     }
-    nlh = nft_set_nlmsg_build_hdr(data->buf, NFT_MSG_NEWSETELEM, family, NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK, seq);
-    nft_set_elems_nlmsg_build_payload(nlh, data->s);
-//     data->portid = mnl_socket_get_portid(data->nl);
-    if (mnl_socket_sendto(data->nl, nlh, nlh->nlmsg_len) < 0) {
-        set_system_error(error, "mnl_socket_sendto failed");
+
+    return 0 == carry;
+}
+
+static bool nftables_put_element(netlink_t *nl, const addr_t *addr, const void *key, bool interval_end)
+{
+    struct nlattr *elem, *nest;
+
+    if (NULL == (elem = netlink_nest_start(nl, NFTA_LIST_ELEM))) {
         return false;
     }
-    ret = mnl_socket_recvfrom(data->nl, data->buf, MNL_SOCKET_BUFFER_SIZE);
-    while (ret > 0) {
-        if ((ret = mnl_cb_run(data->buf, ret, seq, data->portid, NULL, NULL)) <= 0) {
-            set_system_error(error, "mnl_cb_run failed");
+    if (interval_end) {
+        uint32_t flags;
+
+        flags = htonl(NFT_SET_ELEM_INTERVAL_END);
+        if (NULL == netlink_attr_put(nl, NFTA_SET_ELEM_FLAGS, &flags, sizeof(flags))) {
             return false;
-            //break;
         }
-        ret = mnl_socket_recvfrom(data->nl, data->buf, MNL_SOCKET_BUFFER_SIZE);
     }
-    if (-1 == ret) {
-        set_system_error(error, "mnl_socket_recvfrom failed"); // ENOENT 2 /* No such file or directory */
+    if (NULL == (nest = netlink_nest_start(nl, NFTA_SET_ELEM_KEY))) {
+        return false;
+    }
+    if (NULL == netlink_attr_put(nl, NFTA_DATA_VALUE, key, ADDR_SIZE(addr))) {
         return false;
     }
+    netlink_nest_end(nl, nest);
+    netlink_nest_end(nl, elem);
 
     return true;
 }
 
-static void nftables_close(void *ctxt)
+/**
+ * Append a NFT_MSG_NEWSETELEM or NFT_MSG_DELSETELEM message for addr (an
+ * interval if the set supports it)
+ *
+ * @return false if the buffer is full
+ **/
+static bool nftables_append(nftables_data_t *data, int type, const nftables_set_t *set, const addr_t *addr, uint32_t seq)
+{
+    size_t mark;
+    struct nlmsghdr *nlh;
+    struct nlattr *elems;
+
+    mark = data->nl.len;
+    do {
+        uint8_t end[sizeof(struct in6_addr)];
+
+        if (NULL == (nlh = netlink_msg_start(&data->nl, NETLINK_MSG_TYPE(NFNL_SUBSYS_NFTABLES, type), NFT_MSG_NEWSETELEM == type ? NLM_F_CREATE : 0, NFPROTO_INET, 0, seq))) {
+            break;
+        }
+        if (NULL == netlink_attr_put_strz(&data->nl, NFTA_SET_ELEM_LIST_TABLE, data->table)) {
+            break;
+        }
+        if (NULL == netlink_attr_put_strz(&data->nl, NFTA_SET_ELEM_LIST_SET, set->name)) {
+            break;
+        }
+        if (NULL == (elems = netlink_nest_start(&data->nl, NFTA_SET_ELEM_LIST_ELEMENTS))) {
+            break;
+        }
+        if (!nftables_put_element(&data->nl, addr, &addr->sa, false)) {
+            break;
+        }
+        if (set->interval && nftables_interval_end(addr, end) && !nftables_put_element(&data->nl, addr, end, true)) {
+            break;
+        }
+        netlink_nest_end(&data->nl, elems);
+        netlink_msg_end(&data->nl, nlh);
+
+        return true;
+    } while (false);
+    data->nl.len = mark;
+
+    return false;
+}
+
+/**
+ * Collect the errors the kernel queued while processing the batch we've just sent
+ * (only failures are reported: no NLM_F_ACK was asked)
+ *
+ * @return the number of failed messages or -1 if it can't be determined
+ **/
+static int nftables_collect_errors(nftables_data_t *data, int type, const addr_t *addrs, size_t count, uint32_t base_seq, bool *results, bool *ok, char **error)
+{
+    int failures;
+    ssize_t read;
+
+    failures = 0;
+    while (-1 != (read = recv(data->nl.fd, data->nl.rbuf, sizeof(data->nl.rbuf), MSG_DONTWAIT))) {
+        struct nlmsghdr *nlh;
+
+        for (nlh = (struct nlmsghdr *) data->nl.rbuf; NLMSG_OK(nlh, read); nlh = NLMSG_NEXT(nlh, read)) {
+            struct nlmsgerr *err;
+
+            if (NLMSG_ERROR != nlh->nlmsg_type) {
+                continue;
+            }
+            err = NLMSG_DATA(nlh);
+            if (0 == err->error) {
+                continue;
+            }
+            if (nlh->nlmsg_seq - base_seq >= count || !results[nlh->nlmsg_seq - base_seq]) {
+                /* not one of our elements: the whole batch is in error */
+                if (*ok) {
+                    set_errno_error(error, -err->error, "nftables batch failed");
+                }
+                *ok = false;
+                return -1;
+            }
+            results[nlh->nlmsg_seq - base_seq] = false;
+            if (*ok) {
+                const addr_t *addr;
+                char buffer[INET6_ADDRSTRLEN];
+
+                addr = &addrs[nlh->nlmsg_seq - base_seq];
+                set_errno_error(error, -err->error, "%s %s %s set inet %s %s failed", NFT_MSG_NEWSETELEM == type ? "adding" : "removing", addr_ntop(addr, buffer, sizeof(buffer)), NFT_MSG_NEWSETELEM == type ? "to" : "from", data->table, data->sets[AF_INET == addr->fa ? NFTABLES_SET_V4 : NFTABLES_SET_V6].name);
+            }
+            *ok = false;
+            ++failures;
+        }
+    }
+    if (EAGAIN != errno && EWOULDBLOCK != errno) {
+        if (*ok) {
+            set_system_error(error, "recv failed");
+        }
+        *ok = false;
+        return -1;
+    }
+
+    return failures;
+}
+
+/**
+ * Add (or remove) all addresses through NFT_MSG_BATCH_BEGIN/END transactions,
+ * as many elements as the buffer can hold by sendto. A transaction is all or
+ * nothing: when an element is refused, the transaction is replayed without it.
+ *
+ * @param type NFT_MSG_NEWSETELEM or NFT_MSG_DELSETELEM
+ **/
+static bool nftables_batch(void *ctxt, int type, const addr_t *addrs, size_t count, bool *results, char **error)
 {
+    bool ok;
+    size_t i;
+    uint32_t base_seq;
     nftables_data_t *data;
 
+    ok = true;
     data = (nftables_data_t *) ctxt;
-    if (NULL != data->e) {
-        nft_set_elem_free(data->e);
-        data->e = NULL;
-    }
-    if (NULL != data->s) {
-        nft_set_free(data->s);
-        data->s = NULL;
+    /* seq of the message for addrs[i] is base_seq + i */
+    base_seq = data->nl.seq;
+    data->nl.seq += count;
+    for (i = 0; i < count; i++) {
+        const nftables_set_t *set;
+        char buffer[INET6_ADDRSTRLEN];
+
+        set = &data->sets[AF_INET == addrs[i].fa ? NFTABLES_SET_V4 : NFTABLES_SET_V6];
+        results[i] = false;
+        if (!set->exists) {
+            if (ok) {
+                set_generic_error(error, "can't %s %s: set inet %s %s doesn't exist", NFT_MSG_NEWSETELEM == type ? "add" : "remove", addr_ntop(&addrs[i], buffer, sizeof(buffer)), data->table, set->name);
+            }
+        } else if (!set->interval && addrs[i].netmask != ADDR_SIZE(&addrs[i]) * 8) {
+            if (ok) {
+                set_generic_error(error, "can't %s %s/%u: set inet %s %s is not an interval set", NFT_MSG_NEWSETELEM == type ? "add" : "remove", addr_ntop(&addrs[i], buffer, sizeof(buffer)), addrs[i].netmask, data->table, set->name);
+            }
+        } else {
+            results[i] = true;
+            continue;
+        }
+        ok = false;
     }
-    if (NULL != data->nl) {
-        mnl_socket_close(data->nl);
-        data->nl = NULL;
+    i = 0;
+    while (i < count) {
+        int failures;
+        size_t from, appended;
+
+        from = i;
+        appended = 0;
+        netlink_batch_begin(&data->nl, NFNL_SUBSYS_NFTABLES);
+        for (; i < count; i++) {
+            if (!results[i]) {
+                continue;
+            }
+            if (!nftables_append(data, type, &data->sets[AF_INET == addrs[i].fa ? NFTABLES_SET_V4 : NFTABLES_SET_V6], &addrs[i], base_seq + i)) {
+                break;
+            }
+            ++appended;
+        }
+        if (0 == appended) {
+            break;
+        }
+        netlink_batch_end(&data->nl, NFNL_SUBSYS_NFTABLES);
+        if (!netlink_send(&data->nl, ok ? error : NULL) || -1 == (failures = nftables_collect_errors(data, type, addrs, count, base_seq, results, &ok, error))) {
+            size_t j;
+
+            ok = false;
+            for (j = from; j < i; j++) {
+                results[j] = false;
+            }
+        } else if (failures > 0) {
+            /* the transaction was aborted, replay it without the faulty elements */
+            i = from;
+        }
     }
+
+    return ok;
+}
+
+static bool nftables_handle_batch(void *ctxt, const char *UNUSED(tablename), const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return nftables_batch(ctxt, NFT_MSG_NEWSETELEM, addrs, count, results, error);
+}
+
+static bool nftables_unhandle(void *ctxt, const char *UNUSED(tablename), const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return nftables_batch(ctxt, NFT_MSG_DELSETELEM, addrs, count, results, error);
+}
+
+static bool nftables_handle(void *ctxt, const char *tablename, const addr_t *addr, char **error)
+{
+    bool result;
+
+    return nftables_handle_batch(ctxt, tablename, addr, 1, &result, error);
+}
+
+static void nftables_close(void *ctxt)
+{
+    nftables_data_t *data;
+
+    data = (nftables_data_t *) ctxt;
+    netlink_close(&data->nl);
 }
 
 const engine_t nftables_engine = {
+    false, /* the kernel checks CAP_NET_ADMIN at each message, not when the socket is opened */
     "nftables",
     nftables_open,
     nftables_handle,
+    nftables_handle_batch,
+    nftables_unhandle,
+    NULL,
     nftables_close
 };
@@ -1,3 +1,4 @@
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <net/npf.h>
@@ -17,14 +18,14 @@ static void *npf_open(const char *UNUSED(tablename), char **error)
     npf_data_t *data;
 
     do {
-        if (NULL == (data = malloc(sizeof(*data))) {
+        if (NULL == (data = malloc(sizeof(*data)))) {
             set_malloc_error(error, sizeof(*data));
             break;
         }
         if (-1 == (data->fd = open("/dev/npf", O_WRONLY))) {
             free(data);
             data = NULL;
-            set_system_error("failed opening /dev/npf");
+            set_system_error(error, "failed opening /dev/npf");
             break;
         }
     } while (false);
@@ -32,23 +33,23 @@ static void *npf_open(const char *UNUSED(tablename), char **error)
     return data;
 }
 
-static bool npf_handle(void *ctxt, const char *tablename, addr_t addr, char **error)
+/**
+ * @param cmd NPF_CMD_TABLE_ADD or NPF_CMD_TABLE_REMOVE
+ **/
+static void npf_table_init(npf_ioctl_table_t *nct, const char *tablename, int cmd)
 {
-    int ret;
-    npf_data_t *data;
-    npf_ioctl_table_t nct;
-    struct sockaddr_in sin;
-    struct sockaddr_in6 sin6;
-
-    data = (npf_data_t *) ctxt;
-    bzero(&nct, sizeof(nct));
+    bzero(nct, sizeof(*nct));
 #ifdef NPF_ALLOW_NAMED_TABLE
-    nct.nct_name = tablename;
+    nct->nct_name = tablename;
 #else
-    nct.nct_tid = atoi(tablename);
+    nct->nct_tid = atoi(tablename);
 #endif /* NPF_ALLOW_NAMED_TABLE */
-    nct.nct_cmd = NPF_CMD_TABLE_ADD;
-    nct.nct_data.ent.mask = NPF_NO_NETMASK;
+    nct->nct_cmd = cmd;
+    nct->nct_data.ent.mask = NPF_NO_NETMASK;
+}
+
+static bool npf_table_entry(npf_data_t *data, npf_ioctl_table_t *nct, const addr_t *addr, char **error)
+{
 #if 0
     // http://nxr.netbsd.org/xref/src/usr.sbin/npf/npfctl/npf_data.c#158
     uint8_t *ap;
@@ -69,16 +70,59 @@ static bool npf_handle(void *ctxt, const char *tablename, addr_t addr, char **er
     }
     nct.nct_data.ent.mask = addr.netmask;
 #endif
-    nct.nct_data.ent.alen = addr.sa_size;
-    memcpy(&nct.nct_data.ent.addr, &addr.sa, addr.sa_size);
-    if (-1 == ioctl(data->fd, IOC_NPF_TABLE, &nct)) {
-        set_system_error(error, "ioctl(IOC_NPF_TABLE) failed");
+    nct->nct_data.ent.alen = ADDR_SIZE(addr);
+    bzero(&nct->nct_data.ent.addr, sizeof(nct->nct_data.ent.addr));
+    memcpy(&nct->nct_data.ent.addr, &addr->sa, ADDR_SIZE(addr));
+    if (-1 == ioctl(data->fd, IOC_NPF_TABLE, nct)) {
+        char buffer[INET6_ADDRSTRLEN];
+
+        set_system_error(error, "ioctl(IOC_NPF_TABLE) failed for %s", addr_ntop(addr, buffer, sizeof(buffer)));
         return false;
     }
 
     return true;
 }
 
+static bool npf_handle(void *ctxt, const char *tablename, const addr_t *addr, char **error)
+{
+    npf_ioctl_table_t nct;
+
+    npf_table_init(&nct, tablename, NPF_CMD_TABLE_ADD);
+
+    return npf_table_entry((npf_data_t *) ctxt, &nct, addr, error);
+}
+
+/**
+ * NPF has no bulk insertion: issue all ioctls on the already opened /dev/npf
+ * with a single request preparation
+ **/
+static bool npf_table_batch(void *ctxt, const char *tablename, int cmd, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    bool ok;
+    size_t i;
+    npf_ioctl_table_t nct;
+
+    ok = true;
+    npf_table_init(&nct, tablename, cmd);
+    for (i = 0; i < count; i++) {
+        if (!(results[i] = npf_table_entry((npf_data_t *) ctxt, &nct, &addrs[i], ok ? error : NULL))) {
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static bool npf_handle_batch(void *ctxt, const char *tablename, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return npf_table_batch(ctxt, tablename, NPF_CMD_TABLE_ADD, addrs, count, results, error);
+}
+
+static bool npf_unhandle(void *ctxt, const char *tablename, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return npf_table_batch(ctxt, tablename, NPF_CMD_TABLE_REMOVE, addrs, count, results, error);
+}
+
 static void npf_close(void *ctxt)
 {
     npf_data_t *data;
@@ -97,5 +141,8 @@ const engine_t npf_engine = {
     "npf",
     npf_open,
     npf_handle,
+    npf_handle_batch,
+    npf_unhandle,
+    NULL,
     npf_close
 };
@@ -2,16 +2,12 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <assert.h>
 
 #include "config.h"
-#ifdef HAVE_LIBBSD_STRLCPY
-# include <bsd/string.h>
-#endif /* !HAVE_LIBBSD_STRLCPY */
 #include "common.h"
 #include "parse.h"
 #include "err.h"
@@ -112,116 +108,216 @@ if (!flagtmp)
     flagtmp = ip4_matchnet(&(thisip->addr), &privc, 16);
 #endif
 
-bool parse_addr(const char *string, addr_t *addr, char **error)
+/**
+ * Parse a dotted IPv4 address, in [string;end[, the same way
+ * inet_pton(AF_INET, ...) does (exactly 4 decimal octets, no leading zero)
+ **/
+static bool parse_ipv4(const char *string, const char *end, uint8_t *out)
 {
-    bool ok;
-    char *buffer;
-    struct addrinfo *res;
+    int i;
 
-    ok = false;
-    res = NULL;
-    buffer = (char *) string;
-    do {
-        char *p;
-
-        bzero(addr, sizeof(*addr));
-        if (NULL != (p = strchr(string, '/'))) {
-            int ret;
-            unsigned long prefix;
-            struct addrinfo hints;
-
-            buffer = strdup(string);
-            buffer[p - string] = '\0';
-            parse_ulong(++p, &prefix, error);
-            bzero(&hints, sizeof(hints));
-            hints.ai_flags |= AI_NUMERICHOST;
-            if (0 != (ret = getaddrinfo(buffer, NULL, &hints, &res))) {
-                set_generic_error(error, "getaddrinfo failed: %s", gai_strerror(ret));
-                break;
+#define IS_DIGIT(p) ((p) < end && (unsigned int) (*(p) - '0') <= 9)
+    for (i = 0; i < 4; i++) {
+        unsigned int value;
+
+        if (i > 0 && (string == end || '.' != *string++)) {
+            return false;
+        }
+        if (!IS_DIGIT(string)) {
+            return false;
+        }
+        value = *string++ - '0';
+        // no leading zero: a 0 is a whole octet
+        if (0 != value && IS_DIGIT(string)) {
+            value = value * 10 + (*string++ - '0');
+            if (IS_DIGIT(string)) {
+                value = value * 10 + (*string++ - '0');
+                if (value > 255) {
+                    return false;
+                }
             }
-            if (res->ai_family == AF_INET && prefix > 32) {
-                set_generic_error(error, "prefix too long for AF_INET");
-                break;
-            } else if (res->ai_family == AF_INET6 && prefix > 128) {
-                set_generic_error(error, "prefix too long for AF_INET6");
-                break;
+        }
+        out[i] = value;
+    }
+#undef IS_DIGIT
+
+    return string == end;
+}
+
+/* value + 1 of the hexadecimal digits, 0 for any other character */
+static const uint8_t hexdigits[UCHAR_MAX + 1] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/**
+ * Parse an IPv6 address, in [string;end[, the same way inet_pton(AF_INET6, ...)
+ * does (groups of 1 to 4 hexadecimal digits, at most one "::" standing for at
+ * least one group, an optional trailing dotted IPv4 address)
+ **/
+static bool parse_ipv6(const char *string, const char *end, uint8_t *out)
+{
+    int gap;
+    size_t length;
+
+    if (string == end) {
+        return false;
+    }
+    if (':' == *string && (++string == end || ':' != *string)) {
+        return false;
+    }
+    gap = -1;
+    length = 0;
+    while (string < end) {
+        int digit, digits;
+        unsigned int value;
+        const char *group;
+
+        value = 0;
+        group = string;
+        for (digits = 0; string < end && 0 != (digit = hexdigits[(unsigned char) *string]); digits++, string++) {
+            if (4 == digits) {
+                return false;
             }
-#if 0
-            switch (res->ai_family) {
-                case AF_INET:
-                    ret = inet_pton(AF_INET, buffer, &addr->sa.v4);
-                    assert(1 == ret);
-                    addr->sa_size = sizeof(addr->sa.v4);
-                    break;
-                case AF_INET6:
-                    ret = inet_pton(AF_INET6, buffer, &addr->sa.v6);
-                    assert(1 == ret);
-                    addr->sa_size = sizeof(addr->sa.v6);
-                    break;
-                default:
-                    assert(0);
+            value = (value << 4) | (digit - 1);
+        }
+        if (string == end) {
+            if (digits > 0) {
+                if (length + 2 > 16) {
+                    return false;
+                }
+                out[length++] = value >> 8;
+                out[length++] = value & 0xFF;
             }
-#else
-            if (AF_INET == res->ai_family && 1 == inet_pton(AF_INET, buffer, &addr->sa.v4)) {
-                addr->sa_size = sizeof(addr->sa.v4);
-            } else if (AF_INET6 == res->ai_family && 1 == inet_pton(AF_INET6, buffer, &addr->sa.v6)) {
-                addr->sa_size = sizeof(addr->sa.v6);
-            } else {
-                set_generic_error(error, "valid address expected, got: %s", buffer);
-                break;
+            break;
+        }
+        if ('.' == *string) {
+            if (length + 4 > 16 || !parse_ipv4(group, end, out + length)) {
+                return false;
             }
-#endif
-            addr->netmask = prefix;
-            addr->fa = res->ai_family;
+            length += 4;
+            break;
+        }
+        if (':' != *string++) {
+            return false;
+        }
+        if (0 == digits) {
+            if (gap >= 0) {
+                return false;
+            }
+            gap = length;
         } else {
-            if (1 == inet_pton(AF_INET, buffer, &addr->sa.v4)) {
-                addr->fa = AF_INET;
-                addr->netmask = 32;
-                addr->sa_size = sizeof(addr->sa.v4);
-            } else if (1 == inet_pton(AF_INET6, buffer, &addr->sa.v6)) {
-                addr->fa = AF_INET6;
-                addr->netmask = 64;
-                addr->sa_size = sizeof(addr->sa.v6);
-            } else {
-                set_generic_error(error, "valid address expected, got: %s", buffer);
-                break;
+            if (string == end || length + 2 > 16) {
+                return false;
             }
+            out[length++] = value >> 8;
+            out[length++] = value & 0xFF;
         }
-        // set to 0 the unused part of the IP address to align with the netmask else it might be invalid
-        {
-            int b, i, j;
-            uint32_t *m, *a;
-            struct in6_addr mask;
-
-            j = 0;
-            m = (uint32_t *) &mask;
-            a = (uint32_t *) &addr->sa;
-            bzero(&mask, sizeof(mask));
-            for (b = addr->netmask; b >= 32; b -= 32) {
-                m[j++] = 0xFFFFFFFF;
-            }
-            for (i = 31; i > 31 - b; --i) {
-                m[j] |= (1 << i);
+    }
+    if (gap >= 0) {
+        if (16 == length) {
+            return false;
+        }
+        memmove(out + 16 - (length - gap), out + gap, length - gap);
+        memset(out + gap, 0, 16 - length);
+        length = 16;
+    }
+
+    return 16 == length;
+}
+
+/* masks[n] keeps the n most significant bits of a byte */
+static const uint8_t masks[] = { 0x00, 0x80, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC, 0xFE, 0xFF };
+
+/**
+ * Parse an address, IPv4 or IPv6, optionnaly followed by a prefix length
+ * (/1 to /32 or /128), without allocating anything. A plain IPv4 address is
+ * a /32, a plain IPv6 address a /64. The bits outside the prefix are cleared.
+ **/
+bool parse_addr(const char *string, addr_t *addr, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        size_t length;
+        uint8_t *bytes;
+        unsigned int prefix, maxlen;
+        const char *p, *slash;
+
+        for (slash = string; '\0' != *slash && '/' != *slash; slash++)
+            ;
+        length = slash - string;
+        bytes = (uint8_t *) &addr->sa;
+        memset(&addr->sa, 0, sizeof(addr->sa));
+        if (length < INET6_ADDRSTRLEN && parse_ipv4(string, slash, bytes)) {
+            addr->fa = AF_INET;
+            maxlen = 32;
+            prefix = 32;
+        } else if (length < INET6_ADDRSTRLEN && parse_ipv6(string, slash, bytes)) {
+            addr->fa = AF_INET6;
+            maxlen = 128;
+            prefix = 64;
+        } else {
+            set_generic_error(error, "valid address expected, got: %.*s", (int) length, string);
+            break;
+        }
+        if ('/' == *slash) {
+            prefix = 0;
+            for (p = slash + 1; *p >= '0' && *p <= '9' && prefix <= maxlen; p++) {
+                prefix = prefix * 10 + (*p - '0');
             }
-            if (0 != b) {
-                m[j] = htonl(m[j]);
+            if (p == slash + 1 || '\0' != *p || prefix > maxlen) {
+                set_generic_error(error, "prefix length between 1 and %u expected, got: %s", maxlen, slash + 1);
+                break;
             }
-            for (i = 0; i < 4; i++) {
-                a[i] &= m[i];
+            if (0 == prefix) {
+                set_generic_error(error, "number should be greater than 0, got %u", prefix);
+                break;
             }
         }
-        if (strlcpy(addr->humanrepr, buffer, STR_SIZE(addr->humanrepr)) >= STR_SIZE(addr->humanrepr)) {
-            set_generic_error(error, "buffer overflow");
-            break;
+        // set to 0 the unused part of the IP address to align with the netmask else it might be invalid
+        if (prefix < maxlen) {
+            bytes[prefix / 8] &= masks[prefix % 8];
+            memset(bytes + prefix / 8 + 1, 0, maxlen / 8 - prefix / 8 - 1);
         }
+        addr->netmask = prefix;
         ok = true;
     } while (false);
-    if (NULL != res) {
-        freeaddrinfo(res);
-    }
-    if (buffer != string) {
-        free(buffer);
-    }
 
     return ok;
 }
+
+/**
+ * Build an address from a prefix (eg: one resulting of an aggregation)
+ *
+ * @param fa AF_INET or AF_INET6
+ * @param key the address, in network byte order
+ * @param netmask its length
+ **/
+void addr_from_prefix(addr_t *addr, int fa, const void *key, uint8_t netmask)
+{
+    addr->fa = fa;
+    addr->netmask = netmask;
+    memset(&addr->sa, 0, sizeof(addr->sa));
+    memcpy(&addr->sa, key, ADDR_SIZE(addr));
+}
+
+/**
+ * Write the text form of the address, without its prefix length
+ *
+ * @param buffer where to write it, INET6_ADDRSTRLEN bytes are enough
+ * @param size its size
+ *
+ * @return buffer
+ **/
+const char *addr_ntop(const addr_t *addr, char *buffer, size_t size)
+{
+    if (NULL == inet_ntop(addr->fa, &addr->sa, buffer, size)) {
+        buffer[0] = '\0';
+    }
+
+    return buffer;
+}
@@ -5,16 +5,24 @@
 #include <netinet/in.h>
 #include <stdint.h>
 
+/**
+ * An address or a network, kept as small as possible (20 bytes): its text
+ * form is only built, by addr_ntop, when something has to be written
+ **/
 typedef struct {
     union {
         struct in_addr v4;
         struct in6_addr v6;
     } sa;
-    int fa;
-    size_t sa_size;
+    uint8_t fa;
     uint8_t netmask;
-    char humanrepr[INET6_ADDRSTRLEN + 1];
 } addr_t;
 
+/* number of significant bytes of sa */
+#define ADDR_SIZE(addr) \
+    (AF_INET == (addr)->fa ? sizeof((addr)->sa.v4) : sizeof((addr)->sa.v6))
+
 bool parse_addr(const char *, addr_t *, char **);
 bool parse_ulong(const char *, unsigned long *, char **);
+void addr_from_prefix(addr_t *, int, const void *, uint8_t);
+const char *addr_ntop(const addr_t *, char *, size_t);
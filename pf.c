@@ -9,16 +9,19 @@
 #undef v4
 #undef v6
 #include <sys/ioctl.h>
-#include <netdb.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "err.h"
 #include "engine.h"
+#include "trie.h"
 #include "capsicum.h"
 
 typedef struct {
     int fd;
+    size_t addrs_size;
+    struct pfr_addr *addrs; /* reused DIOCRADDADDRS buffer */
+    trie_t kills[2]; /* prefixes (IPv4 then IPv6) whose states are still to kill */
 } pf_data_t;
 
 static void *pf_open(const char *UNUSED(tablename), char **error)
@@ -30,6 +33,10 @@ static void *pf_open(const char *UNUSED(tablename), char **error)
             set_malloc_error(error, sizeof(*data));
             break;
         }
+        data->addrs = NULL;
+        data->addrs_size = 0;
+        trie_init(&data->kills[0]);
+        trie_init(&data->kills[1]);
         if (-1 == (data->fd = open("/dev/pf", O_RDWR))) {
             set_system_error(error, "failed opening /dev/pf");
             free(data);
@@ -39,7 +46,7 @@ static void *pf_open(const char *UNUSED(tablename), char **error)
         if (!CAP_RIGHTS_LIMIT(error, data->fd, CAP_READ, CAP_WRITE, CAP_IOCTL)) {
             break;
         }
-        if (!CAP_IOCTLS_LIMIT(error, data->fd, DIOCRADDADDRS, DIOCKILLSTATES)) {
+        if (!CAP_IOCTLS_LIMIT(error, data->fd, DIOCRADDADDRS, DIOCRDELADDRS, DIOCKILLSTATES)) {
             break;
         }
     } while (false);
@@ -70,150 +77,241 @@ static void *pf_open(const char *UNUSED(tablename), char **error)
 }
 
 /**
- * kill states, taken from pfctl
+ * Kill the states from the prefix key/length (one DIOCKILLSTATES), mask
+ * building taken from pfctl
  * Copyright (c) 2001 Daniel Hartmeier
  * Copyright (c) 2002,2003 Henning Brauer
  * https://svnweb.freebsd.org/base/head/sbin/pfctl/pfctl.c?revision=262799&view=markup#l546
  **/
-static bool pf_handle(void *ctxt, const char *tablename, addr_t parsed_addr, char **error)
+static bool pf_kill_states(pf_data_t *data, int fa, const uint8_t *key, uint8_t length, char **error)
 {
-    int ret;
-    pf_data_t *data;
-    struct pfr_addr addr;
-    struct pfioc_table io;
-    struct sockaddr last_src;
-    struct addrinfo *res, *resp;
     struct pfioc_state_kill psk;
 
-    data = (pf_data_t *) ctxt;
-    bzero(&io, sizeof(io));
-    strlcpy(io.pfrio_table.pfrt_name, tablename, sizeof(io.pfrio_table.pfrt_name));
-    io.pfrio_buffer = &addr;
-    io.pfrio_esize = sizeof(addr);
-    io.pfrio_size = 1;
-    bzero(&addr, sizeof(addr));
     bzero(&psk, sizeof(psk));
+    psk.psk_af = fa;
     memset(&psk.psk_src.addr.v.a.mask, 0xff, sizeof(psk.psk_src.addr.v.a.mask));
-    memset(&last_src, 0xff, sizeof(last_src));
-#if 0
-    if (NULL != (p = strchr(buffer, '/'))) {
-        int q, r;
-        unsigned long prefix;
-        struct addrinfo hints;
-
-        *p++ = '\0';
-        parse_ulong(p, &prefix);
-        bzero(&hints, sizeof(hints));
-        hints.ai_flags |= AI_NUMERICHOST;
-        if (0 != (ret = getaddrinfo(buffer, NULL, &hints, &res))) {
-            errc("getaddrinfo failed: %s", gai_strerror(ret));
+    if (AF_INET == fa) {
+        memcpy(&psk.psk_src.addr.v.a.addr.pfa.v4, key, sizeof(psk.psk_src.addr.v.a.addr.pfa.v4));
+        if (length < 32) {
+            bzero(&psk.psk_src.addr.v.a.mask.pfa.v4, sizeof(psk.psk_src.addr.v.a.mask.pfa.v4));
+            psk.psk_src.addr.v.a.mask.pfa.v4.s_addr = htonl((u_int32_t) (0xffffffffffULL << (32 - length)));
         }
-        if (res->ai_family == AF_INET && prefix > 32) {
-            errx("prefix too long for AF_INET");
-        } else if (res->ai_family == AF_INET6 && prefix > 128) {
-            errx("prefix too long for AF_INET6");
-        }
-        q = prefix >> 3;
-        r = prefix & 7;
-        switch (res->ai_family) {
-            case AF_INET:
-                inet_pton(AF_INET, buffer, &addr.pfra_ip4addr); // assert(1 == inet_pton)
-                bzero(&psk.psk_src.addr.v.a.mask.v4, sizeof(psk.psk_src.addr.v.a.mask.pfa.v4));
-                psk.psk_src.addr.v.a.mask.v4.s_addr = htonl((u_int32_t) (0xffffffffffULL << (32 - prefix)));
-                break;
-            case AF_INET6:
-                inet_pton(AF_INET6, buffer, &addr.pfra_ip6addr); // assert(1 == inet_pton)
-                bzero(&psk.psk_src.addr.v.a.mask.v6, sizeof(psk.psk_src.addr.v.a.mask.pfa.v6));
-                if (q > 0) {
-                    memset((void *) &psk.psk_src.addr.v.a.mask.v6, 0xff, q);
-                }
-                if (r > 0) {
-                    *((u_char *) &psk.psk_src.addr.v.a.mask.v6 + q) = (0xff00 >> r) & 0xff;
-                }
-                break;
-        }
-        addr.pfra_net = prefix;
-        addr.pfra_af = res->ai_family;
-        freeaddrinfo(res);
     } else {
-        if (1 == inet_pton(AF_INET, buffer, &addr.pfra_ip4addr)) {
-            addr.pfra_af = AF_INET;
-            addr.pfra_net = 32;
-        } else if (1 == inet_pton(AF_INET6, buffer, &addr.pfra_ip6addr)) {
-            addr.pfra_af = AF_INET6;
-            addr.pfra_net = 128;
-        } else {
-            warn("Valid address expected, got: %s", buffer);
+        memcpy(&psk.psk_src.addr.v.a.addr.pfa.v6, key, sizeof(psk.psk_src.addr.v.a.addr.pfa.v6));
+        if (length < 128) {
+            int q, r;
+
+            q = length >> 3;
+            r = length & 7;
+            bzero(&psk.psk_src.addr.v.a.mask.pfa.v6, sizeof(psk.psk_src.addr.v.a.mask.pfa.v6));
+            if (q > 0) {
+                memset((void *) &psk.psk_src.addr.v.a.mask.pfa.v6, 0xff, q);
+            }
+            if (r > 0) {
+                *((u_char *) &psk.psk_src.addr.v.a.mask.pfa.v6 + q) = (0xff00 >> r) & 0xff;
+            }
         }
     }
-#else
-    addr.pfra_af = parsed_addr.fa;
-    addr.pfra_net = parsed_addr.netmask;
-    memcpy(&addr.pfra_ip6addr, &parsed_addr.sa.v6, sizeof(parsed_addr.sa.v6));
-    if (AF_INET == addr.pfra_af && addr.pfra_net < 32) {
-        bzero(&psk.psk_src.addr.v.a.mask.pfa.v4, sizeof(psk.psk_src.addr.v.a.mask.pfa.v4));
-        psk.psk_src.addr.v.a.mask.pfa.v4.s_addr = htonl((u_int32_t) (0xffffffffffULL << (32 - parsed_addr.netmask)));
-    } else if (AF_INET6 == addr.pfra_af && addr.pfra_net < 128) {
-        int q, r;
-
-        q = addr.pfra_net >> 3;
-        r = addr.pfra_net & 7;
-        bzero(&psk.psk_src.addr.v.a.mask.pfa.v6, sizeof(psk.psk_src.addr.v.a.mask.pfa.v6));
-        if (q > 0) {
-            memset((void *) &psk.psk_src.addr.v.a.mask.pfa.v6, 0xff, q);
-        }
-        if (r > 0) {
-            *((u_char *) &psk.psk_src.addr.v.a.mask.pfa.v6 + q) = (0xff00 >> r) & 0xff;
-        }
-    } // TODO: else = error?
-#endif
-    if (-1 == ioctl(data->fd, DIOCRADDADDRS, &io)) {
-        set_system_error(error, "ioctl(DIOCRADDADDRS) failed");
+    if (-1 == ioctl(data->fd, DIOCKILLSTATES, &psk)) {
+        set_system_error(error, "ioctl(DIOCKILLSTATES) failed");
         return false;
     }
-#if 0
-    if (0 != (ret = getaddrinfo(buffer, NULL, NULL, &res))) {
-#else
-    if (0 != (ret = getaddrinfo(parsed_addr.humanrepr, NULL, NULL, &res))) {
-#endif
-        set_generic_error(error, "getaddrinfo failed: %s", gai_strerror(ret));
-        return false;
+
+    return true;
+}
+
+/**
+ * Queue the killing of the states of addr, for pf_deferred. Pending
+ * prefixes are coalesced: an address covered by a pending network is
+ * dropped and 2 sibling prefixes become their parent (a single
+ * DIOCKILLSTATES then kills the states of both).
+ **/
+static bool pf_defer_kill(pf_data_t *data, const addr_t *addr, char **error)
+{
+    trie_t *trie;
+    uint8_t length;
+    uint8_t key[TRIE_KEY_SIZE];
+
+    trie = &data->kills[AF_INET == addr->fa ? 0 : 1];
+    length = addr->netmask;
+    memcpy(key, &addr->sa, ADDR_SIZE(addr));
+    if (trie_covered(trie, key, length)) {
+        return true;
     }
-    for (resp = res; NULL != resp; resp = resp->ai_next) {
-        if (NULL == resp->ai_addr) {
-            continue;
-        }
-        if (0 == memcmp(&last_src, resp->ai_addr, sizeof(last_src))) {
-            continue;
-        }
-        last_src = *(struct sockaddr *)resp->ai_addr;
-        psk.psk_af = resp->ai_family;
-        switch (psk.psk_af) {
-            case AF_INET:
-                psk.psk_src.addr.v.a.addr.pfa.v4 = ((struct sockaddr_in *) resp->ai_addr)->sin_addr;
-                break;
-            case AF_INET6:
-                psk.psk_src.addr.v.a.addr.pfa.v6 = ((struct sockaddr_in6 *) resp->ai_addr)->sin6_addr;
-                break;
-            default:
-                freeaddrinfo(res);
-                set_generic_error(error, "unknown address family %d", psk.psk_af);
-                return false;
+
+    return trie_insert(trie, key, length, error) && trie_aggregate(trie, key, &length, error);
+}
+
+typedef struct {
+    pf_data_t *data;
+    int fa;
+    size_t max;
+    size_t count;
+    bool truncated; /* max was reached before the end of the walk */
+    char **error;
+    trie_t *done; /* the killed prefixes, to remove them once the walk is over */
+} pf_kill_t;
+
+static void pf_kill_collect(const uint8_t *key, uint8_t length, void *arg)
+{
+    pf_kill_t *k;
+
+    k = (pf_kill_t *) arg;
+    if (k->count >= k->max) {
+        k->truncated = true;
+        return;
+    }
+    ++k->count;
+    if (!pf_kill_states(k->data, k->fa, key, length, NULL != k->error && NULL == *k->error ? k->error : NULL)) {
+        /* NOP: it is not retried, the states will time out */
+    }
+    trie_insert(k->done, key, length, NULL);
+}
+
+static void pf_kill_forget(const uint8_t *key, uint8_t length, void *arg)
+{
+    trie_remove((trie_t *) arg, key, length);
+}
+
+/**
+ * Kill the states of up to max of the pending prefixes
+ **/
+static bool pf_deferred(void *ctxt, size_t max, char **error)
+{
+    int i;
+    pf_kill_t k;
+    trie_t done;
+    pf_data_t *data;
+
+    data = (pf_data_t *) ctxt;
+    trie_init(&done);
+    k.data = data;
+    k.max = max;
+    k.count = 0;
+    k.error = error;
+    k.done = &done;
+    k.truncated = false;
+    for (i = 0; i < 2; i++) {
+        k.fa = 0 == i ? AF_INET : AF_INET6;
+        trie_foreach(&data->kills[i], pf_kill_collect, &k);
+        if (!k.truncated) {
+            /* all of them, the ones covered by an other included */
+            trie_reset(&data->kills[i]);
+        } else {
+            trie_foreach(&done, pf_kill_forget, &data->kills[i]);
         }
-        if (-1 == ioctl(data->fd, DIOCKILLSTATES, &psk)) {
-            freeaddrinfo(res);
-            set_system_error(error, "ioctl(DIOCKILLSTATES) failed");
+        trie_reset(&done);
+    }
+    trie_free(&done);
+
+    return 0 != data->kills[0].count || 0 != data->kills[1].count;
+}
+
+/**
+ * Issue a DIOCRADDADDRS or DIOCRDELADDRS for all the addresses at once,
+ * data->addrs[i].pfra_fback tells then what happened to each of them
+ **/
+static bool pf_table_ioctl(pf_data_t *data, const char *tablename, unsigned long request, const char *name, const addr_t *parsed_addrs, size_t count, char **error)
+{
+    size_t i;
+    struct pfioc_table io;
+
+    if (count > data->addrs_size) {
+        struct pfr_addr *tmp;
+
+        if (NULL == (tmp = realloc(data->addrs, count * sizeof(*data->addrs)))) {
+            set_malloc_error(error, count * sizeof(*data->addrs));
             return false;
         }
+        data->addrs = tmp;
+        data->addrs_size = count;
+    }
+    bzero(&io, sizeof(io));
+    strlcpy(io.pfrio_table.pfrt_name, tablename, sizeof(io.pfrio_table.pfrt_name));
+    io.pfrio_buffer = data->addrs;
+    io.pfrio_esize = sizeof(*data->addrs);
+    io.pfrio_size = count;
+    io.pfrio_flags = PFR_FLAG_FEEDBACK;
+    bzero(data->addrs, count * sizeof(*data->addrs));
+    for (i = 0; i < count; i++) {
+        data->addrs[i].pfra_af = parsed_addrs[i].fa;
+        data->addrs[i].pfra_net = parsed_addrs[i].netmask;
+        memcpy(&data->addrs[i].pfra_ip6addr, &parsed_addrs[i].sa.v6, sizeof(parsed_addrs[i].sa.v6));
+    }
+    if (-1 == ioctl(data->fd, request, &io)) {
+        set_system_error(error, "ioctl(%s) failed", name);
+        return false;
     }
-    freeaddrinfo(res);
-#if 0
-    free(buffer);
-#endif
 
     return true;
 }
 
+/**
+ * Add all addresses to the table with a single DIOCRADDADDRS: the ban is
+ * effective right away, the killing of their states (the slowest part) is
+ * left to pf_deferred
+ **/
+static bool pf_handle_batch(void *ctxt, const char *tablename, const addr_t *parsed_addrs, size_t count, bool *results, char **error)
+{
+    bool ok;
+    size_t i;
+    pf_data_t *data;
+
+    data = (pf_data_t *) ctxt;
+    if (!(ok = pf_table_ioctl(data, tablename, DIOCRADDADDRS, "DIOCRADDADDRS", parsed_addrs, count, error))) {
+        for (i = 0; i < count; i++) {
+            results[i] = false;
+        }
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        if (PFR_FB_CONFLICT == data->addrs[i].pfra_fback) {
+            results[i] = false;
+            if (ok) {
+                char buffer[INET6_ADDRSTRLEN];
+
+                set_generic_error(error, "%s conflicts with an entry of table <%s>", addr_ntop(&parsed_addrs[i], buffer, sizeof(buffer)), tablename);
+            }
+        } else {
+            results[i] = true;
+            if (!pf_defer_kill(data, &parsed_addrs[i], NULL)) {
+                /* NOP: the states will time out */
+            }
+        }
+        ok &= results[i];
+    }
+
+    return ok;
+}
+
+/**
+ * Remove all addresses from the table with a single DIOCRDELADDRS (an
+ * address which is no longer in the table is not an error)
+ **/
+static bool pf_unhandle(void *ctxt, const char *tablename, const addr_t *parsed_addrs, size_t count, bool *results, char **error)
+{
+    bool ok;
+    size_t i;
+    pf_data_t *data;
+
+    data = (pf_data_t *) ctxt;
+    ok = pf_table_ioctl(data, tablename, DIOCRDELADDRS, "DIOCRDELADDRS", parsed_addrs, count, error);
+    for (i = 0; i < count; i++) {
+        results[i] = ok;
+        /* no need to kill the states of an address which is no longer banned */
+        trie_remove(&data->kills[AF_INET == parsed_addrs[i].fa ? 0 : 1], &parsed_addrs[i].sa, parsed_addrs[i].netmask);
+    }
+
+    return ok;
+}
+
+static bool pf_handle(void *ctxt, const char *tablename, const addr_t *parsed_addr, char **error)
+{
+    bool result;
+
+    return pf_handle_batch(ctxt, tablename, parsed_addr, 1, &result, error);
+}
+
 static void pf_close(void *ctxt)
 {
     pf_data_t *data;
@@ -225,6 +323,12 @@ static void pf_close(void *ctxt)
         }
         data->fd = -1;
     }
+    if (NULL != data->addrs) {
+        free(data->addrs);
+        data->addrs = NULL;
+    }
+    trie_free(&data->kills[0]);
+    trie_free(&data->kills[1]);
 }
 
 const engine_t pf_engine = {
@@ -232,5 +336,8 @@ const engine_t pf_engine = {
     "pf",
     pf_open,
     pf_handle,
+    pf_handle_batch,
+    pf_unhandle,
+    pf_deferred,
     pf_close
 };
@@ -41,7 +41,10 @@ int main(int argc, char **argv)
     ctxt = NULL;
     status = EXIT_FAILURE;
     do {
-        addr_t addr;
+        int i, count;
+        bool unban;
+        addr_t addrs[16];
+        bool results[ARRAY_SIZE(addrs)];
 
         if (argc > 1) {
             if (NULL == (engine = get_engine_by_name(argv[1]))) {
@@ -59,10 +62,42 @@ int main(int argc, char **argv)
                 break;
             }
         }
-        if (!parse_addr("1.2.3.4", &addr, &error)) {
+        /* -d after the engine name unbans the addresses instead */
+        if ((unban = argc > 2 && 0 == strcmp(argv[2], "-d"))) {
+            if (NULL == engine->unhandle) {
+                set_generic_error(&error, "engine '%s' can't unban", engine->name);
+                break;
+            }
+            --argc;
+            ++argv;
+        }
+        /* addresses to ban may follow the engine name, default is to ban 1.2.3.4 */
+        if (argc > 2) {
+            for (count = 0, i = 2; i < argc && count < (int) ARRAY_SIZE(addrs); i++, count++) {
+                if (!parse_addr(argv[i], &addrs[count], &error)) {
+                    break;
+                }
+            }
+            if (NULL != error) {
+                break;
+            }
+        } else {
+            count = 1;
+            if (!parse_addr("1.2.3.4", &addrs[0], &error)) {
+                break;
+            }
+        }
+        if (unban) {
+            if (!engine->unhandle(ctxt, TABLENAME, addrs, count, results, &error)) {
+                break;
+            }
+        } else if (!engine_handle_batch(engine, ctxt, TABLENAME, addrs, count, results, &error)) {
             break;
         }
-        if (!engine->handle(ctxt, TABLENAME, addr, &error)) {
+        /* states killing, ... */
+        while (NULL != engine->deferred && engine->deferred(ctxt, count, &error))
+            ;
+        if (NULL != error) {
             break;
         }
         status = EXIT_SUCCESS;
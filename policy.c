@@ -0,0 +1,310 @@
+#include <sys/socket.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "policy.h"
+
+#define POLICY_DEFAULT_HALF_LIFE 3600
+#define POLICY_DEFAULT_CAPACITY 65536
+/* upper limit of size=, 2^24 counters (512 MB) */
+#define POLICY_MAX_CAPACITY (1UL << 24)
+
+/* number of neighbour slots searched for a counter, before evicting the weakest */
+#define POLICY_PROBES 8
+
+/* fixed point: an offense weighs 1 << SCORE_SHIFT */
+#define SCORE_SHIFT 8
+#define SCORE_ONE (1U << SCORE_SHIFT)
+
+/* the fractional part of the decay is applied by steps of half_life / DECAY_STEPS */
+#define DECAY_STEPS 16
+
+enum {
+    COUNTER_EMPTY,
+    COUNTER_OFFENSES, /* bans of the address or network itself */
+    COUNTER_PREFIX,   /* bans of addresses included in the prefix */
+};
+
+struct policy_counter_t {
+    addr_t addr;
+    uint8_t kind;
+    uint32_t score;
+    uint64_t last; /* when the decay was last applied */
+};
+
+/* 2^(-i/16) << 16 */
+static const uint32_t decay[DECAY_STEPS] = {
+    65536, 62757, 60097, 57548, 55109, 52773, 50535, 48393,
+    46341, 44376, 42495, 40693, 38968, 37316, 35734, 34219,
+};
+
+static const struct {
+    const char *name;
+    size_t offset;
+} numeric_settings[] = {
+    { "escalate", offsetof(policy_t, factor) },
+    { "max-ttl", offsetof(policy_t, max_ttl) },
+    { "widen", offsetof(policy_t, widen) },
+    { "half-life", offsetof(policy_t, half_life) },
+};
+
+/**
+ * Set the settings given by spec, a comma separated list of name=value:
+ * escalate=<factor>, max-ttl=<seconds>, widen=<count>, prefix4=<length>,
+ * prefix6=<length>, half-life=<seconds>, size=<number of counters>
+ **/
+static bool policy_parse(policy_t *policy, const char *spec, char **error)
+{
+    bool ok;
+    char *copy, *p, *token;
+
+    if (NULL == (copy = strdup(spec))) {
+        set_malloc_error(error, strlen(spec) + 1);
+        return false;
+    }
+    ok = true;
+    for (p = copy; ok && NULL != (token = strsep(&p, ",")); ) {
+        size_t i;
+        char *value;
+        unsigned long val;
+
+        if (NULL == (value = strchr(token, '='))) {
+            set_generic_error(error, "policy: name=value expected, got '%s'", token);
+            ok = false;
+            break;
+        }
+        *value++ = '\0';
+        if (!parse_ulong(value, &val, error)) {
+            ok = false;
+            break;
+        }
+        for (i = 0; i < ARRAY_SIZE(numeric_settings); i++) {
+            if (0 == strcmp(token, numeric_settings[i].name)) {
+                *(unsigned long *) ((char *) policy + numeric_settings[i].offset) = val;
+                break;
+            }
+        }
+        if (i < ARRAY_SIZE(numeric_settings)) {
+            /* done */
+        } else if (0 == strcmp(token, "prefix4") || 0 == strcmp(token, "prefix6")) {
+            if (val > ('4' == token[6] ? 32 : 128)) {
+                set_generic_error(error, "policy: invalid prefix length %lu for %s", val, token);
+                ok = false;
+            } else {
+                policy->prefix['4' == token[6] ? 0 : 1] = val;
+            }
+        } else if (0 == strcmp(token, "size")) {
+            if (val > POLICY_MAX_CAPACITY) {
+                set_generic_error(error, "policy: invalid size %lu, at most %lu", val, POLICY_MAX_CAPACITY);
+                ok = false;
+                break;
+            }
+            for (policy->capacity = POLICY_PROBES; policy->capacity < val; policy->capacity <<= 1)
+                ;
+        } else {
+            set_generic_error(error, "policy: unknown setting '%s'", token);
+            ok = false;
+        }
+    }
+    free(copy);
+
+    return ok;
+}
+
+/**
+ * Initialize policy from spec (see policy_parse), NULL for a policy which
+ * does nothing
+ **/
+bool policy_init(policy_t *policy, const char *spec, char **error)
+{
+    policy->factor = 1;
+    policy->max_ttl = 0;
+    policy->widen = 0;
+    policy->prefix[0] = 24;
+    policy->prefix[1] = 48;
+    policy->half_life = POLICY_DEFAULT_HALF_LIFE;
+    policy->capacity = POLICY_DEFAULT_CAPACITY;
+    policy->count = 0;
+    policy->counters = NULL;
+    policy->escalated = policy->widened = policy->evicted = 0;
+    if (NULL != spec && !policy_parse(policy, spec, error)) {
+        return false;
+    }
+    if (policy_enabled(policy) && NULL == (policy->counters = calloc(policy->capacity, sizeof(*policy->counters)))) {
+        set_calloc_error(error, policy->capacity, sizeof(*policy->counters));
+        return false;
+    }
+
+    return true;
+}
+
+bool policy_enabled(const policy_t *policy)
+{
+    return policy->factor > 1 || 0 != policy->widen;
+}
+
+/* FNV-1a */
+static size_t policy_hash(const addr_t *addr, uint8_t kind)
+{
+    size_t i;
+    uint32_t hash;
+    const uint8_t *p;
+
+    hash = ((2166136261U ^ addr->fa) * 16777619U ^ addr->netmask) * 16777619U ^ kind;
+    for (i = 0, p = (const uint8_t *) &addr->sa; i < ADDR_SIZE(addr); i++) {
+        hash = (hash ^ p[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+/**
+ * Bring the score of counter to now: halved every half_life seconds. The
+ * time which doesn't make a full step of the fractional part is kept for
+ * later (last doesn't always reach now), not to lose it on frequent
+ * updates.
+ **/
+static uint32_t counter_decay(const policy_t *policy, policy_counter_t *counter, uint64_t now)
+{
+    uint64_t elapsed, halvings, steps;
+
+    if (now <= counter->last) {
+        return counter->score;
+    }
+    elapsed = now - counter->last;
+    halvings = elapsed / policy->half_life;
+    steps = (elapsed % policy->half_life) * DECAY_STEPS / policy->half_life;
+    if (halvings >= 32) {
+        counter->score = 0;
+        counter->last = now;
+    } else {
+        counter->score = (uint32_t) (((uint64_t) (counter->score >> halvings) * decay[steps]) >> 16);
+        counter->last += halvings * policy->half_life + steps * policy->half_life / DECAY_STEPS;
+    }
+
+    return counter->score;
+}
+
+/**
+ * Find the counter of addr, or take a free one or the weakest of its
+ * neighbours for it
+ **/
+static policy_counter_t *policy_counter(policy_t *policy, const addr_t *addr, uint8_t kind, uint64_t now)
+{
+    size_t i, j;
+    policy_counter_t *victim;
+
+    victim = NULL;
+    for (i = policy_hash(addr, kind), j = 0; j < POLICY_PROBES; i++, j++) {
+        policy_counter_t *counter;
+
+        counter = &policy->counters[i & (policy->capacity - 1)];
+        if (COUNTER_EMPTY == counter->kind) {
+            if (NULL == victim || COUNTER_EMPTY != victim->kind) {
+                victim = counter;
+            }
+            continue;
+        }
+        if (kind == counter->kind && addr->fa == counter->addr.fa && addr->netmask == counter->addr.netmask && 0 == memcmp(&addr->sa, &counter->addr.sa, ADDR_SIZE(addr))) {
+            counter_decay(policy, counter, now);
+            return counter;
+        }
+        if (NULL == victim || (COUNTER_EMPTY != victim->kind && counter_decay(policy, counter, now) < counter_decay(policy, victim, now))) {
+            victim = counter;
+        }
+    }
+    if (COUNTER_EMPTY == victim->kind) {
+        ++policy->count;
+    } else {
+        ++policy->evicted;
+    }
+    victim->addr = *addr;
+    victim->kind = kind;
+    victim->score = 0;
+    victim->last = now;
+
+    return victim;
+}
+
+/**
+ * Count one more offense on counter
+ *
+ * @return the number of (decayed) offenses, this one included
+ **/
+static unsigned long counter_increment(policy_counter_t *counter)
+{
+    if (counter->score <= UINT32_MAX - SCORE_ONE) {
+        counter->score += SCORE_ONE;
+    }
+
+    return (counter->score + SCORE_ONE / 2) >> SCORE_SHIFT;
+}
+
+/**
+ * Count the ban of addr toward its prefix
+ *
+ * @param prefix set to the prefix including addr when true is returned
+ *
+ * @return true if the whole prefix should be banned instead of addr
+ **/
+bool policy_widen(policy_t *policy, const addr_t *addr, addr_t *prefix, uint64_t now)
+{
+    uint8_t length;
+
+    if (0 == policy->widen) {
+        return false;
+    }
+    length = policy->prefix[AF_INET == addr->fa ? 0 : 1];
+    if (addr->netmask <= length) {
+        return false;
+    }
+    *prefix = *addr;
+    prefix->netmask = length;
+    memset((uint8_t *) &prefix->sa + (length + 7) / 8, 0, sizeof(prefix->sa) - (length + 7) / 8);
+    if (0 != length % 8) {
+        ((uint8_t *) &prefix->sa)[length / 8] &= 0xFF << (8 - length % 8);
+    }
+    if (counter_increment(policy_counter(policy, prefix, COUNTER_PREFIX, now)) < policy->widen) {
+        return false;
+    }
+    ++policy->widened;
+
+    return true;
+}
+
+/**
+ * Count the ban of addr as an offense and escalate its duration
+ *
+ * @param ttl the duration of the ban requested (0 for ever)
+ *
+ * @return the duration to apply
+ **/
+unsigned long policy_ttl(policy_t *policy, const addr_t *addr, unsigned long ttl, uint64_t now)
+{
+    unsigned long offenses;
+
+    if (policy->factor <= 1 || 0 == ttl) {
+        return ttl;
+    }
+    offenses = counter_increment(policy_counter(policy, addr, COUNTER_OFFENSES, now));
+    if (offenses > 1) {
+        ++policy->escalated;
+        while (--offenses > 0 && (0 == policy->max_ttl || ttl < policy->max_ttl) && ttl <= ULONG_MAX / policy->factor) {
+            ttl *= policy->factor;
+        }
+    }
+    if (0 != policy->max_ttl && ttl > policy->max_ttl) {
+        ttl = policy->max_ttl;
+    }
+
+    return ttl;
+}
+
+void policy_free(policy_t *policy)
+{
+    free(policy->counters);
+    policy->counters = NULL;
+    policy->count = 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+
+typedef struct policy_counter_t policy_counter_t;
+
+/**
+ * What to do with an address beyond banning it, decided from its past:
+ * - escalation: the duration of the ban of a repeat offender is multiplied
+ *   by factor for each of its previous (recent) bans
+ * - widening: once widen addresses of the same prefix (/24, /48) were
+ *   recently banned, the whole prefix is banned instead of the next one
+ *
+ * The offenses of addresses and prefixes are counted in a table of fixed
+ * size. Counters decay (they are halved every half_life seconds) and, when
+ * the table is full, the weakest counter of the neighbourhood is evicted.
+ **/
+typedef struct {
+    unsigned long factor;    /* 1 to disable escalation */
+    unsigned long max_ttl;   /* upper limit of an escalated duration, 0 for none */
+    unsigned long widen;     /* 0 to disable widening */
+    uint8_t prefix[2];       /* length of the prefixes to widen to, for IPv4 and IPv6 */
+    unsigned long half_life; /* in seconds */
+    size_t capacity;         /* number of counters, a power of 2 */
+    size_t count;
+    policy_counter_t *counters;
+    unsigned long escalated, widened, evicted;
+} policy_t;
+
+bool policy_init(policy_t *, const char *, char **);
+bool policy_enabled(const policy_t *);
+bool policy_widen(policy_t *, const addr_t *, addr_t *, uint64_t);
+unsigned long policy_ttl(policy_t *, const addr_t *, unsigned long, uint64_t);
+void policy_free(policy_t *);
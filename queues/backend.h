@@ -0,0 +1,39 @@
+#pragma once
+
+#include "queue.h"
+
+/**
+ * An implementation of the queue API (see queue.h for the semantics of
+ * each operation), chosen by queue_open from the name of the queue.
+ *
+ * receive_timed, receive_many and send_many are optional: queue.c falls
+ * back to a wait on the descriptor of the queue (else polling it) and to
+ * receiving or sending one message at a time.
+ **/
+typedef struct {
+    const char *name;
+    void *(*init)(char **);
+    queue_err_t (*set_attribute)(void *, queue_attr_t, unsigned long);
+    bool (*open)(void *, const char *, int, char **);
+    queue_err_t (*get_attribute)(void *, queue_attr_t, unsigned long *);
+    int (*receive)(void *, char *, size_t, char **);
+    int (*try_receive)(void *, char *, size_t, char **);
+    int (*receive_timed)(void *, char *, size_t, long, char **);
+    int (*receive_many)(void *, char *, size_t, int *, int, bool, char **);
+    int (*get_fd)(void *);
+    bool (*send)(void *, const char *, int, char **);
+    int (*try_send)(void *, const char *, int, char **);
+    int (*send_many)(void *, const char * const *, const int *, int, char **);
+    bool (*close)(void **, char **);
+} queue_backend_t;
+
+#ifdef HAVE_POSIX_QUEUE
+extern const queue_backend_t posix_queue_backend;
+#endif /* HAVE_POSIX_QUEUE */
+#ifdef HAVE_SYSTEMV_QUEUE
+extern const queue_backend_t systemv_queue_backend;
+#endif /* HAVE_SYSTEMV_QUEUE */
+extern const queue_backend_t unix_queue_backend;
+#ifdef HAVE_SHM_QUEUE
+extern const queue_backend_t shm_queue_backend;
+#endif /* HAVE_SHM_QUEUE */
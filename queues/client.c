@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "queue.h"
+#include "client.h"
+
+static uint64_t client_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Write the key of a packed record (see record.h) to key: its family,
+ * prefix length and address
+ **/
+static void client_key(const char *packed, uint8_t *key)
+{
+    memcpy(key, packed + 2, 2);
+    memcpy(key + 2, packed + 12, 16);
+}
+
+/**
+ * Where key is remembered (FNV-1a, one address per slot: the last one
+ * wins)
+ **/
+static client_recent_t *client_slot(client_t *c, const uint8_t *key)
+{
+    size_t i;
+    uint32_t hash;
+
+    hash = 2166136261U;
+    for (i = 0; i < sizeof(c->recent[0].key); i++) {
+        hash = (hash ^ key[i]) * 16777619U;
+    }
+
+    return &c->recent[hash & (CLIENT_RECENT_SIZE - 1)];
+}
+
+/**
+ * Forget the addresses of the count packed records which were dropped:
+ * the next hit sends them again
+ **/
+static void client_forget(client_t *c, const char *records, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        uint8_t key[sizeof(c->recent[0].key)];
+        client_recent_t *slot;
+
+        if (RECORD_BAN != (uint8_t) records[i * RECORD_SIZE + 4]) {
+            continue;
+        }
+        client_key(records + i * RECORD_SIZE, key);
+        slot = client_slot(c, key);
+        if (0 == memcmp(slot->key, key, sizeof(key))) {
+            slot->key[0] = 0;
+        }
+    }
+}
+
+/**
+ * Send a message of count addresses (records is their packed form),
+ * without waiting for room with CLIENT_FL_NONBLOCK. Addresses which
+ * don't make it (queue full or failure) are forgotten.
+ **/
+static bool client_write(client_t *c, const char *message, size_t length, const char *records, size_t count, char **error)
+{
+    if (HAS_FLAG(c->flags, CLIENT_FL_NONBLOCK)) {
+        switch (queue_try_send(c->queue, message, length, error)) {
+            case -1:
+                client_forget(c, records, count);
+                return false;
+            case 0:
+                c->overflowed += count;
+                client_forget(c, records, count);
+                return true;
+        }
+    } else if (!queue_send(c->queue, message, length, error)) {
+        client_forget(c, records, count);
+        return false;
+    }
+    ++c->sent;
+
+    return true;
+}
+
+static bool client_flush_locked(client_t *c, char **error)
+{
+    bool ok;
+
+    ok = true;
+    if (0 != c->length) {
+        ok = client_write(c, c->buffer, c->length, c->buffer, c->length / RECORD_SIZE, error);
+        c->length = 0;
+    }
+
+    return ok;
+}
+
+/**
+ * The flusher thread: send the records held once they have waited for
+ * delay milliseconds, when no other address came in to send them along
+ **/
+static void *client_flusher(void *arg)
+{
+    client_t *c;
+
+    c = (client_t *) arg;
+    pthread_mutex_lock(&c->lock);
+    while (!c->stopping) {
+        uint64_t now;
+
+        now = client_now();
+        if (0 == c->length) {
+            pthread_cond_wait(&c->due, &c->lock);
+        } else if (now - c->held >= c->delay) {
+            /* nobody to report a failure to, the addresses will be sent again on the next hit */
+            client_flush_locked(c, NULL);
+        } else {
+            uint64_t deadline;
+            struct timespec ts;
+
+            deadline = c->held + c->delay;
+            ts.tv_sec = deadline / 1000;
+            ts.tv_nsec = (deadline % 1000) * 1000000;
+            pthread_cond_timedwait(&c->due, &c->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return NULL;
+}
+
+/**
+ * Open the queue name to send to it
+ *
+ * @param flags CLIENT_FL_BINARY and/or CLIENT_FL_NONBLOCK
+ **/
+bool client_open(client_t *c, const char *name, int flags, char **error)
+{
+    bool ok;
+
+    ok = false;
+    c->flags = flags;
+    c->window = CLIENT_DEFAULT_WINDOW;
+    c->delay = 0;
+    c->buffer = NULL;
+    c->length = c->size = 0;
+    c->held = 0;
+    c->flushing = c->stopping = false;
+    c->sent = c->suppressed = c->overflowed = 0;
+    memset(c->recent, 0, sizeof(c->recent));
+    do {
+        int err;
+        pthread_condattr_t attr;
+
+        if (NULL == (c->queue = queue_init(error))) {
+            break;
+        }
+        if (!queue_open(c->queue, name, QUEUE_FL_SENDER, error)) {
+            break;
+        }
+        if (HAS_FLAG(flags, CLIENT_FL_BINARY)) {
+            unsigned long size;
+
+            if (QUEUE_ERR_OK != queue_get_attribute(c->queue, QUEUE_ATTR_MAX_MESSAGE_SIZE, &size)) {
+                size = RECORD_SIZE;
+            }
+            if (0 == (c->size = size / RECORD_SIZE * RECORD_SIZE)) {
+                set_generic_error(error, "messages of the queue are too small (%lu bytes) for a record", size);
+                break;
+            }
+            if (NULL == (c->buffer = malloc(c->size))) {
+                set_malloc_error(error, c->size);
+                break;
+            }
+        }
+        if (0 != (err = pthread_mutex_init(&c->lock, NULL))) {
+            set_generic_error(error, "pthread_mutex_init failed: %s", strerror(err));
+            break;
+        }
+        /* held is on CLOCK_MONOTONIC, so are the deadlines of the flusher */
+        if (0 != (err = pthread_condattr_init(&attr))) {
+            set_generic_error(error, "pthread_condattr_init failed: %s", strerror(err));
+            pthread_mutex_destroy(&c->lock);
+            break;
+        }
+        if (0 == (err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC))) {
+            err = pthread_cond_init(&c->due, &attr);
+        }
+        pthread_condattr_destroy(&attr);
+        if (0 != err) {
+            set_generic_error(error, "pthread_cond_init failed: %s", strerror(err));
+            pthread_mutex_destroy(&c->lock);
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (!ok) {
+        free(c->buffer);
+        c->buffer = NULL;
+        if (NULL != c->queue) {
+            queue_close(&c->queue, NULL);
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Hold the records (CLIENT_FL_BINARY only) for up to delay milliseconds
+ * to send them together with the next ones: they are sent as soon as a
+ * message is full, else by a thread of the client once the first one has
+ * waited for delay milliseconds. (Set directly, without this thread,
+ * delay holds them until the buffer is full or client_flush.)
+ **/
+bool client_set_delay(client_t *c, unsigned long delay, char **error)
+{
+    int err;
+
+    pthread_mutex_lock(&c->lock);
+    c->delay = delay;
+    pthread_mutex_unlock(&c->lock);
+    if (0 == delay || c->flushing || !HAS_FLAG(c->flags, CLIENT_FL_BINARY)) {
+        return true;
+    }
+    if (0 != (err = pthread_create(&c->flusher, NULL, client_flusher, c))) {
+        set_generic_error(error, "pthread_create failed: %s", strerror(err));
+        return false;
+    }
+    c->flushing = true;
+
+    return true;
+}
+
+/**
+ * Send record, as message (its text form) without CLIENT_FL_BINARY
+ **/
+static bool client_submit(client_t *c, const record_t *record, const char *message, char **error)
+{
+    bool ok;
+    uint64_t now;
+    client_recent_t *slot;
+    char packed[RECORD_SIZE];
+    uint8_t key[sizeof(c->recent[0].key)];
+
+    if (!HAS_FLAG(c->flags, CLIENT_FL_BINARY)) {
+        if (NULL == message) {
+            set_generic_error(error, "a record can only be sent with CLIENT_FL_BINARY");
+            return false;
+        }
+        if (RECORD_UNBAN == record->action) {
+            set_generic_error(error, "an unban can only be sent as a binary record");
+            return false;
+        }
+    }
+    record_pack(record, packed);
+    client_key(packed, key);
+    now = client_now();
+    ok = true;
+    pthread_mutex_lock(&c->lock);
+    do {
+        slot = client_slot(c, key);
+        if (RECORD_BAN == record->action && 0 != c->window) {
+            if (0 == memcmp(slot->key, key, sizeof(key)) && now - slot->sent < c->window * 1000) {
+                ++c->suppressed;
+                break;
+            }
+            memcpy(slot->key, key, sizeof(key));
+            slot->sent = now;
+        } else if (RECORD_UNBAN == record->action && 0 == memcmp(slot->key, key, sizeof(key))) {
+            /* it can be banned again right away */
+            slot->key[0] = 0;
+        }
+        if (!HAS_FLAG(c->flags, CLIENT_FL_BINARY)) {
+            ok = client_write(c, message, strlen(message), packed, 1, error);
+            break;
+        }
+        if (0 == c->length) {
+            c->held = now;
+            if (c->flushing) {
+                pthread_cond_signal(&c->due);
+            }
+        }
+        memcpy(c->buffer + c->length, packed, RECORD_SIZE);
+        c->length += RECORD_SIZE;
+        if (c->length == c->size || now - c->held >= c->delay) {
+            ok = client_flush_locked(c, error);
+        }
+    } while (false);
+    pthread_mutex_unlock(&c->lock);
+
+    return ok;
+}
+
+/**
+ * Ban (or report or unban) an address
+ *
+ * @param message "[report |unban ]<address>[/<prefix>][ <ttl>]", unban
+ * requires CLIENT_FL_BINARY
+ *
+ * @return false on failure, an address suppressed or dropped (queue full)
+ * is not one
+ **/
+bool client_send(client_t *c, const char *message, char **error)
+{
+    record_t record;
+
+    if (!record_parse(&record, message, error)) {
+        return false;
+    }
+
+    return client_submit(c, &record, message, error);
+}
+
+/**
+ * Same as client_send for a record already parsed (CLIENT_FL_BINARY only)
+ **/
+bool client_send_record(client_t *c, const record_t *record, char **error)
+{
+    return client_submit(c, record, NULL, error);
+}
+
+/**
+ * Send the records held (binary only)
+ **/
+bool client_flush(client_t *c, char **error)
+{
+    bool ok;
+
+    pthread_mutex_lock(&c->lock);
+    ok = client_flush_locked(c, error);
+    pthread_mutex_unlock(&c->lock);
+
+    return ok;
+}
+
+/**
+ * Send the records held then close the queue
+ *
+ * @return false if the records held could not be sent
+ **/
+bool client_close(client_t *c, char **error)
+{
+    bool ok;
+
+    ok = true;
+    if (NULL != c->queue) {
+        if (c->flushing) {
+            pthread_mutex_lock(&c->lock);
+            c->stopping = true;
+            pthread_cond_signal(&c->due);
+            pthread_mutex_unlock(&c->lock);
+            pthread_join(c->flusher, NULL);
+            c->flushing = false;
+        }
+        ok = client_flush(c, error);
+        queue_close(&c->queue, NULL);
+        free(c->buffer);
+        c->buffer = NULL;
+        pthread_cond_destroy(&c->due);
+        pthread_mutex_destroy(&c->lock);
+    }
+
+    return ok;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+#define CLIENT_FL_BINARY   (1<<0) /* send binary records, several per message */
+#define CLIENT_FL_NONBLOCK (1<<1) /* never wait for room in the queue, count what is dropped instead */
+
+/* addresses remembered to suppress duplicates, a power of 2 */
+#define CLIENT_RECENT_SIZE 256
+
+/* default of window, in seconds */
+#define CLIENT_DEFAULT_WINDOW 10
+
+/**
+ * An address recently banned: family, prefix length then address, as in a
+ * record (see record.h), family is 0 for an empty slot
+ **/
+typedef struct {
+    uint8_t key[2 + 16];
+    uint64_t sent; /* when, in milliseconds (monotonic) */
+} client_recent_t;
+
+/**
+ * The sending side of a queue for the clients (the Apache module, the
+ * varnish vmod, banip-cli) on top of queue.h:
+ * - an address banned is not sent again for window seconds, it is
+ *   still banned (or being banned) anyway: a flood of hits from the same
+ *   address becomes a single message (reports are never suppressed, they
+ *   are counted by banipd)
+ * - with CLIENT_FL_BINARY, the addresses are packed as records, as many
+ *   per message as the queue allows, and held for delay milliseconds (see
+ *   client_set_delay) to be sent together with the next ones
+ * - with CLIENT_FL_NONBLOCK, a full queue doesn't stall the caller: the
+ *   addresses are dropped (and forgotten, to be sent on the next hit) and
+ *   counted in overflowed
+ *
+ * A client can be shared by several threads.
+ **/
+typedef struct {
+    void *queue;
+    int flags;
+    unsigned long window; /* in seconds, 0 to send every address */
+    unsigned long delay;  /* in milliseconds (see client_set_delay), 0 to send every address right away */
+    char *buffer;         /* records not sent yet (binary only) */
+    size_t length;
+    size_t size;          /* a message of the queue, as records */
+    uint64_t held;        /* when the first record of buffer was added, in milliseconds (monotonic) */
+    pthread_mutex_t lock;
+    pthread_cond_t due;   /* signaled to the flusher when records are held */
+    pthread_t flusher;    /* sends the records held once delay is over */
+    bool flushing;        /* the flusher is running */
+    bool stopping;        /* the flusher has to exit */
+    unsigned long sent;       /* messages */
+    unsigned long suppressed; /* addresses sent less than window seconds earlier */
+    unsigned long overflowed; /* addresses dropped (queue full) */
+    client_recent_t recent[CLIENT_RECENT_SIZE];
+} client_t;
+
+bool client_open(client_t *, const char *, int, char **);
+bool client_set_delay(client_t *, unsigned long, char **);
+bool client_send(client_t *, const char *, char **);
+bool client_send_record(client_t *, const record_t *, char **);
+bool client_flush(client_t *, char **);
+bool client_close(client_t *, char **);
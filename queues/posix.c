@@ -7,10 +7,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "config.h"
 #include "common.h"
-#include "queue.h"
+#include "backend.h"
 #include "capsicum.h"
 
 #define NOT_MQD_T ((mqd_t) -1)
@@ -27,7 +28,7 @@ typedef struct {
     struct mq_attr attr;
 } posix_queue_t;
 
-void *queue_init(char **error)
+static void *posix_init(char **error)
 {
     posix_queue_t *q;
 
@@ -61,7 +62,7 @@ void *queue_init(char **error)
     return q;
 }
 
-queue_err_t queue_set_attribute(void *p, queue_attr_t attr, unsigned long value)
+static queue_err_t posix_set_attribute(void *p, queue_attr_t attr, unsigned long value)
 {
     posix_queue_t *q;
 
@@ -84,7 +85,7 @@ queue_err_t queue_set_attribute(void *p, queue_attr_t attr, unsigned long value)
     return QUEUE_ERR_OK;
 }
 
-bool queue_open(void *p, const char *filename, int flags, char **error)
+static bool posix_open(void *p, const char *filename, int flags, char **error)
 {
     bool ok;
 
@@ -153,7 +154,7 @@ bool queue_open(void *p, const char *filename, int flags, char **error)
     return ok;
 }
 
-queue_err_t queue_get_attribute(void *p, queue_attr_t attr, unsigned long *value)
+static queue_err_t posix_get_attribute(void *p, queue_attr_t attr, unsigned long *value)
 {
     posix_queue_t *q;
 
@@ -172,7 +173,7 @@ queue_err_t queue_get_attribute(void *p, queue_attr_t attr, unsigned long *value
     return QUEUE_ERR_OK;
 }
 
-int queue_receive(void *p, char *buffer, size_t buffer_size, char **error)
+static int posix_receive(void *p, char *buffer, size_t buffer_size, char **error)
 {
     int read;
     posix_queue_t *q;
@@ -187,7 +188,65 @@ int queue_receive(void *p, char *buffer, size_t buffer_size, char **error)
     return read;
 }
 
-bool queue_send(void *p, const char *msg, int msg_len, char **error)
+static int posix_try_receive(void *p, char *buffer, size_t buffer_size, char **error)
+{
+    int read;
+    posix_queue_t *q;
+    struct timespec timeout;
+
+    q = (posix_queue_t *) p;
+    /* an absolute timeout already elapsed makes mq_timedreceive return immediately on an empty queue */
+    timeout.tv_sec = timeout.tv_nsec = 0;
+    if (-1 != (read = mq_timedreceive(q->mq, buffer, buffer_size, NULL, &timeout))) {
+        buffer[read] = '\0';
+    } else if (ETIMEDOUT == errno || EAGAIN == errno) {
+        read = 0;
+    } else {
+        set_system_error(error, "mq_timedreceive failed");
+    }
+
+    return read;
+}
+
+static int posix_receive_timed(void *p, char *buffer, size_t buffer_size, long timeout, char **error)
+{
+    int read;
+    posix_queue_t *q;
+    struct timespec deadline;
+
+    q = (posix_queue_t *) p;
+    /* the timeout of mq_timedreceive is an absolute time of CLOCK_REALTIME */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    if ((deadline.tv_nsec += (timeout % 1000) * 1000000) >= 1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000;
+    }
+    if (-1 != (read = mq_timedreceive(q->mq, buffer, buffer_size, NULL, &deadline))) {
+        buffer[read] = '\0';
+    } else if (ETIMEDOUT == errno || EAGAIN == errno || EINTR == errno) {
+        read = 0;
+    } else {
+        set_system_error(error, "mq_timedreceive failed");
+    }
+
+    return read;
+}
+
+static int posix_get_fd(void *p)
+{
+    posix_queue_t *q;
+
+    q = (posix_queue_t *) p;
+#ifdef __FreeBSD__
+    return mq_getfd_np(q->mq);
+#else
+    /* on Linux, a mqd_t is a file descriptor */
+    return (int) q->mq;
+#endif /* __FreeBSD__ */
+}
+
+static bool posix_send(void *p, const char *msg, int msg_len, char **error)
 {
     bool ok;
 
@@ -209,7 +268,29 @@ bool queue_send(void *p, const char *msg, int msg_len, char **error)
     return ok;
 }
 
-bool queue_close(void **p, char **error)
+static int posix_try_send(void *p, const char *msg, int msg_len, char **error)
+{
+    posix_queue_t *q;
+    struct timespec timeout;
+
+    q = (posix_queue_t *) p;
+    if (msg_len < 0) {
+        msg_len = strlen(msg);
+    }
+    /* as for posix_try_receive: a timeout already elapsed, mq_timedsend returns immediately on a full queue */
+    timeout.tv_sec = timeout.tv_nsec = 0;
+    if (0 != mq_timedsend(q->mq, msg, msg_len, 0, &timeout)) {
+        if (ETIMEDOUT == errno || EAGAIN == errno) {
+            return 0;
+        }
+        set_system_error(error, "mq_timedsend failed to send \"%.*s\"", msg_len, msg);
+        return -1;
+    }
+
+    return 1;
+}
+
+static bool posix_close(void **p, char **error)
 {
     bool ok;
 
@@ -242,3 +323,20 @@ bool queue_close(void **p, char **error)
 
     return ok;
 }
+
+const queue_backend_t posix_queue_backend = {
+    "posix",
+    posix_init,
+    posix_set_attribute,
+    posix_open,
+    posix_get_attribute,
+    posix_receive,
+    posix_try_receive,
+    posix_receive_timed,
+    NULL,
+    posix_get_fd,
+    posix_send,
+    posix_try_send,
+    NULL,
+    posix_close
+};
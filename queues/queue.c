@@ -0,0 +1,284 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "common.h"
+#include "backend.h"
+
+/* the attributes which can be set, indexed by queue_attr_t */
+#define QUEUE_ATTR_COUNT (QUEUE_ATTR_OVERSIZED + 1)
+
+typedef struct {
+    const queue_backend_t *backend; /* NULL until queue_open */
+    void *impl;
+    bool set[QUEUE_ATTR_COUNT];
+    unsigned long attributes[QUEUE_ATTR_COUNT]; /* values set before queue_open */
+} queue_t;
+
+static const struct {
+    const char *prefix;
+    const queue_backend_t *backend; /* NULL if not available on this system */
+} schemes[] = {
+#ifdef HAVE_POSIX_QUEUE
+    { "posix:", &posix_queue_backend },
+#else
+    { "posix:", NULL },
+#endif /* HAVE_POSIX_QUEUE */
+#ifdef HAVE_SYSTEMV_QUEUE
+    { "sysv:", &systemv_queue_backend },
+#else
+    { "sysv:", NULL },
+#endif /* HAVE_SYSTEMV_QUEUE */
+    { "unix:", &unix_queue_backend },
+#ifdef HAVE_SHM_QUEUE
+    { "shm:", &shm_queue_backend },
+#else
+    { "shm:", NULL },
+#endif /* HAVE_SHM_QUEUE */
+};
+
+void *queue_init(char **error)
+{
+    queue_t *q;
+
+    if (NULL == (q = malloc(sizeof(*q)))) {
+        set_malloc_error(error, sizeof(*q));
+    } else {
+        q->backend = NULL;
+        q->impl = NULL;
+        bzero(q->set, sizeof(q->set));
+    }
+
+    return q;
+}
+
+queue_err_t queue_set_attribute(void *p, queue_attr_t attr, unsigned long value)
+{
+    queue_t *q;
+
+    q = (queue_t *) p;
+    if (NULL != q->impl) {
+        return q->backend->set_attribute(q->impl, attr, value);
+    }
+    if (attr >= QUEUE_ATTR_COUNT) {
+        return QUEUE_ERR_NOT_SUPPORTED;
+    }
+    q->set[attr] = true;
+    q->attributes[attr] = value;
+
+    return QUEUE_ERR_OK;
+}
+
+bool queue_open(void *p, const char *name, int flags, char **error)
+{
+    size_t i;
+    queue_t *q;
+
+    q = (queue_t *) p;
+    /* without a scheme: POSIX, else System V, as before they were all built in */
+#if defined(HAVE_POSIX_QUEUE)
+    q->backend = &posix_queue_backend;
+#elif defined(HAVE_SYSTEMV_QUEUE)
+    q->backend = &systemv_queue_backend;
+#else
+    q->backend = NULL;
+#endif
+    for (i = 0; i < ARRAY_SIZE(schemes); i++) {
+        if (0 == strncmp(name, schemes[i].prefix, strlen(schemes[i].prefix))) {
+            q->backend = schemes[i].backend;
+            name += strlen(schemes[i].prefix);
+            break;
+        }
+    }
+    if (NULL == q->backend) {
+        set_generic_error(error, "no implementation available on this system for the queue \"%s\"", name);
+        return false;
+    }
+    if (NULL == (q->impl = q->backend->init(error))) {
+        return false;
+    }
+    for (i = 0; i < QUEUE_ATTR_COUNT; i++) {
+        if (q->set[i]) {
+            q->backend->set_attribute(q->impl, (queue_attr_t) i, q->attributes[i]); // TODO: check returned value
+        }
+    }
+
+    return q->backend->open(q->impl, name, flags, error);
+}
+
+queue_err_t queue_get_attribute(void *p, queue_attr_t attr, unsigned long *value)
+{
+    queue_t *q;
+
+    q = (queue_t *) p;
+    if (NULL == q->impl) {
+        return QUEUE_ERR_GENERAL_FAILURE;
+    }
+
+    return q->backend->get_attribute(q->impl, attr, value);
+}
+
+int queue_receive(void *p, char *buffer, size_t buffer_size, char **error)
+{
+    queue_t *q;
+
+    q = (queue_t *) p;
+
+    return q->backend->receive(q->impl, buffer, buffer_size, error);
+}
+
+int queue_try_receive(void *p, char *buffer, size_t buffer_size, char **error)
+{
+    queue_t *q;
+
+    q = (queue_t *) p;
+
+    return q->backend->try_receive(q->impl, buffer, buffer_size, error);
+}
+
+/**
+ * Default of queue_receive_timed: wait for the descriptor of the queue to
+ * be readable, without one (System V), try to receive every millisecond
+ **/
+int queue_receive_timed(void *p, char *buffer, size_t buffer_size, long timeout, char **error)
+{
+    int fd, read;
+    queue_t *q;
+    struct timespec now, deadline, interval;
+
+    q = (queue_t *) p;
+    if (timeout < 0) {
+        return q->backend->receive(q->impl, buffer, buffer_size, error);
+    }
+    if (NULL != q->backend->receive_timed) {
+        return q->backend->receive_timed(q->impl, buffer, buffer_size, timeout, error);
+    }
+    if (-1 != (fd = q->backend->get_fd(q->impl))) {
+        struct pollfd pfd;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (-1 == poll(&pfd, 1, timeout)) {
+            if (EINTR == errno) {
+                return 0;
+            }
+            set_system_error(error, "poll failed");
+            return -1;
+        }
+        /* 0 if nothing came in (or someone else took it) */
+        return q->backend->try_receive(q->impl, buffer, buffer_size, error);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    if ((deadline.tv_nsec += (timeout % 1000) * 1000000) >= 1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000;
+    }
+    interval.tv_sec = 0;
+    interval.tv_nsec = 1000000;
+    while (0 == (read = q->backend->try_receive(q->impl, buffer, buffer_size, error))) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+            break;
+        }
+        if (0 != nanosleep(&interval, NULL)) {
+            /* EINTR */
+            break;
+        }
+    }
+
+    return read;
+}
+
+int queue_receive_many(void *p, char *buffer, size_t buffer_size, int *lengths, int count, bool wait, char **error)
+{
+    int i;
+    queue_t *q;
+
+    q = (queue_t *) p;
+    if (NULL != q->backend->receive_many) {
+        return q->backend->receive_many(q->impl, buffer, buffer_size, lengths, count, wait, error);
+    }
+    for (i = 0; i < count; i++) {
+        int read;
+
+        if (0 == i && wait) {
+            read = q->backend->receive(q->impl, buffer, buffer_size, error);
+        } else {
+            read = q->backend->try_receive(q->impl, buffer + i * buffer_size, buffer_size, error);
+        }
+        if (-1 == read) {
+            /* report the failure only if nothing was received */
+            return 0 == i ? -1 : i;
+        }
+        if (0 == read && (0 != i || !wait)) {
+            break;
+        }
+        lengths[i] = read;
+    }
+
+    return i;
+}
+
+int queue_get_fd(void *p)
+{
+    queue_t *q;
+
+    q = (queue_t *) p;
+
+    return q->backend->get_fd(q->impl);
+}
+
+bool queue_send(void *p, const char *msg, int msg_len, char **error)
+{
+    queue_t *q;
+
+    q = (queue_t *) p;
+
+    return q->backend->send(q->impl, msg, msg_len, error);
+}
+
+int queue_try_send(void *p, const char *msg, int msg_len, char **error)
+{
+    queue_t *q;
+
+    q = (queue_t *) p;
+
+    return q->backend->try_send(q->impl, msg, msg_len, error);
+}
+
+int queue_send_many(void *p, const char * const *messages, const int *lengths, int count, char **error)
+{
+    int i;
+    queue_t *q;
+
+    q = (queue_t *) p;
+    if (NULL != q->backend->send_many) {
+        return q->backend->send_many(q->impl, messages, lengths, count, error);
+    }
+    for (i = 0; i < count; i++) {
+        if (!q->backend->send(q->impl, messages[i], lengths[i], error)) {
+            return 0 == i ? -1 : i;
+        }
+    }
+
+    return count;
+}
+
+bool queue_close(void **p, char **error)
+{
+    queue_t *q;
+
+    if (NULL != (q = (queue_t *) *p)) {
+        if (NULL != q->impl && !q->backend->close(&q->impl, error)) {
+            return false;
+        }
+        free(q);
+        *p = NULL;
+    }
+
+    return true;
+}
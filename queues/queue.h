@@ -13,14 +13,38 @@ typedef enum {
 } queue_err_t;
 
 typedef enum {
-    QUEUE_ATTR_MAX_QUEUE_SIZE,       // in bytes, System V only (even if for POSIX we can get it by: mq_msgsize * mq_maxmsg)
-    QUEUE_ATTR_MAX_MESSAGE_SIZE,     // in bytes, POSIX only
-    QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE, // POSIX only
+    QUEUE_ATTR_MAX_QUEUE_SIZE,       // in bytes, System V and unix sockets (SO_RCVBUF) only (even if for POSIX we can get it by: mq_msgsize * mq_maxmsg)
+    QUEUE_ATTR_MAX_MESSAGE_SIZE,     // in bytes, POSIX, unix sockets and shared memory (System V: read only, the size of a receive buffer for a receiver)
+    QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE, // POSIX and shared memory only
+    QUEUE_ATTR_FULL_POLICY,          // a queue_full_t, shared memory only (settable by a sender)
+    QUEUE_ATTR_DROPPED,              // messages dropped by the full policy (read only), shared memory only
+    QUEUE_ATTR_OVERSIZED,            // messages longer than the buffer of the receiver, dropped (read only), System V and unix sockets only
 } queue_attr_t;
 
+/**
+ * What queue_send does when the queue is full, instead of blocking
+ * (shared memory only, all of them count the messages dropped)
+ **/
+typedef enum {
+    QUEUE_FULL_DROP,      // drop the message and fail (the default)
+    QUEUE_FULL_OVERWRITE, // drop the oldest message queued to make room (this one if it stays reserved by a sender, as QUEUE_FULL_DROP)
+    QUEUE_FULL_COUNT,     // drop the message but succeed
+} queue_full_t;
+
 /**
  * Calls order:
  *   queue_init > queue_set_attribute* > queue_open > queue_send or queue_receive > queue_close
+ *
+ * The implementation is chosen by queue_open from the scheme prefixing the
+ * name of the queue (all the ones available are built in):
+ * - "posix:<name>": a POSIX queue
+ * - "sysv:<path>[:<id>]": a System V queue, its key derived from <path>
+ *   (created by the owner) and <id> (a character, 'b' by default)
+ * - "unix:<path>": a unix datagram socket bound to <path> by its owner
+ * - "shm:<name>": a ring in a POSIX shared memory object, senders never
+ *   block (see QUEUE_ATTR_FULL_POLICY)
+ * - no scheme: a POSIX queue, or a System V one if POSIX queues are not
+ *   available
  **/
 
 /**
@@ -33,6 +57,9 @@ void *queue_init(char **);
 /**
  * Set an attribute (a maximum size of an internal stuff)
  *
+ * Before queue_open, the value is only recorded (and QUEUE_ERR_OK
+ * returned): queue_open passes it on to the implementation.
+ *
  * Restrictions:
  * - only the owner of the queue can set an attribute
  * - attributes should be set between queue_init and queue_open as various queue internal sizes/lengths can't be
@@ -93,6 +120,66 @@ queue_err_t queue_get_attribute(void *, queue_attr_t, unsigned long *);
  **/
 int queue_receive(void *, char *, size_t, char **);
 
+/**
+ * Receive a message if one is immediately available (never blocks)
+ *
+ * @param queue
+ * @param buffer
+ * @param buffer_size
+ *
+ * @return -1 on failure, 0 if the queue is currently empty or the length of the message
+ **/
+int queue_try_receive(void *, char *, size_t, char **);
+
+/**
+ * Receive a message, waiting for one timeout milliseconds at most:
+ * mq_timedreceive for a POSIX queue, poll(2) for a unix socket, a wait on
+ * the futex with a timeout for shared memory, System V queues (neither
+ * timed nor pollable) are polled with IPC_NOWAIT every millisecond.
+ *
+ * @param queue
+ * @param buffer
+ * @param buffer_size
+ * @param timeout in milliseconds, 0 acts as queue_try_receive and a
+ * negative one as queue_receive
+ *
+ * @return -1 on failure, 0 if no message came in before the timeout (or a
+ * signal was caught while waiting) or the length of the message
+ **/
+int queue_receive_timed(void *, char *, size_t, long, char **);
+
+/**
+ * Receive several messages at once (a single recvmmsg for a unix socket,
+ * straight into each slot for a System V queue)
+ *
+ * @param queue
+ * @param buffer count consecutive slots of buffer_size bytes, the message
+ * i is written (and NUL terminated) at buffer + i * buffer_size
+ * @param buffer_size size of a slot
+ * @param lengths set to the length of each message
+ * @param count number of slots
+ * @param wait block until a first message is available (the following ones
+ * are only taken if immediately available)
+ *
+ * @return -1 on failure or the number of messages received (0 if none is
+ * immediately available and wait is false)
+ **/
+int queue_receive_many(void *, char *, size_t, int *, int, bool, char **);
+
+/**
+ * Get a file descriptor which becomes readable when a message is waiting,
+ * to multiplex several queues with poll(2), epoll or kqueue: a POSIX queue
+ * on Linux (a mqd_t is one) and FreeBSD (mq_getfd_np) or a unix socket.
+ * System V queues and shared memory have none.
+ *
+ * Note: should only be used after queue_open.
+ *
+ * @param queue
+ *
+ * @return the descriptor or -1 if the underlaying implementation has none
+ **/
+int queue_get_fd(void *);
+
 /**
  * Send a message
  *
@@ -104,6 +191,32 @@ int queue_receive(void *, char *, size_t, char **);
  **/
 bool queue_send(void *, const char *, int, char **);
 
+/**
+ * Send a message only if there is room for it in the queue right now
+ * (never blocks): a full shared memory queue applies its policy
+ * (QUEUE_ATTR_FULL_POLICY) but a message dropped is not sent (0)
+ *
+ * @param queue
+ * @param message
+ * @param message_len (-1 to compute it)
+ *
+ * @return -1 on failure, 0 if the queue is full or 1 if the message was sent
+ **/
+int queue_try_send(void *, const char *, int, char **);
+
+/**
+ * Send several messages at once (a single sendmmsg for a unix socket)
+ *
+ * @param queue
+ * @param messages
+ * @param lengths length of each message (-1 to compute it)
+ * @param count number of messages
+ *
+ * @return -1 on failure or the number of messages sent, the first ones
+ * (less than count if a failure occurred after some were sent)
+ **/
+int queue_send_many(void *, const char * const *, const int *, int, char **);
+
 /**
  * Close and deallocate the queue
  *
@@ -0,0 +1,160 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "record.h"
+
+/**
+ * Set the family, address and prefix length of record from an address,
+ * optionally followed by a prefix length (eg: "192.0.2.0/24"). As in a
+ * text message, a plain IPv4 address is a /32, a plain IPv6 address a /64.
+ * The bits outside the prefix are cleared.
+ **/
+bool record_set_addr(record_t *record, const char *string, char **error)
+{
+    const char *slash;
+    size_t i;
+    char copy[INET6_ADDRSTRLEN];
+    unsigned long prefix, maxlen;
+
+    if (NULL == (slash = strchr(string, '/'))) {
+        slash = string + strlen(string);
+    }
+    if ((size_t) (slash - string) >= sizeof(copy)) {
+        set_generic_error(error, "invalid address: %s", string);
+        return false;
+    }
+    memcpy(copy, string, slash - string);
+    copy[slash - string] = '\0';
+    memset(record->addr, 0, sizeof(record->addr));
+    if (1 == inet_pton(AF_INET, copy, record->addr)) {
+        record->family = 4;
+        maxlen = 32;
+    } else if (1 == inet_pton(AF_INET6, copy, record->addr)) {
+        record->family = 6;
+        maxlen = 128;
+    } else {
+        set_generic_error(error, "invalid address: %s", string);
+        return false;
+    }
+    prefix = 4 == record->family ? 32 : 64;
+    if ('/' == *slash) {
+        char *endptr;
+
+        prefix = strtoul(slash + 1, &endptr, 10);
+        if (endptr == slash + 1 || '\0' != *endptr || 0 == prefix || prefix > maxlen) {
+            set_generic_error(error, "prefix length between 1 and %lu expected, got: %s", maxlen, slash + 1);
+            return false;
+        }
+    }
+    record->prefix = (uint8_t) prefix;
+    for (i = prefix; i < maxlen; i++) {
+        record->addr[i / 8] &= ~(0x80 >> (i % 8));
+    }
+
+    return true;
+}
+
+/**
+ * Turn a text message into a record: "[report |unban ]<address>[/<prefix>][ <ttl>]"
+ **/
+bool record_parse(record_t *record, const char *message, char **error)
+{
+    const char *p;
+    char copy[INET6_ADDRSTRLEN + STR_LEN("/128")];
+
+    record->action = RECORD_BAN;
+    record->reason = 0;
+    record->source = 0;
+    record->ttl = RECORD_TTL_DEFAULT;
+    if (0 == strncmp(message, "report ", STR_LEN("report "))) {
+        record->action = RECORD_REPORT;
+        message += STR_LEN("report ");
+    } else if (0 == strncmp(message, "unban ", STR_LEN("unban "))) {
+        record->action = RECORD_UNBAN;
+        message += STR_LEN("unban ");
+    }
+    if (NULL == (p = strchr(message, ' '))) {
+        return record_set_addr(record, message, error);
+    } else {
+        char *endptr;
+        unsigned long ttl;
+
+        ttl = strtoul(p + 1, &endptr, 10);
+        if (endptr == p + 1 || '\0' != *endptr || ttl >= RECORD_TTL_DEFAULT) {
+            set_generic_error(error, "invalid duration: %s", p + 1);
+            return false;
+        }
+        record->ttl = ttl;
+        if ((size_t) (p - message) >= sizeof(copy)) {
+            set_generic_error(error, "invalid address: %.*s", (int) (p - message), message);
+            return false;
+        }
+        memcpy(copy, message, p - message);
+        copy[p - message] = '\0';
+
+        return record_set_addr(record, copy, error);
+    }
+}
+
+/**
+ * Write record, as RECORD_SIZE bytes, to buffer
+ **/
+void record_pack(const record_t *record, char *buffer)
+{
+    uint8_t *p;
+
+    p = (uint8_t *) buffer;
+    p[0] = RECORD_MAGIC;
+    p[1] = RECORD_VERSION;
+    p[2] = record->family;
+    p[3] = record->prefix;
+    p[4] = record->action;
+    p[5] = record->reason;
+    p[6] = record->source >> 8;
+    p[7] = record->source & 0xFF;
+    p[8] = record->ttl >> 24;
+    p[9] = (record->ttl >> 16) & 0xFF;
+    p[10] = (record->ttl >> 8) & 0xFF;
+    p[11] = record->ttl & 0xFF;
+    memcpy(p + 12, record->addr, sizeof(record->addr));
+}
+
+/**
+ * Read a record from the RECORD_SIZE bytes of buffer and check it
+ **/
+bool record_unpack(const char *buffer, record_t *record, char **error)
+{
+    const uint8_t *p;
+
+    p = (const uint8_t *) buffer;
+    if (RECORD_MAGIC != p[0] || RECORD_VERSION != p[1]) {
+        set_generic_error(error, "record of an unknown version (%u)", RECORD_MAGIC == p[0] ? p[1] : 0);
+        return false;
+    }
+    record->family = p[2];
+    record->prefix = p[3];
+    record->action = p[4];
+    record->reason = p[5];
+    record->source = (uint16_t) (p[6] << 8 | p[7]);
+    record->ttl = (uint32_t) p[8] << 24 | (uint32_t) p[9] << 16 | (uint32_t) p[10] << 8 | p[11];
+    memcpy(record->addr, p + 12, sizeof(record->addr));
+    if (4 != record->family && 6 != record->family) {
+        set_generic_error(error, "record of an unknown family (%u)", record->family);
+        return false;
+    }
+    if (0 == record->prefix || record->prefix > (4 == record->family ? 32 : 128)) {
+        set_generic_error(error, "record of an invalid prefix length (%u)", record->prefix);
+        return false;
+    }
+    if (record->action > RECORD_REPORT) {
+        set_generic_error(error, "record of an unknown action (%u)", record->action);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Binary form of a message: one or more records of RECORD_SIZE bytes,
+ * back to back, each one laid out as follows (integers of several bytes
+ * in network byte order):
+ *
+ *    0  magic (RECORD_MAGIC, which can't be the first byte of a text message)
+ *    1  version (RECORD_VERSION)
+ *    2  family (4 or 6)
+ *    3  prefix length (32 for an IPv4 address, 64 for an IPv6 one, as in
+ *       a text message)
+ *    4  action (RECORD_BAN, RECORD_UNBAN or RECORD_REPORT)
+ *    5  reason (a code free for the senders)
+ *    6  source (2 bytes, a tag free for the senders)
+ *    8  ttl (4 bytes, in seconds, 0 for a permanent ban, RECORD_TTL_DEFAULT
+ *       for the default of the queue)
+ *   12  address (16 bytes, an IPv4 one in the first 4)
+ **/
+#define RECORD_MAGIC 0xBA
+#define RECORD_VERSION 1
+#define RECORD_SIZE 28
+#define RECORD_TTL_DEFAULT UINT32_MAX
+
+#define RECORD_IS_BINARY(message, length) \
+    ((length) > 0 && RECORD_MAGIC == (uint8_t) (message)[0])
+
+enum {
+    RECORD_BAN,
+    RECORD_UNBAN,
+    RECORD_REPORT,
+};
+
+typedef struct {
+    uint8_t family;
+    uint8_t prefix;
+    uint8_t action;
+    uint8_t reason;
+    uint16_t source;
+    uint32_t ttl;
+    uint8_t addr[16];
+} record_t;
+
+bool record_set_addr(record_t *, const char *, char **);
+bool record_parse(record_t *, const char *, char **);
+void record_pack(const record_t *, char *);
+bool record_unpack(const char *, record_t *, char **);
@@ -0,0 +1,576 @@
+#include <sys/param.h> /* __FreeBSD__ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#elif defined(__FreeBSD__)
+# include <sys/umtx.h>
+#endif
+
+#include "config.h"
+#include "common.h"
+#include "backend.h"
+
+#define SHM_MAGIC 0x62616E71 /* "banq" */
+#define SHM_VERSION 1
+
+/* assumed size of a cache line, to keep apart what each side writes */
+#define SHM_CACHE_LINE 64
+
+/* bounds of the attributes, for a mapping of a sane size */
+#define SHM_MAX_MESSAGE_SIZE 65536
+#define SHM_MAX_CAPACITY (1 << 20)
+
+/* attempts of QUEUE_FULL_OVERWRITE to make room before dropping the message instead */
+#define SHM_OVERWRITE_RETRIES 64
+
+/**
+ * Beginning of the shared memory object, the slots follow it (at
+ * SHM_SLOTS_OFFSET). Producers only write head (and slots they have
+ * reserved), the consumer only writes tail, except a producer which
+ * overwrites the oldest message (QUEUE_FULL_OVERWRITE).
+ **/
+typedef struct {
+    uint32_t magic; /* written last by the owner, once the ring is ready */
+    uint32_t version;
+    uint32_t capacity; /* slots, a power of 2 */
+    uint32_t msgsize;
+    uint32_t slot_size; /* in bytes, its header included */
+    uint32_t sleeping; /* futex word: 1 while the consumer waits (or is about to) */
+    uint64_t dropped; /* messages dropped by the full policy */
+    char unused1[SHM_CACHE_LINE];
+    uint64_t head; /* next slot to reserve, producers side */
+    char unused2[SHM_CACHE_LINE];
+    uint64_t tail; /* next slot to read, consumer side */
+    char unused3[SHM_CACHE_LINE];
+} shm_header_t;
+
+#define SHM_SLOTS_OFFSET \
+    ((sizeof(shm_header_t) + SHM_CACHE_LINE - 1) & ~(size_t) (SHM_CACHE_LINE - 1))
+
+/**
+ * A slot is free for the producer reserving position pos when its
+ * sequence is pos, holds a message for the consumer at pos when it is
+ * pos + 1 and is given back as pos + capacity (bounded MPMC queue of
+ * D. Vyukov)
+ **/
+typedef struct {
+    uint64_t sequence;
+    uint32_t length;
+    char data[];
+} shm_slot_t;
+
+typedef struct {
+    char *name; /* owner only */
+    shm_header_t *header;
+    char *slots;
+    size_t size; /* of the mapping */
+    /* our own copies, the shared ones could be overwritten by any sender */
+    uint32_t capacity;
+    uint32_t msgsize;
+    uint32_t slot_size;
+    queue_full_t policy;
+} shm_queue_t;
+
+#define SLOT(q, pos) \
+    ((shm_slot_t *) ((q)->slots + ((pos) & ((q)->capacity - 1)) * (q)->slot_size))
+
+static void *shm_init(char **error)
+{
+    shm_queue_t *q;
+
+    if (NULL == (q = malloc(sizeof(*q)))) {
+        set_malloc_error(error, sizeof(*q));
+    } else {
+        q->name = NULL;
+        q->header = NULL;
+        q->slots = NULL;
+        q->size = 0;
+        q->capacity = 1024;
+        q->msgsize = 1024;
+        q->slot_size = 0;
+        q->policy = QUEUE_FULL_DROP;
+    }
+
+    return q;
+}
+
+static queue_err_t shm_set_attribute(void *p, queue_attr_t attr, unsigned long value)
+{
+    shm_queue_t *q;
+
+    q = (shm_queue_t *) p;
+    if (QUEUE_ATTR_FULL_POLICY == attr) {
+        if (value > QUEUE_FULL_COUNT) {
+            return QUEUE_ERR_NOT_SUPPORTED;
+        }
+        q->policy = (queue_full_t) value;
+        return QUEUE_ERR_OK;
+    }
+    if (NULL != q->header) {
+        return QUEUE_ERR_NOT_OWNER;
+    }
+    switch (attr) {
+        case QUEUE_ATTR_MAX_MESSAGE_SIZE:
+            if (0 == value || value > SHM_MAX_MESSAGE_SIZE) {
+                return QUEUE_ERR_NOT_SUPPORTED;
+            }
+            q->msgsize = value;
+            break;
+        case QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE:
+            if (0 == value || value > SHM_MAX_CAPACITY) {
+                return QUEUE_ERR_NOT_SUPPORTED;
+            }
+            for (q->capacity = 1; q->capacity < value; q->capacity <<= 1)
+                ;
+            break;
+        default:
+            return QUEUE_ERR_NOT_SUPPORTED;
+    }
+
+    return QUEUE_ERR_OK;
+}
+
+static bool shm_open_queue(void *p, const char *name, int flags, char **error)
+{
+    int fd;
+    bool ok;
+
+    ok = false;
+    fd = -1;
+    do {
+        void *map;
+        shm_queue_t *q;
+
+        q = (shm_queue_t *) p;
+        if (HAS_FLAG(flags, QUEUE_FL_OWNER)) {
+            uint32_t i;
+            mode_t oldmask;
+
+            q->slot_size = (sizeof(shm_slot_t) + q->msgsize + 7) & ~7U;
+            q->size = SHM_SLOTS_OFFSET + (size_t) q->capacity * q->slot_size;
+            oldmask = umask(0);
+            if (-1 == (fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660)) && EEXIST == errno) {
+                /* left by a previous owner which could not unlink it (privileges dropped): start afresh, senders have to open it again */
+                shm_unlink(name);
+                fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+            }
+            umask(oldmask);
+            if (-1 == fd) {
+                set_system_error(error, "shm_open(\"%s\", O_RDWR | O_CREAT | O_EXCL, 0660) failed", name);
+                break;
+            }
+            if (NULL == (q->name = strdup(name))) {
+                set_generic_error(error, "strdup failed to copy \"%s\"", name);
+                shm_unlink(name);
+                break;
+            }
+            if (0 != ftruncate(fd, q->size)) {
+                set_system_error(error, "ftruncate(\"%s\", %zu) failed", name, q->size);
+                break;
+            }
+            if (MAP_FAILED == (map = mmap(NULL, q->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
+                set_system_error(error, "mmap of \"%s\" failed", name);
+                break;
+            }
+            q->header = (shm_header_t *) map;
+            q->slots = (char *) map + SHM_SLOTS_OFFSET;
+            q->header->version = SHM_VERSION;
+            q->header->capacity = q->capacity;
+            q->header->msgsize = q->msgsize;
+            q->header->slot_size = q->slot_size;
+            for (i = 0; i < q->capacity; i++) {
+                SLOT(q, i)->sequence = i;
+            }
+            __atomic_store_n(&q->header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+        } else if (HAS_FLAG(flags, QUEUE_FL_SENDER)) {
+            struct stat st;
+            shm_header_t *header;
+
+            if (-1 == (fd = shm_open(name, O_RDWR, 0))) {
+                set_system_error(error, "shm_open(\"%s\", O_RDWR) failed", name);
+                break;
+            }
+            if (0 != fstat(fd, &st)) {
+                set_system_error(error, "fstat of \"%s\" failed", name);
+                break;
+            }
+            if ((size_t) st.st_size < SHM_SLOTS_OFFSET) {
+                set_generic_error(error, "\"%s\" is not a queue (or not yet)", name);
+                break;
+            }
+            q->size = st.st_size;
+            if (MAP_FAILED == (map = mmap(NULL, q->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
+                set_system_error(error, "mmap of \"%s\" failed", name);
+                break;
+            }
+            header = (shm_header_t *) map;
+            q->capacity = header->capacity;
+            q->msgsize = header->msgsize;
+            q->slot_size = header->slot_size;
+            if (SHM_MAGIC != __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) || SHM_VERSION != header->version
+                || 0 == q->capacity || 0 != (q->capacity & (q->capacity - 1)) || q->slot_size < sizeof(shm_slot_t) + q->msgsize
+                || q->size < SHM_SLOTS_OFFSET + (size_t) q->capacity * q->slot_size
+            ) {
+                set_generic_error(error, "\"%s\" is not a queue (or not yet)", name);
+                munmap(map, q->size);
+                break;
+            }
+            q->header = header;
+            q->slots = (char *) map + SHM_SLOTS_OFFSET;
+        } else {
+            set_generic_error(error, "only the owner of \"%s\" can receive from it", name);
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (-1 != fd) {
+        /* the mapping is enough */
+        close(fd);
+    }
+
+    return ok;
+}
+
+static queue_err_t shm_get_attribute(void *p, queue_attr_t attr, unsigned long *value)
+{
+    shm_queue_t *q;
+
+    q = (shm_queue_t *) p;
+    switch (attr) {
+        case QUEUE_ATTR_MAX_QUEUE_SIZE:
+            *value = q->size;
+            break;
+        case QUEUE_ATTR_MAX_MESSAGE_SIZE:
+            *value = q->msgsize;
+            break;
+        case QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE:
+            *value = q->capacity;
+            break;
+        case QUEUE_ATTR_FULL_POLICY:
+            *value = q->policy;
+            break;
+        case QUEUE_ATTR_DROPPED:
+            if (NULL == q->header) {
+                return QUEUE_ERR_GENERAL_FAILURE;
+            }
+            *value = __atomic_load_n(&q->header->dropped, __ATOMIC_RELAXED);
+            break;
+        default:
+            return QUEUE_ERR_NOT_SUPPORTED;
+    }
+
+    return QUEUE_ERR_OK;
+}
+
+/**
+ * Take the oldest message into buffer (longer than buffer_size - 1 bytes,
+ * it is truncated), or drop it if buffer is NULL
+ *
+ * @return its length or -1 if there is none
+ **/
+static int shm_take(shm_queue_t *q, char *buffer, size_t buffer_size)
+{
+    uint64_t pos;
+    uint32_t length;
+    shm_slot_t *slot;
+
+    pos = __atomic_load_n(&q->header->tail, __ATOMIC_RELAXED);
+    while (1) {
+        int64_t dif;
+
+        slot = SLOT(q, pos);
+        dif = (int64_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (0 == dif) {
+            /* on failure, pos is updated to the current tail */
+            if (__atomic_compare_exchange_n(&q->header->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            /* empty (or the oldest message is still being written) */
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->header->tail, __ATOMIC_RELAXED);
+        }
+    }
+    length = slot->length;
+    if (length > q->msgsize) {
+        length = q->msgsize;
+    }
+    if (NULL != buffer) {
+        if (length > buffer_size - 1) {
+            length = buffer_size - 1;
+        }
+        memcpy(buffer, slot->data, length);
+        buffer[length] = '\0';
+    }
+    __atomic_store_n(&slot->sequence, pos + q->capacity, __ATOMIC_RELEASE);
+
+    return (int) length;
+}
+
+static bool shm_empty(shm_queue_t *q)
+{
+    uint64_t pos;
+
+    pos = __atomic_load_n(&q->header->tail, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&SLOT(q, pos)->sequence, __ATOMIC_ACQUIRE) != pos + 1;
+}
+
+/**
+ * Sleep while the futex word sleeping is 1, for timeout (less than a
+ * second) nanoseconds at most
+ **/
+static void shm_sleep(shm_queue_t *q, long timeout_ns)
+{
+    struct timespec timeout;
+
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = timeout_ns;
+#if defined(__linux__)
+    /* not FUTEX_PRIVATE_FLAG: the word is shared between processes */
+    syscall(SYS_futex, &q->header->sleeping, FUTEX_WAIT, 1, &timeout, NULL, 0);
+#elif defined(__FreeBSD__)
+    _umtx_op(&q->header->sleeping, UMTX_OP_WAIT_UINT, 1, NULL, &timeout);
+#else
+    /* no futex: poll the ring */
+    if (timeout.tv_nsec > 1000000) {
+        timeout.tv_nsec = 1000000;
+    }
+    (void) q;
+    nanosleep(&timeout, NULL);
+#endif
+}
+
+/**
+ * Wake the consumer up if it is sleeping (or about to sleep) in
+ * shm_receive: the only time a producer enters the kernel. The full
+ * barrier orders the publication of the message before the check of the
+ * flag, as shm_receive does the opposite.
+ **/
+static void shm_wake(shm_queue_t *q)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 != __atomic_load_n(&q->header->sleeping, __ATOMIC_RELAXED) && 0 != __atomic_exchange_n(&q->header->sleeping, 0, __ATOMIC_SEQ_CST)) {
+#if defined(__linux__)
+        syscall(SYS_futex, &q->header->sleeping, FUTEX_WAKE, 1, NULL, NULL, 0);
+#elif defined(__FreeBSD__)
+        _umtx_op(&q->header->sleeping, UMTX_OP_WAKE, 1, NULL, NULL);
+#endif
+    }
+}
+
+static int shm_receive(void *p, char *buffer, size_t buffer_size, char **UNUSED(error))
+{
+    int read;
+    shm_queue_t *q;
+
+    q = (shm_queue_t *) p;
+    while (-1 == (read = shm_take(q, buffer, buffer_size))) {
+        __atomic_store_n(&q->header->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (shm_empty(q)) {
+            shm_sleep(q, 999999999);
+            /* a futex wait is not a cancellation point, poll(2) is: a thread waiting here can still be cancelled */
+            poll(NULL, 0, 0);
+        }
+        __atomic_store_n(&q->header->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return read;
+}
+
+static int shm_receive_timed(void *p, char *buffer, size_t buffer_size, long timeout, char **UNUSED(error))
+{
+    int read;
+    shm_queue_t *q;
+    struct timespec now, deadline;
+
+    q = (shm_queue_t *) p;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    if ((deadline.tv_nsec += (timeout % 1000) * 1000000) >= 1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (-1 == (read = shm_take(q, buffer, buffer_size))) {
+        int64_t left;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((left = (int64_t) (deadline.tv_sec - now.tv_sec) * 1000000000 + deadline.tv_nsec - now.tv_nsec) <= 0) {
+            read = 0;
+            break;
+        }
+        if (left > 999999999) {
+            left = 999999999;
+        }
+        __atomic_store_n(&q->header->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (shm_empty(q)) {
+            shm_sleep(q, left);
+        }
+        __atomic_store_n(&q->header->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return read;
+}
+
+static int shm_try_receive(void *p, char *buffer, size_t buffer_size, char **UNUSED(error))
+{
+    int read;
+
+    if (-1 == (read = shm_take((shm_queue_t *) p, buffer, buffer_size))) {
+        read = 0;
+    }
+
+    return read;
+}
+
+static int shm_get_fd(void *UNUSED(p))
+{
+    /* the consumer waits on a futex, not a file descriptor */
+    return -1;
+}
+
+/**
+ * Reserve a slot (atomically, without any lock) and write the message
+ * into it. Never blocks: when the queue is full, the policy decides.
+ *
+ * @return -1 on failure, 0 if the message was dropped (queue full) or 1
+ **/
+static int shm_put(shm_queue_t *q, const char *msg, int msg_len, char **error)
+{
+    uint64_t pos;
+    int retries;
+    shm_slot_t *slot;
+
+    if (msg_len < 0) {
+        msg_len = strlen(msg);
+    }
+    if ((uint32_t) msg_len > q->msgsize) {
+        set_generic_error(error, "message \"%.*s\" too long (%d > %u)", msg_len, msg, msg_len, q->msgsize);
+        return -1;
+    }
+    retries = 0;
+    pos = __atomic_load_n(&q->header->head, __ATOMIC_RELAXED);
+    while (1) {
+        int64_t dif;
+
+        slot = SLOT(q, pos);
+        dif = (int64_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (0 == dif) {
+            if (__atomic_compare_exchange_n(&q->header->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            /* full */
+            if (QUEUE_FULL_OVERWRITE == q->policy && ++retries <= SHM_OVERWRITE_RETRIES) {
+                /* fails while the oldest slot is reserved but not written yet (or never will be: its sender died) */
+                if (-1 != shm_take(q, NULL, 0)) {
+                    __atomic_add_fetch(&q->header->dropped, 1, __ATOMIC_RELAXED);
+                }
+            } else {
+                __atomic_add_fetch(&q->header->dropped, 1, __ATOMIC_RELAXED);
+                return 0;
+            }
+            pos = __atomic_load_n(&q->header->head, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&q->header->head, __ATOMIC_RELAXED);
+        }
+    }
+    slot->length = msg_len;
+    memcpy(slot->data, msg, msg_len);
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    shm_wake(q);
+
+    return 1;
+}
+
+static bool shm_send(void *p, const char *msg, int msg_len, char **error)
+{
+    shm_queue_t *q;
+
+    q = (shm_queue_t *) p;
+    switch (shm_put(q, msg, msg_len, error)) {
+        case 0:
+            if (QUEUE_FULL_COUNT == q->policy) {
+                return true;
+            }
+            if (msg_len < 0) {
+                msg_len = strlen(msg);
+            }
+            set_generic_error(error, "queue full, \"%.*s\" dropped", msg_len, msg);
+            return false;
+        case 1:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int shm_try_send(void *p, const char *msg, int msg_len, char **error)
+{
+    return shm_put((shm_queue_t *) p, msg, msg_len, error);
+}
+
+static bool shm_close(void **p, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        if (NULL != *p) {
+            shm_queue_t *q;
+
+            q = (shm_queue_t *) *p;
+            if (NULL != q->header) {
+                if (0 != munmap(q->header, q->size)) {
+                    set_system_error(error, "munmap failed");
+                    break;
+                }
+                q->header = NULL;
+            }
+            if (NULL != q->name) { // we are the owner
+                if (0 != shm_unlink(q->name)) {
+                    set_system_error(error, "shm_unlink(\"%s\") failed", q->name);
+                    break;
+                }
+                free(q->name);
+                q->name = NULL;
+            }
+            free(*p);
+            *p = NULL;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+const queue_backend_t shm_queue_backend = {
+    "shm",
+    shm_init,
+    shm_set_attribute,
+    shm_open_queue,
+    shm_get_attribute,
+    shm_receive,
+    shm_try_receive,
+    shm_receive_timed,
+    NULL,
+    shm_get_fd,
+    shm_send,
+    shm_try_send,
+    NULL,
+    shm_close
+};
@@ -12,7 +12,7 @@
 
 #include "config.h"
 #include "common.h"
-#include "queue.h"
+#include "backend.h"
 #include "capsicum.h"
 
 /*
@@ -22,14 +22,22 @@ struct msgbuf {
 };
 */
 
+/**
+ * Messages are received in place, straight into the buffer of the caller,
+ * which thus has to hold a struct msgbuf: mtype then the message, shifted
+ * afterwards to the start of the buffer.
+ **/
+#define SYSTEMV_HEADER_SIZE sizeof(long)
+
 typedef struct {
     int qid;
-    char *buffer; /* emulate a struct *msgbuf, the real buffer to read or write is the mtext field, ie buffer + sizeof(long) */
+    char *buffer; /* to send only, emulate a struct *msgbuf, the real buffer to write is the mtext field, ie buffer + SYSTEMV_HEADER_SIZE */
     char *filename;
-    size_t buffer_size;
+    size_t buffer_size; /* maximum length of a message (mtext) */
+    unsigned long oversized; /* messages too long for the buffer of the receiver, dropped */
 } systemv_queue_t;
 
-void *queue_init(char **error)
+static void *systemv_init(char **error)
 {
     systemv_queue_t *q;
 
@@ -38,13 +46,14 @@ void *queue_init(char **error)
     } else {
         q->qid = -1;
         q->buffer_size = 0;
+        q->oversized = 0;
         q->filename = q->buffer = NULL;
     }
 
     return q;
 }
 
-queue_err_t queue_set_attribute(void *p, queue_attr_t UNUSED(attr), unsigned long UNUSED(value))
+static queue_err_t systemv_set_attribute(void *p, queue_attr_t UNUSED(attr), unsigned long UNUSED(value))
 {
     systemv_queue_t *q;
 
@@ -69,7 +78,35 @@ queue_err_t queue_set_attribute(void *p, queue_attr_t UNUSED(attr), unsigned lon
     return QUEUE_ERR_OK;
 }
 
-bool queue_open(void *p, const char *name, int flags, char **error)
+/**
+ * Split name, "<path>[:<id>]", into the path of the file the key is
+ * derived from and the id, a character (default: 'b')
+ *
+ * @param filename where to copy the path, size bytes long
+ **/
+static bool systemv_parse_name(const char *name, char *filename, size_t size, int *id, char **error)
+{
+    const char *s;
+
+    if (NULL == (s = strchr(name, ':')) || '\0' == s[1]) {
+        *id = 'b';
+        if (NULL == s) {
+            s = name + strlen(name);
+        }
+    } else {
+        *id = s[1];
+    }
+    if ((size_t) (s - name) >= size) {
+        set_buffer_overflow_error(error, name, filename, size);
+        return false;
+    }
+    memcpy(filename, name, s - name);
+    filename[s - name] = '\0';
+
+    return true;
+}
+
+static bool systemv_open(void *p, const char *name, int flags, char **error)
 {
     bool ok;
 
@@ -81,24 +118,13 @@ bool queue_open(void *p, const char *name, int flags, char **error)
         mode_t oldmask;
         systemv_queue_t *q;
         struct msqid_ds buf;
-        char *s, filename[MAXPATHLEN];
+        char filename[MAXPATHLEN];
 
         q = (systemv_queue_t *) p;
+        if (!systemv_parse_name(name, filename, STR_SIZE(filename), &id, error)) {
+            break;
+        }
         if (HAS_FLAG(flags, QUEUE_FL_OWNER)) {
-            if (NULL == (s = strchr(name, ':')) || '\0' == *s) {
-                id = 'b';
-                if (strlcpy(filename, name, STR_SIZE(filename)) >= STR_SIZE(filename)) {
-                    set_buffer_overflow_error(error, name, filename, STR_SIZE(filename));
-                    break;
-                }
-            } else {
-                id = s[1];
-                if (s - name >= STR_SIZE(filename)) {
-                    set_buffer_overflow_error(error, name, filename, STR_SIZE(filename));
-                    break;
-                }
-                strncpy(filename, name, s - name);
-            }
             if (NULL == (fp = fopen(filename, "wx"))) {
                 set_system_error(error, "fopen(\"%s\", \"wx\") failed", filename);
                 break;
@@ -109,15 +135,12 @@ bool queue_open(void *p, const char *name, int flags, char **error)
             }
             fflush(fp);
         } else {
-            if (strlcpy(filename, name, STR_SIZE(filename)) >= STR_SIZE(filename)) {
-                set_buffer_overflow_error(error, name, filename, STR_SIZE(filename));
-                break;
-            }
+            /* the id the queue was created with is in the file */
             if (NULL == (fp = fopen(filename, "r"))) {
                 set_system_error(error, "fopen(\"%s\", \"r\") failed", filename);
                 break;
             }
-            if (1 != fread(&id, sizeof(id), 1, fp) < sizeof(id)) {
+            if (1 != fread(&id, sizeof(id), 1, fp)) {
                 set_system_error(error, "fread from '%s' failed", filename);
                 break;
             }
@@ -165,26 +188,28 @@ https://svnweb.freebsd.org/base/head/sys/kern/sysv_msg.c?revision=282213&view=ma
             set_system_error(error, "msgctl(%d, IPC_STAT, %p) failed", q->qid, &buf);
             break;
         }
+        /* a message sent only takes its own length of msg_qbytes */
         q->buffer_size = buf.msg_qbytes / 8;
-        if (NULL == (q->buffer = malloc(sizeof(long) + sizeof(q->buffer) * q->buffer_size))) {
-            set_malloc_error(error, sizeof(long) + sizeof(q->buffer) * q->buffer_size);
-            break;
+        if (HAS_FLAG(flags, QUEUE_FL_SENDER)) {
+            if (NULL == (q->buffer = malloc(SYSTEMV_HEADER_SIZE + q->buffer_size))) {
+                set_malloc_error(error, SYSTEMV_HEADER_SIZE + q->buffer_size);
+                break;
+            }
+            *(long *) q->buffer = 1; /* mtype is an integer greater than 0 */
         }
-        *(long *) q->buffer = 1; /* mtype is an integer greater than 0 */
         ok = true;
     } while (false);
 
     return ok;
 }
 
-queue_err_t queue_get_attribute(void *p, queue_attr_t attr, unsigned long *value)
+static queue_err_t systemv_get_attribute(void *p, queue_attr_t attr, unsigned long *value)
 {
     systemv_queue_t *q;
 
     q = (systemv_queue_t *) p;
     switch (attr) {
         case QUEUE_ATTR_MAX_QUEUE_SIZE:
-        case QUEUE_ATTR_MAX_MESSAGE_SIZE:
         {
             struct msqid_ds buf;
 
@@ -194,6 +219,13 @@ queue_err_t queue_get_attribute(void *p, queue_attr_t attr, unsigned long *value
             *value = buf.msg_qbytes;
             break;
         }
+        case QUEUE_ATTR_MAX_MESSAGE_SIZE:
+            /* a receiver needs room for the mtype in front of the message */
+            *value = q->buffer_size + (NULL == q->buffer ? SYSTEMV_HEADER_SIZE : 0);
+            break;
+        case QUEUE_ATTR_OVERSIZED:
+            *value = __atomic_load_n(&q->oversized, __ATOMIC_RELAXED);
+            break;
         default:
             return QUEUE_ERR_NOT_SUPPORTED;
     }
@@ -201,46 +233,126 @@ queue_err_t queue_get_attribute(void *p, queue_attr_t attr, unsigned long *value
     return QUEUE_ERR_OK;
 }
 
-int queue_receive(void *p, char *buffer, size_t buffer_size, char **error)
+/**
+ * Receive a message into buffer, used as a struct msgbuf
+ *
+ * @return -1 on failure, 0 if none is waiting (IPC_NOWAIT) or the length
+ * of the message, moved to the start of buffer and NUL terminated (the
+ * ones too long for it are dropped, see QUEUE_ATTR_OVERSIZED)
+ **/
+static int systemv_msgrcv(systemv_queue_t *q, char *buffer, size_t buffer_size, int msgflg, char **error)
 {
-    int read;
-    systemv_queue_t *q;
+    ssize_t read;
 
-    q = (systemv_queue_t *) p;
-
-    if (-1 != (read = msgrcv(q->qid, q->buffer, buffer_size, 0, 0))) { // TODO: min(buffer_size, q->buffer_size) ?
-        strcpy(buffer, q->buffer + sizeof(long)); // TODO: better ?
+    if (buffer_size <= SYSTEMV_HEADER_SIZE + 1) {
+        set_generic_error(error, "buffer too small (%zu bytes) for a message of a System V queue", buffer_size);
+        return -1;
+    }
+    while (-1 == (read = msgrcv(q->qid, buffer, buffer_size - SYSTEMV_HEADER_SIZE - 1, 0, msgflg)) && E2BIG == errno) {
+        /* too long: take it out of the queue (truncated) to drop it, and count it */
+        if (-1 != msgrcv(q->qid, buffer, buffer_size - SYSTEMV_HEADER_SIZE - 1, 0, IPC_NOWAIT | MSG_NOERROR)) {
+            __atomic_add_fetch(&q->oversized, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (-1 != read) {
+        /* by its length: a message (binary records) can contain NUL bytes */
+        memmove(buffer, buffer + SYSTEMV_HEADER_SIZE, read);
+        buffer[read] = '\0';
+    } else if (HAS_FLAG(msgflg, IPC_NOWAIT) && ENOMSG == errno) {
+        read = 0;
     } else {
         set_system_error(error, "msgrcv failed");
     }
 
-    return read;
+    return (int) read;
 }
 
-bool queue_send(void *p, const char *msg, int msg_len, char **error)
+static int systemv_receive(void *p, char *buffer, size_t buffer_size, char **error)
 {
-    bool ok;
+    return systemv_msgrcv((systemv_queue_t *) p, buffer, buffer_size, 0, error);
+}
 
-    ok = false;
-    do {
-        systemv_queue_t *q;
+static int systemv_try_receive(void *p, char *buffer, size_t buffer_size, char **error)
+{
+    return systemv_msgrcv((systemv_queue_t *) p, buffer, buffer_size, IPC_NOWAIT, error);
+}
 
-        q = (systemv_queue_t *) p;
+/**
+ * Drain the queue: each message straight into its slot, until the queue
+ * is empty or count messages were received
+ **/
+static int systemv_receive_many(void *p, char *buffer, size_t buffer_size, int *lengths, int count, bool wait, char **error)
+{
+    int i, read;
+    systemv_queue_t *q;
+
+    q = (systemv_queue_t *) p;
+    for (i = 0; i < count; i++) {
+        if (-1 == (read = systemv_msgrcv(q, buffer + i * buffer_size, buffer_size, 0 == i && wait ? 0 : IPC_NOWAIT, error))) {
+            /* report the failure only if nothing was received */
+            if (0 != i) {
+                error_free(error);
+            }
+            return 0 == i ? -1 : i;
+        }
+        if (0 == read && (0 != i || !wait)) {
+            break;
+        }
+        lengths[i] = read;
+    }
+
+    return i;
+}
+
+static int systemv_get_fd(void *UNUSED(p))
+{
+    /* System V queues are not file descriptors */
+    return -1;
+}
+
+static int systemv_msgsnd(systemv_queue_t *q, const char *msg, int msg_len, int msgflg, char **error)
+{
+    int sent;
+
+    sent = -1;
+    do {
+        if (NULL == q->buffer) {
+            set_generic_error(error, "queue not opened to send");
+            break;
+        }
         if (msg_len < 0) {
             msg_len = strlen(msg);
         }
-        strcpy(q->buffer + sizeof(long), msg); // TODO: safer
-        if (0 != msgsnd(q->qid, q->buffer, q->buffer_size,  0)) {
-            set_system_error(error, "msgsnd failed");
+        if ((size_t) msg_len > q->buffer_size) {
+            set_generic_error(error, "message too long (%d > %zu)", msg_len, q->buffer_size);
             break;
         }
-        ok = true;
+        memcpy(q->buffer + SYSTEMV_HEADER_SIZE, msg, msg_len);
+        if (0 != msgsnd(q->qid, q->buffer, msg_len, msgflg)) {
+            if (HAS_FLAG(msgflg, IPC_NOWAIT) && EAGAIN == errno) {
+                sent = 0;
+            } else {
+                set_system_error(error, "msgsnd failed");
+            }
+            break;
+        }
+        sent = 1;
     } while (false);
 
-    return ok;
+    return sent;
 }
 
-bool queue_close(void **p, char **error)
+static bool systemv_send(void *p, const char *msg, int msg_len, char **error)
+{
+    return 1 == systemv_msgsnd((systemv_queue_t *) p, msg, msg_len, 0, error);
+}
+
+static int systemv_try_send(void *p, const char *msg, int msg_len, char **error)
+{
+    return systemv_msgsnd((systemv_queue_t *) p, msg, msg_len, IPC_NOWAIT, error);
+}
+
+static bool systemv_close(void **p, char **error)
 {
     bool ok;
 
@@ -277,3 +389,20 @@ bool queue_close(void **p, char **error)
 
     return ok;
 }
+
+const queue_backend_t systemv_queue_backend = {
+    "systemv",
+    systemv_init,
+    systemv_set_attribute,
+    systemv_open,
+    systemv_get_attribute,
+    systemv_receive,
+    systemv_try_receive,
+    NULL,
+    systemv_receive_many,
+    systemv_get_fd,
+    systemv_send,
+    systemv_try_send,
+    NULL,
+    systemv_close
+};
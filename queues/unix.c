@@ -0,0 +1,441 @@
+#ifdef __linux__
+# define _GNU_SOURCE /* recvmmsg, sendmmsg */
+#endif /* __linux__ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "backend.h"
+#include "capsicum.h"
+
+/* most messages taken by a single recvmmsg/sendmmsg */
+#define UNIX_MAX_BATCH 64
+
+/**
+ * A unix datagram socket: the owner binds it to the path, senders connect
+ * to it. Each datagram is a message, the kernel buffers them up to
+ * SO_RCVBUF bytes, which a process can set without any tuning of the
+ * system (unlike the limits of POSIX or System V queues).
+ **/
+typedef struct {
+    int fd;
+    char *filename;
+    unsigned long msgsize;
+    unsigned long maxmsg;
+    unsigned long rcvbuf;
+    unsigned long oversized; /* datagrams too long for the buffer of the receiver, dropped */
+} unix_queue_t;
+
+static void *unix_init(char **error)
+{
+    unix_queue_t *q;
+
+    if (NULL == (q = malloc(sizeof(*q)))) {
+        set_malloc_error(error, sizeof(*q));
+    } else {
+        q->fd = -1;
+        q->filename = NULL;
+        q->msgsize = 1024;
+        q->maxmsg = 0;
+        q->rcvbuf = 0;
+        q->oversized = 0;
+    }
+
+    return q;
+}
+
+static queue_err_t unix_set_attribute(void *p, queue_attr_t attr, unsigned long value)
+{
+    unix_queue_t *q;
+
+    q = (unix_queue_t *) p;
+    if (-1 != q->fd) {
+        return QUEUE_ERR_NOT_OWNER;
+    }
+    switch (attr) {
+        case QUEUE_ATTR_MAX_QUEUE_SIZE:
+            q->rcvbuf = value;
+            break;
+        case QUEUE_ATTR_MAX_MESSAGE_SIZE:
+            q->msgsize = value;
+            break;
+        case QUEUE_ATTR_MAX_MESSAGE_IN_QUEUE:
+            /* turned into a size of SO_RCVBUF on open */
+            q->maxmsg = value;
+            break;
+        default:
+            return QUEUE_ERR_NOT_SUPPORTED;
+    }
+
+    return QUEUE_ERR_OK;
+}
+
+/**
+ * Is the socket bound to addr a leftover, nobody receiving from it anymore?
+ **/
+static bool unix_stale(const struct sockaddr_un *addr)
+{
+    int fd;
+    bool stale;
+
+    stale = false;
+    if (-1 != (fd = socket(AF_UNIX, SOCK_DGRAM, 0))) {
+        stale = 0 != connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) && ECONNREFUSED == errno;
+        close(fd);
+    }
+
+    return stale;
+}
+
+static bool unix_open(void *p, const char *filename, int flags, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        unix_queue_t *q;
+        struct sockaddr_un addr;
+
+        q = (unix_queue_t *) p;
+        bzero(&addr, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(filename) >= sizeof(addr.sun_path)) {
+            set_buffer_overflow_error(error, filename, addr.sun_path, sizeof(addr.sun_path));
+            break;
+        }
+        strcpy(addr.sun_path, filename);
+        if (-1 == (q->fd = socket(AF_UNIX, SOCK_DGRAM, 0))) {
+            set_system_error(error, "socket failed");
+            break;
+        }
+        if (HAS_FLAG(flags, QUEUE_FL_SENDER)) {
+            if (0 != connect(q->fd, (struct sockaddr *) &addr, sizeof(addr))) {
+                set_system_error(error, "connect to \"%s\" failed", filename);
+                break;
+            }
+        } else if (HAS_FLAG(flags, QUEUE_FL_OWNER)) {
+            int rc;
+            mode_t oldmask;
+
+            if (NULL == (q->filename = strdup(filename))) {
+                set_generic_error(error, "strdup failed to copy \"%s\"", filename);
+                break;
+            }
+            /* 0660, as the POSIX and System V queues */
+            oldmask = umask(0117);
+            if (0 != (rc = bind(q->fd, (struct sockaddr *) &addr, sizeof(addr))) && EADDRINUSE == errno && unix_stale(&addr)) {
+                /* left by a previous owner which could not unlink it (privileges dropped) */
+                if (0 != unlink(filename) && ENOENT != errno) {
+                    set_system_error(error, "unlink(\"%s\") failed", filename);
+                    umask(oldmask);
+                    free(q->filename);
+                    q->filename = NULL;
+                    break;
+                }
+                rc = bind(q->fd, (struct sockaddr *) &addr, sizeof(addr));
+            }
+            umask(oldmask);
+            if (0 != rc) {
+                set_system_error(error, "bind to \"%s\" failed", filename);
+                free(q->filename);
+                q->filename = NULL;
+                break;
+            }
+            if (0 == q->rcvbuf && 0 != q->maxmsg) {
+                q->rcvbuf = q->maxmsg * q->msgsize;
+            }
+            if (0 != q->rcvbuf) {
+                int value;
+
+                value = q->rcvbuf > INT_MAX ? INT_MAX : (int) q->rcvbuf;
+                if (0 != setsockopt(q->fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value))) {
+                    set_system_error(error, "setsockopt(SO_RCVBUF, %d) failed", value);
+                    break;
+                }
+            }
+            if (!CAP_RIGHTS_LIMIT(&error, q->fd, CAP_READ, CAP_EVENT)) {
+                break;
+            }
+        } else {
+            set_generic_error(error, "only the owner of \"%s\" can receive from it", filename);
+            break;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+static queue_err_t unix_get_attribute(void *p, queue_attr_t attr, unsigned long *value)
+{
+    unix_queue_t *q;
+
+    q = (unix_queue_t *) p;
+    switch (attr) {
+        case QUEUE_ATTR_MAX_QUEUE_SIZE:
+        {
+            int size;
+            socklen_t size_len;
+
+            size_len = sizeof(size);
+            if (0 != getsockopt(q->fd, SOL_SOCKET, SO_RCVBUF, &size, &size_len)) {
+                return QUEUE_ERR_GENERAL_FAILURE;
+            }
+            *value = size;
+            break;
+        }
+        case QUEUE_ATTR_MAX_MESSAGE_SIZE:
+            *value = q->msgsize;
+            break;
+        case QUEUE_ATTR_OVERSIZED:
+            *value = __atomic_load_n(&q->oversized, __ATOMIC_RELAXED);
+            break;
+        default:
+            return QUEUE_ERR_NOT_SUPPORTED;
+    }
+
+    return QUEUE_ERR_OK;
+}
+
+/**
+ * Receive a datagram: longer than buffer_size - 1 bytes, it is dropped
+ * (and counted, see QUEUE_ATTR_OVERSIZED) and the next one is received
+ *
+ * @return -1 on failure, 0 if none was immediately available and wait is
+ * false, else its length
+ **/
+static int unix_recv(unix_queue_t *q, char *buffer, size_t buffer_size, bool wait, char **error)
+{
+    ssize_t read;
+    struct iovec iov;
+    struct msghdr msg;
+
+    iov.iov_base = buffer;
+    iov.iov_len = buffer_size - 1;
+    while (1) {
+        bzero(&msg, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (-1 != (read = recvmsg(q->fd, &msg, wait ? 0 : MSG_DONTWAIT))) {
+            if (HAS_FLAG(msg.msg_flags, MSG_TRUNC)) {
+                __atomic_add_fetch(&q->oversized, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            buffer[read] = '\0';
+        } else if (!wait && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            read = 0;
+        } else {
+            set_system_error(error, "recvmsg failed");
+        }
+        break;
+    }
+
+    return (int) read;
+}
+
+static int unix_receive(void *p, char *buffer, size_t buffer_size, char **error)
+{
+    return unix_recv((unix_queue_t *) p, buffer, buffer_size, true, error);
+}
+
+static int unix_try_receive(void *p, char *buffer, size_t buffer_size, char **error)
+{
+    return unix_recv((unix_queue_t *) p, buffer, buffer_size, false, error);
+}
+
+#ifdef HAVE_RECVMMSG
+static int unix_receive_many(void *p, char *buffer, size_t buffer_size, int *lengths, int count, bool wait, char **error)
+{
+    int i, n;
+    unix_queue_t *q;
+    struct iovec iov[UNIX_MAX_BATCH];
+    struct mmsghdr msgs[UNIX_MAX_BATCH];
+
+    q = (unix_queue_t *) p;
+    if (count > UNIX_MAX_BATCH) {
+        count = UNIX_MAX_BATCH;
+    }
+    bzero(msgs, count * sizeof(*msgs));
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = buffer + i * buffer_size;
+        iov[i].iov_len = buffer_size - 1;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    do {
+        int j;
+
+        if (-1 == (n = recvmmsg(q->fd, msgs, count, wait ? MSG_WAITFORONE : MSG_DONTWAIT, NULL))) {
+            if (!wait && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+                return 0;
+            }
+            set_system_error(error, "recvmmsg failed");
+            return -1;
+        }
+        /* drop (and count) the datagrams truncated, the next ones take their slots */
+        for (i = j = 0; i < n; i++) {
+            if (HAS_FLAG(msgs[i].msg_hdr.msg_flags, MSG_TRUNC)) {
+                __atomic_add_fetch(&q->oversized, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            if (i != j) {
+                memcpy(buffer + j * buffer_size, buffer + i * buffer_size, msgs[i].msg_len);
+            }
+            lengths[j] = msgs[i].msg_len;
+            buffer[j * buffer_size + msgs[i].msg_len] = '\0';
+            ++j;
+        }
+        n = j;
+    } while (0 == n && wait); /* all of them dropped: wait for an other one */
+
+    return n;
+}
+#endif /* HAVE_RECVMMSG */
+
+static int unix_get_fd(void *p)
+{
+    unix_queue_t *q;
+
+    q = (unix_queue_t *) p;
+
+    return q->fd;
+}
+
+static bool unix_send(void *p, const char *msg, int msg_len, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        unix_queue_t *q;
+
+        q = (unix_queue_t *) p;
+        if (msg_len < 0) {
+            msg_len = strlen(msg);
+        }
+        if (-1 == send(q->fd, msg, msg_len, 0)) {
+            set_system_error(error, "send failed to send \"%.*s\"", msg_len, msg);
+            break;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+static int unix_try_send(void *p, const char *msg, int msg_len, char **error)
+{
+    unix_queue_t *q;
+
+    q = (unix_queue_t *) p;
+    if (msg_len < 0) {
+        msg_len = strlen(msg);
+    }
+    if (-1 == send(q->fd, msg, msg_len, MSG_DONTWAIT)) {
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            return 0;
+        }
+        set_system_error(error, "send failed to send \"%.*s\"", msg_len, msg);
+        return -1;
+    }
+
+    return 1;
+}
+
+#ifdef HAVE_SENDMMSG
+static int unix_send_many(void *p, const char * const *messages, const int *lengths, int count, char **error)
+{
+    int i, sent;
+    unix_queue_t *q;
+
+    q = (unix_queue_t *) p;
+    for (sent = 0; sent < count; ) {
+        int n, batch;
+        struct iovec iov[UNIX_MAX_BATCH];
+        struct mmsghdr msgs[UNIX_MAX_BATCH];
+
+        batch = count - sent > UNIX_MAX_BATCH ? UNIX_MAX_BATCH : count - sent;
+        bzero(msgs, batch * sizeof(*msgs));
+        for (i = 0; i < batch; i++) {
+            iov[i].iov_base = (void *) messages[sent + i];
+            iov[i].iov_len = lengths[sent + i] < 0 ? strlen(messages[sent + i]) : (size_t) lengths[sent + i];
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        if (-1 == (n = sendmmsg(q->fd, msgs, batch, 0))) {
+            set_system_error(error, "sendmmsg failed");
+            return 0 == sent ? -1 : sent;
+        }
+        sent += n;
+    }
+
+    return sent;
+}
+#endif /* HAVE_SENDMMSG */
+
+static bool unix_close(void **p, char **error)
+{
+    bool ok;
+
+    ok = false;
+    do {
+        if (NULL != *p) {
+            unix_queue_t *q;
+
+            q = (unix_queue_t *) *p;
+            if (-1 != q->fd) {
+                if (0 != close(q->fd)) {
+                    set_system_error(error, "close failed");
+                    break;
+                }
+                q->fd = -1;
+            }
+            if (NULL != q->filename) { // we are the owner
+                if (0 != unlink(q->filename) && ENOENT != errno) {
+                    set_system_error(error, "unlink(\"%s\") failed", q->filename);
+                    break;
+                }
+                free(q->filename);
+                q->filename = NULL;
+            }
+            free(*p);
+            *p = NULL;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+const queue_backend_t unix_queue_backend = {
+    "unix",
+    unix_init,
+    unix_set_attribute,
+    unix_open,
+    unix_get_attribute,
+    unix_receive,
+    unix_try_receive,
+    NULL,
+#ifdef HAVE_RECVMMSG
+    unix_receive_many,
+#else
+    NULL,
+#endif /* HAVE_RECVMMSG */
+    unix_get_fd,
+    unix_send,
+    unix_try_send,
+#ifdef HAVE_SENDMMSG
+    unix_send_many,
+#else
+    NULL,
+#endif /* HAVE_SENDMMSG */
+    unix_close
+};
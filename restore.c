@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "err.h"
+#include "command.h"
+#include "engine.h"
+
+/**
+ * Shell-based engines, feeding a long-lived ipset restore or iptables-restore
+ * child instead of running a command per address. Errors are reported by
+ * these tools asynchronously, on their output: they are logged (with the
+ * address of the faulty line) but an address is considered as banned as soon
+ * as it was written.
+ **/
+
+/* ======================== ipset restore ======================== */
+
+#define IPSET_SETNAME_SIZE 32 /* IPSET_MAXNAMELEN */
+
+static const char * const ipset_restore_argv[] = { "ipset", "restore", "-!", NULL };
+
+typedef struct {
+    coprocess_t cp;
+    char sets[2][IPSET_SETNAME_SIZE];
+} ipset_restore_data_t;
+
+static void *ipset_restore_open(const char *tablename, char **error)
+{
+    bool ok;
+    ipset_restore_data_t *data;
+
+    ok = false;
+    do {
+        if (NULL == (data = malloc(sizeof(*data)))) {
+            set_malloc_error(error, sizeof(*data));
+            break;
+        }
+        coprocess_init(&data->cp, "ipset restore", ipset_restore_argv, NULL, NULL);
+        if (snprintf(data->sets[0], STR_SIZE(data->sets[0]), "%s4", tablename) >= (int) STR_SIZE(data->sets[0])) {
+            set_generic_error(error, "set name '%s' is too long", tablename);
+            break;
+        }
+        snprintf(data->sets[1], STR_SIZE(data->sets[1]), "%s6", tablename);
+        if (!coprocess_start(&data->cp, error)) {
+            break;
+        }
+        coprocess_append(&data->cp, data->sets[0], "create %s hash:net family inet\n", data->sets[0]);
+        coprocess_append(&data->cp, data->sets[1], "create %s hash:net family inet6\n", data->sets[1]);
+        if (!coprocess_flush(&data->cp, error)) {
+            break;
+        }
+        if (EXIT_SUCCESS != run_command(error, "iptables -C INPUT -m set --match-set %s src -j DROP 2>/dev/null || iptables -I INPUT -m set --match-set %s src -j DROP", data->sets[0], data->sets[0])) {
+            set_generic_error(error, "adding iptables rule for set %s failed", data->sets[0]);
+            break;
+        }
+        if (EXIT_SUCCESS != run_command(error, "ip6tables -C INPUT -m set --match-set %s src -j DROP 2>/dev/null || ip6tables -I INPUT -m set --match-set %s src -j DROP", data->sets[1], data->sets[1])) {
+            set_generic_error(error, "adding ip6tables rule for set %s failed", data->sets[1]);
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (!ok && NULL != data) {
+        coprocess_stop(&data->cp);
+        free(data);
+        data = NULL;
+    }
+
+    return data;
+}
+
+/**
+ * @param verb add or del (for an element which is not in the set, ignored thanks to -!)
+ **/
+static bool ipset_restore_batch(void *ctxt, const char *verb, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    bool ok, flushed;
+    size_t i, from;
+    ipset_restore_data_t *data;
+
+    ok = true;
+    data = (ipset_restore_data_t *) ctxt;
+    for (from = i = 0; i < count; i++) {
+        const char *set;
+        char buffer[INET6_ADDRSTRLEN];
+
+        set = data->sets[AF_INET == addrs[i].fa ? 0 : 1];
+        addr_ntop(&addrs[i], buffer, sizeof(buffer));
+        if (!coprocess_append(&data->cp, buffer, "%s %s %s/%u\n", verb, set, buffer, addrs[i].netmask)) {
+            /* chunk is full: send it and start a new one */
+            flushed = coprocess_flush(&data->cp, ok ? error : NULL);
+            for (; from < i; from++) {
+                results[from] = flushed;
+            }
+            ok &= flushed;
+            coprocess_append(&data->cp, buffer, "%s %s %s/%u\n", verb, set, buffer, addrs[i].netmask);
+        }
+    }
+    flushed = coprocess_flush(&data->cp, ok ? error : NULL);
+    for (; from < count; from++) {
+        results[from] = flushed;
+    }
+    ok &= flushed;
+
+    return ok;
+}
+
+static bool ipset_restore_handle_batch(void *ctxt, const char *UNUSED(tablename), const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return ipset_restore_batch(ctxt, "add", addrs, count, results, error);
+}
+
+static bool ipset_restore_unhandle(void *ctxt, const char *UNUSED(tablename), const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return ipset_restore_batch(ctxt, "del", addrs, count, results, error);
+}
+
+static bool ipset_restore_handle(void *ctxt, const char *tablename, const addr_t *addr, char **error)
+{
+    bool result;
+
+    return ipset_restore_handle_batch(ctxt, tablename, addr, 1, &result, error);
+}
+
+static void ipset_restore_close(void *ctxt)
+{
+    ipset_restore_data_t *data;
+
+    data = (ipset_restore_data_t *) ctxt;
+    coprocess_stop(&data->cp);
+}
+
+const engine_t ipset_restore_engine = {
+    false,
+    "ipset-restore",
+    ipset_restore_open,
+    ipset_restore_handle,
+    ipset_restore_handle_batch,
+    ipset_restore_unhandle,
+    NULL,
+    ipset_restore_close
+};
+
+/* ======================== iptables-restore ======================== */
+
+static const char * const iptables_restore_argv[] = { "iptables-restore", "--noflush", NULL };
+static const char * const ip6tables_restore_argv[] = { "ip6tables-restore", "--noflush", NULL };
+
+typedef struct {
+    coprocess_t cps[2];
+} iptables_restore_data_t;
+
+static void *iptables_restore_open(const char *UNUSED(tablename), char **error)
+{
+    iptables_restore_data_t *data;
+
+    if (NULL == (data = malloc(sizeof(*data)))) {
+        set_malloc_error(error, sizeof(*data));
+    } else {
+        /* each chunk is a transaction of the filter table */
+        coprocess_init(&data->cps[0], "iptables-restore", iptables_restore_argv, "*filter\n", "COMMIT\n");
+        coprocess_init(&data->cps[1], "ip6tables-restore", ip6tables_restore_argv, "*filter\n", "COMMIT\n");
+        if (!coprocess_start(&data->cps[0], error) || !coprocess_start(&data->cps[1], error)) {
+            coprocess_stop(&data->cps[0]);
+            free(data);
+            data = NULL;
+        }
+    }
+
+    return data;
+}
+
+/* rules to insert, to delete */
+#define IPTABLES_RESTORE_INSERT "-I %s 1 -s %s/%u -j DROP\n"
+#define IPTABLES_RESTORE_DELETE "-D %s -s %s/%u -j DROP\n"
+
+/**
+ * @param format IPTABLES_RESTORE_INSERT or IPTABLES_RESTORE_DELETE
+ **/
+static bool iptables_restore_batch(void *ctxt, const char *tablename, const char *format, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    bool ok;
+    size_t i;
+    int family;
+    iptables_restore_data_t *data;
+
+    ok = true;
+    data = (iptables_restore_data_t *) ctxt;
+    /* one family after the other, as each one has its own child */
+    for (family = 0; family < 2; family++) {
+        size_t from;
+        coprocess_t *cp;
+        bool flushed;
+
+        cp = &data->cps[family];
+        flushed = true;
+        for (from = i = 0; i < count; i++) {
+            char buffer[INET6_ADDRSTRLEN];
+
+            if ((0 == family) != (AF_INET == addrs[i].fa)) {
+                continue;
+            }
+            addr_ntop(&addrs[i], buffer, sizeof(buffer));
+            if (!coprocess_append(cp, buffer, format, tablename, buffer, addrs[i].netmask)) {
+                flushed = coprocess_flush(cp, ok ? error : NULL);
+                for (; from < i; from++) {
+                    if ((0 == family) == (AF_INET == addrs[from].fa)) {
+                        results[from] = flushed;
+                    }
+                }
+                ok &= flushed;
+                coprocess_append(cp, buffer, format, tablename, buffer, addrs[i].netmask);
+            }
+        }
+        flushed = coprocess_flush(cp, ok ? error : NULL);
+        for (; from < count; from++) {
+            if ((0 == family) == (AF_INET == addrs[from].fa)) {
+                results[from] = flushed;
+            }
+        }
+        ok &= flushed;
+    }
+
+    return ok;
+}
+
+static bool iptables_restore_handle_batch(void *ctxt, const char *tablename, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return iptables_restore_batch(ctxt, tablename, IPTABLES_RESTORE_INSERT, addrs, count, results, error);
+}
+
+/**
+ * Note: iptables-restore rejects the whole chunk if one of its rules no
+ * longer exists (removed by hand)
+ **/
+static bool iptables_restore_unhandle(void *ctxt, const char *tablename, const addr_t *addrs, size_t count, bool *results, char **error)
+{
+    return iptables_restore_batch(ctxt, tablename, IPTABLES_RESTORE_DELETE, addrs, count, results, error);
+}
+
+static bool iptables_restore_handle(void *ctxt, const char *tablename, const addr_t *addr, char **error)
+{
+    bool result;
+
+    return iptables_restore_handle_batch(ctxt, tablename, addr, 1, &result, error);
+}
+
+static void iptables_restore_close(void *ctxt)
+{
+    iptables_restore_data_t *data;
+
+    data = (iptables_restore_data_t *) ctxt;
+    coprocess_stop(&data->cps[0]);
+    coprocess_stop(&data->cps[1]);
+}
+
+const engine_t iptables_restore_engine = {
+    false,
+    "iptables-restore",
+    iptables_restore_open,
+    iptables_restore_handle,
+    iptables_restore_handle_batch,
+    iptables_restore_unhandle,
+    NULL,
+    iptables_restore_close
+};
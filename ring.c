@@ -0,0 +1,200 @@
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "ring.h"
+
+/**
+ * @param capacity maximum number of entries, rounded up to a power of 2
+ **/
+bool ring_init(ring_t *ring, size_t capacity, char **error)
+{
+    int side;
+    size_t size;
+
+    for (size = 1; size < capacity; size <<= 1)
+        ;
+    ring->mask = size - 1;
+    ring->head = ring->next = ring->tail = 0;
+    ring->pushed = ring->full = 0;
+    ring->max_depth = 0;
+    for (side = RING_CONSUMER; side <= RING_PRODUCER; side++) {
+        ring->sleeping[side] = 0;
+        if (0 != pipe(ring->pipes[side])) {
+            set_system_error(error, "pipe failed");
+            break;
+        }
+        /* the side waking the other up never blocks, a full pipe already wakes it */
+        if (-1 == fcntl(ring->pipes[side][1], F_SETFL, O_NONBLOCK)) {
+            set_system_error(error, "fcntl failed");
+            close(ring->pipes[side][0]);
+            close(ring->pipes[side][1]);
+            break;
+        }
+    }
+    if (side <= RING_PRODUCER || NULL == (ring->entries = calloc(size, sizeof(*ring->entries)))) {
+        if (side > RING_PRODUCER) {
+            set_calloc_error(error, size, sizeof(*ring->entries));
+        }
+        while (--side >= RING_CONSUMER) {
+            close(ring->pipes[side][0]);
+            close(ring->pipes[side][1]);
+        }
+        ring->entries = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Wake up the other side if it is sleeping (or about to sleep) in
+ * ring_wait. The full barrier orders the update of head (or tail) before
+ * the check of its flag, as ring_wait does the opposite.
+ **/
+static void ring_wake(ring_t *ring, int side)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 != __atomic_load_n(&ring->sleeping[side], __ATOMIC_RELAXED) && 0 != __atomic_exchange_n(&ring->sleeping[side], 0, __ATOMIC_SEQ_CST)) {
+        char c;
+
+        c = 0;
+        if (-1 == write(ring->pipes[side][1], &c, 1)) {
+            /* NOP: EAGAIN, the pipe is already full of wake ups */
+        }
+    }
+}
+
+/**
+ * Add an entry (producer side). It is only visible to the consumer once
+ * committed, to let it take a burst as a whole.
+ *
+ * @return false if the ring is full
+ **/
+bool ring_push(ring_t *ring, const ring_entry_t *entry)
+{
+    size_t depth;
+
+    depth = ring->next - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (depth > ring->mask) {
+        ++ring->full;
+        return false;
+    }
+    ring->entries[ring->next++ & ring->mask] = *entry;
+    ++ring->pushed;
+    if (depth + 1 > ring->max_depth) {
+        ring->max_depth = depth + 1;
+    }
+
+    return true;
+}
+
+/**
+ * Publish the entries pushed since the last commit (producer side) and
+ * wake the consumer up
+ **/
+void ring_commit(ring_t *ring)
+{
+    if (ring->next != ring->head) {
+        __atomic_store_n(&ring->head, ring->next, __ATOMIC_RELEASE);
+        ring_wake(ring, RING_CONSUMER);
+    }
+}
+
+/**
+ * Take (consumer side) up to max of the oldest entries
+ *
+ * @return the number of entries copied into entries
+ **/
+size_t ring_pop(ring_t *ring, ring_entry_t *entries, size_t max)
+{
+    size_t i, tail, count;
+
+    tail = ring->tail;
+    count = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    if (count > max) {
+        count = max;
+    }
+    for (i = 0; i < count; i++) {
+        entries[i] = ring->entries[(tail + i) & ring->mask];
+    }
+    if (0 != count) {
+        __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+        ring_wake(ring, RING_PRODUCER);
+    }
+
+    return count;
+}
+
+/**
+ * Number of entries waiting in the ring (a snapshot, from either side)
+ **/
+size_t ring_depth(ring_t *ring)
+{
+    size_t tail;
+
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+/**
+ * Sleep until there is something to pop (side = RING_CONSUMER) or room
+ * to push (side = RING_PRODUCER). Also returns early (true) when
+ * interrupted by a signal, or on a spurious wake up: callers retry.
+ **/
+bool ring_wait(ring_t *ring, int side, char **error)
+{
+    bool ready;
+    char buffer[64];
+
+    __atomic_store_n(&ring->sleeping[side], 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (RING_CONSUMER == side) {
+        ready = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail;
+    } else {
+        ready = ring->next - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) <= ring->mask;
+    }
+    if (!ready && -1 == read(ring->pipes[side][0], buffer, sizeof(buffer)) && EINTR != errno) {
+        set_system_error(error, "read failed");
+        __atomic_store_n(&ring->sleeping[side], 0, __ATOMIC_SEQ_CST);
+        return false;
+    }
+    /* if the other side took the flag first, its wake up is left in the pipe: a spurious one for the next time */
+    __atomic_store_n(&ring->sleeping[side], 0, __ATOMIC_SEQ_CST);
+
+    return true;
+}
+
+/**
+ * Wake the consumer up, even if there is nothing to pop (a spurious wake
+ * up for ring_wait): only a write(2), it can be called from a signal
+ * handler
+ **/
+void ring_interrupt(ring_t *ring)
+{
+    char c;
+
+    c = 0;
+    if (-1 == write(ring->pipes[RING_CONSUMER][1], &c, 1)) {
+        /* NOP: EAGAIN, the pipe is already full of wake ups */
+    }
+}
+
+void ring_free(ring_t *ring)
+{
+    int side;
+
+    if (NULL == ring->entries) {
+        return;
+    }
+    for (side = RING_CONSUMER; side <= RING_PRODUCER; side++) {
+        close(ring->pipes[side][0]);
+        close(ring->pipes[side][1]);
+    }
+    free(ring->entries);
+    ring->entries = NULL;
+}
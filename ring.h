@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+#include "record.h"
+
+/* assumed size of a cache line, to keep apart what each side writes */
+#define RING_CACHE_LINE 64
+
+enum {
+    RING_CONSUMER,
+    RING_PRODUCER,
+};
+
+/**
+ * An address received, on its way to the firewall
+ **/
+typedef struct {
+    addr_t addr;
+    uint32_t binding;  /* index of the queue it comes from */
+    uint32_t ttl;      /* duration of its ban, in seconds */
+    uint8_t action;    /* RECORD_BAN, RECORD_UNBAN or RECORD_REPORT (to count, see -R/--report) */
+    uint8_t reason;    /* metadata of a binary record (see record.h), 0 for a text message */
+    uint16_t source;
+    uint64_t enqueued; /* when it was pushed, in microseconds (monotonic) */
+} ring_entry_t;
+
+/**
+ * Bounded single producer, single consumer, ring: the producer only
+ * writes head (by committing what it pushed), the consumer only writes
+ * tail, no lock is taken to push or pop. A side which has to wait (empty
+ * or full ring) sleeps on a pipe, written by the other side only if it is
+ * known to be sleeping.
+ **/
+typedef struct {
+    ring_entry_t *entries;
+    size_t mask;  /* capacity - 1, a power of 2 */
+    int pipes[2][2]; /* one for each side to be woken up */
+    int sleeping[2];
+    char unused1[RING_CACHE_LINE];
+    size_t head;  /* end of the committed entries, producer side */
+    size_t next;  /* next entry to write, not yet committed */
+    unsigned long pushed;
+    unsigned long full;  /* times the producer found the ring full */
+    size_t max_depth;
+    char unused2[RING_CACHE_LINE];
+    size_t tail;  /* next entry to read, consumer side */
+} ring_t;
+
+bool ring_init(ring_t *, size_t, char **);
+bool ring_push(ring_t *, const ring_entry_t *);
+void ring_commit(ring_t *);
+size_t ring_pop(ring_t *, ring_entry_t *, size_t);
+size_t ring_depth(ring_t *);
+bool ring_wait(ring_t *, int, char **);
+void ring_interrupt(ring_t *);
+void ring_free(ring_t *);
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "sketch.h"
+
+#define ROW(sketch, slice, row) \
+    (&(sketch)->counters[((size_t) (slice) * SKETCH_DEPTH + (row)) * (sketch)->width])
+
+/* the sum of the slices comes after them */
+#define SUM SKETCH_SLICES
+
+/**
+ * @param width counters per row, rounded up to a power of 2, at most
+ * SKETCH_MAX_WIDTH
+ * @param window length of the window, in milliseconds
+ * @param now current time, in milliseconds
+ **/
+bool sketch_init(sketch_t *sketch, unsigned long width, uint64_t window, uint64_t now, char **error)
+{
+    size_t size;
+
+    if (width > SKETCH_MAX_WIDTH) {
+        set_generic_error(error, "sketch: invalid number of counters per row %lu, at most %lu", width, SKETCH_MAX_WIDTH);
+        return false;
+    }
+    for (sketch->width = 1; sketch->width < width; sketch->width <<= 1)
+        ;
+    sketch->slice = window / SKETCH_SLICES;
+    if (0 == sketch->slice) {
+        sketch->slice = 1;
+    }
+    sketch->start = now;
+    sketch->current = 0;
+    sketch->reports = 0;
+    size = (size_t) (SKETCH_SLICES + 1) * SKETCH_DEPTH * sketch->width;
+    if (NULL == (sketch->counters = calloc(size, sizeof(*sketch->counters)))) {
+        set_calloc_error(error, size, sizeof(*sketch->counters));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Memory used by the counters, in bytes
+ **/
+size_t sketch_size(const sketch_t *sketch)
+{
+    return (size_t) (SKETCH_SLICES + 1) * SKETCH_DEPTH * sketch->width * sizeof(*sketch->counters);
+}
+
+/**
+ * Slide the window up to now: each slice which has become too old is
+ * subtracted from the sum and reused for the new reports
+ **/
+static void sketch_slide(sketch_t *sketch, uint64_t now)
+{
+    uint64_t n;
+
+    if (now < sketch->start + sketch->slice) {
+        return;
+    }
+    n = (now - sketch->start) / sketch->slice;
+    sketch->start += n * sketch->slice;
+    if (n >= SKETCH_SLICES) {
+        /* nothing left of the whole window */
+        memset(sketch->counters, 0, sketch_size(sketch));
+        sketch->current = (sketch->current + n) % SKETCH_SLICES;
+        return;
+    }
+    while (n-- > 0) {
+        int row;
+
+        sketch->current = (sketch->current + 1) % SKETCH_SLICES;
+        for (row = 0; row < SKETCH_DEPTH; row++) {
+            uint32_t i, *sum, *old;
+
+            sum = ROW(sketch, SUM, row);
+            old = ROW(sketch, sketch->current, row);
+            for (i = 0; i < sketch->width; i++) {
+                sum[i] -= old[i];
+            }
+            memset(old, 0, sketch->width * sizeof(*old));
+        }
+    }
+}
+
+/* FNV-1a (64 bits) then the finalizer of splitmix64 to spread it */
+static uint64_t sketch_hash(const addr_t *addr)
+{
+    size_t i;
+    uint64_t hash;
+    const uint8_t *p;
+
+    hash = ((14695981039346656037ULL ^ addr->fa) * 1099511628211ULL ^ addr->netmask) * 1099511628211ULL;
+    for (i = 0, p = (const uint8_t *) &addr->sa; i < ADDR_SIZE(addr); i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * Count a report of addr. Conservative update: only the counters which
+ * are below the new estimate are raised (by the same amount in the
+ * current slice to keep the sum exact), which limits the overestimation.
+ *
+ * @return the (estimated) number of reports of addr in the window, this
+ * one included
+ **/
+uint32_t sketch_add(sketch_t *sketch, const addr_t *addr, uint64_t now)
+{
+    int row;
+    uint64_t hash;
+    uint32_t h1, h2, estimate;
+    uint32_t index[SKETCH_DEPTH];
+
+    sketch_slide(sketch, now);
+    ++sketch->reports;
+    hash = sketch_hash(addr);
+    /* rows are indexed by h1 + row * h2 (double hashing) */
+    h1 = (uint32_t) hash;
+    h2 = (uint32_t) (hash >> 32) | 1;
+    estimate = UINT32_MAX;
+    for (row = 0; row < SKETCH_DEPTH; row++) {
+        uint32_t count;
+
+        index[row] = (h1 + row * h2) & (sketch->width - 1);
+        count = ROW(sketch, SUM, row)[index[row]];
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+    if (UINT32_MAX == estimate) {
+        return estimate;
+    }
+    ++estimate;
+    for (row = 0; row < SKETCH_DEPTH; row++) {
+        uint32_t *sum;
+
+        sum = &ROW(sketch, SUM, row)[index[row]];
+        if (*sum < estimate) {
+            ROW(sketch, sketch->current, row)[index[row]] += estimate - *sum;
+            *sum = estimate;
+        }
+    }
+
+    return estimate;
+}
+
+void sketch_free(sketch_t *sketch)
+{
+    free(sketch->counters);
+    sketch->counters = NULL;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+
+/* rows of the sketch: one independent hash each */
+#define SKETCH_DEPTH 4
+/* the window slides by 1/SKETCH_SLICES of its length */
+#define SKETCH_SLICES 8
+/* most counters per row: 2^22, (8 + 1) * 4 rows of them take 576 MB */
+#define SKETCH_MAX_WIDTH (1UL << 22)
+
+/**
+ * Count-min sketch over a sliding window: how many times an address was
+ * reported during the last window milliseconds, in a fixed amount of
+ * memory whatever the number of distinct addresses. The count may be
+ * overestimated (collisions), never underestimated.
+ *
+ * The window is made of SKETCH_SLICES slices, each one a sketch of the
+ * reports received during it, and their sum, kept up to date, on which
+ * the counts are estimated. The oldest slice is subtracted from the sum
+ * when the window slides.
+ **/
+typedef struct {
+    uint32_t width;     /* counters per row, a power of 2 */
+    uint64_t slice;     /* duration of a slice, in milliseconds */
+    uint64_t start;     /* when the current slice began */
+    unsigned int current;
+    uint32_t *counters; /* the slices then their sum, each one SKETCH_DEPTH rows of width counters */
+    unsigned long reports;
+} sketch_t;
+
+bool sketch_init(sketch_t *, unsigned long, uint64_t, uint64_t, char **);
+uint32_t sketch_add(sketch_t *, const addr_t *, uint64_t);
+size_t sketch_size(const sketch_t *);
+void sketch_free(sketch_t *);
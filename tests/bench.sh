@@ -0,0 +1,25 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+# small sizes: only to check the results, not to measure anything
+assertExitValue "bench (trie)" "${TESTDIR}/../bench trie 2000 > /dev/null" $TRUE
+assertExitValue "bench (parse)" "${TESTDIR}/../bench parse 20000 > /dev/null" $TRUE
+assertExitValue "bench (wheel)" "${TESTDIR}/../bench wheel 20000 > /dev/null" $TRUE
+assertExitValue "bench (journal)" "${TESTDIR}/../bench journal 20000 > /dev/null" $TRUE
+assertExitValue "bench (sketch)" "${TESTDIR}/../bench sketch 600000 > /dev/null" $TRUE
+assertExitValue "bench (ring)" "${TESTDIR}/../bench ring 200000 > /dev/null" $TRUE
+rm -f /dev/shm/test-bench 2> /dev/null
+assertExitValue "bench (queue)" "${TESTDIR}/../bench queue 100000 shm:/test-bench > /dev/null" $TRUE
+rm -f "/tmp/${PPID}.bench.sysv" 2> /dev/null
+assertExitValue "bench (queue, System V)" "${TESTDIR}/../bench queue 20000 sysv:/tmp/${PPID}.bench.sysv > /dev/null" $TRUE
+rm -f /dev/shm/test-bench 2> /dev/null
+assertExitValue "bench (client)" "${TESTDIR}/../bench client 20000 shm:/test-bench > /dev/null" $TRUE
+# queue_receive_timed on each kind of queue
+rm -f /dev/shm/test-bench /dev/mqueue/test-bench "/tmp/${PPID}.bench.sysv" "/tmp/${PPID}.bench.sock" 2> /dev/null
+assertExitValue "bench (timed, shared memory)" "${TESTDIR}/../bench timed shm:/test-bench > /dev/null" $TRUE
+assertExitValue "bench (timed, POSIX)" "${TESTDIR}/../bench timed posix:/test-bench > /dev/null" $TRUE
+assertExitValue "bench (timed, System V)" "${TESTDIR}/../bench timed sysv:/tmp/${PPID}.bench.sysv > /dev/null" $TRUE
+assertExitValue "bench (timed, unix socket)" "${TESTDIR}/../bench timed unix:/tmp/${PPID}.bench.sock > /dev/null" $TRUE
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.bulk.log"
+declare -r FEED="/tmp/${PPID}.bulk.feed"
+declare -r OUTPUT="/tmp/${PPID}.bulk.out"
+declare -r REPORT="/tmp/${PPID}.bulk.report"
+declare -r ERRORS="/tmp/${PPID}.bulk.errors"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-bulk 2> /dev/null
+
+# 1000 addresses, none of them sibling of an other (not to be merged), a comment and an invalid line
+(
+    echo '# feed'
+    for i in $(seq 0 999); do
+        echo "10.3.$((i / 64)).$((i % 64 * 4))"
+    done
+    echo 'not an address'
+) > "${FEED}"
+
+# the dummy engine writes what it bans, and into which table, to stderr
+${TESTDIR}/../banipd -d -e dummy -q /test-bulk -t bulk -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queue
+sleep 1
+${TESTDIR}/../banip-cli -f - /test-bulk < "${FEED}" > "${REPORT}" 2> "${ERRORS}"
+sleep 1
+assertExitValue "Bulk (report)" "grep -qF '1000 address(es) sent' '${REPORT}'" $TRUE
+assertExitValue "Bulk (invalid line skipped)" "grep -qF '1 line(s) skipped' '${REPORT}'" $TRUE
+assertExitValue "Bulk (invalid line reported)" "grep -qF -- '-:1002: ' '${ERRORS}' && grep -qF ', skipped' '${ERRORS}'" $TRUE
+assertExitValue "Bulk (packed)" "! grep -qF ' 1000 message(s)' '${REPORT}'" $TRUE
+assertExitValue "Bulk (all received)" "test 1000 -eq \`grep -c \"' into bulk\" '${OUTPUT}'\`" $TRUE
+assertExitValue "Bulk (failure, exit status)" "${TESTDIR}/../banip-cli /test-bulk 'not an address' > /dev/null 2>&1" $FALSE
+kill -TERM `cat ${TESTDIR}/test.pid`
+sleep 1
+rm -f /dev/mqueue/test-bulk "${FEED}" "${REPORT}" "${ERRORS}" 2> /dev/null
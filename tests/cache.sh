@@ -0,0 +1,38 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.cache.log"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-cache 2> /dev/null
+
+${TESTDIR}/../banipd -d -q /test-cache -t dummy -e dummy -l "${LOG}" -p ${TESTDIR}/test.pid
+# let it create the queue
+sleep 1
+for addr in 1.2.3.4 1.2.3.4 10.0.0.0/8 10.1.2.3; do
+    ${TESTDIR}/../banip-cli /test-cache "${addr}" > /dev/null
+done
+sleep 1
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Cache (duplicate and covered addresses)" "grep -qF 'cache: 2 hit(s), 2 miss(es), 1 address(es), 1 network(s), 0 merged' '${LOG}'" $TRUE
+assertExitValue "Ring (statistics)" "grep -q 'ring: 0 address(es) queued ([0-9]* at most), 4 applied' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+
+# queue addresses while banipd is stopped to get them in a single batch
+rm -f /dev/mqueue/test-cache 2> /dev/null
+${TESTDIR}/../banipd -d -q /test-cache -t dummy -e dummy -l "${LOG}" -p ${TESTDIR}/test.pid
+sleep 1
+kill -STOP `cat ${TESTDIR}/test.pid`
+for addr in 1.2.3.4 1.2.3.5 1.2.3.6 1.2.3.7 10.0.0.1 10.0.0.0/8; do
+    ${TESTDIR}/../banip-cli /test-cache "${addr}" > /dev/null
+done
+kill -CONT `cat ${TESTDIR}/test.pid`
+sleep 1
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Cache (batch merged)" "grep -qF 'cache: 0 hit(s), 6 miss(es), 0 address(es), 2 network(s), 4 merged' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
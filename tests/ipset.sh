@@ -5,16 +5,25 @@ declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
 . ${TESTDIR}/assert.sh.inc
 
 skipUnlessBinaryExists ipset
+skipUnlessBinaryExists iptables
+skipUnlessBinaryExists ip6tables
+skipUnlessBinaryExists unshare
 
 if ! zgrep -q ^CONFIG_IP_SET /proc/config.gz; then
     printf "%s: [ \e[%d;01m%s\e[0m ] %s\n" `basename $0` 33 SKIPPED "(kernel compiled without CONFIG_IP_SET option)"
     exit $TRUE
 fi
 
-${TESTDIR}/../pftest ipset
-
-ipset -! create ${PFBAN_TEST_TABLE} hash:net family inet
+# run in a private network namespace to leave the ruleset of the host untouched
+if [ -z "${BANIP_NETNS}" ]; then
+    BANIP_NETNS=1 exec unshare -n bash "${BASH_SOURCE}" "$@"
+fi
 
-assertExitValue "ipset" "ipset test ${PFBAN_TEST_TABLE} 1.2.3.4" $TRUE
+# sets are created by the engine itself
+${TESTDIR}/../pftest ipset 1.2.3.4 10.0.0.0/8 2001:db8::1
 
-ipset destroy ${PFBAN_TEST_TABLE}
+assertExitValue "ipset (address)" "ipset test ${PFBAN_TEST_TABLE}4 1.2.3.4" $TRUE
+assertExitValue "ipset (CIDR)" "ipset test ${PFBAN_TEST_TABLE}4 10.20.30.40" $TRUE
+assertExitValue "ipset (IPv6)" "ipset test ${PFBAN_TEST_TABLE}6 2001:db8::42" $TRUE
+assertExitValue "ipset (not banned)" "ipset test ${PFBAN_TEST_TABLE}4 1.2.3.5" $FALSE
+assertExitValue "iptables rule" "iptables -C INPUT -m set --match-set ${PFBAN_TEST_TABLE}4 src -j DROP" $TRUE
@@ -14,7 +14,7 @@ iptables -I INPUT -j ${PFBAN_TEST_TABLE}
 
 assertOutputValue "iptables" "iptables -nL 2>/dev/null | grep -cF 1.2.3.4" 1 "-eq"
 
-iptables -D ${PFBAN_TEST_TABLE} -s 1.2.3.4 -j DROP
+iptables -D ${PFBAN_TEST_TABLE} -s 1.2.3.4/32 -j DROP
 
 iptables -j ${PFBAN_TEST_TABLE} -D INPUT -p tcp --dport http
 iptables -F ${PFBAN_TEST_TABLE}
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.journal.log"
+declare -r OUTPUT="/tmp/${PPID}.journal.out"
+declare -r JOURNAL="/tmp/${PPID}.journal"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-journal "${JOURNAL}" "${JOURNAL}.snapshot" 2> /dev/null
+
+${TESTDIR}/../banipd -d -q /test-journal -t dummy -e dummy -j "${JOURNAL}" -l "${LOG}" -p ${TESTDIR}/test.pid 2> /dev/null
+# let it create the queue
+sleep 1
+${TESTDIR}/../banip-cli /test-journal 1.2.3.4 > /dev/null
+${TESTDIR}/../banip-cli /test-journal "5.6.7.8 2" > /dev/null
+${TESTDIR}/../banip-cli /test-journal "10.0.0.0/8 600" > /dev/null
+sleep 1
+kill -TERM `cat ${TESTDIR}/test.pid`
+# the ban of 5.6.7.8 comes to an end while banipd is stopped
+sleep 2
+rm -f /dev/mqueue/test-journal 2> /dev/null
+
+# the dummy engine writes what it bans and unbans to stderr
+${TESTDIR}/../banipd -d -q /test-journal -t dummy -e dummy -j "${JOURNAL}" -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queue
+sleep 1
+sleep 1
+assertExitValue "Journal (restored)" "grep -qF \"Received: '1.2.3.4'\" '${OUTPUT}' && grep -qF \"Received: '10.0.0.0'\" '${OUTPUT}'" $TRUE
+assertExitValue "Journal (ended while stopped)" "grep -qF \"Removed: '5.6.7.8'\" '${OUTPUT}'" $TRUE
+# back in the cache: not banned a second time
+${TESTDIR}/../banip-cli /test-journal 1.2.3.4 > /dev/null
+sleep 1
+assertOutputValue "Journal (cache)" "grep -cF \"Received: '1.2.3.4'\" '${OUTPUT}'" 1
+assertExitValue "Journal (log)" "grep -qF '2 ban(s) restored from the journal, 1 ended while stopped' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+rm -f "${LOG}" "${OUTPUT}" "${JOURNAL}" "${JOURNAL}.snapshot"
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.kinds.log"
+declare -r OUTPUT="/tmp/${PPID}.kinds.out"
+declare -r SYSV="/tmp/${PPID}.banip.sysv"
+declare -r SOCKET="/tmp/${PPID}.banip.sock"
+
+# left by a previous run (banipd can't unlink them after dropping its privileges)
+rm -f /dev/mqueue/test-kinds "${SYSV}" "${SOCKET}" 2> /dev/null
+
+# the dummy engine writes what it bans, and into which table, to stderr
+${TESTDIR}/../banipd -d -e dummy -q "posix:/test-kinds" -t posix -q "sysv:${SYSV}:c" -t sysv -q "unix:${SOCKET}" -t unix -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queues
+sleep 1
+${TESTDIR}/../banip-cli "posix:/test-kinds" 1.2.3.4 > /dev/null
+# with its id or not: the one the queue was created with is read from the file
+${TESTDIR}/../banip-cli "sysv:${SYSV}:c" 1.2.3.5 > /dev/null
+${TESTDIR}/../banip-cli "sysv:${SYSV}" 1.2.3.6 > /dev/null
+${TESTDIR}/../banip-cli "unix:${SOCKET}" 1.2.3.7 > /dev/null
+sleep 1
+assertExitValue "Kinds of queues (POSIX)" "grep -qF \"Received: '1.2.3.4' into posix\" '${OUTPUT}'" $TRUE
+assertExitValue "Kinds of queues (System V)" "grep -qF \"Received: '1.2.3.5' into sysv\" '${OUTPUT}'" $TRUE
+assertExitValue "Kinds of queues (System V, relayed again)" "grep -qF \"Received: '1.2.3.6' into sysv\" '${OUTPUT}'" $TRUE
+assertExitValue "Kinds of queues (unix socket)" "grep -qF \"Received: '1.2.3.7' into unix\" '${OUTPUT}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+sleep 1
+# nor can it remove its System V queue: its key is the one of ftok(3) for 'c'
+ipcrm -Q `stat -c '%d %i' "${SYSV}" | (read dev ino; printf '0x63%02x%04x' $((dev & 0xFF)) $((ino & 0xFFFF)))` 2> /dev/null
+rm -f /dev/mqueue/test-kinds "${SYSV}" "${SOCKET}" 2> /dev/null
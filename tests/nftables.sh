@@ -5,9 +5,20 @@ declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
 . ${TESTDIR}/assert.sh.inc
 
 skipUnlessBinaryExists nft
+skipUnlessBinaryExists unshare
 
-${TESTDIR}/../pftest nftables
+# run in a private network namespace to leave the ruleset of the host untouched
+if [ -z "${BANIP_NETNS}" ]; then
+    BANIP_NETNS=1 exec unshare -n bash "${BASH_SOURCE}" "$@"
+fi
 
-assertOutputValue "nftables" "nft list set filter ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 1.2.3.4" 1 "-eq"
+nft add table inet filter
+nft add set inet filter "${PFBAN_TEST_TABLE}4" "{ type ipv4_addr; flags interval; }"
+nft add set inet filter "${PFBAN_TEST_TABLE}6" "{ type ipv6_addr; flags interval; }"
 
-nft delete element filter "${PFBAN_TEST_TABLE}" "{ 1.2.3.4 }" &> /dev/null
+${TESTDIR}/../pftest nftables 1.2.3.4 10.0.0.0/8 2001:db8::1
+
+assertExitValue "nftables (address)" "nft get element inet filter ${PFBAN_TEST_TABLE}4 '{ 1.2.3.4 }' &> /dev/null" $TRUE
+assertExitValue "nftables (CIDR)" "nft get element inet filter ${PFBAN_TEST_TABLE}4 '{ 10.20.30.40 }' &> /dev/null" $TRUE
+assertExitValue "nftables (IPv6)" "nft get element inet filter ${PFBAN_TEST_TABLE}6 '{ 2001:db8::42 }' &> /dev/null" $TRUE
+assertExitValue "nftables (not banned)" "nft get element inet filter ${PFBAN_TEST_TABLE}4 '{ 1.2.3.5 }' &> /dev/null" $FALSE
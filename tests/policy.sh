@@ -0,0 +1,33 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.policy.log"
+declare -r OUTPUT="/tmp/${PPID}.policy.out"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-policy 2> /dev/null
+
+# the dummy engine writes what it bans and unbans to stderr
+${TESTDIR}/../banipd -d -q /test-policy -t dummy -e dummy -T 1 -P escalate=4,widen=3 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queue
+sleep 1
+${TESTDIR}/../banip-cli /test-policy 1.2.3.4 > /dev/null
+sleep 3
+# second offense: banned for 4 seconds
+${TESTDIR}/../banip-cli /test-policy 1.2.3.4 > /dev/null
+sleep 2
+assertOutputValue "Policy (escalation)" "grep -cF \"Removed: '1.2.3.4'\" '${OUTPUT}'" 1
+for i in 1 2 3; do
+    ${TESTDIR}/../banip-cli /test-policy "5.6.7.${i} 600" > /dev/null
+    sleep 1
+done
+assertExitValue "Policy (widening)" "grep -qF \"Received: '5.6.7.0'\" '${OUTPUT}'" $TRUE
+assertExitValue "Policy (not widened too early)" "grep -qF \"Received: '5.6.7.2'\" '${OUTPUT}'" $TRUE
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Policy (statistics)" "grep -qF 'policy: 1 ban(s) escalated, 1 prefix(es) widened' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+assertExitValue "Policy (size too large)" "${TESTDIR}/../banipd -q /test-policy -t dummy -e dummy -P widen=3,size=18446744073709551615 2> /dev/null" $FALSE
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.queues.log"
+declare -r OUTPUT="/tmp/${PPID}.queues.out"
+
+# left by a previous run (banipd can't unlink them after dropping its privileges)
+rm -f /dev/mqueue/test-queue1 /dev/mqueue/test-queue2 2> /dev/null
+
+# the dummy engine writes what it bans, and into which table, to stderr
+${TESTDIR}/../banipd -d -e dummy -q /test-queue1 -t table1 -q /test-queue2 -t table2 -T 1 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queues
+sleep 1
+${TESTDIR}/../banip-cli /test-queue1 1.2.3.4 > /dev/null
+${TESTDIR}/../banip-cli /test-queue2 1.2.3.4 > /dev/null
+${TESTDIR}/../banip-cli /test-queue2 5.6.7.8 > /dev/null
+sleep 1
+assertExitValue "Queues (first table)" "grep -qF \"Received: '1.2.3.4' into table1\" '${OUTPUT}'" $TRUE
+assertExitValue "Queues (second table, own cache)" "grep -qF \"Received: '1.2.3.4' into table2\" '${OUTPUT}'" $TRUE
+assertExitValue "Queues (not mixed)" "grep -qF \"Received: '5.6.7.8' into table1\" '${OUTPUT}'" $FALSE
+sleep 2
+assertExitValue "Queues (ttl of the second queue only)" "grep -qF \"Removed: '5.6.7.8' from table2\" '${OUTPUT}'" $TRUE
+assertExitValue "Queues (no ttl for the first queue)" "grep -qF \"Removed: '1.2.3.4' from table1\" '${OUTPUT}'" $FALSE
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Queues (statistics)" "grep -qF '/test-queue2: cache: 0 hit(s), 2 miss(es)' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
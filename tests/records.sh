@@ -0,0 +1,56 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.records.log"
+declare -r OUTPUT="/tmp/${PPID}.records.out"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-records 2> /dev/null
+
+# the dummy engine writes what it bans, and into which table, to stderr
+${TESTDIR}/../banipd -d -e dummy -q /test-records -t dummy -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queue
+sleep 1
+# several records in a single message
+${TESTDIR}/../banip-cli -b /test-records 10.2.0.1 "10.2.0.2 1" 2001:db8:1::1/48 2001:db8:2::1 > /dev/null
+${TESTDIR}/../banip-cli /test-records 10.2.0.3 > /dev/null
+sleep 1
+assertExitValue "Records (first one)" "grep -qF \"Received: '10.2.0.1' into dummy\" '${OUTPUT}'" $TRUE
+assertExitValue "Records (network, masked)" "grep -qF \"Received: '2001:db8:1::' into dummy\" '${OUTPUT}'" $TRUE
+assertExitValue "Records (IPv6 address, its /64)" "grep -qF \"Received: '2001:db8:2::' into dummy\" '${OUTPUT}'" $TRUE
+assertExitValue "Records (text still accepted)" "grep -qF \"Received: '10.2.0.3' into dummy\" '${OUTPUT}'" $TRUE
+sleep 2
+assertExitValue "Records (ttl)" "grep -qF \"Removed: '10.2.0.2' from dummy\" '${OUTPUT}'" $TRUE
+${TESTDIR}/../banip-cli -b /test-records "unban 10.2.0.1" > /dev/null
+sleep 1
+assertExitValue "Records (unban)" "grep -qF \"Removed: '10.2.0.1' from dummy\" '${OUTPUT}'" $TRUE
+# an unban then a ban of the same address in a single message: applied in that order
+${TESTDIR}/../banip-cli /test-records 10.3.0.1 > /dev/null
+sleep 1
+${TESTDIR}/../banip-cli -b /test-records "unban 10.3.0.1" 10.3.0.1 > /dev/null
+sleep 1
+assertExitValue "Records (unban then ban)" "grep -F \"'10.3.0.1'\" '${OUTPUT}' | tail -n 1 | grep -qF 'Received:'" $TRUE
+# an address only covered by a banned network is not unbanned by itself
+${TESTDIR}/../banip-cli /test-records 10.4.0.0/16 > /dev/null
+sleep 1
+${TESTDIR}/../banip-cli -b /test-records "unban 10.4.0.1" > /dev/null
+sleep 1
+assertExitValue "Records (unban within a network)" "grep -qF \"Removed: '10.4.0.1'\" '${OUTPUT}'" $FALSE
+assertExitValue "Records (unban within a network, reported)" "grep -qF '10.4.0.1/32 not unbanned: banned as part of 10.4.0.0/16' '${LOG}'" $TRUE
+# neither is an address merged with its neighbour, but it is reported too
+${TESTDIR}/../banip-cli -b /test-records 10.9.9.4 10.9.9.5 > /dev/null
+sleep 1
+${TESTDIR}/../banip-cli -b /test-records "unban 10.9.9.4" > /dev/null
+sleep 1
+assertExitValue "Records (unban of a merged address, reported)" "grep -qF '10.9.9.4/32 not unbanned: banned as part of 10.9.9.4/31' '${LOG}'" $TRUE
+# a record refused (reports are disabled) doesn't take the next ones of its message down
+${TESTDIR}/../banip-cli -b /test-records "report 10.6.0.1" 10.6.0.3 > /dev/null
+sleep 1
+assertExitValue "Records (refused one skipped)" "grep -qF 'record 1 of 2: report received but reports are disabled' '${LOG}' && grep -qF \"Received: '10.6.0.3'\" '${OUTPUT}'" $TRUE
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Records (statistics)" "grep -qF 'expiry: 0 ban(s) pending, 1 expired, 2 unbanned' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
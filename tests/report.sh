@@ -0,0 +1,30 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.report.log"
+declare -r OUTPUT="/tmp/${PPID}.report.out"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-report 2> /dev/null
+
+# the dummy engine writes what it bans to stderr
+${TESTDIR}/../banipd -d -q /test-report -t dummy -e dummy -R 3/60 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queue
+sleep 1
+${TESTDIR}/../banip-cli /test-report "report 1.2.3.4" > /dev/null
+${TESTDIR}/../banip-cli /test-report "report 1.2.3.4" > /dev/null
+${TESTDIR}/../banip-cli /test-report "report 5.6.7.8" > /dev/null
+sleep 1
+assertExitValue "Report (below the threshold)" "grep -qF \"Received: '1.2.3.4'\" '${OUTPUT}'" $FALSE
+${TESTDIR}/../banip-cli /test-report "report 1.2.3.4" > /dev/null
+sleep 1
+assertExitValue "Report (threshold reached)" "grep -qF \"Received: '1.2.3.4'\" '${OUTPUT}'" $TRUE
+assertExitValue "Report (other source)" "grep -qF \"Received: '5.6.7.8'\" '${OUTPUT}'" $FALSE
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Report (statistics)" "grep -qF 'reports: 4 received, 1 ban(s)' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+assertExitValue "Report (too many counters)" "${TESTDIR}/../banipd -q /test-report -t dummy -e dummy -R 3/10/4294967296 2> /dev/null" $FALSE
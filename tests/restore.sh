@@ -0,0 +1,36 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+skipUnlessBinaryExists iptables-restore
+skipUnlessBinaryExists ip6tables-restore
+skipUnlessBinaryExists unshare
+
+# run in a private network namespace to leave the ruleset of the host untouched
+if [ -z "${BANIP_NETNS}" ]; then
+    BANIP_NETNS=1 exec unshare -n bash "${BASH_SOURCE}" "$@"
+fi
+
+iptables -N ${PFBAN_TEST_TABLE}
+ip6tables -N ${PFBAN_TEST_TABLE}
+
+${TESTDIR}/../pftest iptables-restore 1.2.3.4 10.0.0.0/8 2001:db8::1
+
+assertOutputValue "iptables-restore (address)" "iptables -nL ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 1.2.3.4" 1 "-eq"
+assertOutputValue "iptables-restore (CIDR)" "iptables -nL ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 10.0.0.0/8" 1 "-eq"
+assertOutputValue "iptables-restore (IPv6)" "ip6tables -nL ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 2001:db8::/64" 1 "-eq"
+
+${TESTDIR}/../pftest iptables-restore -d 1.2.3.4 2001:db8::1
+
+assertOutputValue "iptables-restore (deleted)" "iptables -nL ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 1.2.3.4" 0 "-eq"
+assertOutputValue "iptables-restore (IPv6 deleted)" "ip6tables -nL ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 2001:db8::/64" 0 "-eq"
+assertOutputValue "iptables-restore (others kept)" "iptables -nL ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 10.0.0.0/8" 1 "-eq"
+
+# a rule which doesn't exist: the failure is logged along with its address
+declare -r OUTPUT="/tmp/${PPID}.restore.out"
+${TESTDIR}/../pftest iptables-restore -d 5.6.7.8 2> "${OUTPUT}"
+assertExitValue "iptables-restore (failure reported)" "grep -qF '(5.6.7.8)' '${OUTPUT}'" $TRUE
+assertOutputValue "iptables-restore (failed chunk left the rest)" "iptables -nL ${PFBAN_TEST_TABLE} 2>/dev/null | grep -cF 10.0.0.0/8" 1 "-eq"
+rm -f "${OUTPUT}"
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.shm.log"
+declare -r OUTPUT="/tmp/${PPID}.shm.out"
+
+# the dummy engine writes what it bans, and into which table, to stderr
+${TESTDIR}/../banipd -d -e dummy -q shm:/test-shm -t dummy -s 16 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queue
+sleep 1
+assertExitValue "Shared memory (mode)" "stat -c %a /dev/shm/test-shm | grep -qx 660" $TRUE
+for i in `seq 1 20`; do
+    ${TESTDIR}/../banip-cli shm:/test-shm 10.0.1.${i} > /dev/null
+done
+sleep 1
+assertExitValue "Shared memory (received)" "grep -qF \"Received: '10.0.1.1' into dummy\" '${OUTPUT}'" $TRUE
+assertExitValue "Shared memory (all received)" "grep -qF \"Received: '10.0.1.20' into dummy\" '${OUTPUT}'" $TRUE
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Shared memory (statistics)" "grep -qF 'queue: 0 message(s) dropped by the senders (queue full)' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+sleep 1
+# banipd can't unlink the segment after dropping its privileges: the next one takes it over
+${TESTDIR}/../banipd -d -e dummy -q shm:/test-shm -t dummy -s 16 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+sleep 1
+${TESTDIR}/../banip-cli shm:/test-shm 10.0.2.1 > /dev/null
+sleep 1
+assertExitValue "Shared memory (stale one reclaimed)" "grep -qF \"Received: '10.0.2.1' into dummy\" '${OUTPUT}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+sleep 1
+rm -f /dev/shm/test-shm 2> /dev/null
@@ -5,7 +5,28 @@ declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
 . ${TESTDIR}/assert.sh.inc
 
 ${TESTDIR}/../banipd -d -q /test -t dummy -e dummy -p ${TESTDIR}/test.pid
+# let it write its pid file
+sleep 1
 kill -USR1 `cat ${TESTDIR}/test.pid`
 sleep 2
 assertExitValue "Signal handling (USR1)" "kill -0 `cat ${TESTDIR}/test.pid`" $TRUE
 assertExitValue "Signal handling (TERM)" "kill -TERM `cat ${TESTDIR}/test.pid`" $TRUE
+
+# what was received when TERM comes in is still handed to the engine before exiting
+declare -r OUTPUT="/tmp/${PPID}.signals.out"
+declare -r FEED="/tmp/${PPID}.signals.feed"
+rm -f /dev/mqueue/test-term 2> /dev/null
+# odd addresses only: no sibling to be merged with (see merge_batch)
+for i in `seq 0 249`; do
+    echo "10.5.$((i / 128)).$((i % 128 * 2 + 1))"
+done > "${FEED}"
+${TESTDIR}/../banipd -d -q /test-term -t dummy -e dummy -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+sleep 1
+PID=`cat ${TESTDIR}/test.pid`
+${TESTDIR}/../banip-cli -f - /test-term < "${FEED}" > /dev/null
+kill -TERM ${PID}
+sleep 1
+assertOutputValue "Signal handling (TERM, bans applied)" "grep -cF \"Received: '10.5.\" '${OUTPUT}'" 250 "-eq"
+# last, a failure runs the trap of assert.sh.inc (output removed); a zombie, left unreaped, has exited too
+assertExitValue "Signal handling (TERM, exited)" "ps -o stat= -p ${PID} | grep -qv '^Z'" $FALSE
+rm -f /dev/mqueue/test-term "${OUTPUT}" "${FEED}" 2> /dev/null
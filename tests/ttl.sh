@@ -0,0 +1,29 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.ttl.log"
+declare -r OUTPUT="/tmp/${PPID}.ttl.out"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-ttl 2> /dev/null
+
+# the dummy engine writes what it bans and unbans to stderr
+${TESTDIR}/../banipd -d -q /test-ttl -t dummy -e dummy -T 1 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it create the queue
+sleep 1
+${TESTDIR}/../banip-cli /test-ttl 1.2.3.4 > /dev/null
+${TESTDIR}/../banip-cli /test-ttl "10.0.0.0/8 600" > /dev/null
+sleep 3
+assertExitValue "TTL (default)" "grep -qF \"Removed: '1.2.3.4'\" '${OUTPUT}'" $TRUE
+assertExitValue "TTL (in message)" "grep -qF \"Removed: '10.0.0.0'\" '${OUTPUT}'" $FALSE
+# not in the cache anymore: banned again
+${TESTDIR}/../banip-cli /test-ttl 1.2.3.4 > /dev/null
+sleep 1
+assertOutputValue "TTL (banned again)" "grep -cF \"Received: '1.2.3.4'\" '${OUTPUT}'" 2
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "TTL (statistics)" "grep -qF 'expiry: 1 ban(s) pending, 2 expired' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.unix.log"
+declare -r OUTPUT="/tmp/${PPID}.unix.out"
+declare -r SOCKET="/tmp/${PPID}.banip.sock"
+
+# the dummy engine writes what it bans, and into which table, to stderr
+${TESTDIR}/../banipd -d -e dummy -q "unix:${SOCKET}" -t dummy -s 100 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+# let it bind the socket
+sleep 1
+assertExitValue "Unix socket (mode)" "stat -c %a '${SOCKET}' | grep -qx 660" $TRUE
+for i in `seq 1 40`; do
+    ${TESTDIR}/../banip-cli "unix:${SOCKET}" 10.0.0.${i} > /dev/null
+done
+sleep 1
+assertExitValue "Unix socket (received)" "grep -qF \"Received: '10.0.0.1' into dummy\" '${OUTPUT}'" $TRUE
+assertExitValue "Unix socket (all received)" "grep -qF \"Received: '10.0.0.40' into dummy\" '${OUTPUT}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+sleep 1
+# banipd can't unlink the socket after dropping its privileges: the next one takes it over
+${TESTDIR}/../banipd -d -e dummy -q "unix:${SOCKET}" -t dummy -b 100 -l "${LOG}" -p ${TESTDIR}/test.pid 2> "${OUTPUT}"
+sleep 1
+${TESTDIR}/../banip-cli "unix:${SOCKET}" 10.0.1.1 > /dev/null
+sleep 1
+assertExitValue "Unix socket (stale one reclaimed)" "grep -qF \"Received: '10.0.1.1' into dummy\" '${OUTPUT}'" $TRUE
+# 5 records (140 bytes) in a single datagram, over the 100 bytes of -b: dropped, not truncated
+${TESTDIR}/../banip-cli -b "unix:${SOCKET}" 10.0.2.1 10.0.2.2 10.0.2.3 10.0.2.4 10.0.2.5 > /dev/null
+${TESTDIR}/../banip-cli "unix:${SOCKET}" 10.0.2.6 > /dev/null
+sleep 1
+assertExitValue "Unix socket (too long, dropped)" "grep -qF \"Received: '10.0.2.1' into dummy\" '${OUTPUT}'" $FALSE
+assertExitValue "Unix socket (too long, reported)" "grep -qF '1 message(s) too long, dropped' '${LOG}'" $TRUE
+assertExitValue "Unix socket (next one received)" "grep -qF \"Received: '10.0.2.6' into dummy\" '${OUTPUT}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
+sleep 1
+rm -f "${SOCKET}" 2> /dev/null
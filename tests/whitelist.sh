@@ -0,0 +1,43 @@
+#!/bin/bash
+
+declare -r TESTDIR=$(dirname $(readlink -f "${BASH_SOURCE}"))
+
+. ${TESTDIR}/assert.sh.inc
+
+declare -r LOG="/tmp/${PPID}.whitelist.log"
+declare -r WHITELIST="/tmp/${PPID}.whitelist"
+
+cat > "${WHITELIST}" <<EOW
+# load balancers
+10.0.0.0/8
+2001:db8::1 # a single address
+EOW
+chmod 644 "${WHITELIST}"
+
+# left by a previous run (banipd can't unlink it after dropping its privileges)
+rm -f /dev/mqueue/test-whitelist 2> /dev/null
+${TESTDIR}/../banipd -d -q /test-whitelist -t dummy -e dummy -l "${LOG}" -p ${TESTDIR}/test.pid -W "${WHITELIST}"
+sleep 1
+for addr in 10.1.2.3 8.0.0.0/6 127.0.0.1 2001:db8::/120 11.0.0.1 2001:db8:0:1::1; do
+    ${TESTDIR}/../banip-cli /test-whitelist "${addr}" > /dev/null
+done
+sleep 1
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Whitelist" "grep -qF 'whitelist: 4 network(s), 4 address(es) not banned' '${LOG}'" $TRUE
+
+echo 192.168.0.0/16 > "${WHITELIST}"
+kill -HUP `cat ${TESTDIR}/test.pid`
+sleep 1
+${TESTDIR}/../banip-cli /test-whitelist 10.1.2.3 > /dev/null
+${TESTDIR}/../banip-cli /test-whitelist 192.168.1.1 > /dev/null
+sleep 1
+kill -USR2 `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Whitelist (reload)" "grep -qF 'whitelist: 3 network(s), 5 address(es) not banned' '${LOG}'" $TRUE
+
+echo garbage > "${WHITELIST}"
+kill -HUP `cat ${TESTDIR}/test.pid`
+sleep 1
+assertExitValue "Whitelist (failed reload)" "grep -qF 'reloading whitelist failed' '${LOG}'" $TRUE
+kill -TERM `cat ${TESTDIR}/test.pid`
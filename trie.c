@@ -0,0 +1,610 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "trie.h"
+
+#define TRIE_NIL 0
+
+/* initial number of nodes of the pool */
+#define TRIE_INITIAL_CAPACITY 64
+
+struct trie_node_t {
+    uint32_t children[2];
+    uint8_t length; /* of the prefix, in bits */
+    bool terminal;  /* false for a node only here to branch */
+    uint8_t key[TRIE_KEY_SIZE]; /* bits beyond length are zeroed */
+    uint8_t unused[6]; /* 32 bytes: 2 nodes per cache line, none across 2 lines */
+};
+
+struct trie_bucket_t {
+    uint32_t root;
+    uint8_t cover; /* 1 + length of the longest short prefix which includes the bucket, 0 if none */
+};
+
+#define NODE(trie, index) \
+    (&(trie)->nodes[index])
+
+#define BUCKET(key) \
+    ((((const uint8_t *) (key))[0] << 8) | ((const uint8_t *) (key))[1])
+
+#define BUCKET_COUNT (1 << TRIE_STRIDE)
+
+#define BIT(key, i) \
+    ((((const uint8_t *) (key))[(i) / 8] >> (7 - (i) % 8)) & 1)
+
+/**
+ * Copy the first length bits of src to dst, zeroing the others
+ **/
+static void key_mask(uint8_t *dst, const void *src, uint8_t length)
+{
+    size_t bytes;
+
+    bytes = length / 8;
+    memcpy(dst, src, bytes);
+    if (0 != length % 8) {
+        dst[bytes] = ((const uint8_t *) src)[bytes] & (0xFF << (8 - length % 8));
+        ++bytes;
+    }
+    memset(dst + bytes, 0, TRIE_KEY_SIZE - bytes);
+}
+
+/**
+ * @return the number of leading bits a and b have in common, up to max
+ **/
+static uint8_t key_common(const uint8_t *a, const uint8_t *b, uint8_t max)
+{
+    size_t i;
+
+    for (i = 0; i * 8 < max; i++) {
+        if (a[i] != b[i]) {
+            uint8_t bits;
+
+            bits = i * 8 + __builtin_clz((unsigned int) (a[i] ^ b[i])) - (sizeof(unsigned int) - 1) * 8;
+
+            return bits < max ? bits : max;
+        }
+    }
+
+    return max;
+}
+
+/**
+ * Does key start with the length first bits of the node?
+ **/
+static bool key_match(const trie_node_t *node, const void *key)
+{
+    return key_common(node->key, key, node->length) == node->length;
+}
+
+void trie_init(trie_t *trie)
+{
+    trie->nodes = NULL;
+    trie->buckets = NULL;
+    trie->capacity = 0;
+    trie_reset(trie);
+}
+
+/**
+ * Initialize a trie intended to hold a lot of prefixes (like thousands)
+ **/
+bool trie_init_large(trie_t *trie, char **error)
+{
+    trie_init(trie);
+    if (NULL == (trie->buckets = calloc(BUCKET_COUNT, sizeof(*trie->buckets)))) {
+        set_calloc_error(error, BUCKET_COUNT, sizeof(*trie->buckets));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Empty the trie but keep its memory
+ **/
+void trie_reset(trie_t *trie)
+{
+    trie->size = 1; /* index 0 is TRIE_NIL */
+    trie->root = TRIE_NIL;
+    trie->free = TRIE_NIL;
+    trie->count = 0;
+    if (NULL != trie->buckets) {
+        memset(trie->buckets, 0, BUCKET_COUNT * sizeof(*trie->buckets));
+    }
+}
+
+void trie_free(trie_t *trie)
+{
+    free(trie->nodes);
+    free(trie->buckets);
+    trie_init(trie);
+}
+
+static uint32_t trie_copy(const trie_t *trie, trie_node_t *nodes, uint32_t *next, uint32_t index)
+{
+    uint32_t copy;
+
+    if (TRIE_NIL == index) {
+        return TRIE_NIL;
+    }
+    copy = (*next)++;
+    nodes[copy] = trie->nodes[index];
+    nodes[copy].children[0] = trie_copy(trie, nodes, next, trie->nodes[index].children[0]);
+    nodes[copy].children[1] = trie_copy(trie, nodes, next, trie->nodes[index].children[1]);
+
+    return copy;
+}
+
+/**
+ * Rebuild the pool in depth-first order so that a lookup, especially in
+ * a bucket, reads nodes close to each others. Worth it after a bulk load.
+ **/
+bool trie_optimize(trie_t *trie, char **error)
+{
+    uint32_t next;
+    trie_node_t *nodes;
+
+    if (NULL == trie->nodes) {
+        return true;
+    }
+    if (NULL == (nodes = malloc(trie->capacity * sizeof(*nodes)))) {
+        set_malloc_error(error, trie->capacity * sizeof(*nodes));
+        return false;
+    }
+    next = 1;
+    trie->root = trie_copy(trie, nodes, &next, trie->root);
+    if (NULL != trie->buckets) {
+        uint32_t i;
+
+        for (i = 0; i < BUCKET_COUNT; i++) {
+            trie->buckets[i].root = trie_copy(trie, nodes, &next, trie->buckets[i].root);
+        }
+    }
+    free(trie->nodes);
+    trie->nodes = nodes;
+    trie->size = next;
+    trie->free = TRIE_NIL;
+
+    return true;
+}
+
+/**
+ * @return the link to the root of the (sub-)trie where the prefix key/length belongs
+ **/
+static uint32_t *trie_root(const trie_t *trie, const void *key, uint8_t length)
+{
+    if (NULL != trie->buckets && length >= TRIE_STRIDE) {
+        return &trie->buckets[BUCKET(key)].root;
+    }
+
+    return (uint32_t *) &trie->root;
+}
+
+/**
+ * Make sure the next count allocations won't move the pool
+ **/
+static bool trie_reserve(trie_t *trie, uint32_t count, char **error)
+{
+    if (trie->size + count > trie->capacity) {
+        uint32_t capacity;
+        trie_node_t *nodes;
+
+        capacity = 0 == trie->capacity ? TRIE_INITIAL_CAPACITY : trie->capacity * 2;
+        if (NULL == (nodes = realloc(trie->nodes, capacity * sizeof(*nodes)))) {
+            set_malloc_error(error, capacity * sizeof(*nodes));
+            return false;
+        }
+        trie->nodes = nodes;
+        trie->capacity = capacity;
+    }
+
+    return true;
+}
+
+static uint32_t trie_node_new(trie_t *trie, const uint8_t *key, uint8_t length, bool terminal)
+{
+    uint32_t index;
+    trie_node_t *node;
+
+    if (TRIE_NIL != trie->free) {
+        index = trie->free;
+        trie->free = NODE(trie, index)->children[0];
+    } else {
+        index = trie->size++;
+    }
+    node = NODE(trie, index);
+    node->children[0] = node->children[1] = TRIE_NIL;
+    node->length = length;
+    node->terminal = terminal;
+    key_mask(node->key, key, length);
+
+    return index;
+}
+
+static void trie_node_release(trie_t *trie, uint32_t index)
+{
+    NODE(trie, index)->children[0] = trie->free;
+    trie->free = index;
+}
+
+static bool trie_insert_node(trie_t *trie, const void *key, uint8_t length, char **error)
+{
+    uint32_t *link;
+    uint8_t k[TRIE_KEY_SIZE];
+
+    key_mask(k, key, length);
+    /* a split needs 2 nodes, pointers into the pool stay valid from here */
+    if (!trie_reserve(trie, 2, error)) {
+        return false;
+    }
+    for (link = trie_root(trie, k, length); TRIE_NIL != *link; ) {
+        uint8_t common;
+        trie_node_t *node;
+
+        node = NODE(trie, *link);
+        common = key_common(k, node->key, length < node->length ? length : node->length);
+        if (common < node->length) {
+            uint32_t index;
+
+            /* the new prefix and node diverge (or the new prefix is shorter): insert a node above */
+            if (common == length) {
+                index = trie_node_new(trie, k, length, true);
+                NODE(trie, index)->children[BIT(node->key, length)] = *link;
+            } else {
+                index = trie_node_new(trie, k, common, false);
+                NODE(trie, index)->children[BIT(node->key, common)] = *link;
+                NODE(trie, index)->children[BIT(k, common)] = trie_node_new(trie, k, length, true);
+            }
+            *link = index;
+            ++trie->count;
+            return true;
+        }
+        if (node->length == length) {
+            if (!node->terminal) {
+                node->terminal = true;
+                ++trie->count;
+            }
+            return true;
+        }
+        link = &node->children[BIT(k, node->length)];
+    }
+    *link = trie_node_new(trie, k, length, true);
+    ++trie->count;
+
+    return true;
+}
+
+/**
+ * Unlink the node pointed by link if it is no longer needed (non terminal
+ * with less than 2 children)
+ *
+ * @return true if the node was removed
+ **/
+static bool trie_prune(trie_t *trie, uint32_t *link)
+{
+    uint32_t index;
+    trie_node_t *node;
+
+    index = *link;
+    node = NODE(trie, index);
+    if (node->terminal || (TRIE_NIL != node->children[0] && TRIE_NIL != node->children[1])) {
+        return false;
+    }
+    *link = TRIE_NIL != node->children[0] ? node->children[0] : node->children[1];
+    trie_node_release(trie, index);
+
+    return true;
+}
+
+static bool trie_remove_node(trie_t *trie, const void *key, uint8_t length)
+{
+    trie_node_t *node;
+    uint32_t *link, *parent;
+
+    parent = NULL;
+    for (link = trie_root(trie, key, length); TRIE_NIL != *link; link = &node->children[BIT(key, node->length)]) {
+        node = NODE(trie, *link);
+        if (node->length > length || !key_match(node, key)) {
+            return false;
+        }
+        if (node->length == length) {
+            break;
+        }
+        parent = link;
+    }
+    if (TRIE_NIL == *link || !NODE(trie, *link)->terminal) {
+        return false;
+    }
+    NODE(trie, *link)->terminal = false;
+    --trie->count;
+    /* the node and then its parent (a branching node) may have become useless */
+    if (trie_prune(trie, link) && NULL != parent) {
+        trie_prune(trie, parent);
+    }
+
+    return true;
+}
+
+/**
+ * Is exactly the prefix key/length in the trie?
+ **/
+bool trie_find(const trie_t *trie, const void *key, uint8_t length)
+{
+    uint32_t index;
+
+    for (index = *trie_root(trie, key, length); TRIE_NIL != index; ) {
+        const trie_node_t *node;
+
+        node = NODE(trie, index);
+        if (node->length > length || !key_match(node, key)) {
+            break;
+        }
+        if (node->length == length) {
+            return node->terminal;
+        }
+        index = node->children[BIT(key, node->length)];
+    }
+
+    return false;
+}
+
+/**
+ * Walk down from root as long as the nodes include key/length
+ *
+ * @param shortest stop on the first match instead of the longest one
+ **/
+static bool trie_walk(const trie_t *trie, uint32_t index, const void *key, uint8_t length, bool shortest, uint8_t *match)
+{
+    bool found;
+
+    found = false;
+    while (TRIE_NIL != index) {
+        const trie_node_t *node;
+
+        node = NODE(trie, index);
+        if (node->length > length || !key_match(node, key)) {
+            break;
+        }
+        if (node->terminal) {
+            found = true;
+            if (NULL != match) {
+                *match = node->length;
+            }
+            if (shortest) {
+                break;
+            }
+        }
+        if (node->length == length) {
+            break;
+        }
+        index = node->children[BIT(key, node->length)];
+    }
+
+    return found;
+}
+
+/**
+ * Longest prefix match: look for the longest prefix of the trie which
+ * includes key/length
+ *
+ * @param match if not NULL, set to the length of this prefix
+ *
+ * @return false if there is none
+ **/
+bool trie_lookup(const trie_t *trie, const void *key, uint8_t length, uint8_t *match)
+{
+    if (NULL != trie->buckets && length >= TRIE_STRIDE) {
+        const trie_bucket_t *bucket;
+
+        bucket = &trie->buckets[BUCKET(key)];
+        /* the prefixes of a bucket are longer than the other ones */
+        if (trie_walk(trie, bucket->root, key, length, false, match)) {
+            return true;
+        }
+        if (0 != bucket->cover && NULL != match) {
+            *match = bucket->cover - 1;
+        }
+
+        return 0 != bucket->cover;
+    }
+
+    return trie_walk(trie, trie->root, key, length, false, match);
+}
+
+/**
+ * Is the prefix key/length equal to or included in a prefix of the trie?
+ **/
+bool trie_covered(const trie_t *trie, const void *key, uint8_t length)
+{
+    if (NULL != trie->buckets && length >= TRIE_STRIDE) {
+        const trie_bucket_t *bucket;
+
+        bucket = &trie->buckets[BUCKET(key)];
+
+        return 0 != bucket->cover || trie_walk(trie, bucket->root, key, length, true, NULL);
+    }
+
+    return trie_walk(trie, trie->root, key, length, true, NULL);
+}
+
+/**
+ * Is there a prefix below key/length (included in it) in the sub-trie root?
+ **/
+static bool trie_has_below(const trie_t *trie, uint32_t index, const void *key, uint8_t length)
+{
+    while (TRIE_NIL != index) {
+        const trie_node_t *node;
+
+        node = NODE(trie, index);
+        if (node->length >= length) {
+            /* no empty sub-trie is kept: there is at least one prefix from here */
+            return key_common(node->key, key, length) == length;
+        }
+        if (!key_match(node, key)) {
+            break;
+        }
+        index = node->children[BIT(key, node->length)];
+    }
+
+    return false;
+}
+
+/**
+ * Do the prefix key/length and a prefix of the trie overlap? That is, is
+ * key/length covered by a prefix of the trie or does it include one?
+ **/
+bool trie_overlaps(const trie_t *trie, const void *key, uint8_t length)
+{
+    if (trie_covered(trie, key, length)) {
+        return true;
+    }
+    if (NULL != trie->buckets) {
+        uint32_t i, first;
+        uint8_t k[TRIE_KEY_SIZE];
+
+        if (length >= TRIE_STRIDE) {
+            return trie_has_below(trie, trie->buckets[BUCKET(key)].root, key, length);
+        }
+        key_mask(k, key, length);
+        first = BUCKET(k);
+        for (i = first; i < first + (1U << (TRIE_STRIDE - length)); i++) {
+            if (TRIE_NIL != trie->buckets[i].root) {
+                return true;
+            }
+        }
+    }
+
+    return trie_has_below(trie, trie->root, key, length);
+}
+
+/**
+ * Refresh the cover of the buckets included in the short prefix key/length
+ **/
+static void trie_update_covers(trie_t *trie, const void *key, uint8_t length)
+{
+    uint32_t i, first;
+    uint8_t k[TRIE_KEY_SIZE];
+
+    key_mask(k, key, length);
+    first = BUCKET(k);
+    for (i = first; i < first + (1U << (TRIE_STRIDE - length)); i++) {
+        uint8_t match;
+
+        k[0] = i >> 8;
+        k[1] = i & 0xFF;
+        trie->buckets[i].cover = trie_walk(trie, trie->root, k, TRIE_STRIDE, false, &match) ? match + 1 : 0;
+    }
+}
+
+/**
+ * Add the prefix key/length to the trie
+ *
+ * @return false if memory allocation failed
+ **/
+bool trie_insert(trie_t *trie, const void *key, uint8_t length, char **error)
+{
+    if (!trie_insert_node(trie, key, length, error)) {
+        return false;
+    }
+    if (NULL != trie->buckets && length < TRIE_STRIDE) {
+        trie_update_covers(trie, key, length);
+    }
+
+    return true;
+}
+
+/**
+ * Remove the prefix key/length (exact match)
+ *
+ * @return false if the prefix wasn't in the trie
+ **/
+bool trie_remove(trie_t *trie, const void *key, uint8_t length)
+{
+    if (!trie_remove_node(trie, key, length)) {
+        return false;
+    }
+    if (NULL != trie->buckets && length < TRIE_STRIDE) {
+        trie_update_covers(trie, key, length);
+    }
+
+    return true;
+}
+
+/**
+ * Replace the prefix key/length (which has to be in the trie) and its
+ * sibling, if it is also in the trie, by their parent, then do the same
+ * with this parent, and so on.
+ *
+ * @param key in/out, the prefix is updated to the resulting one
+ * @param length in/out
+ *
+ * @return false if memory allocation failed
+ **/
+bool trie_aggregate(trie_t *trie, uint8_t *key, uint8_t *length, char **error)
+{
+    uint8_t sibling[TRIE_KEY_SIZE];
+
+    /* never up to /0 */
+    while (*length > 1) {
+        key_mask(sibling, key, *length);
+        sibling[(*length - 1) / 8] ^= 1 << (7 - (*length - 1) % 8);
+        if (!trie_find(trie, sibling, *length)) {
+            break;
+        }
+        trie_remove(trie, sibling, *length);
+        trie_remove(trie, key, *length);
+        key_mask(key, key, --*length);
+        if (!trie_insert(trie, key, *length, error)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void trie_foreach_from(const trie_t *trie, uint32_t root, trie_callback_t callback, void *arg)
+{
+    size_t depth;
+    /* each level of the trie pushes at most one pending right child */
+    uint32_t stack[TRIE_KEY_SIZE * 8 + 2];
+
+    depth = 0;
+    if (TRIE_NIL != root) {
+        stack[depth++] = root;
+    }
+    while (depth > 0) {
+        const trie_node_t *node;
+
+        node = NODE(trie, stack[--depth]);
+        if (node->terminal) {
+            /* the prefixes below are covered by this one */
+            callback(node->key, node->length, arg);
+            continue;
+        }
+        if (TRIE_NIL != node->children[1]) {
+            stack[depth++] = node->children[1];
+        }
+        if (TRIE_NIL != node->children[0]) {
+            stack[depth++] = node->children[0];
+        }
+    }
+}
+
+/**
+ * Call callback for each prefix of the trie which is not included in an
+ * other one (in ascending order for a trie which is not a large one)
+ **/
+void trie_foreach(const trie_t *trie, trie_callback_t callback, void *arg)
+{
+    trie_foreach_from(trie, trie->root, callback, arg);
+    if (NULL != trie->buckets) {
+        uint32_t i;
+
+        for (i = 0; i < BUCKET_COUNT; i++) {
+            /* skip what is covered by a short prefix */
+            if (0 == trie->buckets[i].cover) {
+                trie_foreach_from(trie, trie->buckets[i].root, callback, arg);
+            }
+        }
+    }
+}
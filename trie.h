@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* maximum length of a key, in bytes (IPv6) */
+#define TRIE_KEY_SIZE 16
+
+/* number of leading bits indexing the buckets of a large trie */
+#define TRIE_STRIDE 16
+
+typedef struct trie_node_t trie_node_t;
+typedef struct trie_bucket_t trie_bucket_t;
+
+/**
+ * A path-compressed binary (Patricia) trie of prefixes (networks), keys
+ * are addresses in network byte order. Nodes are allocated from a single
+ * array and linked by their index in it (0 means none) to keep them close
+ * in memory and make the trie cheap to empty and reuse.
+ *
+ * A large trie (see trie_init_large) also splits the prefixes of at least
+ * TRIE_STRIDE bits into buckets, by their first TRIE_STRIDE bits, to skip
+ * the first levels (and cache misses) of a lookup.
+ **/
+typedef struct {
+    trie_node_t *nodes;
+    uint32_t capacity; /* allocated nodes */
+    uint32_t size;     /* nodes used by the pool, including freed ones */
+    uint32_t root;     /* all prefixes or only the short ones of a large trie */
+    trie_bucket_t *buckets; /* sub-tries of a large trie, else NULL */
+    uint32_t free;     /* head of the list of freed nodes */
+    size_t count;      /* number of prefixes */
+} trie_t;
+
+typedef void (*trie_callback_t)(const uint8_t *, uint8_t, void *);
+
+void trie_init(trie_t *);
+bool trie_init_large(trie_t *, char **);
+void trie_reset(trie_t *);
+void trie_free(trie_t *);
+bool trie_optimize(trie_t *, char **);
+
+bool trie_insert(trie_t *, const void *, uint8_t, char **);
+bool trie_remove(trie_t *, const void *, uint8_t);
+bool trie_find(const trie_t *, const void *, uint8_t);
+bool trie_lookup(const trie_t *, const void *, uint8_t, uint8_t *);
+bool trie_covered(const trie_t *, const void *, uint8_t);
+bool trie_overlaps(const trie_t *, const void *, uint8_t);
+bool trie_aggregate(trie_t *, uint8_t *, uint8_t *, char **);
+void trie_foreach(const trie_t *, trie_callback_t, void *);
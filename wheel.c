@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "wheel.h"
+
+/* initial number of timers of the pool */
+#define WHEEL_INITIAL_CAPACITY 64
+
+struct wheel_timer_t {
+    addr_t addr;
+    uint16_t slot; /* level * WHEEL_SLOTS + index in the level */
+    uint64_t expiry;
+    uint32_t prev, next;
+};
+
+#define TIMER(wheel, index) \
+    (&(wheel)->timers[index])
+
+#define LEVEL_SPAN(level) \
+    ((uint64_t) 1 << (WHEEL_BITS * (level)))
+
+void wheel_init(wheel_t *wheel, uint64_t now)
+{
+    wheel->now = now;
+    wheel->timers = NULL;
+    wheel->capacity = 0;
+    wheel->size = 1; /* index 0 is WHEEL_NIL */
+    wheel->free = WHEEL_NIL;
+    wheel->count = 0;
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+}
+
+void wheel_free(wheel_t *wheel)
+{
+    free(wheel->timers);
+    wheel_init(wheel, wheel->now);
+}
+
+/**
+ * Put the timer in the slot matching its expiry, relatively to now: the
+ * level is the one of the highest group of bits which differs between them
+ * (the timer expires in the current round of this level)
+ **/
+static void wheel_link(wheel_t *wheel, uint32_t index)
+{
+    int level;
+    uint32_t *head;
+    uint64_t expiry;
+    wheel_timer_t *timer;
+
+    timer = TIMER(wheel, index);
+    expiry = timer->expiry;
+    if (expiry - wheel->now >= LEVEL_SPAN(WHEEL_LEVELS)) {
+        /* beyond the last level: parked in the last slot of the round, it will be placed again from there */
+        level = WHEEL_LEVELS - 1;
+        expiry = wheel->now + LEVEL_SPAN(WHEEL_LEVELS) - LEVEL_SPAN(WHEEL_LEVELS - 1);
+    } else {
+        for (level = WHEEL_LEVELS - 1; level > 0 && 0 == ((expiry ^ wheel->now) >> (WHEEL_BITS * level)); level--)
+            ;
+    }
+    timer->slot = level * WHEEL_SLOTS + ((expiry >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    head = &wheel->slots[level][timer->slot % WHEEL_SLOTS];
+    timer->prev = WHEEL_NIL;
+    timer->next = *head;
+    if (WHEEL_NIL != *head) {
+        TIMER(wheel, *head)->prev = index;
+    }
+    *head = index;
+}
+
+/**
+ * Schedule the removal of addr
+ *
+ * @param expiry when, in seconds, on the same clock as wheel_advance
+ *
+ * @return the timer, to cancel it, or WHEEL_NIL on failure
+ **/
+uint32_t wheel_add(wheel_t *wheel, const addr_t *addr, uint64_t expiry, char **error)
+{
+    uint32_t index;
+    wheel_timer_t *timer;
+
+    if (WHEEL_NIL != wheel->free) {
+        index = wheel->free;
+        wheel->free = TIMER(wheel, index)->next;
+    } else {
+        if (wheel->size >= wheel->capacity) {
+            uint32_t capacity;
+            wheel_timer_t *timers;
+
+            capacity = 0 == wheel->capacity ? WHEEL_INITIAL_CAPACITY : wheel->capacity * 2;
+            if (NULL == (timers = realloc(wheel->timers, capacity * sizeof(*timers)))) {
+                set_malloc_error(error, capacity * sizeof(*timers));
+                return WHEEL_NIL;
+            }
+            wheel->timers = timers;
+            wheel->capacity = capacity;
+        }
+        index = wheel->size++;
+    }
+    timer = TIMER(wheel, index);
+    timer->addr = *addr;
+    /* overdue: handled by the next tick */
+    timer->expiry = expiry > wheel->now ? expiry : wheel->now + 1;
+    wheel_link(wheel, index);
+    ++wheel->count;
+
+    return index;
+}
+
+static void wheel_unlink(wheel_t *wheel, uint32_t index)
+{
+    wheel_timer_t *timer;
+
+    timer = TIMER(wheel, index);
+    if (WHEEL_NIL == timer->prev) {
+        wheel->slots[timer->slot / WHEEL_SLOTS][timer->slot % WHEEL_SLOTS] = timer->next;
+    } else {
+        TIMER(wheel, timer->prev)->next = timer->next;
+    }
+    if (WHEEL_NIL != timer->next) {
+        TIMER(wheel, timer->next)->prev = timer->prev;
+    }
+}
+
+static void wheel_release(wheel_t *wheel, uint32_t index)
+{
+    TIMER(wheel, index)->next = wheel->free;
+    wheel->free = index;
+    --wheel->count;
+}
+
+/**
+ * Forget a timer returned by wheel_add which hasn't expired yet
+ **/
+void wheel_cancel(wheel_t *wheel, uint32_t index)
+{
+    wheel_unlink(wheel, index);
+    wheel_release(wheel, index);
+}
+
+/**
+ * Move the timers of a slot to the lower levels
+ **/
+static void wheel_cascade(wheel_t *wheel, int level, int slot)
+{
+    uint32_t index, next;
+
+    index = wheel->slots[level][slot];
+    wheel->slots[level][slot] = WHEEL_NIL;
+    for (; WHEEL_NIL != index; index = next) {
+        next = TIMER(wheel, index)->next;
+        wheel_link(wheel, index);
+    }
+}
+
+static void wheel_tick(wheel_t *wheel, wheel_callback_t cb, void *arg)
+{
+    int level;
+    uint32_t index, next;
+
+    ++wheel->now;
+    for (level = 1; level < WHEEL_LEVELS && 0 == (wheel->now & (LEVEL_SPAN(level) - 1)); level++) {
+        wheel_cascade(wheel, level, (wheel->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1));
+    }
+    /* detach the slot first: the callback is free to add timers (and move the pool) */
+    index = wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)];
+    wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)] = WHEEL_NIL;
+    for (; WHEEL_NIL != index; index = next) {
+        wheel_timer_t *timer;
+
+        timer = TIMER(wheel, index);
+        next = timer->next;
+        if (timer->expiry > wheel->now) {
+            /* was parked beyond the last level */
+            wheel_link(wheel, index);
+        } else {
+            addr_t addr;
+
+            addr = timer->addr;
+            wheel_release(wheel, index);
+            cb(&addr, arg);
+        }
+    }
+}
+
+/**
+ * Move the time forward up to now, calling cb for each timer which expires
+ **/
+void wheel_advance(wheel_t *wheel, uint64_t now, wheel_callback_t cb, void *arg)
+{
+    while (wheel->now < now) {
+        if (0 == wheel->count) {
+            /* nothing can expire: skip the empty ticks */
+            wheel->now = now;
+            break;
+        }
+        wheel_tick(wheel, cb, arg);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+
+/* a level has 2^WHEEL_BITS slots, the 5 levels cover 2^30 seconds (34 years) */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 5
+
+#define WHEEL_NIL 0
+
+typedef struct wheel_timer_t wheel_timer_t;
+
+/**
+ * Hierarchical timing wheel, with a resolution of a second, to schedule the
+ * end of the bans. Level 0 has a slot per second for the next 64 seconds,
+ * level 1 a slot per 64 seconds for the next 4096 seconds and so on. When
+ * a level completes a round, the timers of the current slot of the level
+ * above are spread over the levels below: a tick only visits the timers
+ * expiring at this second and a timer is moved at most once per level.
+ *
+ * Timers come from a pool and are referenced by their index (WHEEL_NIL is
+ * the end of a list).
+ **/
+typedef struct {
+    uint64_t now; /* current time, in seconds */
+    uint32_t slots[WHEEL_LEVELS][WHEEL_SLOTS]; /* first timer of each slot */
+    wheel_timer_t *timers;
+    uint32_t capacity;
+    uint32_t size;
+    uint32_t free;
+    size_t count;
+} wheel_t;
+
+typedef void (*wheel_callback_t)(const addr_t *, void *);
+
+void wheel_init(wheel_t *, uint64_t);
+uint32_t wheel_add(wheel_t *, const addr_t *, uint64_t, char **);
+void wheel_cancel(wheel_t *, uint32_t);
+void wheel_advance(wheel_t *, uint64_t, wheel_callback_t, void *);
+void wheel_free(wheel_t *);
@@ -0,0 +1,142 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "common.h"
+#include "whitelist.h"
+
+#define NETWORKS(whitelist, addr) \
+    (&(whitelist)->networks[AF_INET == (addr)->fa ? 0 : 1])
+
+/* always whitelisted */
+static const char * const loopbacks[] = {
+    "127.0.0.0/8",
+    "::1/128",
+};
+
+static bool whitelist_add(whitelist_t *whitelist, const char *string, char **error)
+{
+    addr_t addr;
+    char single[INET6_ADDRSTRLEN + STR_LEN("/128")];
+
+    /* unlike a ban, a single IPv6 address means only itself (not its /64) */
+    if (NULL == strchr(string, '/') && NULL != strchr(string, ':') && strlen(string) < INET6_ADDRSTRLEN) {
+        sprintf(single, "%s/128", string);
+        string = single;
+    }
+    if (!parse_addr(string, &addr, error)) {
+        return false;
+    }
+
+    return trie_insert(NETWORKS(whitelist, &addr), &addr.sa, addr.netmask, error);
+}
+
+/**
+ * Build a whitelist from the loopback networks and, if filename is not
+ * NULL, the addresses and networks it lists: one per line, empty lines
+ * and what follows a # are ignored.
+ *
+ * On failure, whitelist is left untouched (freed) and can't be used.
+ **/
+bool whitelist_load(whitelist_t *whitelist, const char *filename, char **error)
+{
+    bool ok;
+    FILE *fp;
+    size_t i;
+
+    ok = false;
+    fp = NULL;
+    trie_init(&whitelist->networks[1]);
+    do {
+        bool failed;
+        char line[256];
+        unsigned long lineno;
+
+        if (!trie_init_large(&whitelist->networks[0], error) || !trie_init_large(&whitelist->networks[1], error)) {
+            break;
+        }
+        for (i = 0; i < ARRAY_SIZE(loopbacks); i++) {
+            if (!whitelist_add(whitelist, loopbacks[i], error)) {
+                break;
+            }
+        }
+        if (i < ARRAY_SIZE(loopbacks)) {
+            break;
+        }
+        if (NULL == filename) {
+            ok = true;
+            break;
+        }
+        if (NULL == (fp = fopen(filename, "r"))) {
+            set_system_error(error, "fopen '%s' failed", filename);
+            break;
+        }
+        failed = false;
+        for (lineno = 1; !failed && NULL != fgets(line, STR_SIZE(line), fp); lineno++) {
+            char *start, *end, *error2;
+
+            error2 = NULL;
+            if (NULL != (end = strchr(line, '#'))) {
+                *end = '\0';
+            } else {
+                end = line + strlen(line);
+            }
+            for (start = line; isspace((unsigned char) *start); start++)
+                ;
+            while (end > start && isspace((unsigned char) end[-1])) {
+                *--end = '\0';
+            }
+            if ('\0' == *start) {
+                continue;
+            }
+            if (!whitelist_add(whitelist, start, &error2)) {
+                set_generic_error(error, "%s:%lu: %s", filename, lineno, error2);
+                error_free(&error2);
+                failed = true;
+            }
+        }
+        if (failed) {
+            break;
+        }
+        if (ferror(fp)) {
+            set_generic_error(error, "reading '%s' failed", filename);
+            break;
+        }
+        /* loaded once, looked up a lot */
+        if (!trie_optimize(&whitelist->networks[0], error) || !trie_optimize(&whitelist->networks[1], error)) {
+            break;
+        }
+        ok = true;
+    } while (false);
+    if (NULL != fp) {
+        fclose(fp);
+    }
+    if (!ok) {
+        whitelist_free(whitelist);
+    }
+
+    return ok;
+}
+
+/**
+ * Would banning addr ban (a part of) a whitelisted network?
+ **/
+bool whitelist_match(const whitelist_t *whitelist, const addr_t *addr)
+{
+    return trie_overlaps(NETWORKS(whitelist, addr), &addr->sa, addr->netmask);
+}
+
+size_t whitelist_count(const whitelist_t *whitelist)
+{
+    return whitelist->networks[0].count + whitelist->networks[1].count;
+}
+
+void whitelist_free(whitelist_t *whitelist)
+{
+    trie_free(&whitelist->networks[0]);
+    trie_free(&whitelist->networks[1]);
+}
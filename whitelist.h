@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parse.h"
+#include "trie.h"
+
+/**
+ * Networks which must never be banned
+ **/
+typedef struct {
+    trie_t networks[2];
+} whitelist_t;
+
+bool whitelist_load(whitelist_t *, const char *, char **);
+bool whitelist_match(const whitelist_t *, const addr_t *);
+size_t whitelist_count(const whitelist_t *);
+void whitelist_free(whitelist_t *);